@@ -0,0 +1,267 @@
+#include "AssetDatabase.h"
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <set>
+
+using namespace Dx12MasterProject;
+
+namespace {
+	const char* MODEL_EXTENSIONS[] = { ".fbx", ".obj", ".gltf", ".glb", ".dae", ".3ds", ".ply", ".stl" };
+
+	//Source state as the file system reports it, the cheap part of the staleness check.
+	bool StatSource(const std::string& source, uint64_t& size, int64_t& writeTime)
+	{
+		std::error_code error;
+		size = std::filesystem::file_size(source, error);
+		if (error) return false;
+		const auto time = std::filesystem::last_write_time(source, error);
+		if (error) return false;
+		writeTime = (int64_t)time.time_since_epoch().count();
+		return true;
+	}
+
+	std::string HexKey(uint64_t key)
+	{
+		std::ostringstream stream;
+		stream << std::hex << std::setw(16) << std::setfill('0') << key;
+		return stream.str();
+	}
+}
+
+AssetDatabase::AssetDatabase(const std::string& root, const ModelImportSettings& settings) : mRoot(root), mSettings(settings)
+{
+	// Artefacts always go through the mesh cache, that is what makes them reusable
+	mSettings.useMeshCache = true;
+	mSettings.cachePath.clear();
+}
+
+bool AssetDatabase::IsModelFile(const std::filesystem::path& path)
+{
+	std::string extension = path.extension().string();
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](char c) { return (char)tolower((unsigned char)c); });
+	for (const char* modelExtension : MODEL_EXTENSIONS) {
+		if (extension == modelExtension) return true;
+	}
+	return false;
+}
+
+std::string AssetDatabase::ArtefactPath(uint64_t importKey) const
+{
+	return mRoot + "/" + COOKED_DIRECTORY + "/" + HexKey(importKey) + ".meshcache";
+}
+
+bool AssetDatabase::Load()
+{
+	mRecords.clear();
+	std::ifstream file(mRoot + "/" + FILE_NAME);
+	if (!file) return false;
+
+	std::string magic;
+	uint32_t version = 0;
+	file >> magic >> version;
+	if (magic != "AssetDatabase" || version != VERSION) return false;
+
+	// One tab separated record per line, the source path comes first and may contain spaces
+	std::string line;
+	std::getline(file, line);
+	while (std::getline(file, line)) {
+		std::istringstream fields(line);
+		AssetRecord record;
+		if (!std::getline(fields, record.source, '\t') || !std::getline(fields, record.artefact, '\t')) continue;
+		fields >> record.sourceSize >> record.sourceWriteTime >> std::hex >> record.sourceHash >> record.importKey >> std::dec
+			>> record.meshCount >> record.lodLevels >> record.triangleCount;
+		if (fields.fail()) continue;
+		mRecords[record.source] = record;
+	}
+	return true;
+}
+
+bool AssetDatabase::Save() const
+{
+	std::error_code error;
+	std::filesystem::create_directories(mRoot, error);
+
+	const std::string path = mRoot + "/" + FILE_NAME;
+	const std::string tempPath = path + ".tmp";
+	{
+		std::ofstream file(tempPath, std::ios::trunc);
+		if (!file) return false;
+		file << "AssetDatabase " << VERSION << "\n";
+		for (const auto& [source, record] : mRecords) {
+			file << record.source << '\t' << record.artefact << '\t' << record.sourceSize << ' ' << record.sourceWriteTime << ' '
+				<< HexKey(record.sourceHash) << ' ' << HexKey(record.importKey) << ' ' << record.meshCount << ' '
+				<< record.lodLevels << ' ' << record.triangleCount << "\n";
+		}
+		if (!file) return false;
+	}
+	std::filesystem::rename(tempPath, path, error);
+	return !error;
+}
+
+CookStats AssetDatabase::Cook(const std::vector<std::string>& sources, ThreadPool* pool)
+{
+	auto start = std::chrono::steady_clock::now();
+	ThreadPool& threadPool = pool != nullptr ? *pool : ThreadPool::Global();
+	CookStats stats;
+
+	struct Pending {
+		AssetRecord record;
+		CookResult result = CookResult::Failed;
+		bool rehashed = false;
+	};
+	std::vector<Pending> pending(sources.size());
+
+	// Stat every source and rehash only those that changed on disk since they were recorded
+	threadPool.ParallelFor((uint32_t)sources.size(), [&](uint32_t i) {
+		Pending& asset = pending[i];
+		AssetRecord& record = asset.record;
+		record.source = sources[i];
+		if (!StatSource(record.source, record.sourceSize, record.sourceWriteTime)) return;
+
+		auto known = mRecords.find(record.source);
+		if (known != mRecords.end() && known->second.sourceSize == record.sourceSize && known->second.sourceWriteTime == record.sourceWriteTime) {
+			record.sourceHash = known->second.sourceHash;
+		}
+		else {
+			if (!HashFile(record.source, record.sourceHash)) return;
+			asset.rehashed = true;
+		}
+		record.importKey = ImportKey(record.sourceHash, mSettings);
+		record.artefact = ArtefactPath(record.importKey);
+
+		std::error_code error;
+		if (known != mRecords.end() && known->second.importKey == record.importKey && std::filesystem::exists(record.artefact, error)) {
+			// A touched but unchanged source only refreshes its write time
+			const int64_t writeTime = record.sourceWriteTime;
+			record = known->second;
+			record.sourceWriteTime = writeTime;
+			asset.result = CookResult::UpToDate;
+		}
+		else {
+			asset.result = CookResult::Imported;
+		}
+	});
+
+	// Sources sharing an import key share the artefact, only the first of them is imported
+	std::map<uint64_t, uint32_t> importers;
+	for (uint32_t i = 0; i < (uint32_t)pending.size(); i++) {
+		if (pending[i].result == CookResult::Imported) importers.emplace(pending[i].record.importKey, i);
+	}
+	std::vector<uint32_t> imports;
+	for (const auto& [key, index] : importers) imports.push_back(index);
+
+	std::error_code error;
+	std::filesystem::create_directories(mRoot + "/" + COOKED_DIRECTORY, error);
+	threadPool.ParallelFor((uint32_t)imports.size(), [&](uint32_t i) {
+		AssetRecord& record = pending[imports[i]].record;
+		// The hash taken above names the artefact and keys the cache inside it, the import does not hash the source again
+		ModelImportSettings settings = mSettings;
+		settings.cachePath = record.artefact;
+		settings.sourceHashKnown = true;
+		settings.sourceHash = record.sourceHash;
+		Model model(record.source, settings);
+		if (model.meshes.empty() || !std::filesystem::exists(record.artefact)) {
+			pending[imports[i]].result = CookResult::Failed;
+			return;
+		}
+
+		record.meshCount = (uint32_t)model.meshes.size();
+		for (const Mesh& mesh : model.meshes) {
+			record.lodLevels = (std::max)(record.lodLevels, (uint32_t)mesh.lods.size());
+			record.triangleCount += mesh.Indices().size() / 3;
+		}
+	});
+
+	for (Pending& asset : pending) {
+		if (asset.result == CookResult::Imported && importers[asset.record.importKey] != (uint32_t)(&asset - pending.data())) {
+			// Shares its artefact with an earlier source, copy that source's outcome
+			const Pending& importer = pending[importers[asset.record.importKey]];
+			asset.result = importer.result;
+			asset.record.meshCount = importer.record.meshCount;
+			asset.record.lodLevels = importer.record.lodLevels;
+			asset.record.triangleCount = importer.record.triangleCount;
+		}
+
+		if (asset.result == CookResult::Failed) {
+			mRecords.erase(asset.record.source);
+			stats.failed++;
+		}
+		else {
+			mRecords[asset.record.source] = asset.record;
+			if (asset.result == CookResult::UpToDate) stats.upToDate++;
+			else stats.imported++;
+		}
+		if (asset.rehashed) stats.rehashed++;
+		stats.results.emplace_back(asset.record.source, asset.result);
+	}
+
+	stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return stats;
+}
+
+CookStats AssetDatabase::CookDirectory(const std::string& directory, ThreadPool* pool)
+{
+	std::vector<std::string> sources;
+	std::error_code error;
+	for (auto it = std::filesystem::recursive_directory_iterator(directory, error); !error && it != std::filesystem::recursive_directory_iterator(); it.increment(error)) {
+		if (it->is_regular_file() && IsModelFile(it->path())) sources.push_back(it->path().generic_string());
+	}
+	std::sort(sources.begin(), sources.end());
+	return Cook(sources, pool);
+}
+
+size_t AssetDatabase::RemoveUnreferencedArtefacts()
+{
+	std::set<std::string> referenced;
+	for (const auto& [source, record] : mRecords) referenced.insert(std::filesystem::path(record.artefact).filename().string());
+
+	size_t removed = 0;
+	std::error_code error;
+	for (const auto& entry : std::filesystem::directory_iterator(mRoot + "/" + COOKED_DIRECTORY, error)) {
+		if (entry.path().extension() != ".meshcache" || referenced.count(entry.path().filename().string()) != 0) continue;
+		if (std::filesystem::remove(entry.path(), error)) removed++;
+	}
+	return removed;
+}
+
+const AssetRecord* AssetDatabase::Find(const std::string& source) const
+{
+	auto record = mRecords.find(source);
+	return record != mRecords.end() ? &record->second : nullptr;
+}
+
+ModelImportSettings AssetDatabase::ImportSettingsFor(const std::string& source) const
+{
+	ModelImportSettings settings = mSettings;
+	const AssetRecord* record = Find(source);
+	uint64_t size = 0;
+	int64_t writeTime = 0;
+	// A source edited since the cook must not be imported into the old key's artefact
+	if (record != nullptr && StatSource(source, size, writeTime) && size == record->sourceSize && writeTime == record->sourceWriteTime &&
+		record->importKey == ImportKey(record->sourceHash, mSettings)) {
+		settings.cachePath = record->artefact;
+	}
+	return settings;
+}
+
+int AssetDatabase::RunCookCommand(const std::string& directory, const std::string& logPath)
+{
+	AssetDatabase database(directory);
+	database.Load();
+	CookStats stats = database.CookDirectory(directory);
+	const size_t removed = database.RemoveUnreferencedArtefacts();
+	const bool saved = database.Save();
+
+	const char* resultNames[] = { "up to date", "imported", "FAILED" };
+	std::ostringstream log;
+	for (const auto& [source, result] : stats.results) log << source << ": " << resultNames[(int)result] << "\n";
+	log << "Cooked " << stats.results.size() << " assets in " << stats.seconds * 1000.0 << " ms: " << stats.imported << " imported, "
+		<< stats.upToDate << " up to date, " << stats.failed << " failed, " << stats.rehashed << " rehashed, " << removed
+		<< " stale artefacts removed" << (saved ? "" : ", DATABASE NOT SAVED") << "\n";
+
+	OutputDebugStringA(log.str().c_str());
+	std::ofstream file(logPath, std::ios::trunc);
+	if (file) file << log.str();
+	return stats.failed == 0 && saved ? 0 : 1;
+}
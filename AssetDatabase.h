@@ -0,0 +1,85 @@
+#pragma once
+#include "Model.h"
+#include "ThreadPool.h"
+#include <filesystem>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace Dx12MasterProject {
+
+	//What the database knows about one source model. The artefact is the mesh cache named after the import key, it
+	//carries every derived product of the import: optimized index buffers, meshlets, LOD chains and the scene graph.
+	struct AssetRecord {
+		std::string source;
+		uint64_t sourceSize = 0;
+		int64_t sourceWriteTime = 0; // file clock ticks, with the size it decides whether the source must be rehashed
+		uint64_t sourceHash = 0;
+		uint64_t importKey = 0; // ImportKey(sourceHash, settings)
+		std::string artefact;
+		uint32_t meshCount = 0;
+		uint32_t lodLevels = 0; // most levels of any mesh, the full detail level excluded
+		uint64_t triangleCount = 0;
+	};
+
+	enum class CookResult : uint8_t {
+		UpToDate,
+		Imported,
+		Failed,
+	};
+
+	struct CookStats {
+		std::vector<std::pair<std::string, CookResult>> results; // in source order
+		uint32_t upToDate = 0;
+		uint32_t imported = 0;
+		uint32_t failed = 0;
+		uint32_t rehashed = 0; // sources whose size or write time changed since they were recorded
+		double seconds = 0.0;
+	};
+
+	/*
+		Content addressed asset database:
+		-Sources are recorded with their size, write time, contents hash and the import key derived from the settings
+		-Artefacts live in <root>/Cooked named by import key, so equal inputs share one artefact and a changed input
+		 never overwrites the artefact of the old one
+		-Cooking only imports sources whose key has no artefact yet, an unchanged size and write time skips the rehash
+		-Independent assets are hashed and imported in parallel, sources sharing a key are imported once
+	*/
+	class AssetDatabase
+	{
+	public:
+		static constexpr uint32_t VERSION = 1;
+		static constexpr const char* FILE_NAME = "AssetDatabase.txt";
+		static constexpr const char* COOKED_DIRECTORY = "Cooked";
+
+		explicit AssetDatabase(const std::string& root, const ModelImportSettings& settings = {});
+
+		//A missing or outdated database loads as empty, the next cook then rebuilds it.
+		bool Load();
+		bool Save() const;
+
+		CookStats Cook(const std::vector<std::string>& sources, ThreadPool* pool = nullptr);
+		//Cooks every model file below directory, the cooked directory itself holds no sources.
+		CookStats CookDirectory(const std::string& directory, ThreadPool* pool = nullptr);
+		//Deletes artefacts no record points at any more, returns how many.
+		size_t RemoveUnreferencedArtefacts();
+
+		const AssetRecord* Find(const std::string& source) const;
+		size_t RecordCount() const { return mRecords.size(); }
+		//Import settings that load the source from its artefact while the record is current, the database settings
+		//with the cache beside the source otherwise.
+		ModelImportSettings ImportSettingsFor(const std::string& source) const;
+
+		static bool IsModelFile(const std::filesystem::path& path);
+
+		//Headless -cook entry point, cooks a directory into its own database and writes a log. Non zero on failure.
+		static int RunCookCommand(const std::string& directory, const std::string& logPath);
+
+	private:
+		std::string ArtefactPath(uint64_t importKey) const;
+
+		std::string mRoot;
+		ModelImportSettings mSettings;
+		std::map<std::string, AssetRecord> mRecords;
+	};
+}
@@ -0,0 +1,149 @@
+#include "AsyncModelLoader.h"
+#include <algorithm>
+
+using namespace Dx12MasterProject;
+
+AsyncModelLoader::AsyncModelLoader(ThreadPool* pool) :
+	mOwnPool(pool == nullptr ? std::make_unique<ThreadPool>(OWN_POOL_WORKER_COUNT) : nullptr),
+	mPool(pool != nullptr ? *pool : *mOwnPool)
+{
+}
+
+AsyncModelLoader::~AsyncModelLoader()
+{
+	WaitForLoads();
+}
+
+ModelHandle AsyncModelLoader::Request(const std::string& path, const ModelImportSettings& settings, CompletionCallback onComplete)
+{
+	auto request = std::make_unique<LoadRequest>();
+	request->path = path;
+	request->settings = settings;
+	request->onComplete = std::move(onComplete);
+	LoadRequest& queued = *request;
+	mRequests.push_back(std::move(request));
+	const ModelHandle handle = (ModelHandle)mRequests.size();
+
+	mPendingLoads.fetch_add(1, std::memory_order_relaxed);
+	mPool.Enqueue([this, handle, &queued]() { Load(handle, queued); });
+	return handle;
+}
+
+void AsyncModelLoader::Load(ModelHandle handle, LoadRequest& request)
+{
+	request.state.store(ModelLoadState::Loading, std::memory_order_relaxed);
+	std::unique_ptr<Model> model;
+	try {
+		model = std::make_unique<Model>(request.path, request.settings);
+	}
+	catch (const std::exception& e) {
+		std::cout << "Model Load Error: " << request.path << ": " << e.what() << std::endl;
+	}
+
+	// A failed import leaves the model without meshes, Model reports the reason itself
+	const bool loaded = model != nullptr && !model->meshes.empty();
+	if (loaded) request.model = std::move(model);
+	request.state.store(loaded ? ModelLoadState::AwaitingUpload : ModelLoadState::Failed, std::memory_order_release);
+	{
+		std::lock_guard<std::mutex> lock(mFinishedMutex);
+		mFinished.push_back(handle);
+	}
+	mPendingLoads.fetch_sub(1, std::memory_order_release);
+}
+
+AsyncModelLoader::LoadRequest* AsyncModelLoader::Find(ModelHandle handle) const
+{
+	return handle != INVALID_MODEL_HANDLE && handle <= mRequests.size() ? mRequests[handle - 1].get() : nullptr;
+}
+
+ModelLoadState AsyncModelLoader::State(ModelHandle handle) const
+{
+	const LoadRequest* request = Find(handle);
+	return request != nullptr ? request->state.load(std::memory_order_acquire) : ModelLoadState::Failed;
+}
+
+Model* AsyncModelLoader::GetModel(ModelHandle handle) const
+{
+	const ModelLoadState state = State(handle);
+	if (state == ModelLoadState::Queued || state == ModelLoadState::Loading || state == ModelLoadState::Failed) return nullptr;
+	return Find(handle)->model.get();
+}
+
+const std::string& AsyncModelLoader::Path(ModelHandle handle) const
+{
+	static const std::string empty;
+	const LoadRequest* request = Find(handle);
+	return request != nullptr ? request->path : empty;
+}
+
+std::vector<ModelHandle> AsyncModelLoader::TakeLoaded(size_t maxCount)
+{
+	std::vector<ModelHandle> loaded;
+	std::lock_guard<std::mutex> lock(mFinishedMutex);
+	// Finish order is kept so a model that is ready first is also uploaded first, failed loads wait for Retire
+	size_t kept = 0;
+	for (size_t i = 0; i < mFinished.size(); i++) {
+		const ModelHandle handle = mFinished[i];
+		LoadRequest& request = *Find(handle);
+		if (loaded.size() < maxCount && request.state.load(std::memory_order_acquire) == ModelLoadState::AwaitingUpload) {
+			request.state.store(ModelLoadState::Uploading, std::memory_order_relaxed);
+			mUploading.push_back(handle);
+			loaded.push_back(handle);
+		}
+		else {
+			mFinished[kept++] = handle;
+		}
+	}
+	mFinished.resize(kept);
+	return loaded;
+}
+
+void AsyncModelLoader::UploadSubmitted(ModelHandle handle, uint64_t fenceValue)
+{
+	LoadRequest* request = Find(handle);
+	if (request != nullptr && request->state.load(std::memory_order_relaxed) == ModelLoadState::Uploading) request->uploadFence = fenceValue;
+}
+
+size_t AsyncModelLoader::Retire(uint64_t completedFenceValue)
+{
+	// Callbacks may issue new requests, so the completed handles are collected before any of them runs
+	std::vector<ModelHandle> completed;
+	{
+		std::lock_guard<std::mutex> lock(mFinishedMutex);
+		auto failed = std::stable_partition(mFinished.begin(), mFinished.end(), [&](ModelHandle handle) {
+			return Find(handle)->state.load(std::memory_order_acquire) != ModelLoadState::Failed;
+		});
+		completed.assign(failed, mFinished.end());
+		mFinished.erase(failed, mFinished.end());
+	}
+	auto resident = std::stable_partition(mUploading.begin(), mUploading.end(), [&](ModelHandle handle) {
+		const uint64_t fence = Find(handle)->uploadFence;
+		return fence == 0 || fence > completedFenceValue;
+	});
+	for (auto it = resident; it != mUploading.end(); ++it) {
+		Find(*it)->state.store(ModelLoadState::Resident, std::memory_order_relaxed);
+		completed.push_back(*it);
+	}
+	mUploading.erase(resident, mUploading.end());
+
+	for (ModelHandle handle : completed) {
+		LoadRequest& request = *Find(handle);
+		if (request.onComplete) request.onComplete(handle, request.state.load(std::memory_order_relaxed));
+	}
+	return completed.size();
+}
+
+void AsyncModelLoader::WaitForLoads()
+{
+	mPool.WaitFor(mPendingLoads);
+}
+
+size_t AsyncModelLoader::InFlightCount() const
+{
+	size_t count = 0;
+	for (const std::unique_ptr<LoadRequest>& request : mRequests) {
+		const ModelLoadState state = request->state.load(std::memory_order_relaxed);
+		if (state != ModelLoadState::Resident && state != ModelLoadState::Failed) count++;
+	}
+	return count;
+}
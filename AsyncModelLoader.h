@@ -0,0 +1,89 @@
+#pragma once
+#include "Model.h"
+#include "ThreadPool.h"
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace Dx12MasterProject {
+
+	using ModelHandle = uint32_t;
+	const ModelHandle INVALID_MODEL_HANDLE = 0;
+
+	//Queued -> Loading -> AwaitingUpload -> Uploading -> Resident, or Failed when the import produced nothing.
+	enum class ModelLoadState : uint8_t {
+		Queued,
+		Loading,
+		AwaitingUpload,
+		Uploading,
+		Resident,
+		Failed,
+	};
+
+	/*
+		Background model loading with fence tracked upload, the device side is left to the caller:
+		-Request returns a handle straight away, import and mesh processing run as a pool task
+		-TakeLoaded hands the render thread models whose CPU work finished, it records their upload
+		-UploadSubmitted ties an upload to the fence value signalled after the command list that carries it
+		-Retire promotes uploads whose fence has completed to Resident and runs the completion callbacks
+		Everything but the pool task runs on the one thread that owns the loader, so callbacks can create render items
+		directly. Models stay owned by the loader.
+	*/
+	class AsyncModelLoader
+	{
+	public:
+		//Runs on the thread calling Retire once the model is Resident or Failed.
+		using CompletionCallback = std::function<void(ModelHandle handle, ModelLoadState state)>;
+
+		//Imports run as tasks of this pool, nullptr gives the loader a pool of its own. Whole imports must stay off the
+		//pools other code calls ParallelFor on, their waits would pick them up and stall for the length of an import.
+		explicit AsyncModelLoader(ThreadPool* pool = nullptr);
+		AsyncModelLoader(const AsyncModelLoader& temp) = delete;
+		AsyncModelLoader& operator= (const AsyncModelLoader& temp) = delete;
+		~AsyncModelLoader(); // waits for loads still on the pool
+
+		ModelHandle Request(const std::string& path, const ModelImportSettings& settings = {}, CompletionCallback onComplete = nullptr);
+
+		ModelLoadState State(ModelHandle handle) const;
+		//Null until the model reaches AwaitingUpload and for failed loads.
+		Model* GetModel(ModelHandle handle) const;
+		const std::string& Path(ModelHandle handle) const;
+
+		//Moves up to maxCount finished models to Uploading, oldest first. Failed loads are left for Retire to report.
+		std::vector<ModelHandle> TakeLoaded(size_t maxCount = SIZE_MAX);
+		void UploadSubmitted(ModelHandle handle, uint64_t fenceValue);
+		//Returns the number of models that completed, resident or failed.
+		size_t Retire(uint64_t completedFenceValue);
+
+		//Blocks until nothing is Queued or Loading, running queued imports on the calling thread meanwhile.
+		void WaitForLoads();
+		//Requests not yet Resident or Failed.
+		size_t InFlightCount() const;
+
+	private:
+		struct LoadRequest {
+			std::string path;
+			ModelImportSettings settings;
+			CompletionCallback onComplete;
+			std::atomic<ModelLoadState> state = ModelLoadState::Queued;
+			std::unique_ptr<Model> model;
+			uint64_t uploadFence = 0; // 0 until UploadSubmitted
+		};
+
+		LoadRequest* Find(ModelHandle handle) const;
+		void Load(ModelHandle handle, LoadRequest& request);
+
+		static constexpr uint32_t OWN_POOL_WORKER_COUNT = 2; // imports side by side, their mesh processing still goes wide on the import settings pool
+
+		std::unique_ptr<ThreadPool> mOwnPool; // only without a pool from the caller
+		ThreadPool& mPool;
+		std::vector<std::unique_ptr<LoadRequest>> mRequests; // handle - 1
+		std::atomic<uint32_t> mPendingLoads = 0;
+
+		std::mutex mFinishedMutex;
+		std::vector<ModelHandle> mFinished; // written by pool tasks, drained by TakeLoaded
+		std::vector<ModelHandle> mUploading; // taken, resident once their upload fence completes
+	};
+}
@@ -0,0 +1,2284 @@
+#include "Benchmark.h"
+#include "AssetDatabase.h"
+#include "AsyncModelLoader.h"
+#include "Bvh.h"
+#include "BvhCache.h"
+#include "CpuRaytracer.h"
+#include "TopLevelBvh.h"
+#include "Model.h"
+#include "VertexCompression.h"
+#include <chrono>
+#include <array>
+#include <filesystem>
+#include <map>
+#include <set>
+#include <atomic>
+#include <random>
+#include <psapi.h>
+
+using namespace Dx12MasterProject;
+
+namespace {
+	const char* BENCHMARK_MODELS[] = { "Models/Shiba.fbx", "Models/RandomModel.fbx" };
+
+	//Set by any correctness check that fails, RunAll and RunTests clear it on entry and fail the run when it is set.
+	bool gCheckFailed = false;
+
+	//Report text of a correctness check, a failure is written in capitals and fails the run.
+	const char* Check(bool passed, const char* passedText, const char* failedText)
+	{
+		if (!passed) gCheckFailed = true;
+		return passed ? passedText : failedText;
+	}
+
+	//Writes a report to the output file and the debugger output window. Non zero when a check failed or the file could
+	//not be written.
+	int WriteReport(const std::string& outputPath, const std::ostringstream& results)
+	{
+		std::string report = results.str();
+		report += gCheckFailed ? "CHECKS FAILED\n" : "All checks passed\n";
+		OutputDebugStringA(report.c_str());
+		std::ofstream file(outputPath, std::ios::trunc);
+		if (!file) return 1;
+		file << report;
+		return gCheckFailed ? 2 : 0;
+	}
+
+	//Corrupts the mesh cache of a model and imports it again, which has to reject the cache and fall back to Assimp.
+	//corrupt edits the cache bytes given the file header and the first mesh's header, and returns false when the
+	//model has nothing it could corrupt.
+	bool FallsBackFromCorruptCache(const char* path, const std::function<bool(std::vector<uint8_t>& bytes, const MeshCache::MeshHeader& mesh)>& corrupt)
+	{
+		const std::string cachePath = MeshCache::CachePathFor(path);
+		Model(path, ModelImportSettings());
+		std::vector<uint8_t> bytes;
+		{
+			std::ifstream in(cachePath, std::ios::binary);
+			bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+		}
+		if (bytes.size() < sizeof(MeshCache::FileHeader) + sizeof(MeshCache::MeshHeader)) return false;
+		MeshCache::MeshHeader mesh;
+		memcpy(&mesh, bytes.data() + sizeof(MeshCache::FileHeader), sizeof(mesh));
+		if (!corrupt(bytes, mesh)) return false;
+		{
+			std::ofstream outFile(cachePath, std::ios::binary | std::ios::trunc);
+			outFile.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+		}
+		Model model(path);
+		return !model.IsFromCache() && !model.meshes.empty();
+	}
+
+	template<typename Func>
+	double MeasureSeconds(Func&& func)
+	{
+		auto start = std::chrono::steady_clock::now();
+		func();
+		auto end = std::chrono::steady_clock::now();
+		return std::chrono::duration<double>(end - start).count();
+	}
+
+	//Fastest of three runs, whatever func writes is left from the last one.
+	template<typename Func>
+	double BestOfThreeSeconds(Func&& func)
+	{
+		double best = 0.0;
+		for (int run = 0; run < 3; run++) {
+			const double seconds = MeasureSeconds(func);
+			if (run == 0 || seconds < best) best = seconds;
+		}
+		return best;
+	}
+
+	//Meshlets must respect the limits and, walked in order, reproduce the mesh's index buffer exactly.
+	bool MeshletsMatchMesh(const Mesh& mesh, const MeshletSettings& settings)
+	{
+		const MeshletData& data = mesh.meshlets;
+		IndexView indices = mesh.Indices();
+		size_t index = 0;
+		for (const Meshlet& meshlet : data.Meshlets()) {
+			if (meshlet.vertexCount > settings.maxVertices || meshlet.triangleCount > settings.maxTriangles) return false;
+			for (uint32_t i = 0; i < meshlet.triangleCount * 3; i++) {
+				const uint8_t local = data.Triangles()[meshlet.triangleOffset * 3 + i];
+				if (local >= meshlet.vertexCount || index >= indices.size()) return false;
+				if (data.Vertices()[meshlet.vertexOffset + local] != indices[index++]) return false;
+			}
+		}
+		return index == indices.size() - indices.size() % 3;
+	}
+
+	uint64_t HashMeshlets(const std::vector<Mesh>& meshes)
+	{
+		uint64_t hash = HashBytes(nullptr, 0);
+		for (const Mesh& mesh : meshes) {
+			hash = HashBytes(mesh.meshlets.Meshlets().data(), mesh.meshlets.Meshlets().size_bytes(), hash);
+			hash = HashBytes(mesh.meshlets.Bounds().data(), mesh.meshlets.Bounds().size_bytes(), hash);
+			hash = HashBytes(mesh.meshlets.Vertices().data(), mesh.meshlets.Vertices().size_bytes(), hash);
+			hash = HashBytes(mesh.meshlets.Triangles().data(), mesh.meshlets.Triangles().size_bytes(), hash);
+		}
+		return hash;
+	}
+
+	//Every border edge of the full detail mesh must survive in every level, edges compared by position since a
+	//level may reference a different vertex at the same position.
+	bool LodBordersPreserved(const Mesh& mesh)
+	{
+		std::map<std::array<float, 3>, uint32_t> positionIds;
+		auto positionId = [&](uint32_t vertex) {
+			const DirectX::XMFLOAT3& pos = mesh.Vertices()[vertex].pos;
+			return positionIds.emplace(std::array<float, 3>{ pos.x, pos.y, pos.z }, (uint32_t)positionIds.size()).first->second;
+		};
+		auto directedEdges = [&](IndexView indices) {
+			std::set<std::pair<uint32_t, uint32_t>> edges;
+			for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+				for (uint32_t e = 0; e < 3; e++) edges.emplace(positionId(indices[i + e]), positionId(indices[i + (e + 1) % 3]));
+			}
+			return edges;
+		};
+
+		const std::set<std::pair<uint32_t, uint32_t>> fullEdges = directedEdges(mesh.Indices());
+		for (const MeshLod& lod : mesh.lods) {
+			const std::set<std::pair<uint32_t, uint32_t>> lodEdges = directedEdges(lod.Indices());
+			for (const std::pair<uint32_t, uint32_t>& edge : fullEdges) {
+				const bool border = fullEdges.find({ edge.second, edge.first }) == fullEdges.end();
+				if (border && lodEdges.find(edge) == lodEdges.end()) return false;
+			}
+		}
+		return true;
+	}
+
+	//Largest element difference between the linear pass and walking each node's parent chain.
+	float WorldTransformError(const SceneGraph& scene)
+	{
+		float error = 0.0f;
+		for (size_t i = 0; i < scene.NodeCount(); i++) {
+			DirectX::XMMATRIX world = DirectX::XMMatrixIdentity();
+			for (uint32_t node = (uint32_t)i; node != SceneGraph::NO_PARENT; node = scene.parents[node]) {
+				world = DirectX::XMMatrixMultiply(world, DirectX::XMLoadFloat4x4(&scene.localTransforms[node]));
+			}
+			DirectX::XMFLOAT4X4 reference;
+			DirectX::XMStoreFloat4x4(&reference, world);
+			for (int row = 0; row < 4; row++) {
+				for (int column = 0; column < 4; column++) error = (std::max)(error, std::fabs(reference.m[row][column] - scene.worldTransforms[i].m[row][column]));
+			}
+		}
+		return error;
+	}
+
+	uint64_t HashLods(const std::vector<Mesh>& meshes)
+	{
+		uint64_t hash = HashBytes(nullptr, 0);
+		for (const Mesh& mesh : meshes) {
+			for (const MeshLod& lod : mesh.lods) {
+				IndexView indices = lod.Indices();
+				for (size_t i = 0; i < indices.size(); i++) {
+					const uint32_t index = indices[i];
+					hash = HashBytes(&index, sizeof(index), hash);
+				}
+				hash = HashBytes(&lod.geometricError, sizeof(lod.geometricError), hash);
+			}
+		}
+		return hash;
+	}
+
+	//Per component min/max one vertex at a time, the reference the vectorized reduction is measured against.
+	DirectX::BoundingBox ScalarBox(std::span<const vertexConsts> vertices)
+	{
+		DirectX::XMFLOAT3 minPos = vertices[0].pos;
+		DirectX::XMFLOAT3 maxPos = vertices[0].pos;
+		for (const vertexConsts& vertex : vertices) {
+			minPos.x = (std::min)(minPos.x, vertex.pos.x);
+			minPos.y = (std::min)(minPos.y, vertex.pos.y);
+			minPos.z = (std::min)(minPos.z, vertex.pos.z);
+			maxPos.x = (std::max)(maxPos.x, vertex.pos.x);
+			maxPos.y = (std::max)(maxPos.y, vertex.pos.y);
+			maxPos.z = (std::max)(maxPos.z, vertex.pos.z);
+		}
+		DirectX::BoundingBox box;
+		box.Center = DirectX::XMFLOAT3((minPos.x + maxPos.x) * 0.5f, (minPos.y + maxPos.y) * 0.5f, (minPos.z + maxPos.z) * 0.5f);
+		box.Extents = DirectX::XMFLOAT3((maxPos.x - minPos.x) * 0.5f, (maxPos.y - minPos.y) * 0.5f, (maxPos.z - minPos.z) * 0.5f);
+		return box;
+	}
+
+	bool SameBox(const DirectX::BoundingBox& a, const DirectX::BoundingBox& b)
+	{
+		return memcmp(&a.Center, &b.Center, sizeof(a.Center)) == 0 && memcmp(&a.Extents, &b.Extents, sizeof(a.Extents)) == 0;
+	}
+
+	//Random small triangles filling a unit cube, a stand in for scenes far larger than the bundled models.
+	RtGeometry TriangleSoup(uint32_t triangleCount, uint32_t seed)
+	{
+		std::mt19937 random(seed);
+		std::uniform_real_distribution<float> position(-1.0f, 1.0f);
+		std::uniform_real_distribution<float> offset(-0.01f, 0.01f);
+		RtGeometry geometry;
+		geometry.vertices.reserve((size_t)triangleCount * 3);
+		geometry.indices.reserve((size_t)triangleCount * 3);
+		for (uint32_t i = 0; i < triangleCount; i++) {
+			const DirectX::XMFLOAT3 center(position(random), position(random), position(random));
+			for (uint32_t corner = 0; corner < 3; corner++) {
+				geometry.indices.push_back((uint32_t)geometry.vertices.size());
+				geometry.vertices.push_back(RTVertexBufferLayout{ DirectX::XMFLOAT3(center.x + offset(random), center.y + offset(random), center.z + offset(random)), DirectX::XMFLOAT3(0.0f, 1.0f, 0.0f) });
+			}
+		}
+		return geometry;
+	}
+
+	//Rays from a sphere around the box towards random points inside it, so most of them enter the BVH.
+	std::vector<std::pair<DirectX::XMFLOAT3, DirectX::XMFLOAT3>> RandomRays(const BvhNode& root, uint32_t count, uint32_t seed)
+	{
+		std::mt19937 random(seed);
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+		const DirectX::XMVECTOR boundsMin = DirectX::XMLoadFloat3(&root.boundsMin);
+		const DirectX::XMVECTOR boundsMax = DirectX::XMLoadFloat3(&root.boundsMax);
+		const DirectX::XMVECTOR center = DirectX::XMVectorScale(DirectX::XMVectorAdd(boundsMin, boundsMax), 0.5f);
+		const float radius = DirectX::XMVectorGetX(DirectX::XMVector3Length(DirectX::XMVectorSubtract(boundsMax, boundsMin)));
+
+		std::vector<std::pair<DirectX::XMFLOAT3, DirectX::XMFLOAT3>> rays(count);
+		for (auto& [origin, direction] : rays) {
+			const DirectX::XMVECTOR onSphere = DirectX::XMVector3Normalize(DirectX::XMVectorSet(unit(random) - 0.5f, unit(random) - 0.5f, unit(random) - 0.5f, 0.0f));
+			const DirectX::XMVECTOR start = DirectX::XMVectorAdd(center, DirectX::XMVectorScale(onSphere, radius));
+			const DirectX::XMVECTOR target = DirectX::XMVectorLerpV(boundsMin, boundsMax, DirectX::XMVectorSet(unit(random), unit(random), unit(random), 0.0f));
+			DirectX::XMStoreFloat3(&origin, start);
+			DirectX::XMStoreFloat3(&direction, DirectX::XMVector3Normalize(DirectX::XMVectorSubtract(target, start)));
+		}
+		return rays;
+	}
+
+	//Box and triangle tests BvhTraversal::IntersectClosest makes for one ray, its exact steps so the traversal cost of
+	//two builds can be compared without timing noise. Also returns the hit distance, -1 on a miss.
+	float CountTraversalSteps(const Bvh& bvh, const DirectX::XMFLOAT3& origin, const DirectX::XMFLOAT3& direction, uint64_t& boxTests, uint64_t& triangleTests,
+		float tMin = 0.0f)
+	{
+		if (bvh.Empty()) return -1.0f;
+		const float rayOrigin[3] = { origin.x, origin.y, origin.z };
+		const float rayDirection[3] = { direction.x, direction.y, direction.z };
+		float inverseDirection[3];
+		BvhTraversal::InverseDirection(rayDirection, inverseDirection);
+
+		float closest = FLT_MAX;
+		bool found = false;
+		boxTests++;
+		if (BvhTraversal::IntersectBox(bvh.nodes[0], rayOrigin, inverseDirection, tMin, closest) == FLT_MAX) return -1.0f;
+		uint32_t stack[Bvh::MAX_DEPTH];
+		uint32_t stackSize = 0;
+		uint32_t index = 0;
+		for (;;) {
+			const BvhNode& node = bvh.nodes[index];
+			if (node.IsLeaf()) {
+				triangleTests += node.count;
+				for (uint32_t i = node.offset; i < node.offset + node.count; i++) {
+					float t, u, v;
+					if (!BvhTraversal::IntersectTriangle(bvh.triangles[i], rayOrigin, rayDirection, tMin, closest, t, u, v)) continue;
+					closest = t;
+					found = true;
+				}
+			}
+			else {
+				uint32_t nearChild = index + 1, farChild = node.offset;
+				float nearT = BvhTraversal::IntersectBox(bvh.nodes[nearChild], rayOrigin, inverseDirection, tMin, closest);
+				float farT = BvhTraversal::IntersectBox(bvh.nodes[farChild], rayOrigin, inverseDirection, tMin, closest);
+				boxTests += 2;
+				if (farT < nearT) {
+					std::swap(nearChild, farChild);
+					std::swap(nearT, farT);
+				}
+				if (nearT != FLT_MAX) {
+					if (farT != FLT_MAX) stack[stackSize++] = farChild;
+					index = nearChild;
+					continue;
+				}
+			}
+			if (stackSize == 0) break;
+			index = stack[--stackSize];
+		}
+		return found ? closest : -1.0f;
+	}
+
+	//The same counts for BvhTraversal::IntersectAny, which stops on the first triangle hit. Returns whether there was one.
+	bool CountOcclusionSteps(const Bvh& bvh, const DirectX::XMFLOAT3& origin, const DirectX::XMFLOAT3& direction, float tMin, uint64_t& boxTests, uint64_t& triangleTests)
+	{
+		if (bvh.Empty()) return false;
+		const float rayOrigin[3] = { origin.x, origin.y, origin.z };
+		const float rayDirection[3] = { direction.x, direction.y, direction.z };
+		float inverseDirection[3];
+		BvhTraversal::InverseDirection(rayDirection, inverseDirection);
+
+		auto anyTriangle = [&](const BvhNode& leaf) {
+			for (uint32_t i = leaf.offset; i < leaf.offset + leaf.count; i++) {
+				float t, u, v;
+				triangleTests++;
+				if (BvhTraversal::IntersectTriangle(bvh.triangles[i], rayOrigin, rayDirection, tMin, FLT_MAX, t, u, v)) return true;
+			}
+			return false;
+		};
+		boxTests++;
+		if (BvhTraversal::IntersectBox(bvh.nodes[0], rayOrigin, inverseDirection, tMin, FLT_MAX) == FLT_MAX) return false;
+		if (bvh.nodes[0].IsLeaf()) return anyTriangle(bvh.nodes[0]);
+		uint32_t stack[Bvh::MAX_DEPTH];
+		uint32_t stackSize = 0;
+		uint32_t index = 0;
+		for (;;) {
+			const BvhNode& node = bvh.nodes[index];
+			uint32_t nearChild = index + 1, farChild = node.offset;
+			float nearT = BvhTraversal::IntersectBox(bvh.nodes[nearChild], rayOrigin, inverseDirection, tMin, FLT_MAX);
+			float farT = BvhTraversal::IntersectBox(bvh.nodes[farChild], rayOrigin, inverseDirection, tMin, FLT_MAX);
+			boxTests += 2;
+			if (farT < nearT) {
+				std::swap(nearChild, farChild);
+				std::swap(nearT, farT);
+			}
+			const uint32_t children[2] = { nearChild, farChild };
+			const float distances[2] = { nearT, farT };
+			bool descend = false;
+			for (int i = 0; i < 2; i++) {
+				if (distances[i] == FLT_MAX) continue;
+				if (bvh.nodes[children[i]].IsLeaf()) {
+					if (anyTriangle(bvh.nodes[children[i]])) return true;
+				}
+				else if (!descend) {
+					index = children[i];
+					descend = true;
+				}
+				else stack[stackSize++] = children[i];
+			}
+			if (descend) continue;
+			if (stackSize == 0) return false;
+			index = stack[--stackSize];
+		}
+	}
+
+	//Every triangle once, the reference traversal is measured against.
+	bool BruteForceClosest(const Bvh& bvh, const DirectX::XMFLOAT3& origin, const DirectX::XMFLOAT3& direction, float tMax, BvhHit& hit)
+	{
+		const float rayOrigin[3] = { origin.x, origin.y, origin.z };
+		const float rayDirection[3] = { direction.x, direction.y, direction.z };
+		bool found = false;
+		for (size_t i = 0; i < bvh.triangles.size(); i++) {
+			float t, u, v;
+			if (!BvhTraversal::IntersectTriangle(bvh.triangles[i], rayOrigin, rayDirection, 0.0f, tMax, t, u, v)) continue;
+			tMax = t;
+			found = true;
+			hit.t = t;
+			hit.geometry = bvh.primitives[i].geometry;
+			hit.primitive = bvh.primitives[i].primitive;
+		}
+		return found;
+	}
+
+	//Each triangle referenced once, children inside their parent and leaf triangles inside their leaf. With spatial
+	//splits triangles may be referenced more than once and only their part inside a leaf is bounded by it, so leaf
+	//boxes only have to touch their triangles.
+	bool BvhIsValid(const Bvh& bvh, uint64_t triangleCount, bool spatialSplits = false)
+	{
+		if (bvh.primitives.size() != bvh.triangles.size() || (!spatialSplits && bvh.primitives.size() != triangleCount)) return false;
+		std::set<std::pair<uint32_t, uint32_t>> references;
+		for (const BvhPrimitive& primitive : bvh.primitives) references.emplace(primitive.geometry, primitive.primitive);
+		if (references.size() != triangleCount) return false;
+
+		auto contains = [](const BvhNode& outer, const DirectX::XMFLOAT3& boundsMin, const DirectX::XMFLOAT3& boundsMax) {
+			return outer.boundsMin.x <= boundsMin.x && outer.boundsMin.y <= boundsMin.y && outer.boundsMin.z <= boundsMin.z &&
+				outer.boundsMax.x >= boundsMax.x && outer.boundsMax.y >= boundsMax.y && outer.boundsMax.z >= boundsMax.z;
+		};
+		for (size_t i = 0; i < bvh.nodes.size(); i++) {
+			const BvhNode& node = bvh.nodes[i];
+			if (!node.IsLeaf()) {
+				if (node.offset <= i + 1 || node.offset >= bvh.nodes.size()) return false;
+				const BvhNode& first = bvh.nodes[i + 1];
+				const BvhNode& second = bvh.nodes[node.offset];
+				if (!contains(node, first.boundsMin, first.boundsMax) || !contains(node, second.boundsMin, second.boundsMax)) return false;
+				continue;
+			}
+			for (uint32_t p = node.offset; p < node.offset + node.count; p++) {
+				const BvhTriangle& triangle = bvh.triangles[p];
+				const DirectX::XMFLOAT3 corners[3] = { triangle.v0,
+					DirectX::XMFLOAT3(triangle.v0.x + triangle.edge1.x, triangle.v0.y + triangle.edge1.y, triangle.v0.z + triangle.edge1.z),
+					DirectX::XMFLOAT3(triangle.v0.x + triangle.edge2.x, triangle.v0.y + triangle.edge2.y, triangle.v0.z + triangle.edge2.z) };
+				// The edges are stored, adding them back may round a corner just outside the box
+				const float tolerance = 1.0e-5f * (1.0f + std::fabs(node.boundsMax.x - node.boundsMin.x) + std::fabs(node.boundsMax.y - node.boundsMin.y) + std::fabs(node.boundsMax.z - node.boundsMin.z));
+				if (spatialSplits) {
+					DirectX::XMFLOAT3 boundsMin = corners[0], boundsMax = corners[0];
+					for (const DirectX::XMFLOAT3& corner : corners) {
+						boundsMin = DirectX::XMFLOAT3((std::min)(boundsMin.x, corner.x), (std::min)(boundsMin.y, corner.y), (std::min)(boundsMin.z, corner.z));
+						boundsMax = DirectX::XMFLOAT3((std::max)(boundsMax.x, corner.x), (std::max)(boundsMax.y, corner.y), (std::max)(boundsMax.z, corner.z));
+					}
+					if (boundsMin.x > node.boundsMax.x + tolerance || boundsMin.y > node.boundsMax.y + tolerance || boundsMin.z > node.boundsMax.z + tolerance ||
+						boundsMax.x < node.boundsMin.x - tolerance || boundsMax.y < node.boundsMin.y - tolerance || boundsMax.z < node.boundsMin.z - tolerance) return false;
+					continue;
+				}
+				for (const DirectX::XMFLOAT3& corner : corners) {
+					if (!contains(node, DirectX::XMFLOAT3(corner.x + tolerance, corner.y + tolerance, corner.z + tolerance), DirectX::XMFLOAT3(corner.x - tolerance, corner.y - tolerance, corner.z - tolerance))) return false;
+				}
+			}
+		}
+		return true;
+	}
+
+	//Closest hit over the instances of a top level, as CpuRaytracer::TraceClosest finds it. Without the top level tree
+	//every instance is tried in turn, the reference the tree walk is checked against.
+	bool TraceInstances(const TopLevelBvh& topLevel, std::span<const Bvh> bottomLevels, const DirectX::XMFLOAT3& origin, const DirectX::XMFLOAT3& direction,
+		bool useTree, BvhHit& hit, uint32_t& instance)
+	{
+		const DirectX::XMVECTOR worldOrigin = DirectX::XMLoadFloat3(&origin);
+		const DirectX::XMVECTOR worldDirection = DirectX::XMLoadFloat3(&direction);
+		float closest = FLT_MAX;
+		bool found = false;
+		auto trace = [&](uint32_t i) {
+			const TopLevelInstance& candidate = topLevel.Instance(i);
+			const DirectX::XMMATRIX worldToObject = DirectX::XMLoadFloat3x4(&candidate.inverse);
+			DirectX::XMFLOAT3 objectOrigin, objectDirection;
+			DirectX::XMStoreFloat3(&objectOrigin, DirectX::XMVector3TransformCoord(worldOrigin, worldToObject));
+			DirectX::XMStoreFloat3(&objectDirection, DirectX::XMVector3TransformNormal(worldDirection, worldToObject));
+			if (!BvhTraversal::IntersectClosest(bottomLevels[candidate.bottomLevel], objectOrigin, objectDirection, 0.0f, closest, hit)) return;
+			closest = hit.t;
+			instance = i;
+			found = true;
+		};
+		if (useTree) {
+			TopLevelTraversal instances(topLevel, origin, direction, 0.0f, 0xFF);
+			for (uint32_t i = instances.Next(closest); i != TopLevelTraversal::END; i = instances.Next(closest)) trace(i);
+		}
+		else {
+			for (uint32_t i = 0; i < topLevel.InstanceCount(); i++) trace(i);
+		}
+		return found;
+	}
+
+	//A named set of geometries built into one bottom level.
+	struct GeometryInput {
+		std::string name;
+		std::vector<RtGeometry> geometries;
+	};
+
+	//A named scene for the whole tracer.
+	struct SceneInput {
+		std::string name;
+		RtScene scene;
+	};
+
+	std::vector<BvhGeometryDesc> GeometryDescs(std::span<const RtGeometry> geometries)
+	{
+		std::vector<BvhGeometryDesc> descs;
+		for (const RtGeometry& geometry : geometries) descs.push_back(BvhGeometryDesc::Of(geometry));
+		return descs;
+	}
+
+	uint64_t TriangleCount(std::span<const RtGeometry> geometries)
+	{
+		uint64_t count = 0;
+		for (const RtGeometry& geometry : geometries) count += geometry.indices.size() / 3;
+		return count;
+	}
+
+	//Every mesh of a model as a geometry, in mesh order.
+	std::vector<RtGeometry> ModelGeometries(const char* path)
+	{
+		Model model(path);
+		std::vector<RtGeometry> geometries;
+		for (const Mesh& mesh : model.meshes) geometries.push_back(MakeRtGeometry(mesh));
+		return geometries;
+	}
+
+	//Every mesh of a model as one bottom level under one instance, scaled into the view of RayGen's camera.
+	RtScene ModelScene(const char* path)
+	{
+		RtScene scene;
+		scene.geometries = ModelGeometries(path);
+		scene.bottomLevels.resize(1);
+		for (uint32_t geometry = 0; geometry < (uint32_t)scene.geometries.size(); geometry++) scene.bottomLevels[0].push_back(geometry);
+		const BvhNode root = BvhBuilder::Build(GeometryDescs(scene.geometries)).nodes[0];
+		const float extent = (std::max)({ root.boundsMax.x - root.boundsMin.x, root.boundsMax.y - root.boundsMin.y, root.boundsMax.z - root.boundsMin.z });
+		const float scale = 3.0f / (std::max)(extent, FLT_MIN);
+		const DirectX::XMMATRIX world = DirectX::XMMatrixTranslation(-(root.boundsMin.x + root.boundsMax.x) * 0.5f, -(root.boundsMin.y + root.boundsMax.y) * 0.5f,
+			-(root.boundsMin.z + root.boundsMax.z) * 0.5f) * DirectX::XMMatrixScaling(scale, scale, scale) * DirectX::XMMatrixTranslation(0.0f, 0.0f, 0.5f);
+		RtInstance& instance = scene.instances.emplace_back();
+		DirectX::XMStoreFloat4x4(&instance.world, world);
+		return scene;
+	}
+
+	//The demo scene turned so its side triangles go through their instance transforms at an angle, and the first bundled
+	//model as a scene with a real bottom level.
+	std::vector<SceneInput> TracerScenes()
+	{
+		std::vector<SceneInput> inputs;
+		inputs.push_back({ "Demo scene", DemoScene::Build(0.6f) });
+		inputs.push_back({ BENCHMARK_MODELS[0], ModelScene(BENCHMARK_MODELS[0]) });
+		return inputs;
+	}
+
+	//The primary rays RayGen shoots, row by row.
+	std::vector<CpuRay> CameraRays(uint32_t width, uint32_t height)
+	{
+		std::vector<CpuRay> rays((size_t)width * height);
+		for (uint32_t y = 0; y < height; y++) {
+			for (uint32_t x = 0; x < width; x++) {
+				CpuRay& ray = rays[(size_t)y * width + x];
+				const float dx = ((float)x / (float)width) * 2.0f - 1.0f;
+				const float dy = ((float)y / (float)height) * 2.0f - 1.0f;
+				ray.origin = DirectX::XMFLOAT3(0.0f, 0.0f, -2.0f);
+				DirectX::XMStoreFloat3(&ray.direction, DirectX::XMVector3Normalize(DirectX::XMVectorSet(dx * ((float)width / (float)height), -dy, 1.0f, 0.0f)));
+			}
+		}
+		return rays;
+	}
+
+	//Closest hits of rays into one bottom level. A miss is stored as t = -1.
+	template<typename BvhType>
+	void ClosestHits(const BvhType& bvh, std::span<const std::pair<DirectX::XMFLOAT3, DirectX::XMFLOAT3>> rays, std::vector<BvhHit>& hits)
+	{
+		hits.assign(rays.size(), BvhHit{ -1.0f });
+		for (size_t i = 0; i < rays.size(); i++) {
+			if (!BvhTraversal::IntersectClosest(bvh, rays[i].first, rays[i].second, 0.0f, FLT_MAX, hits[i])) hits[i].t = -1.0f;
+		}
+	}
+
+	//The same, best of three passes. Returns rays per second.
+	template<typename BvhType>
+	double TraceClosestRays(const BvhType& bvh, std::span<const std::pair<DirectX::XMFLOAT3, DirectX::XMFLOAT3>> rays, std::vector<BvhHit>& hits)
+	{
+		return (double)rays.size() / BestOfThreeSeconds([&]() { ClosestHits(bvh, rays, hits); });
+	}
+
+	//Best of three renders, pixels keep the image of the last one.
+	CpuRenderStats BestRender(const CpuRaytracer& tracer, uint32_t width, uint32_t height, std::vector<uint32_t>& pixels, ThreadPool* pool = nullptr,
+		uint32_t packetSize = CpuRaytracer::DEFAULT_PACKET_SIZE)
+	{
+		CpuRenderStats best;
+		for (int run = 0; run < 3; run++) {
+			const CpuRenderStats stats = tracer.Render(width, height, pixels, pool, packetSize);
+			if (run == 0 || stats.seconds < best.seconds) best = stats;
+		}
+		return best;
+	}
+
+	//The whole reference tracer on the demo scene once per bottom level layout, rates and images against the first
+	//layout. Single rays, packets would take every layout's primary rays through the binary BVHs.
+	void RenderLayouts(std::ostream& out, std::span<const std::pair<const char*, CpuBvhLayout>> layouts)
+	{
+		const uint32_t width = CpuRaytracer::DEFAULT_WIDTH, height = CpuRaytracer::DEFAULT_HEIGHT;
+		const RtScene scene = DemoScene::Build(0.6f);
+		std::vector<uint32_t> reference;
+		double referenceRate = 0.0;
+		for (const auto& [name, layout] : layouts) {
+			const CpuRaytracer tracer(scene, {}, nullptr, layout);
+			std::vector<uint32_t> pixels;
+			const CpuRenderStats best = BestRender(tracer, width, height, pixels, nullptr, 1);
+			if (reference.empty()) {
+				reference = pixels;
+				referenceRate = best.RaysPerSecond();
+			}
+			out << "Demo scene " << width << "x" << height << " " << name << ": " << best.RaysPerSecond() / 1.0e6 << " Mrays/s x" << best.RaysPerSecond() / referenceRate
+				<< ", " << Check(pixels == reference, "image matches ", "IMAGE DIFFERS FROM ") << layouts[0].first << "\n";
+		}
+	}
+
+	//Bit identical nodes, primitives and leaf triangles.
+	bool SameBvh(const Bvh& a, const Bvh& b)
+	{
+		return a.nodes.size() == b.nodes.size() && a.primitives.size() == b.primitives.size() && a.triangles.size() == b.triangles.size() &&
+			memcmp(a.nodes.data(), b.nodes.data(), a.nodes.size() * sizeof(BvhNode)) == 0 &&
+			memcmp(a.primitives.data(), b.primitives.data(), a.primitives.size() * sizeof(BvhPrimitive)) == 0 &&
+			memcmp(a.triangles.data(), b.triangles.data(), a.triangles.size() * sizeof(BvhTriangle)) == 0;
+	}
+
+	//Closest hits of random rays into the root box against testing every triangle. hits counts the rays that hit.
+	bool TracesMatchBruteForce(const Bvh& bvh, uint32_t rayCount, uint32_t seed, uint32_t& hits)
+	{
+		bool matches = true;
+		hits = 0;
+		for (const auto& [origin, direction] : RandomRays(bvh.nodes[0], rayCount, seed)) {
+			BvhHit bvhHit, reference;
+			const bool found = BvhTraversal::IntersectClosest(bvh, origin, direction, 0.0f, FLT_MAX, bvhHit);
+			const bool expected = BruteForceClosest(bvh, origin, direction, FLT_MAX, reference);
+			matches = matches && found == expected && (!found || bvhHit.t == reference.t);
+			hits += found ? 1 : 0;
+		}
+		return matches;
+	}
+
+	//A builder of one bottom level, given the pool to build on.
+	struct BuildVariant {
+		const char* name;
+		std::function<Bvh(std::span<const BvhGeometryDesc>, ThreadPool*)> build;
+		bool spatialSplits = false; // references may repeat, see BvhIsValid
+	};
+
+	//The binned SAH build and the linear builds compared against it.
+	std::vector<BuildVariant> LinearBuildVariants()
+	{
+		LinearBvhSettings morton30, morton63, treelets;
+		morton63.mortonBits = 63;
+		treelets.treeletPasses = 3;
+		return {
+			{ "binned SAH", [](std::span<const BvhGeometryDesc> descs, ThreadPool* pool) { return BvhBuilder::Build(descs, {}, pool); } },
+			{ "LBVH 30 bit", [=](std::span<const BvhGeometryDesc> descs, ThreadPool* pool) { return BvhBuilder::BuildLinear(descs, morton30, pool); } },
+			{ "LBVH 63 bit", [=](std::span<const BvhGeometryDesc> descs, ThreadPool* pool) { return BvhBuilder::BuildLinear(descs, morton63, pool); } },
+			{ "LBVH 30 bit + 3 treelet passes", [=](std::span<const BvhGeometryDesc> descs, ThreadPool* pool) { return BvhBuilder::BuildLinear(descs, treelets, pool); } },
+		};
+	}
+
+	//Both lists found the same closest hit distance, or both missed, for every ray.
+	bool SameHits(const std::vector<BvhHit>& a, const std::vector<BvhHit>& b)
+	{
+		if (a.size() != b.size()) return false;
+		for (size_t i = 0; i < a.size(); i++) {
+			if (a[i].t != b[i].t) return false;
+		}
+		return true;
+	}
+
+	//The same import on the pool, on one thread and read back from the mesh cache it writes, what the determinism
+	//checks compare.
+	struct ImportRuns {
+		std::unique_ptr<Model> threaded;
+		std::unique_ptr<Model> serial;
+		std::unique_ptr<Model> cached;
+	};
+
+	ImportRuns ImportThreeWays(const char* path, ModelImportSettings settings = {})
+	{
+		ImportRuns runs;
+		settings.useMeshCache = false;
+		runs.threaded = std::make_unique<Model>(path, settings);
+
+		ThreadPool serialPool(0);
+		settings.threadPool = &serialPool;
+		runs.serial = std::make_unique<Model>(path, settings);
+
+		// A cold import writes the cache, the second import must come from it
+		settings.threadPool = nullptr;
+		settings.useMeshCache = true;
+		Model(path, settings);
+		runs.cached = std::make_unique<Model>(path, settings);
+		return runs;
+	}
+
+	//A cached scene graph holds the same nodes as the import and reproduces its world matrices exactly.
+	bool SceneCacheMatches(const SceneGraph& imported, const Model& cached)
+	{
+		return cached.IsFromCache() && cached.sceneGraph.parents == imported.parents && cached.sceneGraph.meshRefs == imported.meshRefs &&
+			cached.sceneGraph.meshOffsets == imported.meshOffsets && WorldTransformError(cached.sceneGraph) == 0.0f;
+	}
+
+	//Outcome of loading the bundled models and one missing file through an AsyncModelLoader, one upload per frame as
+	//the renderer does with a simulated fence two frames behind.
+	struct AsyncLoadRun {
+		size_t requests = 0;
+		double requestSeconds = 0.0; // until every Request returned
+		double firstResidentSeconds = 0.0;
+		double residentSeconds = 0.0;
+		uint32_t frames = 0;
+		bool ordered = true; // the state of every request only moved forwards
+		bool callbacksOk = true; // one callback per request, with its final state
+	};
+
+	AsyncLoadRun LoadAsync(const ModelImportSettings& settings)
+	{
+		AsyncLoadRun run;
+		AsyncModelLoader loader;
+		std::map<ModelHandle, std::vector<ModelLoadState>> completions;
+		auto onComplete = [&](ModelHandle handle, ModelLoadState state) { completions[handle].push_back(state); };
+
+		std::vector<ModelHandle> handles;
+		auto start = std::chrono::steady_clock::now();
+		for (const char* path : BENCHMARK_MODELS) handles.push_back(loader.Request(path, settings, onComplete));
+		handles.push_back(loader.Request("Models/DoesNotExist.fbx", settings, onComplete));
+		run.requests = handles.size();
+		run.requestSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		const uint64_t fenceLatency = 2;
+		uint64_t fence = 0;
+		std::vector<ModelLoadState> lastStates(handles.size(), ModelLoadState::Queued);
+		while (loader.InFlightCount() > 0 || completions.size() < handles.size()) {
+			run.frames++;
+			loader.Retire(fence > fenceLatency ? fence - fenceLatency : 0);
+			std::vector<ModelHandle> uploads = loader.TakeLoaded(1);
+			fence++;
+			for (ModelHandle handle : uploads) {
+				run.ordered &= loader.GetModel(handle) != nullptr;
+				loader.UploadSubmitted(handle, fence);
+			}
+
+			for (size_t i = 0; i < handles.size(); i++) {
+				const ModelLoadState state = loader.State(handles[i]);
+				run.ordered &= state >= lastStates[i];
+				lastStates[i] = state;
+				if (state == ModelLoadState::Resident && run.firstResidentSeconds == 0.0) {
+					run.firstResidentSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+				}
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		run.residentSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		run.callbacksOk = completions.size() == handles.size();
+		for (size_t i = 0; i < handles.size(); i++) {
+			const std::vector<ModelLoadState>& states = completions[handles[i]];
+			const ModelLoadState expected = i + 1 < handles.size() ? ModelLoadState::Resident : ModelLoadState::Failed;
+			run.callbacksOk &= states.size() == 1 && states[0] == expected && loader.State(handles[i]) == expected;
+		}
+		return run;
+	}
+
+	//Instances of a set of bottom levels, each scaled to about a unit box around its center, on a grid two units apart.
+	//They spin at mRotation's 0.5 radians per second and drift at up to three units per second, the drift is what
+	//degrades a refitted top level.
+	class DriftingInstances
+	{
+	public:
+		static constexpr float FRAME_TIME = 1.0f / 60.0f;
+
+		DriftingInstances(std::span<const Bvh> bottomLevels, uint32_t instanceCount)
+		{
+			for (const Bvh& bottomLevel : bottomLevels) {
+				const DirectX::XMVECTOR boundsMin = DirectX::XMLoadFloat3(&bottomLevel.nodes[0].boundsMin);
+				const DirectX::XMVECTOR boundsMax = DirectX::XMLoadFloat3(&bottomLevel.nodes[0].boundsMax);
+				const DirectX::XMVECTOR extent = DirectX::XMVectorSubtract(boundsMax, boundsMin);
+				const float largest = (std::max)((std::max)(DirectX::XMVectorGetX(extent), DirectX::XMVectorGetY(extent)), DirectX::XMVectorGetZ(extent));
+				DirectX::XMFLOAT4X4& normalize = mNormalize.emplace_back();
+				DirectX::XMStoreFloat4x4(&normalize, DirectX::XMMatrixTranslationFromVector(DirectX::XMVectorScale(DirectX::XMVectorAdd(boundsMin, boundsMax), -0.5f)) *
+					DirectX::XMMatrixScaling(1.0f / largest, 1.0f / largest, 1.0f / largest));
+			}
+
+			std::mt19937 random(31);
+			std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+			const uint32_t side = (uint32_t)std::ceil(std::cbrt((double)instanceCount));
+			mMotions.resize(instanceCount);
+			mInstances.resize(instanceCount);
+			for (uint32_t i = 0; i < instanceCount; i++) {
+				const float x = (float)(i % side), y = (float)(i / side % side), z = (float)(i / (side * side));
+				mMotions[i] = { DirectX::XMFLOAT3(x * 2.0f, y * 2.0f, z * 2.0f), DirectX::XMFLOAT3(unit(random) * 3.0f, unit(random) * 3.0f, unit(random) * 3.0f), unit(random) * 3.14159f };
+				mInstances[i].instanceId = i;
+				mInstances[i].bottomLevel = i % (uint32_t)bottomLevels.size();
+			}
+			for (uint32_t i = 0; i < instanceCount; i++) mInstances[i].world = World(i, 0);
+		}
+
+		//The instances at frame 0.
+		const std::vector<RtInstance>& Instances() const { return mInstances; }
+
+		DirectX::XMFLOAT4X4 World(uint32_t i, uint32_t frame) const
+		{
+			const Motion& motion = mMotions[i];
+			const float time = (float)frame * FRAME_TIME;
+			DirectX::XMFLOAT4X4 result;
+			DirectX::XMStoreFloat4x4(&result, DirectX::XMLoadFloat4x4(&mNormalize[mInstances[i].bottomLevel]) * DirectX::XMMatrixRotationY(motion.rotation + 0.5f * time) *
+				DirectX::XMMatrixTranslation(motion.position.x + motion.velocity.x * time, motion.position.y + motion.velocity.y * time, motion.position.z + motion.velocity.z * time));
+			return result;
+		}
+
+	private:
+		struct Motion {
+			DirectX::XMFLOAT3 position;
+			DirectX::XMFLOAT3 velocity;
+			float rotation;
+		};
+		std::vector<DirectX::XMFLOAT4X4> mNormalize; // per bottom level
+		std::vector<Motion> mMotions;
+		std::vector<RtInstance> mInstances;
+	};
+
+	//Closest hit and instance of every ray through a top level, the tree walk or the instance loop. A miss is t = -1.
+	std::vector<std::pair<float, uint32_t>> TopLevelHits(const TopLevelBvh& topLevel, std::span<const Bvh> bottomLevels,
+		std::span<const std::pair<DirectX::XMFLOAT3, DirectX::XMFLOAT3>> rays, bool useTree)
+	{
+		std::vector<std::pair<float, uint32_t>> hits(rays.size());
+		for (size_t r = 0; r < rays.size(); r++) {
+			BvhHit hit;
+			uint32_t instance = 0;
+			hits[r] = TraceInstances(topLevel, bottomLevels, rays[r].first, rays[r].second, useTree, hit, instance) ? std::make_pair(hit.t, instance) : std::make_pair(-1.0f, 0u);
+		}
+		return hits;
+	}
+
+	//The demo scene advanced frameCount frames by updating its instance transforms has to render as a tracer built at
+	//that rotation does. update tells whether the top level was refitted or rebuilt.
+	bool DemoUpdateMatchesRebuild(uint32_t frameCount, TopLevelUpdate& update)
+	{
+		const float rotation = 0.5f * DriftingInstances::FRAME_TIME * (float)frameCount;
+		const RtScene start = DemoScene::Build(0.0f);
+		const RtScene moved = DemoScene::Build(rotation);
+		CpuRaytracer updated(start), rebuilt(moved);
+		DirectX::XMFLOAT4X4 worlds[DemoScene::INSTANCE_COUNT];
+		DemoScene::InstanceTransforms(rotation, worlds);
+		update = updated.UpdateInstanceTransforms(worlds);
+		std::vector<uint32_t> updatedPixels, rebuiltPixels;
+		updated.Render(640, 360, updatedPixels);
+		rebuilt.Render(640, 360, rebuiltPixels);
+		return updatedPixels == rebuiltPixels;
+	}
+
+	//Points the first primitive of a cached BVH at a geometry past its inputs, a key match alone must not get the cache read.
+	void CorruptBvhCachePrimitive(const std::string& cachePath, uint32_t geometryCount)
+	{
+		std::vector<uint8_t> bytes;
+		{
+			std::ifstream in(cachePath, std::ios::binary);
+			bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+		}
+		BvhCache::FileHeader fileHeader;
+		if (bytes.size() < sizeof(fileHeader)) return;
+		memcpy(&fileHeader, bytes.data(), sizeof(fileHeader));
+		if (fileHeader.primitiveCount == 0 || fileHeader.primitiveOffset + sizeof(BvhPrimitive) > bytes.size()) return;
+		memcpy(bytes.data() + fileHeader.primitiveOffset + offsetof(BvhPrimitive, geometry), &geometryCount, sizeof(geometryCount));
+		std::ofstream outFile(cachePath, std::ios::binary | std::ios::trunc);
+		outFile.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+	}
+
+	//Closest hit distance of each ray through the tracer one at a time, -1 on a miss.
+	void TraceSingleRays(const CpuRaytracer& tracer, std::span<const CpuRay> rays, std::vector<float>& hitT)
+	{
+		hitT.resize(rays.size());
+		for (size_t i = 0; i < rays.size(); i++) {
+			CpuHit hit;
+			hitT[i] = tracer.TraceClosest(rays[i], 0xFF, hit) ? hit.t : -1.0f;
+		}
+	}
+
+	//The same for camera rays traced as packets of packetSize x packetSize pixel tiles. Returns the ray and instance
+	//pairs that fell back to single rays.
+	uint64_t TracePacketRays(const CpuRaytracer& tracer, std::span<const CpuRay> rays, uint32_t width, uint32_t height, uint32_t packetSize, std::vector<float>& hitT)
+	{
+		hitT.resize(rays.size());
+		uint64_t fallback = 0;
+		std::array<CpuRay, BvhRayPacket::MAX_RAYS> tile;
+		std::array<CpuHit, BvhRayPacket::MAX_RAYS> hits;
+		std::array<bool, BvhRayPacket::MAX_RAYS> found;
+		for (uint32_t y0 = 0; y0 < height; y0 += packetSize) {
+			for (uint32_t x0 = 0; x0 < width; x0 += packetSize) {
+				const uint32_t tileWidth = (std::min)(packetSize, width - x0), tileHeight = (std::min)(packetSize, height - y0);
+				for (uint32_t i = 0; i < tileWidth * tileHeight; i++) tile[i] = rays[(size_t)(y0 + i / tileWidth) * width + x0 + i % tileWidth];
+				fallback += tracer.TraceClosestPacket(std::span(tile.data(), tileWidth * tileHeight), 0xFF, hits, found);
+				for (uint32_t i = 0; i < tileWidth * tileHeight; i++) hitT[(size_t)(y0 + i / tileWidth) * width + x0 + i % tileWidth] = found[i] ? hits[i].t : -1.0f;
+			}
+		}
+		return fallback;
+	}
+
+	//The shadow rays PlaneHit shoots toward its light, from wherever a camera ray of a width x height image lands.
+	std::vector<CpuRay> ShadowRaysFrom(const CpuRaytracer& tracer, uint32_t width, uint32_t height)
+	{
+		std::vector<CpuRay> rays;
+		for (const CpuRay& cameraRay : CameraRays(width, height)) {
+			CpuHit hit;
+			if (!tracer.TraceClosest(cameraRay, 0xFF, hit)) continue;
+			CpuRay& ray = rays.emplace_back();
+			DirectX::XMStoreFloat3(&ray.origin, DirectX::XMVectorAdd(DirectX::XMLoadFloat3(&cameraRay.origin), DirectX::XMVectorScale(DirectX::XMLoadFloat3(&cameraRay.direction), hit.t)));
+			DirectX::XMStoreFloat3(&ray.direction, DirectX::XMVector3Normalize(DirectX::XMVectorSet(0.5f, 0.5f, -0.5f, 0.0f)));
+			ray.tMin = 0.01f;
+		}
+		return rays;
+	}
+
+	//Instance masks filter shadow casters: with the plane instance out of the shadow ray mask, only the other triangles
+	//occlude. The masked answers have to be those of a scene that leaves the plane out altogether.
+	void ShadowMaskChecks(std::ostream& out, uint32_t width, uint32_t height)
+	{
+		RtScene masked = DemoScene::Build(0.6f);
+		for (RtInstance& instance : masked.instances) instance.mask = instance.bottomLevel == 0 ? 0x02 : 0x01;
+		RtScene unmasked = masked;
+		std::erase_if(unmasked.instances, [](const RtInstance& instance) { return instance.mask != 0x01; });
+		const CpuRaytracer tracer(masked);
+		const CpuRaytracer withoutMasked(unmasked);
+		const std::vector<CpuRay> rays = ShadowRaysFrom(tracer, width, height);
+		size_t occluded[2] = {};
+		bool matchesScene = true;
+		for (const uint8_t mask : { (uint8_t)0xFF, (uint8_t)0x01 }) {
+			size_t& count = occluded[mask == 0xFF ? 0 : 1];
+			bool matches = true;
+			for (const CpuRay& ray : rays) {
+				CpuHit hit;
+				const bool any = tracer.TraceAny(ray, mask);
+				matches = matches && any == tracer.TraceClosest(ray, mask, hit);
+				if (mask == 0x01) matchesScene = matchesScene && any == withoutMasked.TraceAny(ray, 0xFF);
+				count += any ? 1 : 0;
+			}
+			out << "Demo scene, shadow ray mask 0x" << std::hex << (uint32_t)mask << std::dec << ": " << count * 100.0 / (std::max)(rays.size(), (size_t)1) << "% occluded, "
+				<< Check(matches, "answers match closest hit", "ANSWERS DIFFER FROM CLOSEST HIT") << "\n";
+		}
+		out << "Demo scene, shadow ray mask 0x1: " << Check(occluded[1] < occluded[0], "fewer rays occluded than with 0xff", "MASK DOES NOT REMOVE OCCLUDERS") << ", "
+			<< Check(matchesScene, "answers match the scene without the masked instances", "ANSWERS DIFFER FROM THE SCENE WITHOUT THE MASKED INSTANCES") << "\n";
+	}
+
+	//Polls the working set on a background thread. The process peak counter cannot be reset between runs, so the
+	//growth over the starting working set is sampled instead, short spikes between polls can be missed.
+	class WorkingSetSampler
+	{
+	public:
+		WorkingSetSampler() : mBaseline(WorkingSet()), mPeak(mBaseline) {
+			mThread = std::thread([this]() {
+				while (!mStop.load(std::memory_order_relaxed)) {
+					mPeak = (std::max)(mPeak.load(std::memory_order_relaxed), WorkingSet());
+					std::this_thread::sleep_for(std::chrono::milliseconds(1));
+				}
+			});
+		}
+		~WorkingSetSampler() { Stop(); }
+
+		//Peak growth over the baseline in bytes.
+		uint64_t Stop() {
+			if (mThread.joinable()) {
+				mStop = true;
+				mThread.join();
+				mPeak = (std::max)(mPeak.load(), WorkingSet());
+			}
+			return mPeak - mBaseline;
+		}
+
+	private:
+		static uint64_t WorkingSet() {
+			PROCESS_MEMORY_COUNTERS counters = {};
+			counters.cb = sizeof(counters);
+			return GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)) ? counters.WorkingSetSize : 0;
+		}
+
+		uint64_t mBaseline;
+		std::atomic<uint64_t> mPeak;
+		std::atomic<bool> mStop = false;
+		std::thread mThread;
+	};
+}
+
+int Benchmark::RunAll(const std::string& outputPath)
+{
+	gCheckFailed = false;
+	std::ostringstream results;
+	ModelLoad(results);
+	ImportIOSystem(results);
+	MeshProcessingScaling(results);
+	VertexWelding(results);
+	MeshOptimization(results);
+	CompactVertexError(results);
+	MeshletGeneration(results);
+	LodGeneration(results);
+	SceneFlattening(results);
+	AsyncModelLoading(results);
+	AssetCooking(results);
+	BoundsComputation(results);
+	CpuRaytracing(results);
+	BvhConstruction(results);
+	WideBvhTraversal(results);
+	PacketTracing(results);
+	LinearBvhConstruction(results);
+	TopLevelRefit(results);
+	SpatialSplits(results);
+	QuantizedBvhTraversal(results);
+	BvhCacheStartup(results);
+	ShadowRays(results);
+	return WriteReport(outputPath, results);
+}
+
+int Benchmark::RunTests(const std::string& outputPath)
+{
+	gCheckFailed = false;
+	std::ostringstream results;
+	MeshCacheTests(results);
+	CompactVertexTests(results);
+	MeshletTests(results);
+	LodTests(results);
+	SceneGraphTests(results);
+	AsyncLoadTests(results);
+	BvhBuildTests(results);
+	BvhTraversalTests(results);
+	TopLevelTests(results);
+	BvhCacheTests(results);
+	ShadowRayTests(results);
+	return WriteReport(outputPath, results);
+}
+
+void Benchmark::MeshCacheTests(std::ostream& out)
+{
+	out << "== Mesh cache tests ==\n";
+	for (const char* path : BENCHMARK_MODELS) {
+		Model(path, ModelImportSettings());
+		Model cached(path);
+		const bool indexRejected = FallsBackFromCorruptCache(path, [](std::vector<uint8_t>& bytes, const MeshCache::MeshHeader& mesh) {
+			if (mesh.indexCount == 0) return false;
+			const uint32_t outOfRange = mesh.vertexCount;
+			memcpy(bytes.data() + mesh.indexOffset, &outOfRange, mesh.indexFormat == DXGI_FORMAT_R16_UINT ? sizeof(uint16_t) : sizeof(uint32_t));
+			return mesh.indexFormat == DXGI_FORMAT_R32_UINT || outOfRange <= UINT16_MAX;
+		});
+		const bool meshletIndexRejected = FallsBackFromCorruptCache(path, [](std::vector<uint8_t>& bytes, const MeshCache::MeshHeader& mesh) {
+			if (mesh.meshletTriangleCount == 0) return false;
+			bytes[mesh.meshletTriangleOffset] = UINT8_MAX;
+			return true;
+		});
+		const bool meshletRangeRejected = FallsBackFromCorruptCache(path, [](std::vector<uint8_t>& bytes, const MeshCache::MeshHeader& mesh) {
+			if (mesh.meshletCount == 0) return false;
+			Meshlet meshlet;
+			memcpy(&meshlet, bytes.data() + mesh.meshletOffset, sizeof(meshlet));
+			meshlet.vertexOffset = mesh.meshletVertexCount;
+			memcpy(bytes.data() + mesh.meshletOffset, &meshlet, sizeof(meshlet));
+			return true;
+		});
+		const bool lodIndexRejected = FallsBackFromCorruptCache(path, [](std::vector<uint8_t>& bytes, const MeshCache::MeshHeader& mesh) {
+			if (mesh.lodCount == 0) return false;
+			MeshCache::LodHeader lod;
+			memcpy(&lod, bytes.data() + mesh.lodOffset, sizeof(lod));
+			const uint32_t outOfRange = mesh.vertexCount;
+			if (lod.indexCount == 0 || (mesh.indexFormat == DXGI_FORMAT_R16_UINT && outOfRange > UINT16_MAX)) return false;
+			memcpy(bytes.data() + lod.indexOffset, &outOfRange, mesh.indexFormat == DXGI_FORMAT_R16_UINT ? sizeof(uint16_t) : sizeof(uint32_t));
+			return true;
+		});
+		out << path << ": " << Check(cached.IsFromCache(), "warm import reads the cache", "WARM IMPORT MISSES THE CACHE") << ", "
+			<< Check(indexRejected, "out of range index falls back to Assimp", "OUT OF RANGE INDEX ACCEPTED") << ", "
+			<< Check(lodIndexRejected, "out of range LOD index falls back", "OUT OF RANGE LOD INDEX ACCEPTED") << ", "
+			<< Check(meshletIndexRejected, "out of range meshlet index falls back", "OUT OF RANGE MESHLET INDEX ACCEPTED") << ", "
+			<< Check(meshletRangeRejected, "out of range meshlet vertices fall back", "OUT OF RANGE MESHLET VERTICES ACCEPTED") << "\n";
+	}
+}
+
+void Benchmark::CompactVertexTests(std::ostream& out)
+{
+	out << "== Compact vertex tests ==\n";
+	ModelImportSettings settings;
+	settings.useMeshCache = false;
+	for (const char* path : BENCHMARK_MODELS) {
+		Model model(path, settings);
+		bool withinBounds = !model.meshes.empty();
+		for (const Mesh& mesh : model.meshes) withinBounds = withinBounds && VertexCompression::MeasureError(mesh).WithinBounds();
+		out << path << ": encoding error " << Check(withinBounds, "within bounds", "BOUND EXCEEDED") << "\n";
+	}
+}
+
+void Benchmark::MeshletTests(std::ostream& out)
+{
+	out << "== Meshlet tests ==\n";
+	for (const char* path : BENCHMARK_MODELS) {
+		const ModelImportSettings settings;
+		const ImportRuns runs = ImportThreeWays(path, settings);
+		const Model& threaded = *runs.threaded;
+		const Model& serial = *runs.serial;
+		const Model& cached = *runs.cached;
+
+		bool valid = !threaded.meshes.empty();
+		for (const Mesh& mesh : threaded.meshes) valid = valid && MeshletsMatchMesh(mesh, settings.meshlet);
+		for (const Mesh& mesh : cached.meshes) valid = valid && MeshletsMatchMesh(mesh, settings.meshlet);
+		const uint64_t hash = HashMeshlets(threaded.meshes);
+		out << path << ": meshlets " << Check(valid, "valid", "INVALID") << ", " << Check(hash == HashMeshlets(serial.meshes), "same on one thread", "DIFFER ON ONE THREAD")
+			<< ", " << Check(cached.IsFromCache(), "read from the mesh cache", "NOT READ FROM THE MESH CACHE") << ", "
+			<< Check(hash == HashMeshlets(cached.meshes), "same from the mesh cache", "DIFFER FROM THE MESH CACHE") << "\n";
+	}
+}
+
+void Benchmark::LodTests(std::ostream& out)
+{
+	out << "== LOD tests ==\n";
+	for (const char* path : BENCHMARK_MODELS) {
+		const ImportRuns runs = ImportThreeWays(path);
+		bool bordersPreserved = !runs.threaded->meshes.empty();
+		for (const Mesh& mesh : runs.threaded->meshes) bordersPreserved = bordersPreserved && LodBordersPreserved(mesh);
+		for (const Mesh& mesh : runs.cached->meshes) bordersPreserved = bordersPreserved && LodBordersPreserved(mesh);
+		const uint64_t hash = HashLods(runs.threaded->meshes);
+		out << path << ": " << Check(bordersPreserved, "borders preserved", "BORDERS MOVED") << ", "
+			<< Check(hash == HashLods(runs.serial->meshes), "same on one thread", "DIFFER ON ONE THREAD") << ", "
+			<< Check(runs.cached->IsFromCache() && hash == HashLods(runs.cached->meshes), "same from the mesh cache", "DIFFER FROM THE MESH CACHE") << "\n";
+	}
+}
+
+void Benchmark::SceneGraphTests(std::ostream& out)
+{
+	out << "== Scene graph tests ==\n";
+	for (const char* path : BENCHMARK_MODELS) {
+		ModelImportSettings settings;
+		settings.useMeshCache = false;
+		Model imported(path, settings);
+
+		settings.useMeshCache = true;
+		Model(path, settings);
+		Model cached(path, settings);
+
+		out << path << ": " << Check(imported.sceneGraph.IsValid(imported.meshes.size()), "valid", "INVALID") << ", "
+			<< Check(SceneCacheMatches(imported.sceneGraph, cached), "cache matches", "CACHE MISMATCH") << "\n";
+	}
+
+	// The graph the TLAS instances come from, moved as the renderer does every frame
+	SceneGraph demo;
+	DemoScene::BuildSceneGraph(0.0f, demo);
+	DemoScene::UpdateSceneGraph(0.6f, demo);
+	DirectX::XMFLOAT4X4 world[DemoScene::INSTANCE_COUNT];
+	DemoScene::InstanceTransforms(0.6f, world);
+	const std::vector<SceneInstance> instances = demo.Instances();
+	bool placed = instances.size() == DemoScene::INSTANCE_COUNT;
+	for (uint32_t i = 0; placed && i < DemoScene::INSTANCE_COUNT; i++) {
+		placed = memcmp(&instances[i].world, &world[i], sizeof(world[i])) == 0 && instances[i].mesh == (i == 0 ? 0u : 1u);
+	}
+	out << "Demo scene: " << Check(demo.IsValid(2), "valid", "INVALID") << ", "
+		<< Check(placed, "instances placed as InstanceTransforms", "INSTANCES MISPLACED") << "\n";
+}
+
+void Benchmark::AsyncLoadTests(std::ostream& out)
+{
+	out << "== Async load tests ==\n";
+	ModelImportSettings settings;
+	settings.useMeshCache = false;
+	const AsyncLoadRun run = LoadAsync(settings);
+	out << run.requests << " requests: " << Check(run.ordered, "states ordered", "STATES OUT OF ORDER") << ", "
+		<< Check(run.callbacksOk, "callbacks ok", "CALLBACKS WRONG") << "\n";
+}
+
+void Benchmark::BvhBuildTests(std::ostream& out)
+{
+	out << "== BVH build tests ==\n";
+	std::vector<GeometryInput> inputs;
+	const RtScene demo = DemoScene::Build(0.0f);
+	inputs.push_back({ "Demo scene triangle + plane", { demo.geometries[0], demo.geometries[1] } });
+	for (const char* path : BENCHMARK_MODELS) inputs.push_back({ path, ModelGeometries(path) });
+	inputs.push_back({ "Triangle soup", { TriangleSoup(20000, 17) } });
+
+	std::vector<BuildVariant> variants = LinearBuildVariants();
+	BvhBuildSettings spatial;
+	spatial.spatialSplitBudget = 0.3f;
+	variants.push_back({ "SAH + spatial splits", [=](std::span<const BvhGeometryDesc> descs, ThreadPool* pool) { return BvhBuilder::Build(descs, spatial, pool); }, true });
+	for (const GeometryInput& input : inputs) {
+		const std::vector<BvhGeometryDesc> descs = GeometryDescs(input.geometries);
+		const uint64_t triangleCount = TriangleCount(input.geometries);
+		for (const BuildVariant& variant : variants) {
+			ThreadPool serial(0);
+			const Bvh bvh = variant.build(descs, nullptr);
+			out << input.name << " " << variant.name << ": " << Check(BvhIsValid(bvh, triangleCount, variant.spatialSplits), "valid", "INVALID") << ", "
+				<< Check(SameBvh(bvh, variant.build(descs, &serial)), "deterministic", "THREAD COUNT CHANGES THE BVH") << "\n";
+		}
+	}
+}
+
+void Benchmark::BvhTraversalTests(std::ostream& out)
+{
+	out << "== BVH traversal tests ==\n";
+	std::vector<GeometryInput> inputs;
+	inputs.push_back({ "Triangle", { DemoScene::Triangle() } });
+	inputs.push_back({ "Cube", { DemoScene::Cube(1.0f, 1.0f, 1.0f) } });
+	for (const char* path : BENCHMARK_MODELS) inputs.push_back({ path, ModelGeometries(path) });
+	inputs.push_back({ "Triangle soup", { TriangleSoup(20000, 29) } });
+
+	for (const GeometryInput& input : inputs) {
+		const Bvh binary = BvhBuilder::Build(GeometryDescs(input.geometries));
+		uint32_t hits = 0;
+		const bool tracesMatch = TracesMatchBruteForce(binary, 200, 5, hits);
+
+		const Bvh4 wide4 = BvhBuilder::Collapse<4>(binary);
+		const auto rays = RandomRays(binary.nodes[0], 20000, 9);
+		std::vector<BvhHit> binaryHits, hits4, hits8, quantizedHits;
+		ClosestHits(binary, rays, binaryHits);
+		ClosestHits(wide4, rays, hits4);
+		ClosestHits(BvhBuilder::Collapse<8>(binary), rays, hits8);
+		ClosestHits(BvhBuilder::Quantize(wide4), rays, quantizedHits);
+		out << input.name << ": " << Check(tracesMatch, "traversal matches brute force", "TRAVERSAL DIFFERS FROM BRUTE FORCE") << ", "
+			<< Check(SameHits(hits4, binaryHits) && SameHits(hits8, binaryHits), "wide hits match binary", "WIDE HITS DIFFER FROM BINARY") << ", "
+			<< Check(SameHits(quantizedHits, binaryHits), "quantized hits match binary", "QUANTIZED HITS DIFFER FROM BINARY") << "\n";
+	}
+
+	// Packets against single rays through the binary bottom levels, and every layout's image against the binary one
+	const uint32_t width = 320, height = 180;
+	const std::vector<CpuRay> rays = CameraRays(width, height);
+	for (const SceneInput& input : TracerScenes()) {
+		const CpuRaytracer tracer(input.scene, {}, nullptr, CpuBvhLayout::Binary);
+		std::vector<float> singleT, packetT8, packetT16;
+		TraceSingleRays(tracer, rays, singleT);
+		TracePacketRays(tracer, rays, width, height, 8, packetT8);
+		TracePacketRays(tracer, rays, width, height, 16, packetT16);
+		out << input.name << ": " << Check(packetT8 == singleT && packetT16 == singleT, "packet hits match single rays", "PACKET HITS DIFFER FROM SINGLE RAYS") << "\n";
+	}
+
+	const RtScene scene = DemoScene::Build(0.6f);
+	std::vector<uint32_t> reference, packets;
+	const CpuRaytracer binary(scene, {}, nullptr, CpuBvhLayout::Binary);
+	binary.Render(width, height, reference, nullptr, 1);
+	binary.Render(width, height, packets, nullptr, 8);
+	bool layoutsMatch = true;
+	for (CpuBvhLayout layout : { CpuBvhLayout::Wide4, CpuBvhLayout::Wide8, CpuBvhLayout::Quantized4 }) {
+		std::vector<uint32_t> pixels;
+		CpuRaytracer(scene, {}, nullptr, layout).Render(width, height, pixels, nullptr, 1);
+		layoutsMatch = layoutsMatch && pixels == reference;
+	}
+	out << "Demo scene render: " << Check(packets == reference, "packet image matches single rays", "PACKET IMAGE DIFFERS FROM SINGLE RAYS") << ", "
+		<< Check(layoutsMatch, "every layout matches binary", "LAYOUT IMAGE DIFFERS FROM BINARY") << "\n";
+}
+
+void Benchmark::TopLevelTests(std::ostream& out)
+{
+	out << "== Top level tests ==\n";
+	std::vector<Bvh> bottomLevels;
+	for (const RtGeometry& geometry : { DemoScene::Triangle(), DemoScene::Cube(0.5f, 0.5f, 0.5f), TriangleSoup(2000, 31) }) {
+		const BvhGeometryDesc desc = BvhGeometryDesc::Of(geometry);
+		bottomLevels.push_back(BvhBuilder::Build(std::span(&desc, 1)));
+	}
+
+	// Refit, rebuild and the heuristic between them over 30 frames of drifting instances have to find the same hits,
+	// and those of the instance loop
+	const DriftingInstances drifting(bottomLevels, 1000);
+	TopLevelBvh refit(drifting.Instances(), bottomLevels), rebuild = refit, update = refit;
+	for (uint32_t frame = 1; frame <= 30; frame++) {
+		for (uint32_t i = 0; i < (uint32_t)drifting.Instances().size(); i++) {
+			refit.SetTransform(i, drifting.World(i, frame));
+			rebuild.SetTransform(i, drifting.World(i, frame));
+			update.SetTransform(i, drifting.World(i, frame));
+		}
+		refit.Refit();
+		rebuild.Rebuild();
+		update.Update();
+	}
+	const auto rays = RandomRays(rebuild.Tree().nodes[0], 2000, 37);
+	const std::vector<std::pair<float, uint32_t>> hits = TopLevelHits(rebuild, bottomLevels, rays, true);
+	const std::vector<std::pair<float, uint32_t>> loopHits = TopLevelHits(rebuild, bottomLevels, rays, false);
+	bool loopMatches = true;
+	for (size_t r = 0; r < rays.size(); r++) loopMatches = loopMatches && hits[r].first == loopHits[r].first;
+	out << drifting.Instances().size() << " drifting instances: " << Check(loopMatches, "tree matches the instance loop", "TREE DIFFERS FROM THE INSTANCE LOOP") << ", "
+		<< Check(TopLevelHits(refit, bottomLevels, rays, true) == hits && TopLevelHits(update, bottomLevels, rays, true) == hits, "refit hits match rebuild",
+			"REFIT HITS DIFFER FROM REBUILD") << "\n";
+
+	TopLevelUpdate demoUpdate;
+	out << "Demo scene after 10 frames: " << Check(DemoUpdateMatchesRebuild(10, demoUpdate), "image matches a tracer built at that rotation",
+		"IMAGE DIFFERS FROM A TRACER BUILT AT THAT ROTATION") << "\n";
+}
+
+void Benchmark::BvhCacheTests(std::ostream& out)
+{
+	out << "== BVH cache tests ==\n";
+	const std::string directory = "TestBvhCache";
+	std::error_code error;
+	std::filesystem::remove_all(directory, error);
+
+	std::vector<GeometryInput> inputs;
+	for (const char* path : BENCHMARK_MODELS) inputs.push_back({ path, ModelGeometries(path) });
+	inputs.push_back({ "Triangle soup", { TriangleSoup(20000, 37) } });
+	for (GeometryInput& input : inputs) {
+		const std::vector<BvhGeometryDesc> descs = GeometryDescs(input.geometries);
+		bool coldHit = true, warmHit = false, vertexHit = true, settingsHit = true, corruptHit = true;
+		const Bvh built = BvhBuilder::Build(descs);
+		const Bvh cold = BvhCache::BuildCached(directory, descs, {}, nullptr, &coldHit);
+		const Bvh warm = BvhCache::BuildCached(directory, descs, {}, nullptr, &warmHit);
+
+		input.geometries[0].vertices[0].vertexPos.x += 1.0f;
+		BvhCache::BuildCached(directory, descs, {}, nullptr, &vertexHit);
+		input.geometries[0].vertices[0].vertexPos.x -= 1.0f;
+		BvhBuildSettings changed;
+		changed.maxLeafSize = 2;
+		BvhCache::BuildCached(directory, descs, changed, nullptr, &settingsHit);
+		CorruptBvhCachePrimitive(BvhCache::CachePathFor(directory, BvhCache::KeyFor(descs, {})), (uint32_t)descs.size());
+		BvhCache::BuildCached(directory, descs, {}, nullptr, &corruptHit);
+
+		out << input.name << ": " << Check(!coldHit && warmHit, "cold miss, warm hit", "WRONG HIT OR MISS") << ", "
+			<< Check(SameBvh(built, cold) && SameBvh(built, warm), "identical to a build", "DIFFERS FROM A BUILD") << ", "
+			<< Check(!vertexHit, "changed vertex misses", "CHANGED VERTEX HITS") << ", " << Check(!settingsHit, "changed settings miss", "CHANGED SETTINGS HIT") << ", "
+			<< Check(!corruptHit, "out of range primitive misses", "OUT OF RANGE PRIMITIVE HITS") << "\n";
+	}
+	std::filesystem::remove_all(directory, error);
+}
+
+void Benchmark::ShadowRayTests(std::ostream& out)
+{
+	out << "== Shadow ray tests ==\n";
+	const uint32_t width = 320, height = 180;
+	for (const SceneInput& input : TracerScenes()) {
+		bool matches = true;
+		for (CpuBvhLayout layout : { CpuBvhLayout::Binary, CpuBvhLayout::Wide4, CpuBvhLayout::Wide8, CpuBvhLayout::Quantized4 }) {
+			const CpuRaytracer tracer(input.scene, {}, nullptr, layout);
+			for (const CpuRay& ray : ShadowRaysFrom(tracer, width, height)) {
+				CpuHit hit;
+				matches = matches && tracer.TraceAny(ray, 0xFF) == tracer.TraceClosest(ray, 0xFF, hit);
+			}
+		}
+		out << input.name << ": " << Check(matches, "any hit matches closest hit in every layout", "ANY HIT DIFFERS FROM CLOSEST HIT") << "\n";
+	}
+	ShadowMaskChecks(out, width, height);
+}
+
+void Benchmark::ModelLoad(std::ostream& out)
+{
+	out << "== Model load (cold = Assimp import + cache write, warm = mapped mesh cache) ==\n";
+	for (const char* path : BENCHMARK_MODELS) {
+		std::error_code error;
+		std::filesystem::remove(MeshCache::CachePathFor(path), error);
+
+		std::unique_ptr<Model> model;
+		double cold = MeasureSeconds([&]() { model = std::make_unique<Model>(path); });
+		model.reset();
+		double warm = MeasureSeconds([&]() { model = std::make_unique<Model>(path); });
+
+		out << path << ": cold " << cold * 1000.0 << " ms, warm " << warm * 1000.0 << " ms"
+			<< Check(model->IsFromCache(), "", " (CACHE MISS)")
+			<< ", speedup x" << (warm > 0.0 ? cold / warm : 0.0) << "\n";
+	}
+}
+
+void Benchmark::ImportIOSystem(std::ostream& out)
+{
+	out << "== Import IO (Assimp default stdio IOSystem vs memory mapped IOSystem, best of 3, no mesh cache) ==\n";
+	for (const char* path : BENCHMARK_MODELS) {
+		const uint64_t fileSize = std::filesystem::file_size(path);
+		double bestSeconds[2] = { 1.0e30, 1.0e30 };
+		uint64_t bestGrowth[2] = { UINT64_MAX, UINT64_MAX };
+		// Alternate the two so neither always runs with the warmer page cache
+		for (int run = 0; run < 3; run++) {
+			for (int mapped = 0; mapped < 2; mapped++) {
+				ModelImportSettings settings;
+				settings.useMeshCache = false;
+				settings.mappedImport = mapped == 1;
+				settings.weldVertices = false;
+				settings.optimizeMeshes = false;
+				settings.buildMeshlets = false;
+				settings.buildLods = false;
+
+				WorkingSetSampler sampler;
+				Model model(path, settings);
+				bestGrowth[mapped] = (std::min)(bestGrowth[mapped], sampler.Stop());
+				bestSeconds[mapped] = (std::min)(bestSeconds[mapped], model.loadStats.importSeconds);
+			}
+		}
+
+		out << path << " (" << fileSize / 1024 << " KB): default " << bestSeconds[0] * 1000.0 << " ms / +" << bestGrowth[0] / 1024
+			<< " KB peak working set, mapped " << bestSeconds[1] * 1000.0 << " ms / +" << bestGrowth[1] / 1024
+			<< " KB, speedup x" << (bestSeconds[1] > 0.0 ? bestSeconds[0] / bestSeconds[1] : 0.0) << "\n";
+	}
+}
+
+void Benchmark::MeshProcessingScaling(std::ostream& out)
+{
+	out << "== Mesh processing scaling (Assimp scene to Mesh conversion only) ==\n";
+	const uint32_t maxThreads = (std::max)(1u, std::thread::hardware_concurrency());
+	for (const char* path : BENCHMARK_MODELS) {
+		double singleThreaded = 0.0;
+		for (uint32_t threads = 1; threads <= maxThreads; threads = threads == maxThreads ? threads + 1 : (std::min)(threads * 2, maxThreads)) {
+			ThreadPool pool(threads - 1);
+			ModelImportSettings settings;
+			settings.threadPool = &pool;
+			settings.useMeshCache = false;
+			settings.weldVertices = false;
+			settings.optimizeMeshes = false;
+			Model model(path, settings);
+
+			double seconds = model.loadStats.processSeconds;
+			if (threads == 1) singleThreaded = seconds;
+			out << path << ": " << threads << " thread(s) " << seconds * 1000.0 << " ms, "
+				<< model.meshes.size() << " meshes, " << (seconds > 0.0 ? model.loadStats.vertexCount / seconds / 1.0e6 : 0.0) << " M vertices/s, "
+				<< "scaling x" << (seconds > 0.0 ? singleThreaded / seconds : 0.0) << "\n";
+		}
+	}
+}
+
+void Benchmark::VertexWelding(std::ostream& out)
+{
+	out << "== Vertex welding (run on meshes mapped from an unwelded mesh cache) ==\n";
+	ModelImportSettings settings;
+	settings.weldVertices = false;
+	settings.optimizeMeshes = false;
+	for (const char* path : BENCHMARK_MODELS) {
+		Model(path, settings);
+		Model model(path, settings);
+
+		WeldStats stats;
+		double seconds = MeasureSeconds([&]() {
+			for (Mesh& mesh : model.meshes) stats += MeshProcessing::WeldVertices(mesh, settings.weld);
+		});
+
+		out << path << ": " << stats.inputVertexCount << " -> " << stats.outputVertexCount << " vertices, ratio "
+			<< stats.Ratio() << " (x" << (stats.outputVertexCount > 0 ? (double)stats.inputVertexCount / stats.outputVertexCount : 0.0) << " fewer), "
+			<< stats.removedTriangleCount << " degenerate triangles removed, " << seconds * 1000.0 << " ms"
+			<< (model.IsFromCache() ? "" : " (cache miss)") << "\n";
+	}
+}
+
+void Benchmark::MeshOptimization(std::ostream& out)
+{
+	out << "== Mesh optimization (FIFO cache simulation, overdraw from six axis views) ==\n";
+	ModelImportSettings settings;
+	settings.useMeshCache = false;
+	settings.optimizeMeshes = false;
+	const uint32_t cacheSize = settings.optimize.cacheSize;
+	for (const char* path : BENCHMARK_MODELS) {
+		Model model(path, settings);
+
+		VertexCacheStats cacheBefore, cacheAfter;
+		OverdrawStats overdrawBefore, overdrawAfter;
+		auto accumulate = [&](VertexCacheStats& cacheStats, OverdrawStats& overdrawStats) {
+			for (const Mesh& mesh : model.meshes) {
+				VertexCacheStats meshCache = MeshProcessing::AnalyzeVertexCache(mesh, cacheSize);
+				OverdrawStats meshOverdraw = MeshProcessing::AnalyzeOverdraw(mesh);
+				cacheStats.triangleCount += meshCache.triangleCount;
+				cacheStats.vertexCount += meshCache.vertexCount;
+				cacheStats.cacheMisses += meshCache.cacheMisses;
+				overdrawStats.pixelsCovered += meshOverdraw.pixelsCovered;
+				overdrawStats.pixelsShaded += meshOverdraw.pixelsShaded;
+			}
+		};
+
+		accumulate(cacheBefore, overdrawBefore);
+		double seconds = MeasureSeconds([&]() {
+			for (Mesh& mesh : model.meshes) MeshProcessing::OptimizeMesh(mesh, settings.optimize);
+		});
+		accumulate(cacheAfter, overdrawAfter);
+
+		out << path << " (cache " << cacheSize << "): ACMR " << cacheBefore.Acmr() << " -> " << cacheAfter.Acmr()
+			<< ", ATVR " << cacheBefore.Atvr() << " -> " << cacheAfter.Atvr()
+			<< ", overdraw " << overdrawBefore.Overdraw() << " -> " << overdrawAfter.Overdraw()
+			<< ", " << seconds * 1000.0 << " ms\n";
+	}
+}
+
+void Benchmark::CompactVertexError(std::ostream& out)
+{
+	out << "== Compact vertex encoding (" << sizeof(vertexConsts) << " -> " << sizeof(CompactVertex) << " bytes per vertex) ==\n";
+	ModelImportSettings settings;
+	settings.useMeshCache = false;
+	for (const char* path : BENCHMARK_MODELS) {
+		Model model(path, settings);
+
+		CompressionError worst;
+		uint64_t vertexCount = 0;
+		bool withinBounds = true;
+		for (const Mesh& mesh : model.meshes) {
+			CompressionError error = VertexCompression::MeasureError(mesh);
+			withinBounds = withinBounds && error.WithinBounds();
+			worst.maxPositionError = (std::max)(worst.maxPositionError, error.maxPositionError);
+			worst.positionErrorBound = (std::max)(worst.positionErrorBound, error.positionErrorBound);
+			worst.maxNormalError = (std::max)(worst.maxNormalError, error.maxNormalError);
+			worst.normalErrorBound = error.normalErrorBound;
+			worst.maxColourError = (std::max)(worst.maxColourError, error.maxColourError);
+			worst.colourErrorBound = error.colourErrorBound;
+			vertexCount += mesh.Vertices().size();
+		}
+
+		double seconds = MeasureSeconds([&]() {
+			for (const Mesh& mesh : model.meshes) VertexCompression::EncodeVertices(mesh.Vertices(), VertexCompression::QuantizationFor(mesh.bounds));
+		});
+
+		const float degrees = 180.0f / DirectX::XM_PI;
+		out << path << ": position error " << worst.maxPositionError << " (bound " << worst.positionErrorBound << ")"
+			<< ", normal error " << worst.maxNormalError * degrees << " deg (bound " << worst.normalErrorBound * degrees << ")"
+			<< ", colour error " << worst.maxColourError << " (bound " << worst.colourErrorBound << ")"
+			<< ", " << Check(withinBounds, "within bounds", "BOUND EXCEEDED")
+			<< ", " << vertexCount * (sizeof(vertexConsts) - sizeof(CompactVertex)) / 1024 << " KB saved, encode "
+			<< (seconds > 0.0 ? vertexCount / seconds / 1.0e6 : 0.0) << " M vertices/s\n";
+	}
+}
+
+void Benchmark::MeshletGeneration(std::ostream& out)
+{
+	out << "== Meshlet generation (deterministic across thread counts and the mesh cache) ==\n";
+	for (const char* path : BENCHMARK_MODELS) {
+		ModelImportSettings settings;
+		settings.useMeshCache = false;
+		Model threaded(path, settings);
+
+		ThreadPool serialPool(0);
+		settings.threadPool = &serialPool;
+		Model serial(path, settings);
+
+		settings.threadPool = nullptr;
+		settings.useMeshCache = true;
+		Model(path, settings);
+		Model cached(path, settings);
+
+		bool valid = true;
+		MeshletStats stats;
+		double seconds = 0.0;
+		uint64_t backfacing = 0;
+		for (const Mesh& mesh : threaded.meshes) {
+			valid = valid && MeshletsMatchMesh(mesh, settings.meshlet);
+			stats += MeshletBuilder::Stats(mesh.meshlets, settings.meshlet);
+			seconds += MeasureSeconds([&]() { MeshletBuilder::Build(mesh, settings.meshlet); });
+
+			// Camera in front of the mesh along -z, roughly the half facing away should be rejected
+			const DirectX::XMFLOAT3 camera(mesh.bounds.Center.x, mesh.bounds.Center.y, mesh.bounds.Center.z - 4.0f * (std::max)(mesh.bounds.Extents.z, 1.0e-3f));
+			for (const MeshletBounds& bounds : mesh.meshlets.Bounds()) backfacing += MeshletBuilder::IsBackfacing(bounds, camera) ? 1 : 0;
+		}
+
+		const uint64_t hash = HashMeshlets(threaded.meshes);
+		const bool deterministic = hash == HashMeshlets(serial.meshes) && cached.IsFromCache() && hash == HashMeshlets(cached.meshes);
+		out << path << " (" << settings.meshlet.maxVertices << "/" << settings.meshlet.maxTriangles << "): "
+			<< stats.meshletCount << " meshlets, " << stats.MeshletsPerMesh() << " per mesh, triangle fill " << stats.TriangleFill()
+			<< ", vertex fill " << stats.VertexFill() << ", " << (stats.meshletCount > 0 ? (double)backfacing / stats.meshletCount : 0.0)
+			<< " cone culled from -z, " << seconds * 1000.0 << " ms, " << Check(valid, "valid", "INVALID") << ", "
+			<< Check(deterministic, "deterministic", "NOT DETERMINISTIC") << "\n";
+	}
+}
+
+void Benchmark::LodGeneration(std::ostream& out)
+{
+	out << "== LOD generation (quadric simplification, RMS error relative to the bounds diagonal) ==\n";
+	for (const char* path : BENCHMARK_MODELS) {
+		const ModelImportSettings settings;
+		const ImportRuns runs = ImportThreeWays(path, settings);
+		const Model& threaded = *runs.threaded;
+
+		std::vector<uint64_t> levelTriangles(1 + settings.lod.levelCount, 0);
+		std::vector<float> levelErrors(1 + settings.lod.levelCount, 0.0f);
+		bool bordersPreserved = true;
+		float diagonal = 0.0f;
+		double seconds = 0.0;
+		for (const Mesh& mesh : threaded.meshes) {
+			levelTriangles[0] += mesh.Indices().size() / 3;
+			for (size_t level = 0; level < mesh.lods.size(); level++) {
+				levelTriangles[level + 1] += mesh.lods[level].Indices().size() / 3;
+				levelErrors[level + 1] = (std::max)(levelErrors[level + 1], mesh.lods[level].geometricError);
+			}
+			bordersPreserved = bordersPreserved && LodBordersPreserved(mesh);
+			diagonal = (std::max)(diagonal, 2.0f * DirectX::XMVectorGetX(DirectX::XMVector3Length(DirectX::XMLoadFloat3(&mesh.bounds.Extents))));
+			seconds += MeasureSeconds([&]() { LodBuilder::Build(mesh, settings.lod); });
+		}
+
+		const uint64_t hash = HashLods(threaded.meshes);
+		const bool deterministic = hash == HashLods(runs.serial->meshes) && runs.cached->IsFromCache() && hash == HashLods(runs.cached->meshes);
+		out << path << ": " << levelTriangles[0] << " triangles";
+		for (size_t level = 1; level < levelTriangles.size(); level++) {
+			out << ", lod" << level << " " << levelTriangles[level] << " ("
+				<< (levelTriangles[0] > 0 ? 100.0 * levelTriangles[level] / levelTriangles[0] : 0.0) << "%, error "
+				<< (diagonal > 0.0f ? 100.0f * levelErrors[level] / diagonal : 0.0f) << "%)";
+		}
+		out << ", " << seconds * 1000.0 << " ms, " << Check(bordersPreserved, "borders preserved", "BORDERS MOVED") << ", "
+			<< Check(deterministic, "deterministic", "NOT DETERMINISTIC") << "\n";
+	}
+}
+
+void Benchmark::SceneFlattening(std::ostream& out)
+{
+	out << "== Scene flattening (SoA nodes, world matrices in one linear pass) ==\n";
+	for (const char* path : BENCHMARK_MODELS) {
+		ModelImportSettings settings;
+		settings.useMeshCache = false;
+		Model imported(path, settings);
+
+		settings.useMeshCache = true;
+		Model(path, settings);
+		Model cached(path, settings);
+
+		SceneGraph& scene = imported.sceneGraph;
+		const int repeats = 1000;
+		const double seconds = MeasureSeconds([&]() {
+			for (int i = 0; i < repeats; i++) scene.UpdateWorldTransforms();
+		});
+
+		// Vertices a per node copy of every mesh would have stored
+		uint64_t sharedVertices = 0, instancedVertices = 0;
+		for (const Mesh& mesh : imported.meshes) sharedVertices += mesh.Vertices().size();
+		for (const SceneInstance& instance : scene.Instances()) instancedVertices += imported.meshes[instance.mesh].Vertices().size();
+
+		out << path << ": " << scene.NodeCount() << " nodes, " << scene.InstanceCount() << " instances of " << imported.meshes.size()
+			<< " meshes, " << sharedVertices << " vertices stored (" << instancedVertices << " if duplicated), world pass "
+			<< (scene.NodeCount() > 0 ? seconds / repeats / scene.NodeCount() * 1.0e9 : 0.0) << " ns per node, max error "
+			<< WorldTransformError(scene) << ", " << Check(scene.IsValid(imported.meshes.size()), "valid", "INVALID") << ", "
+			<< Check(SceneCacheMatches(scene, cached), "cache matches", "CACHE MISMATCH") << "\n";
+	}
+}
+
+void Benchmark::AsyncModelLoading(std::ostream& out)
+{
+	out << "== Async model loading (device free, uploads retired against a simulated fence two frames behind) ==\n";
+	ModelImportSettings settings;
+	settings.useMeshCache = false;
+
+	double synchronous = 0.0;
+	for (const char* path : BENCHMARK_MODELS) synchronous += MeasureSeconds([&]() { Model model(path, settings); });
+
+	const AsyncLoadRun run = LoadAsync(settings);
+	out << run.requests << " requests returned in " << run.requestSeconds * 1.0e6 << " us (synchronous load " << synchronous * 1000.0
+		<< " ms), first resident after " << run.firstResidentSeconds * 1000.0 << " ms, all complete after " << run.residentSeconds * 1000.0
+		<< " ms over " << run.frames << " frames, " << Check(run.ordered, "states ordered", "STATES OUT OF ORDER") << ", "
+		<< Check(run.callbacksOk, "callbacks ok", "CALLBACKS WRONG") << "\n";
+}
+
+void Benchmark::AssetCooking(std::ostream& out)
+{
+	out << "== Asset cooking (content addressed database, bundled models copied to a scratch directory) ==\n";
+	const std::string root = "BenchmarkAssets";
+	std::error_code error;
+	std::filesystem::remove_all(root, error);
+	std::filesystem::create_directories(root + "/Copies", error);
+	for (const char* path : BENCHMARK_MODELS) {
+		const std::filesystem::path source(path);
+		std::filesystem::copy_file(source, root / source.filename(), error);
+		// A second copy with identical contents shares its artefact with the first
+		std::filesystem::copy_file(source, root + "/Copies/" + source.filename().string(), error);
+	}
+
+	auto report = [&](const char* name, const CookStats& stats) {
+		out << name << ": " << stats.seconds * 1000.0 << " ms, " << stats.imported << " imported, " << stats.upToDate << " up to date, "
+			<< stats.failed << " failed, " << stats.rehashed << " rehashed\n";
+	};
+	auto cook = [&](const ModelImportSettings& settings) {
+		// A fresh database object each run so every state goes through Save and Load
+		AssetDatabase database(root, settings);
+		database.Load();
+		CookStats stats = database.CookDirectory(root);
+		database.RemoveUnreferencedArtefacts();
+		database.Save();
+		return stats;
+	};
+
+	ModelImportSettings settings;
+	report("first run", cook(settings));
+	report("no-op re-run", cook(settings));
+
+	// Touching a source without changing it costs a rehash but no import
+	const std::filesystem::path touched = root / std::filesystem::path(BENCHMARK_MODELS[0]).filename();
+	std::filesystem::last_write_time(touched, std::filesystem::last_write_time(touched) + std::chrono::seconds(1), error);
+	report("touched source", cook(settings));
+
+	settings.lod.levelCount = 2;
+	report("changed LOD settings", cook(settings));
+
+	size_t artefacts = 0;
+	for (const auto& entry : std::filesystem::directory_iterator(root + "/" + AssetDatabase::COOKED_DIRECTORY, error)) artefacts += entry.path().extension() == ".meshcache";
+	AssetDatabase database(root, settings);
+	database.Load();
+	const AssetRecord* record = database.Find((root / std::filesystem::path(BENCHMARK_MODELS[0]).filename()).generic_string());
+	const bool current = record != nullptr && database.ImportSettingsFor(record->source).cachePath == record->artefact;
+	// The cook keys the artefact with the hash it already took, a load that hashes the source itself has to agree
+	const bool loads = record != nullptr && Model(record->source, database.ImportSettingsFor(record->source)).IsFromCache();
+	out << database.RecordCount() << " records, " << artefacts << " artefacts after removing stale ones, "
+		<< Check(current, "records resolve to their artefacts", "RECORD DOES NOT RESOLVE") << ", "
+		<< Check(loads, "artefacts load from the cache", "ARTEFACT MISSES THE CACHE") << "\n";
+	std::filesystem::remove_all(root, error);
+}
+
+void Benchmark::BoundsComputation(std::ostream& out)
+{
+	out << "== Bounds computation (scalar vs 4 wide DirectXMath min/max reduction, spheres, world bounds) ==\n";
+	for (const char* path : BENCHMARK_MODELS) {
+		ModelImportSettings settings;
+		settings.useMeshCache = false;
+		Model model(path, settings);
+		settings.useMeshCache = true;
+		Model(path, settings);
+		Model cached(path, settings);
+
+		uint64_t vertexCount = 0;
+		for (const Mesh& mesh : model.meshes) vertexCount += mesh.Vertices().size();
+		const int repeats = (int)(std::max)((uint64_t)1, 20000000 / (std::max)(vertexCount, (uint64_t)1));
+
+		// The results feed a checksum stored to a volatile so the optimizer cannot drop the loops
+		float checksum = 0.0f;
+		const double scalarSeconds = MeasureSeconds([&]() {
+			for (int r = 0; r < repeats; r++) {
+				for (const Mesh& mesh : model.meshes) checksum += ScalarBox(mesh.Vertices()).Extents.x;
+			}
+		});
+		const double boxSeconds = MeasureSeconds([&]() {
+			for (int r = 0; r < repeats; r++) {
+				for (const Mesh& mesh : model.meshes) checksum += Bounds::ComputeBox(mesh.Vertices()).Extents.x;
+			}
+		});
+		const double sphereSeconds = MeasureSeconds([&]() {
+			for (int r = 0; r < repeats; r++) {
+				for (const Mesh& mesh : model.meshes) checksum += Bounds::ComputeSphere(mesh.Vertices(), mesh.bounds).Radius;
+			}
+		});
+
+		volatile float sink = checksum;
+		(void)sink;
+
+		bool boxesMatch = true, spheresContain = true, cacheMatches = cached.IsFromCache() && cached.meshes.size() == model.meshes.size();
+		float sphereToBoxRatio = 0.0f;
+		for (size_t i = 0; i < model.meshes.size(); i++) {
+			const Mesh& mesh = model.meshes[i];
+			boxesMatch &= SameBox(mesh.bounds, ScalarBox(mesh.Vertices()));
+			const DirectX::XMVECTOR center = DirectX::XMLoadFloat3(&mesh.sphere.Center);
+			for (const vertexConsts& vertex : mesh.Vertices()) {
+				spheresContain &= DirectX::XMVectorGetX(DirectX::XMVector3Length(DirectX::XMVectorSubtract(DirectX::XMLoadFloat3(&vertex.pos), center))) <= mesh.sphere.Radius;
+			}
+			const float halfDiagonal = DirectX::XMVectorGetX(DirectX::XMVector3Length(DirectX::XMLoadFloat3(&mesh.bounds.Extents)));
+			sphereToBoxRatio = (std::max)(sphereToBoxRatio, halfDiagonal > 0.0f ? mesh.sphere.Radius / halfDiagonal : 0.0f);
+			if (cacheMatches) {
+				const Mesh& cachedMesh = cached.meshes[i];
+				cacheMatches &= SameBox(cachedMesh.bounds, mesh.bounds) && cachedMesh.sphere.Radius == mesh.sphere.Radius &&
+					memcmp(&cachedMesh.sphere.Center, &mesh.sphere.Center, sizeof(mesh.sphere.Center)) == 0;
+			}
+		}
+
+		// World bounds of every placement, each must hold its mesh's vertices moved by the same matrix
+		bool worldBoundsContain = true;
+		for (const SceneInstance& instance : model.sceneGraph.Instances()) {
+			const Mesh& mesh = model.meshes[instance.mesh];
+			const DirectX::BoundingBox worldBox = Bounds::TransformBox(mesh.bounds, instance.world);
+			const DirectX::XMMATRIX world = DirectX::XMLoadFloat4x4(&instance.world);
+			const DirectX::XMVECTOR boxMin = DirectX::XMVectorSubtract(DirectX::XMLoadFloat3(&worldBox.Center), DirectX::XMLoadFloat3(&worldBox.Extents));
+			const DirectX::XMVECTOR boxMax = DirectX::XMVectorAdd(DirectX::XMLoadFloat3(&worldBox.Center), DirectX::XMLoadFloat3(&worldBox.Extents));
+			const DirectX::XMVECTOR tolerance = DirectX::XMVectorReplicate(1.0e-4f * (1.0f + DirectX::XMVectorGetX(DirectX::XMVector3Length(boxMax))));
+			for (const vertexConsts& vertex : mesh.Vertices()) {
+				const DirectX::XMVECTOR p = DirectX::XMVector3TransformCoord(DirectX::XMLoadFloat3(&vertex.pos), world);
+				worldBoundsContain &= DirectX::XMVector3GreaterOrEqual(p, DirectX::XMVectorSubtract(boxMin, tolerance)) &&
+					DirectX::XMVector3LessOrEqual(p, DirectX::XMVectorAdd(boxMax, tolerance));
+			}
+		}
+
+		const double processed = (double)vertexCount * repeats / 1.0e6;
+		out << path << ": " << vertexCount << " vertices, scalar box " << processed / scalarSeconds << " M vertices/s, SIMD box "
+			<< processed / boxSeconds << " M vertices/s (x" << scalarSeconds / boxSeconds << "), sphere " << processed / sphereSeconds
+			<< " M vertices/s, sphere/half diagonal " << sphereToBoxRatio << ", " << Check(boxesMatch, "boxes match", "BOXES DIFFER") << ", "
+			<< Check(spheresContain, "spheres contain", "SPHERE MISSES A VERTEX") << ", " << Check(worldBoundsContain, "world bounds contain", "WORLD BOUNDS MISS")
+			<< ", " << Check(cacheMatches, "cache matches", "CACHE MISMATCH") << (checksum == 0.0f ? " " : "") << "\n";
+	}
+}
+
+void Benchmark::CpuRaytracing(std::ostream& out)
+{
+	const uint32_t width = CpuRaytracer::DEFAULT_WIDTH, height = CpuRaytracer::DEFAULT_HEIGHT;
+	out << "== CPU reference raytracer (RayGenShaders.hlsl programs on the demo scene, " << width << "x" << height << ") ==\n";
+	// Turned so the side triangles go through their instance transforms at an angle
+	const RtScene scene = DemoScene::Build(0.6f);
+	CpuRaytracer tracer(scene);
+
+	std::vector<uint32_t> reference;
+	double singleThreadRate = 0.0;
+	for (uint32_t threads = 1;; threads = (std::min)(threads * 2, ThreadPool::DefaultWorkerCount() + 1)) {
+		ThreadPool pool(threads - 1);
+		std::vector<uint32_t> pixels;
+		const CpuRenderStats best = BestRender(tracer, width, height, pixels, &pool);
+		if (threads == 1) {
+			reference = pixels;
+			singleThreadRate = best.RaysPerSecond();
+		}
+
+		const double speedup = singleThreadRate > 0.0 ? best.RaysPerSecond() / singleThreadRate : 0.0;
+		out << threads << " threads: " << best.primaryRays << " primary + " << best.shadowRays << " shadow rays in " << best.seconds * 1000.0
+			<< " ms, " << best.RaysPerSecond() / 1.0e6 << " Mrays/s, x" << speedup << " (" << speedup / threads * 100.0 << "% per thread), "
+			<< Check(pixels == reference, "image matches", "IMAGE DIFFERS FROM 1 THREAD") << "\n";
+		if (threads == ThreadPool::DefaultWorkerCount() + 1) break;
+	}
+
+	// The sky is the top left pixel, the ground is pure grey and everything else an interpolated triangle colour
+	const uint32_t sky = reference[0];
+	uint64_t skyPixels = 0, litPixels = 0, shadowPixels = 0;
+	for (uint32_t pixel : reference) {
+		const uint8_t r = (uint8_t)pixel, g = (uint8_t)(pixel >> 8), b = (uint8_t)(pixel >> 16);
+		if (pixel == sky) skyPixels++;
+		else if (r == g && g == b) (r > 128 ? litPixels : shadowPixels)++;
+	}
+	const uint32_t center = reference[(size_t)(height / 2) * width + width / 2];
+	const bool centerOnTriangle = center != sky && !((uint8_t)center == (uint8_t)(center >> 8) && (uint8_t)center == (uint8_t)(center >> 16));
+	const bool written = CpuRaytracer::WriteBmp("CpuRaytraceBenchmark.bmp", width, height, reference);
+
+	const double total = (double)reference.size() / 100.0;
+	out << "Image hash " << std::hex << HashBytes(reference.data(), reference.size() * sizeof(uint32_t)) << std::dec << ", sky "
+		<< skyPixels / total << "%, lit ground " << litPixels / total << "%, shadowed ground " << shadowPixels / total << "%, triangles "
+		<< (reference.size() - skyPixels - litPixels - shadowPixels) / total << "%, " << Check(centerOnTriangle, "center on triangle", "CENTER MISSES TRIANGLE")
+		<< ", " << Check(shadowPixels > 0, "shadows cast", "NO SHADOWS") << ", " << Check(written, "written to CpuRaytraceBenchmark.bmp", "IMAGE NOT WRITTEN") << "\n";
+}
+
+void Benchmark::BvhConstruction(std::ostream& out)
+{
+	out << "== BVH construction (binned SAH over the CreateBottomLevelAS inputs, 1 thread vs the pool) ==\n";
+	std::vector<GeometryInput> inputs;
+	const RtScene demo = DemoScene::Build(0.0f);
+	inputs.push_back({ "Demo scene triangle + plane", { demo.geometries[0], demo.geometries[1] } });
+	for (const char* path : BENCHMARK_MODELS) inputs.push_back({ path, ModelGeometries(path) });
+	inputs.push_back({ "Triangle soup", { TriangleSoup(1000000, 17) } });
+
+	const BvhBuildSettings settings;
+	for (const GeometryInput& input : inputs) {
+		const std::vector<BvhGeometryDesc> descs = GeometryDescs(input.geometries);
+		const uint64_t triangleCount = TriangleCount(input.geometries);
+
+		ThreadPool serial(0);
+		Bvh single, parallel;
+		const double singleSeconds = MeasureSeconds([&]() { single = BvhBuilder::Build(descs, settings, &serial); });
+		const double parallelSeconds = MeasureSeconds([&]() { parallel = BvhBuilder::Build(descs, settings); });
+		const bool deterministic = SameBvh(single, parallel);
+		const BvhStats stats = BvhBuilder::Stats(parallel, settings);
+
+		// Brute force is quadratic in the scene size, fewer rays are checked against the larger inputs
+		const uint32_t rayCount = (uint32_t)(std::max)((uint64_t)16, (std::min)((uint64_t)2000, 200000000 / (std::max)(triangleCount, (uint64_t)1)));
+		uint32_t hits = 0;
+		const bool tracesMatch = TracesMatchBruteForce(parallel, rayCount, 5, hits);
+
+		out << input.name << ": " << input.geometries.size() << " geometries, " << triangleCount << " triangles, 1 thread "
+			<< singleSeconds * 1000.0 << " ms, pool " << parallelSeconds * 1000.0 << " ms (x" << singleSeconds / parallelSeconds << ", "
+			<< triangleCount / parallelSeconds / 1.0e6 << " M triangles/s), " << stats.nodeCount << " nodes, " << stats.PrimitivesPerLeaf()
+			<< " triangles/leaf, depth " << stats.maxDepth << ", SAH cost " << stats.sahCost << ", " << parallel.MemoryBytes() / 1024 << " KB, "
+			<< Check(BvhIsValid(parallel, triangleCount), "valid", "INVALID") << ", " << Check(deterministic, "deterministic", "THREAD COUNT CHANGES THE BVH")
+			<< ", " << hits << "/" << rayCount << " rays hit, " << Check(tracesMatch, "traversal matches brute force", "TRAVERSAL DIFFERS FROM BRUTE FORCE") << "\n";
+	}
+}
+
+void Benchmark::WideBvhTraversal(std::ostream& out)
+{
+	out << "== Wide BVH traversal (binary vs collapsed 4 and 8 wide, 1 thread, random rays into each bottom level) ==\n";
+	std::vector<GeometryInput> inputs;
+	inputs.push_back({ "Triangle", { DemoScene::Triangle() } });
+	inputs.push_back({ "Plane", { DemoScene::Plane(DemoScene::PLANE_WIDTH, DemoScene::PLANE_LENGTH, DemoScene::PLANE_HEIGHT) } });
+	inputs.push_back({ "Cube", { DemoScene::Cube(1.0f, 1.0f, 1.0f) } });
+	for (const char* path : BENCHMARK_MODELS) inputs.push_back({ path, ModelGeometries(path) });
+
+	constexpr uint32_t rayCount = 500000;
+	for (const GeometryInput& input : inputs) {
+		const Bvh binary = BvhBuilder::Build(GeometryDescs(input.geometries));
+		const Bvh4 wide4 = BvhBuilder::Collapse<4>(binary);
+		const Bvh8 wide8 = BvhBuilder::Collapse<8>(binary);
+		const auto rays = RandomRays(binary.nodes[0], rayCount, 9);
+
+		std::vector<BvhHit> binaryHits, hits4, hits8;
+		const double binaryRate = TraceClosestRays(binary, rays, binaryHits);
+		const double rate4 = TraceClosestRays(wide4, rays, hits4);
+		const double rate8 = TraceClosestRays(wide8, rays, hits8);
+
+		out << input.name << ": " << binary.triangles.size() << " triangles, binary " << binary.nodes.size() << " nodes " << binary.MemoryBytes() / 1024
+			<< " KB " << binaryRate / 1.0e6 << " Mrays/s, 4 wide " << wide4.nodes.size() << " nodes (" << BvhBuilder::LaneOccupancy(wide4) << " lanes used) "
+			<< wide4.MemoryBytes() / 1024 << " KB " << rate4 / 1.0e6 << " Mrays/s x" << rate4 / binaryRate << ", 8 wide " << wide8.nodes.size() << " nodes ("
+			<< BvhBuilder::LaneOccupancy(wide8) << " lanes used) " << wide8.MemoryBytes() / 1024 << " KB " << rate8 / 1.0e6 << " Mrays/s x" << rate8 / binaryRate
+			<< ", " << Check(SameHits(hits4, binaryHits) && SameHits(hits8, binaryHits), "hits match binary", "HITS DIFFER FROM BINARY") << "\n";
+	}
+
+	// The whole reference tracer on the demo scene, where instance transforms and shading dilute the traversal gain
+	const std::pair<const char*, CpuBvhLayout> layouts[] = { { "binary", CpuBvhLayout::Binary }, { "4 wide", CpuBvhLayout::Wide4 }, { "8 wide", CpuBvhLayout::Wide8 } };
+	RenderLayouts(out, layouts);
+}
+
+void Benchmark::PacketTracing(std::ostream& out)
+{
+	const uint32_t width = CpuRaytracer::DEFAULT_WIDTH, height = CpuRaytracer::DEFAULT_HEIGHT;
+	out << "== Packet tracing (primary rays of " << width << "x" << height << " tiles as packets vs single rays, both through the binary BVHs) ==\n";
+
+	const std::vector<SceneInput> inputs = TracerScenes();
+
+	// Trace only, the same camera rays RayGen shoots, one thread. Packets only walk binary BVHs, so the single rays they
+	// are measured against do too.
+	for (const SceneInput& input : inputs) {
+		const CpuRaytracer tracer(input.scene, {}, nullptr, CpuBvhLayout::Binary);
+		const std::vector<CpuRay> rays = CameraRays(width, height);
+
+		std::vector<float> singleT;
+		const double singleSeconds = BestOfThreeSeconds([&]() { TraceSingleRays(tracer, rays, singleT); });
+		const size_t hits = rays.size() - std::count(singleT.begin(), singleT.end(), -1.0f);
+		out << input.name << " binary single rays: " << rays.size() / singleSeconds / 1.0e6 << " Mrays/s, " << hits * 100.0 / rays.size() << "% hit\n";
+
+		for (uint32_t packetSize : { 8u, 16u }) {
+			std::vector<float> packetT;
+			uint64_t fallback = 0;
+			const double packetSeconds = BestOfThreeSeconds([&]() { fallback = TracePacketRays(tracer, rays, width, height, packetSize, packetT); });
+			out << input.name << " " << packetSize << "x" << packetSize << " packets: " << rays.size() / packetSeconds / 1.0e6 << " Mrays/s x"
+				<< singleSeconds / packetSeconds << ", " << fallback * 100.0 / ((double)rays.size() * input.scene.instances.size()) << "% of ray traversals fell back to single rays, "
+				<< Check(packetT == singleT, "hits match single rays", "HITS DIFFER FROM SINGLE RAYS") << "\n";
+		}
+	}
+
+	// The full render on the pool, shading and shadow rays stay per ray
+	const CpuRaytracer tracer(inputs[0].scene, {}, nullptr, CpuBvhLayout::Binary);
+	std::vector<uint32_t> reference;
+	double singleRate = 0.0;
+	for (uint32_t packetSize : { 1u, 8u, 16u }) {
+		std::vector<uint32_t> pixels;
+		const CpuRenderStats best = BestRender(tracer, width, height, pixels, nullptr, packetSize);
+		if (packetSize == 1) {
+			reference = pixels;
+			singleRate = best.RaysPerSecond();
+		}
+		out << "Demo scene render, " << (packetSize == 1 ? std::string("binary single rays") : std::to_string(packetSize) + "x" + std::to_string(packetSize) + " packets") << ": "
+			<< best.seconds * 1000.0 << " ms, " << best.RaysPerSecond() / 1.0e6 << " Mrays/s x" << best.RaysPerSecond() / singleRate << ", "
+			<< Check(pixels == reference, "image matches single rays", "IMAGE DIFFERS FROM SINGLE RAYS") << "\n";
+	}
+}
+
+void Benchmark::LinearBvhConstruction(std::ostream& out)
+{
+	out << "== Linear BVH construction (Morton sorted LBVH vs binned SAH, build time against 1 thread trace rate) ==\n";
+	std::vector<GeometryInput> inputs;
+	inputs.push_back({ BENCHMARK_MODELS[0], ModelGeometries(BENCHMARK_MODELS[0]) });
+	for (uint32_t triangles : { 65536u, 262144u, 1048576u }) inputs.push_back({ "Triangle soup " + std::to_string(triangles), { TriangleSoup(triangles, 23) } });
+
+	const std::vector<BuildVariant> variants = LinearBuildVariants();
+	for (const GeometryInput& input : inputs) {
+		const std::vector<BvhGeometryDesc> descs = GeometryDescs(input.geometries);
+		const uint64_t triangleCount = TriangleCount(input.geometries);
+		out << input.name << ", " << triangleCount << " triangles:\n";
+
+		std::vector<std::pair<DirectX::XMFLOAT3, DirectX::XMFLOAT3>> rays;
+		std::vector<float> referenceT;
+		double sahSeconds = 0.0, sahRate = 0.0;
+		for (const BuildVariant& variant : variants) {
+			Bvh bvh;
+			const double seconds = BestOfThreeSeconds([&]() { bvh = variant.build(descs, nullptr); });
+			ThreadPool serial(0);
+			const Bvh single = variant.build(descs, &serial);
+			const bool deterministic = SameBvh(single, bvh);
+
+			// Every variant traces the rays aimed at the SAH build's root box
+			if (rays.empty()) rays = RandomRays(bvh.nodes[0], 100000, 13);
+			std::vector<float> hitT(rays.size());
+			const double traceSeconds = MeasureSeconds([&]() {
+				for (size_t i = 0; i < rays.size(); i++) {
+					BvhHit hit;
+					hitT[i] = BvhTraversal::IntersectClosest(bvh, rays[i].first, rays[i].second, 0.0f, FLT_MAX, hit) ? hit.t : -1.0f;
+				}
+			});
+			const double rate = (double)rays.size() / traceSeconds;
+			if (referenceT.empty()) {
+				referenceT = hitT;
+				sahSeconds = seconds;
+				sahRate = rate;
+			}
+
+			const BvhStats stats = BvhBuilder::Stats(bvh);
+			out << "  " << variant.name << ": build " << seconds * 1000.0 << " ms (x" << sahSeconds / seconds << " vs SAH), SAH cost " << stats.sahCost << ", depth "
+				<< stats.maxDepth << ", " << stats.PrimitivesPerLeaf() << " triangles/leaf, trace " << rate / 1.0e6 << " Mrays/s (x" << rate / sahRate << " vs SAH), "
+				<< Check(BvhIsValid(bvh, triangleCount), "valid", "INVALID") << ", " << Check(deterministic, "deterministic", "THREAD COUNT CHANGES THE BVH") << ", "
+				<< Check(hitT == referenceT, "hits match SAH", "HITS DIFFER FROM SAH") << "\n";
+		}
+	}
+}
+
+void Benchmark::TopLevelRefit(std::ostream& out)
+{
+	out << "== Top level refit (instances spinning in place and drifting apart, refit vs rebuild per frame) ==\n";
+	std::vector<RtGeometry> geometries = { DemoScene::Triangle(), DemoScene::Cube(0.5f, 0.5f, 0.5f) };
+	for (RtGeometry& geometry : ModelGeometries(BENCHMARK_MODELS[0])) geometries.push_back(std::move(geometry));
+	std::vector<Bvh> bottomLevels;
+	for (const RtGeometry& geometry : geometries) {
+		const BvhGeometryDesc desc = BvhGeometryDesc::Of(geometry);
+		bottomLevels.push_back(BvhBuilder::Build(std::span(&desc, 1)));
+	}
+
+	constexpr uint32_t frameCount = 120;
+	for (uint32_t instanceCount : { 10u, 1000u, 100000u }) {
+		const DriftingInstances drifting(bottomLevels, instanceCount);
+		const std::vector<RtInstance>& instances = drifting.Instances();
+
+		TopLevelBvh initial;
+		const double buildSeconds = MeasureSeconds([&]() { initial = TopLevelBvh(instances, bottomLevels); });
+		out << instanceCount << " instances: build " << buildSeconds * 1000.0 << " ms, SAH cost " << initial.BuildSahCost() << "\n";
+
+		struct Policy {
+			const char* name;
+			TopLevelBvh topLevel;
+			double seconds = 0.0;
+			uint32_t rebuilds = 0;
+		};
+		Policy policies[] = { { "refit", initial }, { "rebuild", initial }, { "refit with rebuild heuristic", initial } };
+		for (uint32_t frame = 1; frame <= frameCount; frame++) {
+			for (Policy& policy : policies) {
+				for (uint32_t i = 0; i < instanceCount; i++) policy.topLevel.SetTransform(i, drifting.World(i, frame));
+			}
+			policies[0].seconds += MeasureSeconds([&]() { policies[0].topLevel.Refit(); });
+			policies[1].seconds += MeasureSeconds([&]() { policies[1].topLevel.Rebuild(); });
+			policies[2].seconds += MeasureSeconds([&]() {
+				if (policies[2].topLevel.Update() == TopLevelUpdate::Rebuild) policies[2].rebuilds++;
+			});
+		}
+		policies[1].rebuilds = frameCount;
+
+		// Rays through the scene as it stands after the last frame, every policy has to find the same hits
+		const auto rays = RandomRays(policies[1].topLevel.Tree().nodes[0], 50000, 37);
+		std::vector<std::pair<float, uint32_t>> reference;
+		for (Policy& policy : policies) {
+			std::vector<std::pair<float, uint32_t>> hits;
+			const double traceSeconds = MeasureSeconds([&]() { hits = TopLevelHits(policy.topLevel, bottomLevels, rays, true); });
+			if (reference.empty()) {
+				// The instance loop is checked once where it is affordable, the policies are checked against each other
+				bool loopMatches = true;
+				if (instanceCount <= 1000) {
+					const std::vector<std::pair<float, uint32_t>> expected = TopLevelHits(policy.topLevel, bottomLevels, rays, false);
+					for (size_t r = 0; r < rays.size(); r++) loopMatches &= expected[r].first == hits[r].first;
+				}
+				reference = hits;
+				if (!loopMatches) out << "  " << Check(false, "", "TOP LEVEL HITS DIFFER FROM THE INSTANCE LOOP") << "\n";
+			}
+
+			out << "  " << policy.name << ": " << policy.seconds * 1000.0 / frameCount << " ms/frame, " << policy.rebuilds << " rebuilds in " << frameCount
+				<< " frames, SAH cost " << policy.topLevel.SahCost() << " (x" << policy.topLevel.SahCost() / policies[1].topLevel.SahCost() << " vs rebuild), trace "
+				<< rays.size() / traceSeconds / 1.0e6 << " Mrays/s, " << Check(hits == reference, "hits match", "HITS DIFFER") << "\n";
+		}
+	}
+
+	TopLevelUpdate update;
+	const bool matches = DemoUpdateMatchesRebuild(10, update);
+	out << "Demo scene after 10 frames: " << (update == TopLevelUpdate::Refit ? "refitted" : "rebuilt") << ", "
+		<< Check(matches, "image matches a tracer built at that rotation", "IMAGE DIFFERS FROM A TRACER BUILT AT THAT ROTATION") << "\n";
+}
+
+void Benchmark::SpatialSplits(std::ostream& out)
+{
+	out << "== Spatial splits (SBVH reference duplication budgets vs the plain binned SAH build, 1 thread trace) ==\n";
+	std::vector<GeometryInput> inputs;
+	{
+		// Shiba moved next to the demo triangle in front of the camera, the giant plane triangles run underneath both
+		GeometryInput scene = { "Demo triangle + plane + " + std::string(BENCHMARK_MODELS[0]), { DemoScene::Triangle(), DemoScene::Plane(DemoScene::PLANE_WIDTH, DemoScene::PLANE_LENGTH, DemoScene::PLANE_HEIGHT) } };
+		GeometryInput model = { BENCHMARK_MODELS[0], ModelGeometries(BENCHMARK_MODELS[0]) };
+		const BvhNode root = BvhBuilder::Build(GeometryDescs(model.geometries)).nodes[0];
+		const float extent = (std::max)({ root.boundsMax.x - root.boundsMin.x, root.boundsMax.y - root.boundsMin.y, root.boundsMax.z - root.boundsMin.z });
+		const float scale = 2.0f / (std::max)(extent, FLT_MIN);
+		const DirectX::XMMATRIX world = DirectX::XMMatrixTranslation(-(root.boundsMin.x + root.boundsMax.x) * 0.5f, -(root.boundsMin.y + root.boundsMax.y) * 0.5f,
+			-(root.boundsMin.z + root.boundsMax.z) * 0.5f) * DirectX::XMMatrixScaling(scale, scale, scale) * DirectX::XMMatrixTranslation(2.0f, 0.0f, 1.0f);
+		for (RtGeometry geometry : model.geometries) {
+			for (RTVertexBufferLayout& vertex : geometry.vertices) {
+				DirectX::XMStoreFloat3(&vertex.vertexPos, DirectX::XMVector3TransformCoord(DirectX::XMLoadFloat3(&vertex.vertexPos), world));
+			}
+			scene.geometries.push_back(std::move(geometry));
+		}
+		// The same scene with the plane turned off the axes, its two triangles then span a box around everything else
+		GeometryInput tilted = { "Same with the plane tilted 30 degrees about x and z", scene.geometries };
+		const DirectX::XMMATRIX tilt = DirectX::XMMatrixRotationX(DirectX::XM_PI / 6.0f) * DirectX::XMMatrixRotationZ(DirectX::XM_PI / 6.0f);
+		for (RTVertexBufferLayout& vertex : tilted.geometries[1].vertices) {
+			DirectX::XMStoreFloat3(&vertex.vertexPos, DirectX::XMVector3TransformCoord(DirectX::XMLoadFloat3(&vertex.vertexPos), tilt));
+		}
+		// Long thin diagonal triangles through the model, cables or grass blades, whose boxes overlap most of it
+		GeometryInput slivers = { "Same with 256 diagonal slivers through " + std::string(BENCHMARK_MODELS[0]), scene.geometries };
+		RtGeometry& sliverGeometry = slivers.geometries.emplace_back();
+		std::mt19937 random(43);
+		std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+		for (uint32_t i = 0; i < 256; i++) {
+			const DirectX::XMVECTOR start = DirectX::XMVectorSet(2.0f + unit(random), unit(random), 1.0f + unit(random), 0.0f);
+			const DirectX::XMVECTOR end = DirectX::XMVectorSet(2.0f + unit(random), unit(random), 1.0f + unit(random), 0.0f);
+			const DirectX::XMVECTOR width = DirectX::XMVectorSet(unit(random) * 0.01f, unit(random) * 0.01f, unit(random) * 0.01f, 0.0f);
+			for (DirectX::XMVECTOR corner : { start, end, DirectX::XMVectorAdd(start, width) }) {
+				sliverGeometry.indices.push_back((uint32_t)sliverGeometry.vertices.size());
+				RTVertexBufferLayout& vertex = sliverGeometry.vertices.emplace_back();
+				DirectX::XMStoreFloat3(&vertex.vertexPos, corner);
+				vertex.vertexNorm = DirectX::XMFLOAT3(0.0f, 1.0f, 0.0f);
+			}
+		}
+		inputs.push_back(std::move(scene));
+		inputs.push_back(std::move(tilted));
+		inputs.push_back(std::move(slivers));
+		inputs.push_back(std::move(model));
+	}
+
+	// RayGen's camera at a lower resolution, and random rays aimed into each input's box
+	std::vector<std::pair<DirectX::XMFLOAT3, DirectX::XMFLOAT3>> cameraRays;
+	const uint32_t width = 640, height = 360;
+	for (uint32_t y = 0; y < height; y++) {
+		for (uint32_t x = 0; x < width; x++) {
+			const float dx = ((float)x / (float)width) * 2.0f - 1.0f;
+			const float dy = ((float)y / (float)height) * 2.0f - 1.0f;
+			auto& [origin, direction] = cameraRays.emplace_back();
+			origin = DirectX::XMFLOAT3(0.0f, 0.0f, -2.0f);
+			DirectX::XMStoreFloat3(&direction, DirectX::XMVector3Normalize(DirectX::XMVectorSet(dx * ((float)width / (float)height), -dy, 1.0f, 0.0f)));
+		}
+	}
+
+	for (const GeometryInput& input : inputs) {
+		const std::vector<BvhGeometryDesc> descs = GeometryDescs(input.geometries);
+		const uint64_t triangleCount = TriangleCount(input.geometries);
+		out << input.name << ", " << triangleCount << " triangles:\n";
+
+		std::vector<std::pair<DirectX::XMFLOAT3, DirectX::XMFLOAT3>> randomRays;
+		std::vector<float> referenceT;
+		size_t referenceBytes = 0;
+		float referenceCost = 0.0f;
+		double referenceSteps = 0.0;
+		double referenceRates[2] = {};
+		for (float budget : { 0.0f, 0.1f, 0.3f, 1.0f }) {
+			BvhBuildSettings settings;
+			settings.spatialSplitBudget = budget;
+			Bvh bvh;
+			const double buildSeconds = MeasureSeconds([&]() { bvh = BvhBuilder::Build(descs, settings); });
+			ThreadPool serial(0);
+			const Bvh single = BvhBuilder::Build(descs, settings, &serial);
+			const bool deterministic = SameBvh(single, bvh);
+			if (randomRays.empty()) randomRays = RandomRays(bvh.nodes[0], 100000, 41);
+
+			// Box and triangle tests per ray over both ray sets, and the best of three timed passes over each
+			std::vector<float> hitT;
+			uint64_t boxTests = 0, triangleTests = 0;
+			double rates[2];
+			const std::vector<std::pair<DirectX::XMFLOAT3, DirectX::XMFLOAT3>>* raySets[2] = { &cameraRays, &randomRays };
+			for (int set = 0; set < 2; set++) {
+				const auto& rays = *raySets[set];
+				for (const auto& [origin, direction] : rays) hitT.push_back(CountTraversalSteps(bvh, origin, direction, boxTests, triangleTests));
+				std::vector<BvhHit> hits;
+				rates[set] = TraceClosestRays(bvh, rays, hits);
+			}
+			const double rayCount = (double)hitT.size();
+			const double steps = (double)(boxTests + triangleTests) / rayCount;
+
+			const BvhStats stats = BvhBuilder::Stats(bvh, settings);
+			if (referenceT.empty()) {
+				referenceT = hitT;
+				referenceSteps = steps;
+				referenceBytes = bvh.MemoryBytes();
+				referenceCost = stats.sahCost;
+				referenceRates[0] = rates[0];
+				referenceRates[1] = rates[1];
+			}
+			size_t mismatches = 0;
+			for (size_t i = 0; i < hitT.size(); i++) mismatches += hitT[i] != referenceT[i] ? 1 : 0;
+
+			out << "  budget " << budget * 100.0f << "%: build " << buildSeconds * 1000.0 << " ms, " << bvh.primitives.size() << " references (+"
+				<< 100.0 * ((double)bvh.primitives.size() / (double)triangleCount - 1.0) << "%), " << bvh.nodes.size() << " nodes, " << bvh.MemoryBytes() / 1024 << " KB (+"
+				<< 100.0 * ((double)bvh.MemoryBytes() / (double)referenceBytes - 1.0) << "%), SAH cost " << stats.sahCost << " (x" << stats.sahCost / referenceCost
+				<< "), " << (double)boxTests / rayCount << " box + " << (double)triangleTests / rayCount << " triangle tests/ray (x"
+				<< steps / referenceSteps << "), camera " << rates[0] / 1.0e6 << " Mrays/s (x" << rates[0] / referenceRates[0] << "), random " << rates[1] / 1.0e6 << " Mrays/s (x"
+				<< rates[1] / referenceRates[1] << "), " << Check(BvhIsValid(bvh, triangleCount, budget > 0.0f), "valid", "INVALID") << ", "
+				<< Check(deterministic, "deterministic", "THREAD COUNT CHANGES THE BVH") << ", ";
+			if (mismatches == 0) out << "hits match";
+			else out << mismatches << " OF " << hitT.size() << " " << Check(false, "", "HITS DIFFER");
+			out << "\n";
+		}
+	}
+}
+
+void Benchmark::QuantizedBvhTraversal(std::ostream& out)
+{
+	out << "== Quantized BVH (binary vs 4 wide vs 4 wide with 8 bit child bounds, 1 thread, random rays into each bottom level) ==\n";
+	std::vector<GeometryInput> inputs;
+	for (const char* path : BENCHMARK_MODELS) inputs.push_back({ path, ModelGeometries(path) });
+	inputs.push_back({ "Triangle soup", { TriangleSoup(262144, 29) } });
+
+	constexpr uint32_t rayCount = 200000;
+	for (const GeometryInput& input : inputs) {
+		std::vector<BvhGeometryDesc> descs;
+		size_t vertexBytes = 0;
+		for (const RtGeometry& geometry : input.geometries) {
+			descs.push_back(BvhGeometryDesc::Of(geometry));
+			vertexBytes += geometry.vertices.size() * sizeof(RTVertexBufferLayout) + geometry.indices.size() * sizeof(uint32_t);
+		}
+		const Bvh binary = BvhBuilder::Build(descs);
+		const Bvh4 wide = BvhBuilder::Collapse<4>(binary);
+		QuantizedBvh quantized;
+		const double quantizeSeconds = MeasureSeconds([&]() { quantized = BvhBuilder::Quantize(wide); });
+		const auto rays = RandomRays(binary.nodes[0], rayCount, 31);
+
+		std::vector<BvhHit> binaryHits, wideHits, quantizedHits;
+		const double binaryRate = TraceClosestRays(binary, rays, binaryHits);
+		const double wideRate = TraceClosestRays(wide, rays, wideHits);
+		const double quantizedRate = TraceClosestRays(quantized, rays, quantizedHits);
+
+		const double triangles = (double)(std::max)(binary.triangles.size(), (size_t)1);
+		auto report = [&](const char* name, size_t nodeBytes, size_t totalBytes, double rate) {
+			out << ", " << name << " " << (double)nodeBytes / triangles << " node + " << (double)(totalBytes - nodeBytes) / triangles << " triangle bytes/triangle "
+				<< rate / 1.0e6 << " Mrays/s";
+		};
+		out << input.name << ": " << binary.triangles.size() << " triangles, vertex data " << (double)vertexBytes / triangles << " bytes/triangle";
+		report("binary", binary.nodes.size() * sizeof(BvhNode), binary.MemoryBytes(), binaryRate);
+		report("4 wide", wide.nodes.size() * sizeof(WideBvhNode<4>), wide.MemoryBytes(), wideRate);
+		report("quantized", quantized.nodes.size() * sizeof(QuantizedBvhNode), quantized.MemoryBytes(), quantizedRate);
+		out << " (x" << quantizedRate / wideRate << " vs 4 wide, x" << quantizedRate / binaryRate << " vs binary, quantized in " << quantizeSeconds * 1000.0 << " ms), "
+			<< Check(SameHits(quantizedHits, binaryHits), "hits match binary", "HITS DIFFER FROM BINARY") << "\n";
+	}
+
+	// The whole reference tracer on the demo scene
+	const std::pair<const char*, CpuBvhLayout> layouts[] = { { "4 wide", CpuBvhLayout::Wide4 }, { "quantized", CpuBvhLayout::Quantized4 } };
+	RenderLayouts(out, layouts);
+}
+
+void Benchmark::BvhCacheStartup(std::ostream& out)
+{
+	out << "== BVH cache (bottom level builds vs reading them back from a scratch cache directory) ==\n";
+	const std::string directory = "BenchmarkBvhCache";
+	std::error_code error;
+	std::filesystem::remove_all(directory, error);
+
+	std::vector<GeometryInput> inputs;
+	for (const char* path : BENCHMARK_MODELS) inputs.push_back({ path, ModelGeometries(path) });
+	inputs.push_back({ "Triangle soup", { TriangleSoup(1000000, 37) } });
+
+	BvhBuildSettings spatial;
+	spatial.spatialSplitBudget = 0.3f;
+	const std::pair<const char*, BvhBuildSettings> variants[] = { { "SAH", {} }, { "SAH + spatial splits", spatial } };
+	for (GeometryInput& input : inputs) {
+		const std::vector<BvhGeometryDesc> descs = GeometryDescs(input.geometries);
+		for (const auto& [name, settings] : variants) {
+			Bvh built, cold, warm;
+			bool coldHit = true, warmHit = false;
+			const double buildSeconds = MeasureSeconds([&]() { built = BvhBuilder::Build(descs, settings); });
+			const double coldSeconds = MeasureSeconds([&]() { cold = BvhCache::BuildCached(directory, descs, settings, nullptr, &coldHit); });
+			const double warmSeconds = MeasureSeconds([&]() { warm = BvhCache::BuildCached(directory, descs, settings, nullptr, &warmHit); });
+			uint64_t key = 0;
+			const double keySeconds = MeasureSeconds([&]() { key = BvhCache::KeyFor(descs, settings); });
+			const uint64_t fileBytes = std::filesystem::file_size(BvhCache::CachePathFor(directory, key), error);
+			out << input.name << " " << name << ": build " << buildSeconds * 1000.0 << " ms, cold " << coldSeconds * 1000.0 << " ms (" << Check(!coldHit, "miss", "HIT")
+				<< "), warm " << warmSeconds * 1000.0 << " ms (" << Check(warmHit, "hit", "MISS") << ", x" << buildSeconds / warmSeconds << ", " << keySeconds * 1000.0
+				<< " ms of it hashing), " << fileBytes / 1024 << " KB, " << Check(SameBvh(built, cold) && SameBvh(built, warm), "identical to a build", "DIFFERS FROM A BUILD") << "\n";
+		}
+
+		// Any change to the vertex data or the settings has to miss
+		bool vertexHit = true, settingsHit = true;
+		input.geometries[0].vertices[0].vertexPos.x += 1.0f;
+		BvhCache::BuildCached(directory, descs, {}, nullptr, &vertexHit);
+		input.geometries[0].vertices[0].vertexPos.x -= 1.0f;
+		BvhBuildSettings changed;
+		changed.maxLeafSize = 2;
+		BvhCache::BuildCached(directory, descs, changed, nullptr, &settingsHit);
+		// A primitive outside the geometries has to miss even when the key matches
+		bool corruptHit = true;
+		CorruptBvhCachePrimitive(BvhCache::CachePathFor(directory, BvhCache::KeyFor(descs, {})), (uint32_t)descs.size());
+		BvhCache::BuildCached(directory, descs, {}, nullptr, &corruptHit);
+		out << input.name << ": " << Check(!vertexHit, "changed vertex misses", "CHANGED VERTEX HITS") << ", " << Check(!settingsHit, "changed settings miss", "CHANGED SETTINGS HIT")
+			<< ", " << Check(!corruptHit, "out of range primitive misses", "OUT OF RANGE PRIMITIVE HITS") << "\n";
+	}
+
+	// Tracer startup over every input as its own bottom level, the top level is always rebuilt
+	RtScene scene;
+	for (GeometryInput& input : inputs) {
+		std::vector<uint32_t>& bottomLevel = scene.bottomLevels.emplace_back();
+		for (RtGeometry& geometry : input.geometries) {
+			bottomLevel.push_back((uint32_t)scene.geometries.size());
+			scene.geometries.push_back(std::move(geometry));
+		}
+		RtInstance& instance = scene.instances.emplace_back();
+		DirectX::XMStoreFloat4x4(&instance.world, DirectX::XMMatrixIdentity());
+	}
+	std::filesystem::remove_all(directory, error);
+	std::unique_ptr<CpuRaytracer> reference;
+	const std::pair<const char*, std::string> startups[] = { { "no cache", std::string() }, { "cold cache", directory }, { "warm cache", directory } };
+	for (const auto& [name, cacheDirectory] : startups) {
+		std::unique_ptr<CpuRaytracer> tracer;
+		const double seconds = MeasureSeconds([&]() { tracer = std::make_unique<CpuRaytracer>(scene, BvhBuildSettings{}, nullptr, CpuBvhLayout::Wide4, cacheDirectory); });
+		bool identical = true;
+		if (reference) {
+			for (uint32_t i = 0; i < (uint32_t)scene.bottomLevels.size(); i++) identical = identical && SameBvh(tracer->BottomLevel(i), reference->BottomLevel(i));
+		}
+		out << "Tracer startup over all inputs, " << name << ": " << seconds * 1000.0 << " ms, " << Check(identical, "bottom levels match", "BOTTOM LEVELS DIFFER") << "\n";
+		if (!reference) reference = std::move(tracer);
+	}
+	std::filesystem::remove_all(directory, error);
+}
+
+void Benchmark::ShadowRays(std::ostream& out)
+{
+	const uint32_t width = CpuRaytracer::DEFAULT_WIDTH, height = CpuRaytracer::DEFAULT_HEIGHT;
+	out << "== Shadow rays (TraceAny vs TraceClosest toward PlaneHit's light from every primary hit of " << width << "x" << height << ", 1 thread) ==\n";
+	const std::vector<SceneInput> inputs = TracerScenes();
+
+	// Best of three passes, the answers of the last pass are kept for the comparison
+	auto trace = [](const std::vector<CpuRay>& rays, std::vector<bool>& occluded, auto&& query) {
+		occluded.assign(rays.size(), false);
+		return (double)rays.size() / BestOfThreeSeconds([&]() {
+			for (size_t i = 0; i < rays.size(); i++) occluded[i] = query(rays[i]);
+		});
+	};
+
+	const std::pair<const char*, CpuBvhLayout> layouts[] = {
+		{ "binary", CpuBvhLayout::Binary }, { "4 wide", CpuBvhLayout::Wide4 }, { "8 wide", CpuBvhLayout::Wide8 }, { "quantized", CpuBvhLayout::Quantized4 } };
+	for (const SceneInput& input : inputs) {
+		// Occluded and unoccluded rays are timed apart, only the first can end early
+		std::vector<CpuRay> rays[2];
+		for (const auto& [name, layout] : layouts) {
+			const CpuRaytracer tracer(input.scene, {}, nullptr, layout);
+			if (rays[0].empty() && rays[1].empty()) {
+				for (const CpuRay& ray : ShadowRaysFrom(tracer, width, height)) {
+					CpuHit hit;
+					rays[tracer.TraceClosest(ray, 0xFF, hit) ? 1 : 0].push_back(ray);
+				}
+			}
+			out << input.name << " " << name << ":";
+			bool matches = true;
+			for (int occluded = 1; occluded >= 0; occluded--) {
+				std::vector<bool> closestOccluded, anyOccluded;
+				const double closestRate = trace(rays[occluded], closestOccluded, [&](const CpuRay& ray) { CpuHit hit; return tracer.TraceClosest(ray, 0xFF, hit); });
+				const double anyRate = trace(rays[occluded], anyOccluded, [&](const CpuRay& ray) { return tracer.TraceAny(ray, 0xFF); });
+				matches = matches && anyOccluded == closestOccluded && std::count(anyOccluded.begin(), anyOccluded.end(), !occluded) == 0;
+				out << (occluded ? " " : ", ") << rays[occluded].size() << (occluded ? " occluded" : " unoccluded") << " rays closest " << closestRate / 1.0e6
+					<< " Mrays/s, any " << anyRate / 1.0e6 << " Mrays/s x" << anyRate / closestRate;
+				if (layout != CpuBvhLayout::Binary) continue;
+
+				// Timing is noisy, the box and triangle tests of the binary bottom levels are exact
+				uint64_t closestSteps = 0, anySteps = 0;
+				for (const CpuRay& ray : rays[occluded]) {
+					for (uint32_t i = 0; i < tracer.TopLevel().InstanceCount(); i++) {
+						const TopLevelInstance& instance = tracer.TopLevel().Instance(i);
+						const DirectX::XMMATRIX worldToObject = DirectX::XMLoadFloat3x4(&instance.inverse);
+						DirectX::XMFLOAT3 origin, direction;
+						DirectX::XMStoreFloat3(&origin, DirectX::XMVector3TransformCoord(DirectX::XMLoadFloat3(&ray.origin), worldToObject));
+						DirectX::XMStoreFloat3(&direction, DirectX::XMVector3TransformNormal(DirectX::XMLoadFloat3(&ray.direction), worldToObject));
+						CountTraversalSteps(tracer.BottomLevel(instance.bottomLevel), origin, direction, closestSteps, closestSteps, ray.tMin);
+						CountOcclusionSteps(tracer.BottomLevel(instance.bottomLevel), origin, direction, ray.tMin, anySteps, anySteps);
+					}
+				}
+				const double rayCount = (double)(std::max)(rays[occluded].size(), (size_t)1);
+				out << " (" << closestSteps / rayCount << " vs " << anySteps / rayCount << " tests/ray over every instance)";
+			}
+			out << ", " << Check(matches, "answers match closest hit", "ANSWERS DIFFER FROM CLOSEST HIT") << "\n";
+		}
+	}
+
+	ShadowMaskChecks(out, width, height);
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include "Utility.h"
+
+namespace Dx12MasterProject {
+
+	//Headless performance suite, launched with the -benchmark command line switch instead of opening the renderer.
+	//Results are written to the output file and echoed to the debugger output window. Every correctness check in the
+	//report counts, RunAll returns non zero when one of them failed.
+	namespace Benchmark {
+		int RunAll(const std::string& outputPath);
+		//The deterministic correctness checks alone, no timings, launched with -test. Non zero when one failed.
+		int RunTests(const std::string& outputPath);
+
+		void MeshCacheTests(std::ostream& out);
+		void CompactVertexTests(std::ostream& out);
+		void MeshletTests(std::ostream& out);
+		void LodTests(std::ostream& out);
+		void SceneGraphTests(std::ostream& out);
+		void AsyncLoadTests(std::ostream& out);
+		void BvhBuildTests(std::ostream& out);
+		void BvhTraversalTests(std::ostream& out);
+		void TopLevelTests(std::ostream& out);
+		void BvhCacheTests(std::ostream& out);
+		void ShadowRayTests(std::ostream& out);
+
+		void ModelLoad(std::ostream& out);
+		void ImportIOSystem(std::ostream& out);
+		void MeshProcessingScaling(std::ostream& out);
+		void VertexWelding(std::ostream& out);
+		void MeshOptimization(std::ostream& out);
+		void CompactVertexError(std::ostream& out);
+		void MeshletGeneration(std::ostream& out);
+		void LodGeneration(std::ostream& out);
+		void SceneFlattening(std::ostream& out);
+		void AsyncModelLoading(std::ostream& out);
+		void AssetCooking(std::ostream& out);
+		void BoundsComputation(std::ostream& out);
+		void CpuRaytracing(std::ostream& out);
+		void BvhConstruction(std::ostream& out);
+		void WideBvhTraversal(std::ostream& out);
+		void PacketTracing(std::ostream& out);
+		void LinearBvhConstruction(std::ostream& out);
+		void TopLevelRefit(std::ostream& out);
+		void SpatialSplits(std::ostream& out);
+		void QuantizedBvhTraversal(std::ostream& out);
+		void BvhCacheStartup(std::ostream& out);
+		void ShadowRays(std::ostream& out);
+	}
+}
@@ -0,0 +1,73 @@
+#include "Bounds.h"
+
+using namespace Dx12MasterProject;
+
+namespace {
+	static_assert(offsetof(vertexConsts, pos) == 0 && sizeof(vertexConsts) >= sizeof(DirectX::XMFLOAT4), "pos must be loadable as a float4");
+
+	//Loads pos with a single 16 byte load, the 4th lane picks up norm.x and is never used.
+	DirectX::XMVECTOR LoadPosition(const vertexConsts& vertex)
+	{
+		return DirectX::XMLoadFloat4(reinterpret_cast<const DirectX::XMFLOAT4*>(&vertex.pos));
+	}
+}
+
+DirectX::BoundingBox Bounds::ComputeBox(std::span<const vertexConsts> vertices)
+{
+	if (vertices.empty()) return DirectX::BoundingBox(DirectX::XMFLOAT3(0.0f, 0.0f, 0.0f), DirectX::XMFLOAT3(0.0f, 0.0f, 0.0f));
+
+	DirectX::XMVECTOR first = LoadPosition(vertices[0]);
+	DirectX::XMVECTOR minPos[4] = { first, first, first, first };
+	DirectX::XMVECTOR maxPos[4] = { first, first, first, first };
+
+	size_t i = 0;
+	for (; i + 4 <= vertices.size(); i += 4) {
+		for (size_t lane = 0; lane < 4; lane++) {
+			const DirectX::XMVECTOR position = LoadPosition(vertices[i + lane]);
+			minPos[lane] = DirectX::XMVectorMin(minPos[lane], position);
+			maxPos[lane] = DirectX::XMVectorMax(maxPos[lane], position);
+		}
+	}
+	for (; i < vertices.size(); i++) {
+		const DirectX::XMVECTOR position = LoadPosition(vertices[i]);
+		minPos[0] = DirectX::XMVectorMin(minPos[0], position);
+		maxPos[0] = DirectX::XMVectorMax(maxPos[0], position);
+	}
+
+	const DirectX::XMVECTOR boxMin = DirectX::XMVectorMin(DirectX::XMVectorMin(minPos[0], minPos[1]), DirectX::XMVectorMin(minPos[2], minPos[3]));
+	const DirectX::XMVECTOR boxMax = DirectX::XMVectorMax(DirectX::XMVectorMax(maxPos[0], maxPos[1]), DirectX::XMVectorMax(maxPos[2], maxPos[3]));
+	DirectX::BoundingBox box;
+	DirectX::XMStoreFloat3(&box.Center, DirectX::XMVectorScale(DirectX::XMVectorAdd(boxMin, boxMax), 0.5f));
+	DirectX::XMStoreFloat3(&box.Extents, DirectX::XMVectorScale(DirectX::XMVectorSubtract(boxMax, boxMin), 0.5f));
+	return box;
+}
+
+DirectX::BoundingSphere Bounds::ComputeSphere(std::span<const vertexConsts> vertices, const DirectX::BoundingBox& box)
+{
+	const DirectX::XMVECTOR center = DirectX::XMLoadFloat3(&box.Center);
+	DirectX::XMVECTOR maxDistanceSq[4] = { DirectX::XMVectorZero(), DirectX::XMVectorZero(), DirectX::XMVectorZero(), DirectX::XMVectorZero() };
+
+	size_t i = 0;
+	for (; i + 4 <= vertices.size(); i += 4) {
+		for (size_t lane = 0; lane < 4; lane++) {
+			const DirectX::XMVECTOR offset = DirectX::XMVectorSubtract(LoadPosition(vertices[i + lane]), center);
+			maxDistanceSq[lane] = DirectX::XMVectorMax(maxDistanceSq[lane], DirectX::XMVector3LengthSq(offset));
+		}
+	}
+	for (; i < vertices.size(); i++) {
+		const DirectX::XMVECTOR offset = DirectX::XMVectorSubtract(LoadPosition(vertices[i]), center);
+		maxDistanceSq[0] = DirectX::XMVectorMax(maxDistanceSq[0], DirectX::XMVector3LengthSq(offset));
+	}
+
+	const DirectX::XMVECTOR distanceSq = DirectX::XMVectorMax(DirectX::XMVectorMax(maxDistanceSq[0], maxDistanceSq[1]), DirectX::XMVectorMax(maxDistanceSq[2], maxDistanceSq[3]));
+	// Rounding in the distance must not leave the furthest vertex a hair outside
+	const float radius = DirectX::XMVectorGetX(DirectX::XMVectorSqrt(distanceSq)) * (1.0f + FLT_EPSILON);
+	return DirectX::BoundingSphere(box.Center, radius);
+}
+
+DirectX::BoundingBox Bounds::TransformBox(const DirectX::BoundingBox& box, const DirectX::XMFLOAT4X4& world)
+{
+	DirectX::BoundingBox transformed;
+	box.Transform(transformed, DirectX::XMLoadFloat4x4(&world));
+	return transformed;
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include "Utility.h"
+#include "FrameResource.h"
+#include <span>
+
+namespace Dx12MasterProject {
+
+	namespace Bounds {
+		//Axis aligned box of the positions. Four vertices per iteration into independent min/max accumulators so the
+		//reduction is bound by loads rather than by the latency of one dependency chain. Empty input gives a zero box.
+		DirectX::BoundingBox ComputeBox(std::span<const vertexConsts> vertices);
+
+		//Sphere around the box center with the radius of the furthest position, one more vectorized pass. Never larger
+		//than the sphere through the box corners.
+		DirectX::BoundingSphere ComputeSphere(std::span<const vertexConsts> vertices, const DirectX::BoundingBox& box);
+
+		//Box of a box transformed by a row vector world matrix, what a render item is culled against.
+		DirectX::BoundingBox TransformBox(const DirectX::BoundingBox& box, const DirectX::XMFLOAT4X4& world);
+	}
+}
@@ -0,0 +1,1920 @@
+#include "Bvh.h"
+#include <DirectXPackedVector.h>
+#include <bit>
+#include <cfloat>
+#include <cmath>
+
+using namespace Dx12MasterProject;
+
+namespace {
+	constexpr uint32_t MAX_BINS = 64;
+	constexpr uint32_t PARALLEL_CHUNK = 4096; // primitives per task when a large node is reduced in parallel
+	// Past this depth nodes are halved by count, which reaches single leaves within 32 more levels for any input size
+	constexpr uint32_t MEDIAN_SPLIT_DEPTH = Bvh::MAX_DEPTH - 32;
+
+	struct Aabb {
+		float min[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+		float max[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+		void Grow(const float point[3]) {
+			for (int axis = 0; axis < 3; axis++) {
+				min[axis] = (std::min)(min[axis], point[axis]);
+				max[axis] = (std::max)(max[axis], point[axis]);
+			}
+		}
+		void Grow(const Aabb& other) {
+			for (int axis = 0; axis < 3; axis++) {
+				min[axis] = (std::min)(min[axis], other.min[axis]);
+				max[axis] = (std::max)(max[axis], other.max[axis]);
+			}
+		}
+		void Clip(const Aabb& other) {
+			for (int axis = 0; axis < 3; axis++) {
+				min[axis] = (std::max)(min[axis], other.min[axis]);
+				max[axis] = (std::min)(max[axis], other.max[axis]);
+			}
+		}
+		bool Empty() const { return min[0] > max[0] || min[1] > max[1] || min[2] > max[2]; }
+		//Half the surface area, the SAH only ever compares ratios of it.
+		float HalfArea() const {
+			if (min[0] > max[0]) return 0.0f;
+			const float dx = max[0] - min[0], dy = max[1] - min[1], dz = max[2] - min[2];
+			return dx * dy + dy * dz + dz * dx;
+		}
+	};
+
+	struct BuildPrimitive {
+		Aabb bounds;
+		float centroid[3];
+		BvhPrimitive reference;
+	};
+
+	struct BuildNode {
+		Aabb bounds;
+		uint32_t children[2] = { 0, 0 };
+		uint32_t begin = 0;
+		uint32_t count = 0; // 0 for interior nodes
+	};
+
+	struct Bin {
+		Aabb bounds;
+		uint32_t count = 0;
+	};
+
+	const float* Position(const BvhGeometryDesc& geometry, uint32_t vertex)
+	{
+		return reinterpret_cast<const float*>(static_cast<const uint8_t*>(geometry.vertices) + (size_t)vertex * geometry.vertexStride);
+	}
+
+	//Bounds and centroids of the triangles in geometry order, triangles with invalid indices or non finite positions
+	//are left out.
+	std::vector<BuildPrimitive> GatherPrimitives(std::span<const BvhGeometryDesc> geometries, ThreadPool& pool)
+	{
+		std::vector<uint32_t> firstPrimitive(geometries.size() + 1, 0);
+		for (size_t g = 0; g < geometries.size(); g++) firstPrimitive[g + 1] = firstPrimitive[g] + geometries[g].indexCount / 3;
+
+		std::vector<BuildPrimitive> primitives(firstPrimitive.back());
+		std::vector<uint8_t> active(primitives.size(), 0);
+		const uint32_t chunkCount = (uint32_t)((primitives.size() + PARALLEL_CHUNK - 1) / PARALLEL_CHUNK);
+		pool.ParallelFor(chunkCount, [&](uint32_t chunk) {
+			const uint32_t end = (std::min)((chunk + 1) * PARALLEL_CHUNK, (uint32_t)primitives.size());
+			uint32_t g = (uint32_t)(std::upper_bound(firstPrimitive.begin(), firstPrimitive.end(), chunk * PARALLEL_CHUNK) - firstPrimitive.begin()) - 1;
+			for (uint32_t i = chunk * PARALLEL_CHUNK; i < end; i++) {
+				while (i >= firstPrimitive[g + 1]) g++;
+				const BvhGeometryDesc& geometry = geometries[g];
+				const uint32_t triangle = i - firstPrimitive[g];
+				BuildPrimitive& primitive = primitives[i];
+				primitive.reference = { g, triangle };
+				bool valid = true;
+				for (uint32_t corner = 0; corner < 3; corner++) {
+					const uint32_t vertex = geometry.indices[triangle * 3 + corner];
+					if (vertex >= geometry.vertexCount) {
+						valid = false;
+						break;
+					}
+					const float* position = Position(geometry, vertex);
+					valid &= std::isfinite(position[0]) && std::isfinite(position[1]) && std::isfinite(position[2]);
+					primitive.bounds.Grow(position);
+				}
+				if (!valid) continue;
+				for (int axis = 0; axis < 3; axis++) primitive.centroid[axis] = (primitive.bounds.min[axis] + primitive.bounds.max[axis]) * 0.5f;
+				active[i] = 1;
+			}
+		});
+		size_t kept = 0;
+		for (size_t i = 0; i < primitives.size(); i++) {
+			if (active[i]) primitives[kept++] = primitives[i];
+		}
+		primitives.resize(kept);
+		return primitives;
+	}
+
+	BvhTriangle MakeTriangle(std::span<const BvhGeometryDesc> geometries, const BvhPrimitive& reference)
+	{
+		const BvhGeometryDesc& geometry = geometries[reference.geometry];
+		const float* p0 = Position(geometry, geometry.indices[reference.primitive * 3 + 0]);
+		const float* p1 = Position(geometry, geometry.indices[reference.primitive * 3 + 1]);
+		const float* p2 = Position(geometry, geometry.indices[reference.primitive * 3 + 2]);
+		return BvhTriangle{ DirectX::XMFLOAT3(p0[0], p0[1], p0[2]),
+			DirectX::XMFLOAT3(p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]), DirectX::XMFLOAT3(p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]) };
+	}
+
+	struct SplitCandidate {
+		float cost = FLT_MAX; // left area * left count + right area * right count, not yet divided by the parent's area
+		int axis = -1; // -1 when no boundary puts references on both sides
+		uint32_t split = 0; // first bin of the right side
+	};
+
+	//Sweeps the bins of every axis with a non zero scale from the right storing the cost terms, then from the left
+	//evaluating every boundary. leftCount and rightCount are the references a bin adds to either side, the same for
+	//object bins but entries and exits for spatial ones.
+	template<typename BinType, typename LeftCount, typename RightCount>
+	SplitCandidate SweepBins(const std::vector<BinType>& binned, uint32_t binCount, const float scale[3], LeftCount&& leftCount, RightCount&& rightCount)
+	{
+		SplitCandidate best;
+		for (int axis = 0; axis < 3; axis++) {
+			if (scale[axis] == 0.0f) continue;
+			const BinType* bins = binned.data() + axis * binCount;
+			float rightCost[MAX_BINS];
+			uint32_t rightCounts[MAX_BINS];
+			Aabb rightBounds;
+			uint32_t right = 0;
+			for (uint32_t i = binCount - 1; i > 0; i--) {
+				rightBounds.Grow(bins[i].bounds);
+				right += rightCount(bins[i]);
+				rightCost[i] = rightBounds.HalfArea() * (float)right;
+				rightCounts[i] = right;
+			}
+			Aabb leftBounds;
+			uint32_t left = 0;
+			for (uint32_t split = 1; split < binCount; split++) {
+				leftBounds.Grow(bins[split - 1].bounds);
+				left += leftCount(bins[split - 1]);
+				if (left == 0 || rightCounts[split] == 0) continue;
+				const float cost = leftBounds.HalfArea() * (float)left + rightCost[split];
+				if (cost < best.cost) {
+					best.cost = cost;
+					best.axis = axis;
+					best.split = split;
+				}
+			}
+		}
+		return best;
+	}
+
+	//Bounds of the bins either side of a split.
+	template<typename BinType>
+	void SplitBounds(const std::vector<BinType>& binned, uint32_t binCount, const SplitCandidate& split, Aabb& left, Aabb& right)
+	{
+		const BinType* bins = binned.data() + split.axis * binCount;
+		for (uint32_t i = 0; i < split.split; i++) left.Grow(bins[i].bounds);
+		for (uint32_t i = split.split; i < binCount; i++) right.Grow(bins[i].bounds);
+	}
+
+	uint32_t ObjectBinIndex(const BuildPrimitive& primitive, int axis, const Aabb& centroidBounds, float scale, uint32_t binCount)
+	{
+		const int bin = (int)((primitive.centroid[axis] - centroidBounds.min[axis]) * scale);
+		return (uint32_t)(std::min)((std::max)(bin, 0), (int)binCount - 1);
+	}
+
+	//Binning and partitioning of one node range, shared by every task of a build.
+	class Builder
+	{
+	public:
+		Builder(const BvhBuildSettings& settings, ThreadPool& pool, std::vector<BuildPrimitive>& primitives) :
+			mSettings(settings), mPool(pool), mPrimitives(primitives), mNodes((std::max)(primitives.size() * 2, (size_t)1))
+		{
+			mBinCount = (std::min)((std::max)(settings.binCount, 2u), MAX_BINS);
+			mMaxLeafSize = (std::max)(settings.maxLeafSize, 1u);
+		}
+
+		void BuildRoot() {
+			mNodeCount = 1;
+			Build(0, 0, (uint32_t)mPrimitives.size(), 0);
+		}
+
+		const std::vector<BuildNode>& Nodes() const { return mNodes; }
+
+	private:
+		//Reduces [begin, begin + count) chunk by chunk, in parallel for large ranges. Chunks are merged in order so
+		//the result is the same however the chunks were scheduled.
+		template<typename Result, typename Accumulate, typename Merge>
+		Result Reduce(uint32_t begin, uint32_t count, const Result& identity, Accumulate&& accumulate, Merge&& merge) {
+			if (count < mSettings.parallelThreshold) {
+				Result result = identity;
+				for (uint32_t i = begin; i < begin + count; i++) accumulate(result, mPrimitives[i]);
+				return result;
+			}
+			const uint32_t chunkCount = (count + PARALLEL_CHUNK - 1) / PARALLEL_CHUNK;
+			std::vector<Result> partial(chunkCount, identity);
+			mPool.ParallelFor(chunkCount, [&](uint32_t chunk) {
+				const uint32_t end = (std::min)(begin + (chunk + 1) * PARALLEL_CHUNK, begin + count);
+				for (uint32_t i = begin + chunk * PARALLEL_CHUNK; i < end; i++) accumulate(partial[chunk], mPrimitives[i]);
+			});
+			for (uint32_t chunk = 1; chunk < chunkCount; chunk++) merge(partial[0], partial[chunk]);
+			return partial[0];
+		}
+
+		void MakeLeaf(BuildNode& node, uint32_t begin, uint32_t count) {
+			node.begin = begin;
+			node.count = count;
+		}
+
+		void Build(uint32_t nodeIndex, uint32_t begin, uint32_t count, uint32_t depth) {
+			BuildNode& node = mNodes[nodeIndex];
+			struct Extents {
+				Aabb bounds;
+				Aabb centroids;
+			};
+			const Extents extents = Reduce(begin, count, Extents(),
+				[](Extents& result, const BuildPrimitive& primitive) { result.bounds.Grow(primitive.bounds); result.centroids.Grow(primitive.centroid); },
+				[](Extents& result, const Extents& other) { result.bounds.Grow(other.bounds); result.centroids.Grow(other.centroids); });
+			node.bounds = extents.bounds;
+			if (count <= 1) {
+				MakeLeaf(node, begin, count);
+				return;
+			}
+
+			uint32_t leftCount = 0;
+			if (depth < MEDIAN_SPLIT_DEPTH) leftCount = SahPartition(node, begin, count, extents.centroids);
+			if (leftCount == 0) {
+				if (count <= mMaxLeafSize) {
+					MakeLeaf(node, begin, count);
+					return;
+				}
+				// Coincident centroids or a very deep branch, halving keeps the leaves within their size limit
+				leftCount = count / 2;
+			}
+
+			const uint32_t left = mNodeCount.fetch_add(2, std::memory_order_relaxed);
+			node.children[0] = left;
+			node.children[1] = left + 1;
+			if (count >= mSettings.parallelThreshold) {
+				std::atomic<uint32_t> pending = 1;
+				mPool.Enqueue([&, left, begin, leftCount, depth]() {
+					Build(left, begin, leftCount, depth + 1);
+					pending.fetch_sub(1, std::memory_order_release);
+				});
+				Build(left + 1, begin + leftCount, count - leftCount, depth + 1);
+				mPool.WaitFor(pending);
+			}
+			else {
+				Build(left, begin, leftCount, depth + 1);
+				Build(left + 1, begin + leftCount, count - leftCount, depth + 1);
+			}
+		}
+
+		//Partitions the range at the cheapest bin boundary and returns the size of the left half, 0 when a leaf is
+		//cheaper or no boundary separates the centroids.
+		uint32_t SahPartition(const BuildNode& node, uint32_t begin, uint32_t count, const Aabb& centroidBounds) {
+			// Small nodes get no more bins than triangles, clearing and sweeping unused bins dominated their cost
+			const uint32_t binCount = (std::min)(mBinCount, count);
+			float scale[3];
+			for (int axis = 0; axis < 3; axis++) {
+				const float extent = centroidBounds.max[axis] - centroidBounds.min[axis];
+				scale[axis] = extent > 0.0f ? (float)binCount * (1.0f - 1.0e-6f) / extent : 0.0f;
+			}
+
+			const std::vector<Bin> binned = Reduce(begin, count, std::vector<Bin>(3 * binCount),
+				[&](std::vector<Bin>& result, const BuildPrimitive& primitive) {
+					for (int axis = 0; axis < 3; axis++) {
+						if (scale[axis] == 0.0f) continue;
+						Bin& bin = result[axis * binCount + ObjectBinIndex(primitive, axis, centroidBounds, scale[axis], binCount)];
+						bin.bounds.Grow(primitive.bounds);
+						bin.count++;
+					}
+				},
+				[&](std::vector<Bin>& result, const std::vector<Bin>& other) {
+					for (size_t i = 0; i < result.size(); i++) {
+						result[i].bounds.Grow(other[i].bounds);
+						result[i].count += other[i].count;
+					}
+				});
+
+			const auto binCountOf = [](const Bin& bin) { return bin.count; };
+			const SplitCandidate best = SweepBins(binned, binCount, scale, binCountOf, binCountOf);
+			if (best.axis < 0) return 0;
+			const float parentArea = (std::max)(node.bounds.HalfArea(), FLT_MIN);
+			const float splitCost = mSettings.traversalCost + mSettings.intersectionCost * best.cost / parentArea;
+			const float leafCost = mSettings.intersectionCost * (float)count;
+			if (count <= mMaxLeafSize && leafCost <= splitCost) return 0;
+
+			BuildPrimitive* first = mPrimitives.data() + begin;
+			BuildPrimitive* middle = std::partition(first, first + count, [&](const BuildPrimitive& primitive) {
+				return ObjectBinIndex(primitive, best.axis, centroidBounds, scale[best.axis], binCount) < best.split;
+			});
+			return (uint32_t)(middle - first);
+		}
+
+		const BvhBuildSettings& mSettings;
+		ThreadPool& mPool;
+		std::vector<BuildPrimitive>& mPrimitives;
+		std::vector<BuildNode> mNodes;
+		std::atomic<uint32_t> mNodeCount = 0;
+		uint32_t mBinCount = 16;
+		uint32_t mMaxLeafSize = 4;
+	};
+
+	//Depth first copy of the build tree with every first child placed right after its parent. Box builds pass no
+	//geometries and get no triangles.
+	uint32_t Flatten(const std::vector<BuildNode>& buildNodes, uint32_t index, const std::vector<BuildPrimitive>& buildPrimitives,
+		std::span<const BvhGeometryDesc> geometries, Bvh& bvh)
+	{
+		const BuildNode& source = buildNodes[index];
+		const uint32_t flatIndex = (uint32_t)bvh.nodes.size();
+		BvhNode& node = bvh.nodes.emplace_back();
+		node.boundsMin = DirectX::XMFLOAT3(source.bounds.min[0], source.bounds.min[1], source.bounds.min[2]);
+		node.boundsMax = DirectX::XMFLOAT3(source.bounds.max[0], source.bounds.max[1], source.bounds.max[2]);
+		node.count = source.count;
+
+		if (source.count != 0) {
+			node.offset = (uint32_t)bvh.primitives.size();
+			for (uint32_t i = source.begin; i < source.begin + source.count; i++) {
+				bvh.primitives.push_back(buildPrimitives[i].reference);
+				if (!geometries.empty()) bvh.triangles.push_back(MakeTriangle(geometries, buildPrimitives[i].reference));
+			}
+			return flatIndex;
+		}
+
+		Flatten(buildNodes, source.children[0], buildPrimitives, geometries, bvh);
+		const uint32_t second = Flatten(buildNodes, source.children[1], buildPrimitives, geometries, bvh);
+		bvh.nodes[flatIndex].offset = second;
+		return flatIndex;
+	}
+
+	struct SpatialBin {
+		Aabb bounds;
+		uint32_t entries = 0; // references whose box starts in the bin
+		uint32_t exits = 0; // references whose box ends in the bin
+	};
+
+	//Boxes of the parts of a reference's triangle either side of the plane, each clipped to the reference's box so
+	//references that were split before stay within their earlier cuts.
+	void SplitReference(std::span<const BvhGeometryDesc> geometries, const BuildPrimitive& reference, int axis, float plane, Aabb& left, Aabb& right)
+	{
+		const BvhGeometryDesc& geometry = geometries[reference.reference.geometry];
+		const float* corners[3];
+		for (uint32_t corner = 0; corner < 3; corner++) corners[corner] = Position(geometry, geometry.indices[reference.reference.primitive * 3 + corner]);
+		for (uint32_t edge = 0; edge < 3; edge++) {
+			const float* v0 = corners[edge];
+			const float* v1 = corners[(edge + 1) % 3];
+			if (v0[axis] <= plane) left.Grow(v0);
+			if (v0[axis] >= plane) right.Grow(v0);
+			if ((v0[axis] < plane && v1[axis] > plane) || (v0[axis] > plane && v1[axis] < plane)) {
+				const float t = (plane - v0[axis]) / (v1[axis] - v0[axis]);
+				float crossing[3];
+				for (int component = 0; component < 3; component++) crossing[component] = v0[component] + (v1[component] - v0[component]) * t;
+				crossing[axis] = plane;
+				left.Grow(crossing);
+				right.Grow(crossing);
+			}
+		}
+		left.Clip(reference.bounds);
+		right.Clip(reference.bounds);
+	}
+
+	//Split BVH (Stich, Friedrich and Dietrich 2009): next to the binned object split, nodes whose object split children
+	//overlap also bin spatially, cutting the triangles that straddle a plane so each child only bounds its part. Large
+	//triangles among small ones then stop inflating every box they pass through, at the price of references that
+	//appear in more than one leaf. Straddling references are kept whole on one side where that is cheaper (reference
+	//unsplitting). Each node hands the duplication budget it did not use to its children in proportion to their
+	//references, so the result does not depend on the thread count.
+	class SpatialBuilder
+	{
+	public:
+		SpatialBuilder(const BvhBuildSettings& settings, ThreadPool& pool, std::span<const BvhGeometryDesc> geometries, uint32_t triangleCount) :
+			mSettings(settings), mPool(pool), mGeometries(geometries)
+		{
+			mBinCount = (std::min)((std::max)(settings.binCount, 2u), MAX_BINS);
+			mMaxLeafSize = (std::max)(settings.maxLeafSize, 1u);
+			mBudget = (uint32_t)((double)triangleCount * (std::max)(settings.spatialSplitBudget, 0.0f));
+			mReferences.resize((size_t)triangleCount + mBudget);
+			mNodes.resize((std::max)(mReferences.size() * 2, (size_t)1));
+		}
+
+		void BuildRoot(std::vector<BuildPrimitive>&& primitives) {
+			Aabb bounds;
+			for (const BuildPrimitive& primitive : primitives) bounds.Grow(primitive.bounds);
+			mRootArea = (std::max)(bounds.HalfArea(), FLT_MIN);
+			mNodeCount = 1;
+			Build(0, std::move(primitives), mBudget, 0);
+			mReferences.resize(mReferenceCount);
+		}
+
+		const std::vector<BuildNode>& Nodes() const { return mNodes; }
+		//Leaf references, BuildNode::begin indexes them.
+		const std::vector<BuildPrimitive>& References() const { return mReferences; }
+
+	private:
+		void Build(uint32_t nodeIndex, std::vector<BuildPrimitive> references, uint32_t budget, uint32_t depth) {
+			BuildNode& node = mNodes[nodeIndex];
+			Aabb centroids;
+			for (const BuildPrimitive& reference : references) {
+				node.bounds.Grow(reference.bounds);
+				centroids.Grow(reference.centroid);
+			}
+			const uint32_t count = (uint32_t)references.size();
+			std::vector<BuildPrimitive> left, right;
+			if (count > 1 && depth < MEDIAN_SPLIT_DEPTH) Split(node, references, centroids, budget, left, right);
+			if (left.empty()) {
+				if (count <= mMaxLeafSize) {
+					node.begin = mReferenceCount.fetch_add(count, std::memory_order_relaxed);
+					node.count = count;
+					std::copy(references.begin(), references.end(), mReferences.begin() + node.begin);
+					return;
+				}
+				// Coincident centroids or a very deep branch, halving keeps the leaves within their size limit
+				left.assign(references.begin(), references.begin() + count / 2);
+				right.assign(references.begin() + count / 2, references.end());
+			}
+			references = std::vector<BuildPrimitive>();
+
+			// What this node's split did not duplicate is shared out by reference count
+			const uint32_t duplicates = (uint32_t)(left.size() + right.size()) - count;
+			const uint32_t remaining = budget - duplicates;
+			const uint32_t leftBudget = (uint32_t)((uint64_t)remaining * left.size() / (left.size() + right.size()));
+			const uint32_t first = mNodeCount.fetch_add(2, std::memory_order_relaxed);
+			node.children[0] = first;
+			node.children[1] = first + 1;
+			if (count >= mSettings.parallelThreshold) {
+				std::atomic<uint32_t> pending = 1;
+				mPool.Enqueue([&, first, leftBudget, depth, left = std::move(left)]() mutable {
+					Build(first, std::move(left), leftBudget, depth + 1);
+					pending.fetch_sub(1, std::memory_order_release);
+				});
+				Build(first + 1, std::move(right), remaining - leftBudget, depth + 1);
+				mPool.WaitFor(pending);
+			}
+			else {
+				Build(first, std::move(left), leftBudget, depth + 1);
+				Build(first + 1, std::move(right), remaining - leftBudget, depth + 1);
+			}
+		}
+
+		//Fills left and right with the cheapest split, leaves them empty when a leaf is cheaper or nothing separates
+		//the references.
+		void Split(const BuildNode& node, std::vector<BuildPrimitive>& references, const Aabb& centroidBounds, uint32_t budget,
+			std::vector<BuildPrimitive>& left, std::vector<BuildPrimitive>& right) {
+			const uint32_t count = (uint32_t)references.size();
+			const uint32_t binCount = (std::min)(mBinCount, count);
+			float scale[3];
+			for (int axis = 0; axis < 3; axis++) {
+				const float extent = centroidBounds.max[axis] - centroidBounds.min[axis];
+				scale[axis] = extent > 0.0f ? (float)binCount * (1.0f - 1.0e-6f) / extent : 0.0f;
+			}
+			std::vector<Bin> objectBins(3 * binCount);
+			for (const BuildPrimitive& reference : references) {
+				for (int axis = 0; axis < 3; axis++) {
+					if (scale[axis] == 0.0f) continue;
+					Bin& bin = objectBins[axis * binCount + ObjectBinIndex(reference, axis, centroidBounds, scale[axis], binCount)];
+					bin.bounds.Grow(reference.bounds);
+					bin.count++;
+				}
+			}
+			const auto binCountOf = [](const Bin& bin) { return bin.count; };
+			const SplitCandidate object = SweepBins(objectBins, binCount, scale, binCountOf, binCountOf);
+
+			// Spatial splits only pay off where the object split leaves its children overlapping
+			SplitCandidate spatial;
+			float spatialScale[3] = { 0.0f, 0.0f, 0.0f };
+			std::vector<SpatialBin> spatialBins;
+			if (budget > 0 && object.axis >= 0) {
+				Aabb objectLeft, objectRight;
+				SplitBounds(objectBins, binCount, object, objectLeft, objectRight);
+				Aabb overlap = objectLeft;
+				overlap.Clip(objectRight);
+				if (!overlap.Empty() && overlap.HalfArea() > mSettings.spatialSplitOverlap * mRootArea) {
+					spatialBins = BinSpatially(references, node.bounds, spatialScale);
+					spatial = SweepBins(spatialBins, mBinCount, spatialScale,
+						[](const SpatialBin& bin) { return bin.entries; }, [](const SpatialBin& bin) { return bin.exits; });
+				}
+			}
+
+			const SplitCandidate& best = spatial.cost < object.cost ? spatial : object;
+			if (best.axis < 0) return;
+			const float parentArea = (std::max)(node.bounds.HalfArea(), FLT_MIN);
+			const float splitCost = mSettings.traversalCost + mSettings.intersectionCost * best.cost / parentArea;
+			const float leafCost = mSettings.intersectionCost * (float)count;
+			if (count <= mMaxLeafSize && leafCost <= splitCost) return;
+
+			if (&best == &spatial) {
+				PartitionSpatially(references, node.bounds, spatialBins, spatial, spatialScale, budget, left, right);
+				if (!left.empty() && !right.empty()) return;
+				// Clipping can leave one side without any reference, the object split still separates them
+				left.clear();
+				right.clear();
+				if (object.axis < 0) return;
+			}
+			for (const BuildPrimitive& reference : references) {
+				const bool isLeft = ObjectBinIndex(reference, object.axis, centroidBounds, scale[object.axis], binCount) < object.split;
+				(isLeft ? left : right).push_back(reference);
+			}
+		}
+
+		//First and last spatial bin the reference's box touches.
+		std::pair<uint32_t, uint32_t> BinRange(const BuildPrimitive& reference, int axis, const Aabb& bounds, float scale) const {
+			auto bin = [&](float position) { return (uint32_t)(std::min)((std::max)((int)((position - bounds.min[axis]) * scale), 0), (int)mBinCount - 1); };
+			return { bin(reference.bounds.min[axis]), bin(reference.bounds.max[axis]) };
+		}
+
+		float BinPlane(int axis, uint32_t split, const Aabb& bounds, float scale) const {
+			return bounds.min[axis] + (float)split / scale;
+		}
+
+		//Equal width bins over the node's box. Each reference is chopped at every bin boundary it crosses, the pieces
+		//grow the bins they fall in and the reference counts as entering its first bin and leaving its last.
+		std::vector<SpatialBin> BinSpatially(const std::vector<BuildPrimitive>& references, const Aabb& bounds, float scale[3]) const {
+			std::vector<SpatialBin> bins(3 * mBinCount);
+			for (int axis = 0; axis < 3; axis++) {
+				const float extent = bounds.max[axis] - bounds.min[axis];
+				scale[axis] = extent > 0.0f ? (float)mBinCount / extent : 0.0f;
+				if (scale[axis] == 0.0f) continue;
+				SpatialBin* axisBins = bins.data() + axis * mBinCount;
+				for (const BuildPrimitive& reference : references) {
+					const auto [first, last] = BinRange(reference, axis, bounds, scale[axis]);
+					BuildPrimitive piece = reference;
+					for (uint32_t bin = first; bin < last; bin++) {
+						Aabb below, above;
+						SplitReference(mGeometries, piece, axis, BinPlane(axis, bin + 1, bounds, scale[axis]), below, above);
+						axisBins[bin].bounds.Grow(below);
+						piece.bounds = above;
+					}
+					axisBins[last].bounds.Grow(piece.bounds);
+					axisBins[first].entries++;
+					axisBins[last].exits++;
+				}
+			}
+			return bins;
+		}
+
+		void PartitionSpatially(const std::vector<BuildPrimitive>& references, const Aabb& bounds, const std::vector<SpatialBin>& bins, const SplitCandidate& split,
+			const float scale[3], uint32_t budget, std::vector<BuildPrimitive>& left, std::vector<BuildPrimitive>& right) const {
+			const int axis = split.axis;
+			const float plane = BinPlane(axis, split.split, bounds, scale[axis]);
+			Aabb leftBounds, rightBounds;
+			SplitBounds(bins, mBinCount, split, leftBounds, rightBounds);
+			uint32_t leftCount = 0, rightCount = 0;
+			for (uint32_t i = 0; i < split.split; i++) leftCount += bins[axis * mBinCount + i].entries;
+			for (uint32_t i = split.split; i < mBinCount; i++) rightCount += bins[axis * mBinCount + i].exits;
+			const float leftArea = leftBounds.HalfArea(), rightArea = rightBounds.HalfArea();
+			const float splitCost = leftArea * (float)leftCount + rightArea * (float)rightCount;
+
+			uint32_t duplicates = 0;
+			for (const BuildPrimitive& reference : references) {
+				const auto [first, last] = BinRange(reference, axis, bounds, scale[axis]);
+				if (last < split.split) {
+					left.push_back(reference);
+					continue;
+				}
+				if (first >= split.split) {
+					right.push_back(reference);
+					continue;
+				}
+
+				BuildPrimitive below = reference, above = reference;
+				below.bounds = Aabb();
+				above.bounds = Aabb();
+				SplitReference(mGeometries, reference, axis, plane, below.bounds, above.bounds);
+				if (below.bounds.Empty() || above.bounds.Empty()) {
+					(above.bounds.Empty() ? left : right).push_back(reference);
+					continue;
+				}
+
+				// Keeping the reference whole on one side saves a duplicate where it grows that side's box little
+				Aabb leftWith = leftBounds, rightWith = rightBounds;
+				leftWith.Grow(reference.bounds);
+				rightWith.Grow(reference.bounds);
+				const float leftCost = leftWith.HalfArea() * (float)leftCount + rightArea * (float)(rightCount - 1);
+				const float rightCost = leftArea * (float)(leftCount - 1) + rightWith.HalfArea() * (float)rightCount;
+				if (duplicates < budget && splitCost <= leftCost && splitCost <= rightCost) {
+					for (int component = 0; component < 3; component++) {
+						below.centroid[component] = (below.bounds.min[component] + below.bounds.max[component]) * 0.5f;
+						above.centroid[component] = (above.bounds.min[component] + above.bounds.max[component]) * 0.5f;
+					}
+					left.push_back(below);
+					right.push_back(above);
+					duplicates++;
+				}
+				else {
+					(leftCost <= rightCost ? left : right).push_back(reference);
+				}
+			}
+		}
+
+		const BvhBuildSettings& mSettings;
+		ThreadPool& mPool;
+		std::span<const BvhGeometryDesc> mGeometries;
+		std::vector<BuildNode> mNodes;
+		std::vector<BuildPrimitive> mReferences;
+		std::atomic<uint32_t> mNodeCount = 0;
+		std::atomic<uint32_t> mReferenceCount = 0;
+		uint32_t mBudget = 0;
+		uint32_t mBinCount = 16;
+		uint32_t mMaxLeafSize = 4;
+		float mRootArea = 1.0f;
+	};
+
+	//Spreads the low 21 bits of value so two zero bits separate each of them.
+	uint64_t SpreadBits(uint64_t value)
+	{
+		value &= 0x1FFFFF;
+		value = (value | value << 32) & 0x1F00000000FFFF;
+		value = (value | value << 16) & 0x1F0000FF0000FF;
+		value = (value | value << 8) & 0x100F00F00F00F00F;
+		value = (value | value << 4) & 0x10C30C30C30C30C3;
+		value = (value | value << 2) & 0x1249249249249249;
+		return value;
+	}
+
+	//Stable LSD radix sort of keys and their values, 8 bits per pass. Chunks histogram their digits in parallel, a prefix
+	//sum in digit then chunk order gives every chunk its scatter offsets and the chunks scatter in parallel. Passes
+	//over a digit every key shares are skipped.
+	void RadixSort(std::vector<uint64_t>& keys, std::vector<uint32_t>& values, uint32_t keyBits, ThreadPool& pool)
+	{
+		const uint32_t count = (uint32_t)keys.size();
+		const uint32_t chunkCount = (count + PARALLEL_CHUNK - 1) / PARALLEL_CHUNK;
+		std::vector<uint64_t> sortedKeys(count);
+		std::vector<uint32_t> sortedValues(count);
+		std::vector<uint32_t> offsets((size_t)chunkCount * 256);
+		for (uint32_t shift = 0; shift < keyBits; shift += 8) {
+			std::fill(offsets.begin(), offsets.end(), 0);
+			pool.ParallelFor(chunkCount, [&](uint32_t chunk) {
+				uint32_t* histogram = &offsets[(size_t)chunk * 256];
+				const uint32_t end = (std::min)((chunk + 1) * PARALLEL_CHUNK, count);
+				for (uint32_t i = chunk * PARALLEL_CHUNK; i < end; i++) histogram[(keys[i] >> shift) & 0xFF]++;
+			});
+
+			uint32_t sum = 0;
+			bool shared = false;
+			for (uint32_t digit = 0; digit < 256; digit++) {
+				uint32_t digitCount = 0;
+				for (uint32_t chunk = 0; chunk < chunkCount; chunk++) {
+					uint32_t& offset = offsets[(size_t)chunk * 256 + digit];
+					const uint32_t chunkDigits = offset;
+					offset = sum;
+					sum += chunkDigits;
+					digitCount += chunkDigits;
+				}
+				shared |= digitCount == count;
+			}
+			if (shared) continue;
+
+			pool.ParallelFor(chunkCount, [&](uint32_t chunk) {
+				uint32_t* offset = &offsets[(size_t)chunk * 256];
+				const uint32_t end = (std::min)((chunk + 1) * PARALLEL_CHUNK, count);
+				for (uint32_t i = chunk * PARALLEL_CHUNK; i < end; i++) {
+					const uint32_t target = offset[(keys[i] >> shift) & 0xFF]++;
+					sortedKeys[target] = keys[i];
+					sortedValues[target] = values[i];
+				}
+			});
+			keys.swap(sortedKeys);
+			values.swap(sortedValues);
+		}
+	}
+
+	//Node of an LBVH under construction: internal nodes 0 to n - 2 with the root at 0, then one leaf per sorted primitive.
+	struct LinearNode {
+		Aabb bounds;
+		uint32_t children[2] = { 0, 0 };
+		uint32_t parent = UINT32_MAX;
+		uint32_t primitiveCount = 1;
+		float cost = 0.0f; // SAH cost of the subtree, in unnormalized area units
+		bool collapse = false; // the subtree is cheaper, or has to be, as a single leaf
+		uint32_t outputNodes = 1; // nodes the subtree flattens to
+	};
+
+	//Karras 2012: sorting by Morton code turns the hierarchy into a radix tree over the codes, every internal node
+	//finds its key range and split from its neighbours' codes alone, so all of them are emitted in parallel. Bounds and
+	//costs are then filled in bottom up, the second child to finish continues with the parent. The optional treelet
+	//pass (Karras and Aila 2013) rebuilds small treelets in their SAH optimal topology on the same bottom up walk.
+	class LinearBuilder
+	{
+	public:
+		LinearBuilder(const LinearBvhSettings& settings, ThreadPool& pool, std::vector<BuildPrimitive>& primitives) :
+			mSettings(settings), mPool(pool), mPrimitives(primitives), mCount((uint32_t)primitives.size())
+		{
+			mMaxLeafSize = (std::max)(settings.maxLeafSize, 1u);
+		}
+
+		void Build() {
+			SortByMortonCode();
+			mNodes.resize((size_t)mCount * 2 - 1);
+			const uint32_t chunkCount = (mCount + PARALLEL_CHUNK - 1) / PARALLEL_CHUNK;
+			mPool.ParallelFor(chunkCount, [&](uint32_t chunk) {
+				const uint32_t end = (std::min)((chunk + 1) * PARALLEL_CHUNK, mCount);
+				for (uint32_t i = chunk * PARALLEL_CHUNK; i < end; i++) {
+					LinearNode& leaf = mNodes[Leaf(i)];
+					leaf.bounds = mPrimitives[i].bounds;
+					leaf.cost = mSettings.intersectionCost * leaf.bounds.HalfArea();
+					if (i + 1 < mCount) EmitInternal((int)i);
+				}
+			});
+
+			BottomUp([&](uint32_t node) { Refit(node); });
+			// Later passes only restructure larger subtrees, the gain per pass shrinks while the work would not
+			for (uint32_t pass = 0; pass < mSettings.treeletPasses; pass++) {
+				const uint32_t minPrimitives = TREELET_SIZE << pass;
+				BottomUp([&](uint32_t node) {
+					Refit(node);
+					if (mNodes[node].primitiveCount >= minPrimitives) OptimizeTreelet(node);
+				});
+			}
+		}
+
+		//Depth first copy into the final layout. Subtree sizes are counted first, which places every subtree up front
+		//so large ones are written by separate tasks.
+		void Flatten(std::span<const BvhGeometryDesc> geometries, Bvh& bvh) {
+			const uint32_t nodeCount = Count(0, 1);
+			bvh.nodes.resize(nodeCount);
+			bvh.primitives.resize(mCount);
+			bvh.triangles.resize(mCount);
+			Place(0, 0, 0, geometries, bvh);
+		}
+
+	private:
+		static constexpr uint32_t TREELET_SIZE = 7;
+
+		uint32_t Leaf(uint32_t primitive) const { return mCount - 1 + primitive; }
+		bool IsLeaf(uint32_t node) const { return node >= mCount - 1; }
+
+		void SortByMortonCode() {
+			const uint32_t chunkCount = (mCount + PARALLEL_CHUNK - 1) / PARALLEL_CHUNK;
+			std::vector<Aabb> chunkBounds(chunkCount);
+			mPool.ParallelFor(chunkCount, [&](uint32_t chunk) {
+				const uint32_t end = (std::min)((chunk + 1) * PARALLEL_CHUNK, mCount);
+				for (uint32_t i = chunk * PARALLEL_CHUNK; i < end; i++) chunkBounds[chunk].Grow(mPrimitives[i].centroid);
+			});
+			Aabb centroidBounds;
+			for (const Aabb& bounds : chunkBounds) centroidBounds.Grow(bounds);
+
+			const uint32_t bitsPerAxis = mSettings.mortonBits >= 63 ? 21 : 10;
+			const float cells = (float)(1u << bitsPerAxis);
+			float scale[3];
+			for (int axis = 0; axis < 3; axis++) {
+				const float extent = centroidBounds.max[axis] - centroidBounds.min[axis];
+				scale[axis] = extent > 0.0f ? cells / extent : 0.0f;
+			}
+
+			mKeys.resize(mCount);
+			std::vector<uint32_t> order(mCount);
+			mPool.ParallelFor(chunkCount, [&](uint32_t chunk) {
+				const uint32_t end = (std::min)((chunk + 1) * PARALLEL_CHUNK, mCount);
+				for (uint32_t i = chunk * PARALLEL_CHUNK; i < end; i++) {
+					uint64_t code = 0;
+					for (int axis = 0; axis < 3; axis++) {
+						const float cell = (std::min)((std::max)((mPrimitives[i].centroid[axis] - centroidBounds.min[axis]) * scale[axis], 0.0f), cells - 1.0f);
+						code |= SpreadBits((uint64_t)cell) << (2 - axis);
+					}
+					mKeys[i] = code;
+					order[i] = i;
+				}
+			});
+			RadixSort(mKeys, order, bitsPerAxis * 3, mPool);
+
+			std::vector<BuildPrimitive> sorted(mCount);
+			mPool.ParallelFor(chunkCount, [&](uint32_t chunk) {
+				const uint32_t end = (std::min)((chunk + 1) * PARALLEL_CHUNK, mCount);
+				for (uint32_t i = chunk * PARALLEL_CHUNK; i < end; i++) sorted[i] = mPrimitives[order[i]];
+			});
+			mPrimitives.swap(sorted);
+		}
+
+		//Length of the common prefix of two sorted keys, duplicates are told apart by their index.
+		int Delta(int i, int j) const {
+			if (j < 0 || j >= (int)mCount) return -1;
+			const uint64_t a = mKeys[i], b = mKeys[j];
+			if (a != b) return std::countl_zero(a ^ b);
+			return 64 + std::countl_zero((uint32_t)(i ^ j));
+		}
+
+		void EmitInternal(int i) {
+			// The range grows towards the neighbour sharing the longer prefix, its end is found by exponential then binary search
+			const int direction = Delta(i, i + 1) - Delta(i, i - 1) >= 0 ? 1 : -1;
+			const int deltaMin = Delta(i, i - direction);
+			int lengthMax = 2;
+			while (Delta(i, i + lengthMax * direction) > deltaMin) lengthMax *= 2;
+			int length = 0;
+			for (int step = lengthMax / 2; step >= 1; step /= 2) {
+				if (Delta(i, i + (length + step) * direction) > deltaMin) length += step;
+			}
+			const int j = i + length * direction;
+
+			// The split is the last key sharing more than the range's common prefix with key i
+			const int deltaNode = Delta(i, j);
+			int split = 0;
+			for (int step = length; step > 1;) {
+				step = (step + 1) / 2;
+				if (Delta(i, i + (split + step) * direction) > deltaNode) split += step;
+			}
+			const int gamma = i + split * direction + (std::min)(direction, 0);
+
+			LinearNode& node = mNodes[i];
+			node.children[0] = (std::min)(i, j) == gamma ? Leaf(gamma) : (uint32_t)gamma;
+			node.children[1] = (std::max)(i, j) == gamma + 1 ? Leaf(gamma + 1) : (uint32_t)gamma + 1;
+			mNodes[node.children[0]].parent = i;
+			mNodes[node.children[1]].parent = i;
+		}
+
+		//Calls visit on every internal node after both of its children, spread over the pool from the leaves up.
+		template<typename Visit>
+		void BottomUp(Visit&& visit) {
+			if (mCount < 2) return;
+			std::vector<std::atomic<uint32_t>> arrivals(mCount - 1);
+			const uint32_t chunkCount = (mCount + PARALLEL_CHUNK - 1) / PARALLEL_CHUNK;
+			mPool.ParallelFor(chunkCount, [&](uint32_t chunk) {
+				const uint32_t end = (std::min)((chunk + 1) * PARALLEL_CHUNK, mCount);
+				for (uint32_t i = chunk * PARALLEL_CHUNK; i < end; i++) {
+					for (uint32_t node = mNodes[Leaf(i)].parent; node != UINT32_MAX; node = mNodes[node].parent) {
+						// The first child to arrive stops, the second sees its sibling's writes through the acquire
+						if (arrivals[node].fetch_add(1, std::memory_order_acq_rel) == 0) break;
+						visit(node);
+					}
+				}
+			});
+		}
+
+		void Refit(uint32_t index) {
+			LinearNode& node = mNodes[index];
+			const LinearNode& left = mNodes[node.children[0]];
+			const LinearNode& right = mNodes[node.children[1]];
+			node.bounds = left.bounds;
+			node.bounds.Grow(right.bounds);
+			node.primitiveCount = left.primitiveCount + right.primitiveCount;
+			const float area = node.bounds.HalfArea();
+			const float splitCost = mSettings.traversalCost * area + left.cost + right.cost;
+			const float leafCost = mSettings.intersectionCost * area * (float)node.primitiveCount;
+			node.collapse = node.primitiveCount <= mMaxLeafSize && leafCost <= splitCost;
+			node.cost = node.collapse ? leafCost : splitCost;
+		}
+
+		//Grows a treelet under root by opening its largest leaf until it has TREELET_SIZE leaves, then finds the SAH optimal
+		//binary tree over those leaves by dynamic programming over all their subsets and rebuilds the treelet in that
+		//shape, reusing its internal nodes.
+		void OptimizeTreelet(uint32_t root) {
+			uint32_t leaves[TREELET_SIZE];
+			uint32_t internals[TREELET_SIZE - 1];
+			uint32_t leafCount = 2, internalCount = 1;
+			leaves[0] = mNodes[root].children[0];
+			leaves[1] = mNodes[root].children[1];
+			internals[0] = root;
+			while (leafCount < TREELET_SIZE) {
+				int open = -1;
+				float openArea = -1.0f;
+				for (uint32_t i = 0; i < leafCount; i++) {
+					if (IsLeaf(leaves[i]) || mNodes[leaves[i]].bounds.HalfArea() <= openArea) continue;
+					open = (int)i;
+					openArea = mNodes[leaves[i]].bounds.HalfArea();
+				}
+				if (open < 0) break;
+				const uint32_t opened = leaves[open];
+				internals[internalCount++] = opened;
+				leaves[open] = mNodes[opened].children[0];
+				leaves[leafCount++] = mNodes[opened].children[1];
+			}
+
+			constexpr uint32_t SUBSETS = 1u << TREELET_SIZE;
+			const uint32_t full = (1u << leafCount) - 1;
+			Aabb bounds[SUBSETS];
+			uint32_t primitiveCount[SUBSETS];
+			float cost[SUBSETS];
+			uint8_t bestSplit[SUBSETS];
+			for (uint32_t set = 1; set <= full; set++) {
+				const uint32_t lowest = std::countr_zero(set);
+				const uint32_t rest = set & (set - 1);
+				const LinearNode& leaf = mNodes[leaves[lowest]];
+				bounds[set] = leaf.bounds;
+				bounds[set].Grow(bounds[rest]);
+				primitiveCount[set] = leaf.primitiveCount + (rest != 0 ? primitiveCount[rest] : 0);
+				if (rest == 0) {
+					cost[set] = leaf.cost;
+					continue;
+				}
+
+				// Every split once: the part holding the lowest leaf plus any proper subset of the others
+				const uint32_t lowestBit = set & (0u - set);
+				float bestCost = FLT_MAX;
+				for (uint32_t part = rest; ; part = (part - 1) & rest) {
+					if (part != rest) {
+						const uint32_t left = part | lowestBit;
+						const float splitCost = cost[left] + cost[set ^ left];
+						if (splitCost < bestCost) {
+							bestCost = splitCost;
+							bestSplit[set] = (uint8_t)left;
+						}
+					}
+					if (part == 0) break;
+				}
+				const float area = bounds[set].HalfArea();
+				cost[set] = mSettings.traversalCost * area + bestCost;
+				if (primitiveCount[set] <= mMaxLeafSize) cost[set] = (std::min)(cost[set], mSettings.intersectionCost * area * (float)primitiveCount[set]);
+			}
+			if (!(cost[full] < mNodes[root].cost * (1.0f - 1.0e-5f))) return;
+
+			uint32_t nextInternal = 0;
+			Rebuild(full, leaves, internals, bestSplit, nextInternal);
+		}
+
+		uint32_t Rebuild(uint32_t set, const uint32_t* leaves, const uint32_t* internals, const uint8_t* bestSplit, uint32_t& nextInternal) {
+			if ((set & (set - 1)) == 0) return leaves[std::countr_zero(set)];
+			const uint32_t index = internals[nextInternal++];
+			const uint32_t left = Rebuild(bestSplit[set], leaves, internals, bestSplit, nextInternal);
+			const uint32_t right = Rebuild(set ^ bestSplit[set], leaves, internals, bestSplit, nextInternal);
+			mNodes[index].children[0] = left;
+			mNodes[index].children[1] = right;
+			mNodes[left].parent = index;
+			mNodes[right].parent = index;
+			Refit(index);
+			return index;
+		}
+
+		//Output nodes of the subtree. Subtrees reaching Bvh::MAX_DEPTH become leaves whatever their size, which only
+		//long runs of equal Morton codes can cause.
+		uint32_t Count(uint32_t index, uint32_t depth) {
+			LinearNode& node = mNodes[index];
+			if (IsLeaf(index)) return node.outputNodes = 1;
+			if (depth >= Bvh::MAX_DEPTH) node.collapse = true;
+			if (node.collapse) return node.outputNodes = 1;
+
+			uint32_t counts[2];
+			if (node.primitiveCount >= mSettings.parallelThreshold) {
+				std::atomic<uint32_t> pending = 1;
+				mPool.Enqueue([&, depth]() {
+					counts[0] = Count(node.children[0], depth + 1);
+					pending.fetch_sub(1, std::memory_order_release);
+				});
+				counts[1] = Count(node.children[1], depth + 1);
+				mPool.WaitFor(pending);
+			}
+			else {
+				counts[0] = Count(node.children[0], depth + 1);
+				counts[1] = Count(node.children[1], depth + 1);
+			}
+			return node.outputNodes = 1 + counts[0] + counts[1];
+		}
+
+		void Place(uint32_t index, uint32_t position, uint32_t firstPrimitive, std::span<const BvhGeometryDesc> geometries, Bvh& bvh) {
+			const LinearNode& node = mNodes[index];
+			BvhNode& output = bvh.nodes[position];
+			output.boundsMin = DirectX::XMFLOAT3(node.bounds.min[0], node.bounds.min[1], node.bounds.min[2]);
+			output.boundsMax = DirectX::XMFLOAT3(node.bounds.max[0], node.bounds.max[1], node.bounds.max[2]);
+
+			if (IsLeaf(index) || node.collapse) {
+				output.offset = firstPrimitive;
+				output.count = node.primitiveCount;
+				uint32_t written = firstPrimitive;
+				GatherLeaves(index, [&](uint32_t primitive) {
+					bvh.primitives[written] = mPrimitives[primitive].reference;
+					bvh.triangles[written] = MakeTriangle(geometries, mPrimitives[primitive].reference);
+					written++;
+				});
+				return;
+			}
+
+			const uint32_t first = node.children[0], second = node.children[1];
+			const uint32_t secondPosition = position + 1 + mNodes[first].outputNodes;
+			output.offset = secondPosition;
+			output.count = 0;
+			if (node.primitiveCount >= mSettings.parallelThreshold) {
+				std::atomic<uint32_t> pending = 1;
+				mPool.Enqueue([&, first, position, firstPrimitive]() {
+					Place(first, position + 1, firstPrimitive, geometries, bvh);
+					pending.fetch_sub(1, std::memory_order_release);
+				});
+				Place(second, secondPosition, firstPrimitive + mNodes[first].primitiveCount, geometries, bvh);
+				mPool.WaitFor(pending);
+			}
+			else {
+				Place(first, position + 1, firstPrimitive, geometries, bvh);
+				Place(second, secondPosition, firstPrimitive + mNodes[first].primitiveCount, geometries, bvh);
+			}
+		}
+
+		//Calls func with the sorted primitive of every leaf under index, left to right.
+		template<typename Func>
+		void GatherLeaves(uint32_t index, Func&& func) const {
+			uint32_t stack[Bvh::MAX_DEPTH * 2];
+			uint32_t stackSize = 0;
+			stack[stackSize++] = index;
+			while (stackSize > 0) {
+				const uint32_t current = stack[--stackSize];
+				if (IsLeaf(current)) {
+					func(current - (mCount - 1));
+					continue;
+				}
+				stack[stackSize++] = mNodes[current].children[1];
+				stack[stackSize++] = mNodes[current].children[0];
+			}
+		}
+
+		const LinearBvhSettings& mSettings;
+		ThreadPool& mPool;
+		std::vector<BuildPrimitive>& mPrimitives;
+		uint32_t mCount;
+		uint32_t mMaxLeafSize = 4;
+		std::vector<uint64_t> mKeys;
+		std::vector<LinearNode> mNodes;
+	};
+
+	float HalfArea(const BvhNode& node)
+	{
+		const float dx = node.boundsMax.x - node.boundsMin.x, dy = node.boundsMax.y - node.boundsMin.y, dz = node.boundsMax.z - node.boundsMin.z;
+		return dx * dy + dy * dz + dz * dx;
+	}
+
+	//Wide node of the binary node at index, its children are collapsed recursively first so the layout stays depth first.
+	template<uint32_t Width>
+	uint32_t CollapseNode(const Bvh& bvh, uint32_t index, WideBvh<Width>& wide)
+	{
+		uint32_t lanes[Width];
+		uint32_t laneCount = 0;
+		const BvhNode& root = bvh.nodes[index];
+		if (root.IsLeaf()) {
+			lanes[laneCount++] = index;
+		}
+		else {
+			lanes[laneCount++] = index + 1;
+			lanes[laneCount++] = root.offset;
+		}
+		while (laneCount < Width) {
+			int open = -1;
+			float openArea = -1.0f;
+			for (uint32_t lane = 0; lane < laneCount; lane++) {
+				const BvhNode& child = bvh.nodes[lanes[lane]];
+				if (!child.IsLeaf() && HalfArea(child) > openArea) {
+					open = (int)lane;
+					openArea = HalfArea(child);
+				}
+			}
+			if (open < 0) break;
+			const uint32_t opened = lanes[open];
+			lanes[open] = opened + 1;
+			lanes[laneCount++] = bvh.nodes[opened].offset;
+		}
+
+		const uint32_t wideIndex = (uint32_t)wide.nodes.size();
+		WideBvhNode<Width>& node = wide.nodes.emplace_back();
+		for (uint32_t lane = 0; lane < Width; lane++) {
+			for (int axis = 0; axis < 3; axis++) {
+				node.bounds[0][axis][lane] = FLT_MAX;
+				node.bounds[1][axis][lane] = -FLT_MAX;
+			}
+			node.offset[lane] = 0;
+			node.count[lane] = 0;
+		}
+		for (uint32_t lane = 0; lane < laneCount; lane++) {
+			const BvhNode& child = bvh.nodes[lanes[lane]];
+			const float* boundsMin = &child.boundsMin.x;
+			const float* boundsMax = &child.boundsMax.x;
+			for (int axis = 0; axis < 3; axis++) {
+				node.bounds[0][axis][lane] = boundsMin[axis];
+				node.bounds[1][axis][lane] = boundsMax[axis];
+			}
+			node.offset[lane] = child.offset;
+			node.count[lane] = child.count;
+		}
+		// The recursion grows the node array, so the node is looked up again for every interior child
+		for (uint32_t lane = 0; lane < laneCount; lane++) {
+			if (bvh.nodes[lanes[lane]].IsLeaf()) continue;
+			const uint32_t child = CollapseNode(bvh, lanes[lane], wide);
+			wide.nodes[wideIndex].offset[lane] = child;
+		}
+		return wideIndex;
+	}
+
+	DirectX::XMVECTOR LoadQuad(const float* lanes, uint32_t quad)
+	{
+		return DirectX::XMLoadFloat4A(reinterpret_cast<const DirectX::XMFLOAT4A*>(lanes + quad * 4));
+	}
+
+	//A ray set up to slab test four boxes at a time. The near plane of each axis is the max plane when the ray runs down
+	//it, so no per lane min/max is needed.
+	struct SlabRay {
+		float origin[3];
+		float direction[3];
+		uint32_t nearSide[3];
+		DirectX::XMVECTOR start[3];
+		DirectX::XMVECTOR scale[3];
+		DirectX::XMVECTOR tMin;
+
+		SlabRay(const DirectX::XMFLOAT3& rayOrigin, const DirectX::XMFLOAT3& rayDirection, float rayTMin) :
+			origin{ rayOrigin.x, rayOrigin.y, rayOrigin.z }, direction{ rayDirection.x, rayDirection.y, rayDirection.z }
+		{
+			float inverseDirection[3];
+			BvhTraversal::InverseDirection(direction, inverseDirection);
+			for (int axis = 0; axis < 3; axis++) {
+				nearSide[axis] = inverseDirection[axis] < 0.0f ? 1 : 0;
+				start[axis] = DirectX::XMVectorReplicate(origin[axis]);
+				scale[axis] = DirectX::XMVectorReplicate(inverseDirection[axis]);
+			}
+			tMin = DirectX::XMVectorReplicate(rayTMin);
+		}
+	};
+
+	//Entry distances of four boxes given by their near and far planes, FLT_MAX for the ones the ray misses before tMax,
+	//stored to 16 byte aligned distances. Same slab arithmetic as the binary traversal, a fused origin * scale bias would
+	//lose hits to cancellation near the origin.
+	void SlabDistances(const SlabRay& ray, const DirectX::XMVECTOR nearPlanes[3], const DirectX::XMVECTOR farPlanes[3], float tMax, float* distances)
+	{
+		const DirectX::XMVECTOR miss = DirectX::XMVectorReplicate(FLT_MAX);
+		DirectX::XMVECTOR enter = ray.tMin, exit = miss;
+		for (int axis = 0; axis < 3; axis++) {
+			enter = DirectX::XMVectorMax(enter, DirectX::XMVectorMultiply(DirectX::XMVectorSubtract(nearPlanes[axis], ray.start[axis]), ray.scale[axis]));
+			exit = DirectX::XMVectorMin(exit, DirectX::XMVectorMultiply(DirectX::XMVectorSubtract(farPlanes[axis], ray.start[axis]), ray.scale[axis]));
+		}
+		exit = DirectX::XMVectorMin(DirectX::XMVectorMultiply(exit, DirectX::XMVectorReplicate(1.00000024f)), DirectX::XMVectorReplicate(tMax));
+		const DirectX::XMVECTOR inside = DirectX::XMVectorLessOrEqual(enter, exit);
+		DirectX::XMStoreFloat4A(reinterpret_cast<DirectX::XMFLOAT4A*>(distances), DirectX::XMVectorSelect(miss, enter, inside));
+	}
+
+	template<uint32_t Width>
+	void WideNodeDistances(const WideBvhNode<Width>& node, const SlabRay& ray, float tMax, float distances[Width])
+	{
+		for (uint32_t group = 0; group < Width; group += 4) {
+			DirectX::XMVECTOR nearPlanes[3], farPlanes[3];
+			for (int axis = 0; axis < 3; axis++) {
+				nearPlanes[axis] = DirectX::XMLoadFloat4A(reinterpret_cast<const DirectX::XMFLOAT4A*>(&node.bounds[ray.nearSide[axis]][axis][group]));
+				farPlanes[axis] = DirectX::XMLoadFloat4A(reinterpret_cast<const DirectX::XMFLOAT4A*>(&node.bounds[1 - ray.nearSide[axis]][axis][group]));
+			}
+			SlabDistances(ray, nearPlanes, farPlanes, tMax, distances + group);
+		}
+	}
+
+	//Whether any of count triangles from offset lies along the ray within [tMin, tMax].
+	bool AnyTriangle(const std::vector<BvhTriangle>& triangles, uint32_t offset, uint32_t count, const float origin[3], const float direction[3], float tMin, float tMax)
+	{
+		for (uint32_t i = offset; i < offset + count; i++) {
+			float t, u, v;
+			if (BvhTraversal::IntersectTriangle(triangles[i], origin, direction, tMin, tMax, t, u, v)) return true;
+		}
+		return false;
+	}
+
+	// Leaves too large for a quantized lane are split in four per level. A lane holds up to 65535 triangles and
+	// ceil((2^32 - 1) / 4^9) = 16384, so any 32 bit triangle count fits within this many levels (4^8 would leave 65536)
+	constexpr uint32_t QUANTIZED_LEAF_SPLIT_DEPTH = 9;
+
+	float GridSpacing(int8_t exponent)
+	{
+		return std::bit_cast<float>((uint32_t)(exponent + 127) << 23);
+	}
+
+	//Smallest power of two spacing whose 255th step from origin reaches max.
+	int8_t GridExponent(float origin, float max)
+	{
+		int exponent = 0;
+		std::frexp((max - origin) / 255.0f, &exponent);
+		exponent = (std::min)((std::max)(exponent, -126), 127);
+		while (exponent < 127 && origin + 255.0f * GridSpacing((int8_t)exponent) < max) exponent++;
+		return (int8_t)exponent;
+	}
+
+	//Steps of one axis of a child box, widened until the dequantized planes enclose it. The products are exact, so
+	//traversal rounds the planes the same way whether or not it fuses the multiply and add.
+	void QuantizePlanes(float origin, float spacing, float boundsMin, float boundsMax, uint8_t& stepMin, uint8_t& stepMax)
+	{
+		int low = (int)(std::min)((std::max)(std::floor((boundsMin - origin) / spacing), 0.0f), 255.0f);
+		while (low > 0 && origin + (float)low * spacing > boundsMin) low--;
+		int high = (int)(std::min)((std::max)(std::ceil((boundsMax - origin) / spacing), 0.0f), 255.0f);
+		while (high < 255 && origin + (float)high * spacing < boundsMax) high++;
+		stepMin = (uint8_t)low;
+		stepMax = (uint8_t)high;
+	}
+
+	QuantizedBvhNode QuantizeNode(const BvhBox* boxes, const uint32_t* offsets, const uint32_t* counts, uint32_t laneCount)
+	{
+		QuantizedBvhNode node = {};
+		node.laneCount = (uint8_t)laneCount;
+		Aabb bounds;
+		for (uint32_t lane = 0; lane < laneCount; lane++) {
+			bounds.Grow(&boxes[lane].boundsMin.x);
+			bounds.Grow(&boxes[lane].boundsMax.x);
+		}
+		float* origin = &node.origin.x;
+		for (int axis = 0; axis < 3; axis++) {
+			origin[axis] = bounds.min[axis];
+			node.exponent[axis] = GridExponent(bounds.min[axis], bounds.max[axis]);
+			const float spacing = GridSpacing(node.exponent[axis]);
+			for (uint32_t lane = 0; lane < laneCount; lane++) {
+				QuantizePlanes(origin[axis], spacing, (&boxes[lane].boundsMin.x)[axis], (&boxes[lane].boundsMax.x)[axis], node.bounds[0][axis][lane], node.bounds[1][axis][lane]);
+			}
+		}
+		for (uint32_t lane = 0; lane < laneCount; lane++) {
+			node.offset[lane] = offsets[lane];
+			node.count[lane] = (uint16_t)counts[lane];
+		}
+		return node;
+	}
+
+	BvhBox TriangleRangeBox(const std::vector<BvhTriangle>& triangles, uint32_t offset, uint32_t count)
+	{
+		Aabb bounds;
+		for (uint32_t i = offset; i < offset + count; i++) {
+			const BvhTriangle& triangle = triangles[i];
+			const float* v0 = &triangle.v0.x;
+			const float* edge1 = &triangle.edge1.x;
+			const float* edge2 = &triangle.edge2.x;
+			const float v1[3] = { v0[0] + edge1[0], v0[1] + edge1[1], v0[2] + edge1[2] };
+			const float v2[3] = { v0[0] + edge2[0], v0[1] + edge2[1], v0[2] + edge2[2] };
+			bounds.Grow(v0);
+			bounds.Grow(v1);
+			bounds.Grow(v2);
+		}
+		return { DirectX::XMFLOAT3(bounds.min[0], bounds.min[1], bounds.min[2]), DirectX::XMFLOAT3(bounds.max[0], bounds.max[1], bounds.max[2]) };
+	}
+
+	//Node over four parts of a leaf too large for a lane, appended to the quantized nodes. Returns its index.
+	uint32_t SplitQuantizedLeaf(QuantizedBvh& bvh, uint32_t offset, uint32_t count)
+	{
+		BvhBox boxes[4];
+		uint32_t offsets[4], counts[4];
+		const uint32_t part = (count + 3) / 4;
+		uint32_t laneCount = 0;
+		for (uint32_t begin = offset; begin < offset + count; begin += part) {
+			const uint32_t lane = laneCount++;
+			counts[lane] = (std::min)(part, offset + count - begin);
+			offsets[lane] = begin;
+			boxes[lane] = TriangleRangeBox(bvh.triangles, begin, counts[lane]);
+			if (counts[lane] > QuantizedBvhNode::MAX_LEAF_SIZE) {
+				offsets[lane] = SplitQuantizedLeaf(bvh, begin, counts[lane]);
+				counts[lane] = 0;
+			}
+		}
+		bvh.nodes.push_back(QuantizeNode(boxes, offsets, counts, laneCount));
+		return (uint32_t)bvh.nodes.size() - 1;
+	}
+
+	//SlabDistances of the four lanes of a quantized node, the planes are dequantized in registers.
+	void QuantizedNodeDistances(const QuantizedBvhNode& node, const SlabRay& ray, float tMax, float distances[4])
+	{
+		const float* origin = &node.origin.x;
+		DirectX::XMVECTOR nearPlanes[3], farPlanes[3];
+		for (int axis = 0; axis < 3; axis++) {
+			const DirectX::XMVECTOR gridOrigin = DirectX::XMVectorReplicate(origin[axis]);
+			const DirectX::XMVECTOR spacing = DirectX::XMVectorReplicate(GridSpacing(node.exponent[axis]));
+			const DirectX::XMVECTOR nearSteps = DirectX::PackedVector::XMLoadUByte4(reinterpret_cast<const DirectX::PackedVector::XMUBYTE4*>(node.bounds[ray.nearSide[axis]][axis]));
+			const DirectX::XMVECTOR farSteps = DirectX::PackedVector::XMLoadUByte4(reinterpret_cast<const DirectX::PackedVector::XMUBYTE4*>(node.bounds[1 - ray.nearSide[axis]][axis]));
+			nearPlanes[axis] = DirectX::XMVectorAdd(gridOrigin, DirectX::XMVectorMultiply(nearSteps, spacing));
+			farPlanes[axis] = DirectX::XMVectorAdd(gridOrigin, DirectX::XMVectorMultiply(farSteps, spacing));
+		}
+		SlabDistances(ray, nearPlanes, farPlanes, tMax, distances);
+	}
+
+	//Traversal state of one packet: per ray reciprocal directions and the range of each across the packet, which
+	//bounds its frustum.
+	class PacketTraversal
+	{
+	public:
+		PacketTraversal(const Bvh& bvh, BvhRayPacket& packet) : mBvh(bvh), mPacket(packet) {
+			assert(packet.rayCount > 0 && packet.rayCount <= BvhRayPacket::MAX_RAYS);
+			mQuadCount = (packet.rayCount + 3) / 4;
+			// Padding lanes repeat the last ray with an empty interval so they never hit anything
+			for (uint32_t i = packet.rayCount; i < mQuadCount * 4; i++) {
+				for (int axis = 0; axis < 3; axis++) packet.direction[axis][i] = packet.direction[axis][packet.rayCount - 1];
+				packet.t[i] = -FLT_MAX;
+			}
+
+			mOrigin[0] = packet.origin.x;
+			mOrigin[1] = packet.origin.y;
+			mOrigin[2] = packet.origin.z;
+			for (uint32_t i = 0; i < mQuadCount * 4; i++) {
+				const float direction[3] = { packet.direction[0][i], packet.direction[1][i], packet.direction[2][i] };
+				float inverseDirection[3];
+				BvhTraversal::InverseDirection(direction, inverseDirection);
+				for (int axis = 0; axis < 3; axis++) mInverse[axis][i] = inverseDirection[axis];
+			}
+			for (int axis = 0; axis < 3; axis++) {
+				mNearSide[axis] = mInverse[axis][0] < 0.0f ? 1 : 0;
+				mLow[axis] = mHigh[axis] = mInverse[axis][0];
+				for (uint32_t i = 1; i < mQuadCount * 4; i++) {
+					if ((mInverse[axis][i] < 0.0f ? 1u : 0u) != mNearSide[axis]) mCoherent = false;
+					mLow[axis] = (std::min)(mLow[axis], mInverse[axis][i]);
+					mHigh[axis] = (std::max)(mHigh[axis], mInverse[axis][i]);
+				}
+				mCentral[axis] = packet.direction[axis][packet.rayCount / 2];
+			}
+			UpdateMaxT();
+		}
+
+		//Whether every ray runs the same way along each axis, the frustum test relies on it.
+		bool Coherent() const { return mCoherent; }
+
+		void Trace() {
+			struct Entry {
+				uint32_t node;
+				uint32_t firstQuad; // quads before it missed an ancestor
+			};
+			Entry stack[Bvh::MAX_DEPTH];
+			uint32_t stackSize = 0;
+			Entry current = { 0, 0 };
+			for (;;) {
+				const BvhNode& node = mBvh.nodes[current.node];
+				uint32_t first = current.firstQuad;
+				bool entered = QuadEntersBox(node, first);
+				if (!entered && !FrustumMisses(node)) {
+					while (++first < mQuadCount) {
+						if (QuadEntersBox(node, first)) {
+							entered = true;
+							break;
+						}
+					}
+				}
+
+				if (entered) {
+					if (!node.IsLeaf()) {
+						// Nearest child along the packet's central ray first
+						uint32_t nearChild = current.node + 1, farChild = node.offset;
+						const BvhNode& a = mBvh.nodes[nearChild];
+						const BvhNode& b = mBvh.nodes[farChild];
+						const float separation = (b.boundsMin.x + b.boundsMax.x - a.boundsMin.x - a.boundsMax.x) * mCentral[0] +
+							(b.boundsMin.y + b.boundsMax.y - a.boundsMin.y - a.boundsMax.y) * mCentral[1] +
+							(b.boundsMin.z + b.boundsMax.z - a.boundsMin.z - a.boundsMax.z) * mCentral[2];
+						if (separation < 0.0f) std::swap(nearChild, farChild);
+						stack[stackSize++] = { farChild, first };
+						current = { nearChild, first };
+						continue;
+					}
+
+					for (uint32_t quad = first; quad < mQuadCount; quad++) {
+						if (quad != first && !QuadEntersBox(node, quad)) continue;
+						for (uint32_t i = node.offset; i < node.offset + node.count; i++) IntersectQuad(i, quad);
+					}
+					UpdateMaxT();
+				}
+
+				if (stackSize == 0) break;
+				current = stack[--stackSize];
+			}
+		}
+
+	private:
+		//Same slab arithmetic as IntersectBox, so a quad enters exactly the boxes its rays would enter one by one.
+		bool QuadEntersBox(const BvhNode& node, uint32_t quad) const {
+			const float* bounds[2] = { &node.boundsMin.x, &node.boundsMax.x };
+			const DirectX::XMVECTOR widen = DirectX::XMVectorReplicate(1.00000024f);
+			DirectX::XMVECTOR enter = DirectX::XMVectorReplicate(mPacket.tMin);
+			DirectX::XMVECTOR exit = LoadQuad(mPacket.t, quad);
+			for (int axis = 0; axis < 3; axis++) {
+				const DirectX::XMVECTOR scale = LoadQuad(mInverse[axis], quad);
+				const DirectX::XMVECTOR nearDistance = DirectX::XMVectorReplicate(bounds[mNearSide[axis]][axis] - mOrigin[axis]);
+				const DirectX::XMVECTOR farDistance = DirectX::XMVectorReplicate(bounds[1 - mNearSide[axis]][axis] - mOrigin[axis]);
+				enter = DirectX::XMVectorMax(enter, DirectX::XMVectorMultiply(nearDistance, scale));
+				exit = DirectX::XMVectorMin(exit, DirectX::XMVectorMultiply(DirectX::XMVectorMultiply(farDistance, scale), widen));
+			}
+			return !DirectX::XMComparisonAllTrue(DirectX::XMVector4GreaterR(enter, exit));
+		}
+
+		//Interval arithmetic over the packet's direction ranges: the latest entry any ray could have against the earliest
+		//exit any ray could have. True only when no ray of the packet can enter the box.
+		bool FrustumMisses(const BvhNode& node) const {
+			const float* bounds[2] = { &node.boundsMin.x, &node.boundsMax.x };
+			float enter = mPacket.tMin, exit = mMaxT;
+			for (int axis = 0; axis < 3; axis++) {
+				const float nearDistance = bounds[mNearSide[axis]][axis] - mOrigin[axis];
+				const float farDistance = bounds[1 - mNearSide[axis]][axis] - mOrigin[axis];
+				enter = (std::max)(enter, (std::min)(nearDistance * mLow[axis], nearDistance * mHigh[axis]));
+				exit = (std::min)(exit, (std::max)(farDistance * mLow[axis], farDistance * mHigh[axis]) * 1.00000024f);
+			}
+			return enter > exit;
+		}
+
+		//IntersectTriangle for four rays, with the same operations in the same order so the hits match bit for bit. The
+		//shared origin makes tvec, qvec and the numerator of t scalars.
+		void IntersectQuad(uint32_t triangleIndex, uint32_t quad) {
+			const BvhTriangle& triangle = mBvh.triangles[triangleIndex];
+			const DirectX::XMFLOAT3& e1 = triangle.edge1;
+			const DirectX::XMFLOAT3& e2 = triangle.edge2;
+			const float tvec[3] = { mOrigin[0] - triangle.v0.x, mOrigin[1] - triangle.v0.y, mOrigin[2] - triangle.v0.z };
+			const float qvec[3] = { tvec[1] * e1.z - tvec[2] * e1.y, tvec[2] * e1.x - tvec[0] * e1.z, tvec[0] * e1.y - tvec[1] * e1.x };
+			const float tNumerator = e2.x * qvec[0] + e2.y * qvec[1] + e2.z * qvec[2];
+
+			using namespace DirectX;
+			const XMVECTOR dx = LoadQuad(mPacket.direction[0], quad);
+			const XMVECTOR dy = LoadQuad(mPacket.direction[1], quad);
+			const XMVECTOR dz = LoadQuad(mPacket.direction[2], quad);
+			const XMVECTOR p0 = XMVectorSubtract(XMVectorMultiply(dy, XMVectorReplicate(e2.z)), XMVectorMultiply(dz, XMVectorReplicate(e2.y)));
+			const XMVECTOR p1 = XMVectorSubtract(XMVectorMultiply(dz, XMVectorReplicate(e2.x)), XMVectorMultiply(dx, XMVectorReplicate(e2.z)));
+			const XMVECTOR p2 = XMVectorSubtract(XMVectorMultiply(dx, XMVectorReplicate(e2.y)), XMVectorMultiply(dy, XMVectorReplicate(e2.x)));
+			const XMVECTOR det = XMVectorAdd(XMVectorAdd(XMVectorMultiply(XMVectorReplicate(e1.x), p0), XMVectorMultiply(XMVectorReplicate(e1.y), p1)),
+				XMVectorMultiply(XMVectorReplicate(e1.z), p2));
+			const XMVECTOR invDet = XMVectorReciprocal(det);
+			const XMVECTOR u = XMVectorMultiply(XMVectorAdd(XMVectorAdd(XMVectorMultiply(XMVectorReplicate(tvec[0]), p0), XMVectorMultiply(XMVectorReplicate(tvec[1]), p1)),
+				XMVectorMultiply(XMVectorReplicate(tvec[2]), p2)), invDet);
+			const XMVECTOR v = XMVectorMultiply(XMVectorAdd(XMVectorAdd(XMVectorMultiply(dx, XMVectorReplicate(qvec[0])), XMVectorMultiply(dy, XMVectorReplicate(qvec[1]))),
+				XMVectorMultiply(dz, XMVectorReplicate(qvec[2]))), invDet);
+			const XMVECTOR t = XMVectorMultiply(XMVectorReplicate(tNumerator), invDet);
+
+			const XMVECTOR zero = XMVectorZero(), one = XMVectorReplicate(1.0f);
+			XMVECTOR accept = XMVectorNotEqual(det, zero);
+			accept = XMVectorAndInt(accept, XMVectorAndInt(XMVectorGreaterOrEqual(u, zero), XMVectorLessOrEqual(u, one)));
+			accept = XMVectorAndInt(accept, XMVectorAndInt(XMVectorGreaterOrEqual(v, zero), XMVectorLessOrEqual(XMVectorAdd(u, v), one)));
+			accept = XMVectorAndInt(accept, XMVectorAndInt(XMVectorGreaterOrEqual(t, XMVectorReplicate(mPacket.tMin)), XMVectorLessOrEqual(t, LoadQuad(mPacket.t, quad))));
+			alignas(16) uint32_t lanes[4];
+			XMStoreInt4(lanes, accept);
+			if ((lanes[0] | lanes[1] | lanes[2] | lanes[3]) == 0) return;
+
+			alignas(16) float hitT[4], hitU[4], hitV[4];
+			XMStoreFloat4A(reinterpret_cast<XMFLOAT4A*>(hitT), t);
+			XMStoreFloat4A(reinterpret_cast<XMFLOAT4A*>(hitU), u);
+			XMStoreFloat4A(reinterpret_cast<XMFLOAT4A*>(hitV), v);
+			for (uint32_t lane = 0; lane < 4; lane++) {
+				if (lanes[lane] == 0) continue;
+				const uint32_t ray = quad * 4 + lane;
+				mPacket.t[ray] = hitT[lane];
+				mPacket.u[ray] = hitU[lane];
+				mPacket.v[ray] = hitV[lane];
+				mPacket.geometry[ray] = mBvh.primitives[triangleIndex].geometry;
+				mPacket.primitive[ray] = mBvh.primitives[triangleIndex].primitive;
+				mPacket.hit[ray] = true;
+			}
+		}
+
+		void UpdateMaxT() {
+			mMaxT = -FLT_MAX;
+			for (uint32_t i = 0; i < mPacket.rayCount; i++) mMaxT = (std::max)(mMaxT, mPacket.t[i]);
+		}
+
+		const Bvh& mBvh;
+		BvhRayPacket& mPacket;
+		uint32_t mQuadCount = 0;
+		float mOrigin[3];
+		alignas(16) float mInverse[3][BvhRayPacket::MAX_RAYS];
+		uint32_t mNearSide[3];
+		float mLow[3], mHigh[3]; // range of the reciprocal directions per axis
+		float mCentral[3];
+		float mMaxT = 0.0f; // largest tMax left in the packet
+		bool mCoherent = true;
+	};
+}
+
+Bvh BvhBuilder::Build(std::span<const BvhGeometryDesc> geometries, const BvhBuildSettings& settings, ThreadPool* pool)
+{
+	ThreadPool& threadPool = pool != nullptr ? *pool : ThreadPool::Global();
+	std::vector<BuildPrimitive> primitives = GatherPrimitives(geometries, threadPool);
+	Bvh bvh;
+	if (primitives.empty()) return bvh;
+
+	if (settings.spatialSplitBudget > 0.0f) {
+		SpatialBuilder builder(settings, threadPool, geometries, (uint32_t)primitives.size());
+		builder.BuildRoot(std::move(primitives));
+		const std::vector<BuildPrimitive>& references = builder.References();
+		bvh.nodes.reserve(references.size() * 2);
+		bvh.primitives.reserve(references.size());
+		bvh.triangles.reserve(references.size());
+		Flatten(builder.Nodes(), 0, references, geometries, bvh);
+		bvh.nodes.shrink_to_fit();
+		return bvh;
+	}
+
+	Builder builder(settings, threadPool, primitives);
+	builder.BuildRoot();
+
+	bvh.nodes.reserve(primitives.size() * 2);
+	bvh.primitives.reserve(primitives.size());
+	bvh.triangles.reserve(primitives.size());
+	Flatten(builder.Nodes(), 0, primitives, geometries, bvh);
+	bvh.nodes.shrink_to_fit();
+	return bvh;
+}
+
+Bvh BvhBuilder::BuildOverBoxes(std::span<const BvhBox> boxes, const BvhBuildSettings& settings, ThreadPool* pool)
+{
+	ThreadPool& threadPool = pool != nullptr ? *pool : ThreadPool::Global();
+	std::vector<BuildPrimitive> primitives;
+	primitives.reserve(boxes.size());
+	for (uint32_t i = 0; i < (uint32_t)boxes.size(); i++) {
+		const float* boundsMin = &boxes[i].boundsMin.x;
+		const float* boundsMax = &boxes[i].boundsMax.x;
+		bool valid = true;
+		for (int axis = 0; axis < 3; axis++) valid &= std::isfinite(boundsMin[axis]) && std::isfinite(boundsMax[axis]) && boundsMin[axis] <= boundsMax[axis];
+		if (!valid) continue;
+
+		BuildPrimitive& primitive = primitives.emplace_back();
+		primitive.bounds.Grow(boundsMin);
+		primitive.bounds.Grow(boundsMax);
+		for (int axis = 0; axis < 3; axis++) primitive.centroid[axis] = (boundsMin[axis] + boundsMax[axis]) * 0.5f;
+		primitive.reference = { 0, i };
+	}
+	Bvh bvh;
+	if (primitives.empty()) return bvh;
+
+	Builder builder(settings, threadPool, primitives);
+	builder.BuildRoot();
+
+	bvh.nodes.reserve(primitives.size() * 2);
+	bvh.primitives.reserve(primitives.size());
+	Flatten(builder.Nodes(), 0, primitives, {}, bvh);
+	bvh.nodes.shrink_to_fit();
+	return bvh;
+}
+
+Bvh BvhBuilder::BuildLinear(std::span<const BvhGeometryDesc> geometries, const LinearBvhSettings& settings, ThreadPool* pool)
+{
+	ThreadPool& threadPool = pool != nullptr ? *pool : ThreadPool::Global();
+	std::vector<BuildPrimitive> primitives = GatherPrimitives(geometries, threadPool);
+	Bvh bvh;
+	if (primitives.empty()) return bvh;
+
+	LinearBuilder builder(settings, threadPool, primitives);
+	builder.Build();
+	builder.Flatten(geometries, bvh);
+	return bvh;
+}
+
+BvhStats BvhBuilder::Stats(const Bvh& bvh, const BvhBuildSettings& settings)
+{
+	BvhStats stats;
+	if (bvh.Empty()) return stats;
+
+	const float rootArea = (std::max)(HalfArea(bvh.nodes[0]), FLT_MIN);
+
+	double cost = 0.0;
+	std::vector<std::pair<uint32_t, uint32_t>> stack = { { 0, 1 } };
+	while (!stack.empty()) {
+		const auto [index, depth] = stack.back();
+		stack.pop_back();
+		const BvhNode& node = bvh.nodes[index];
+		stats.nodeCount++;
+		stats.maxDepth = (std::max)(stats.maxDepth, depth);
+		const double area = HalfArea(node) / rootArea;
+		if (node.IsLeaf()) {
+			stats.leafCount++;
+			stats.primitiveCount += node.count;
+			stats.maxLeafSize = (std::max)(stats.maxLeafSize, node.count);
+			cost += area * settings.intersectionCost * node.count;
+		}
+		else {
+			cost += area * settings.traversalCost;
+			stack.push_back({ index + 1, depth + 1 });
+			stack.push_back({ node.offset, depth + 1 });
+		}
+	}
+	stats.sahCost = (float)cost;
+	return stats;
+}
+
+bool BvhTraversal::IntersectClosest(const Bvh& bvh, const DirectX::XMFLOAT3& origin, const DirectX::XMFLOAT3& direction, float tMin, float tMax, BvhHit& hit)
+{
+	if (bvh.Empty()) return false;
+
+	const float rayOrigin[3] = { origin.x, origin.y, origin.z };
+	const float rayDirection[3] = { direction.x, direction.y, direction.z };
+	float inverseDirection[3];
+	InverseDirection(rayDirection, inverseDirection);
+
+	float closest = tMax;
+	bool found = false;
+	if (IntersectBox(bvh.nodes[0], rayOrigin, inverseDirection, tMin, closest) == FLT_MAX) return false;
+
+	uint32_t stack[Bvh::MAX_DEPTH];
+	uint32_t stackSize = 0;
+	uint32_t index = 0;
+	for (;;) {
+		const BvhNode& node = bvh.nodes[index];
+		if (node.IsLeaf()) {
+			for (uint32_t i = node.offset; i < node.offset + node.count; i++) {
+				float t, u, v;
+				if (!IntersectTriangle(bvh.triangles[i], rayOrigin, rayDirection, tMin, closest, t, u, v)) continue;
+				closest = t;
+				found = true;
+				hit.t = t;
+				hit.barycentrics = DirectX::XMFLOAT2(u, v);
+				hit.geometry = bvh.primitives[i].geometry;
+				hit.primitive = bvh.primitives[i].primitive;
+			}
+		}
+		else {
+			uint32_t nearChild = index + 1, farChild = node.offset;
+			float nearT = IntersectBox(bvh.nodes[nearChild], rayOrigin, inverseDirection, tMin, closest);
+			float farT = IntersectBox(bvh.nodes[farChild], rayOrigin, inverseDirection, tMin, closest);
+			if (farT < nearT) {
+				std::swap(nearChild, farChild);
+				std::swap(nearT, farT);
+			}
+			if (nearT != FLT_MAX) {
+				if (farT != FLT_MAX) stack[stackSize++] = farChild;
+				index = nearChild;
+				continue;
+			}
+		}
+
+		if (stackSize == 0) break;
+		index = stack[--stackSize];
+	}
+	return found;
+}
+
+bool BvhTraversal::IntersectAny(const Bvh& bvh, const DirectX::XMFLOAT3& origin, const DirectX::XMFLOAT3& direction, float tMin, float tMax)
+{
+	if (bvh.Empty()) return false;
+
+	const float rayOrigin[3] = { origin.x, origin.y, origin.z };
+	const float rayDirection[3] = { direction.x, direction.y, direction.z };
+	float inverseDirection[3];
+	InverseDirection(rayDirection, inverseDirection);
+
+	if (IntersectBox(bvh.nodes[0], rayOrigin, inverseDirection, tMin, tMax) == FLT_MAX) return false;
+	if (bvh.nodes[0].IsLeaf()) return AnyTriangle(bvh.triangles, bvh.nodes[0].offset, bvh.nodes[0].count, rayOrigin, rayDirection, tMin, tMax);
+
+	uint32_t stack[Bvh::MAX_DEPTH];
+	uint32_t stackSize = 0;
+	uint32_t index = 0;
+	for (;;) {
+		// Only interior nodes are walked, leaf children are tested as soon as their box is entered
+		const BvhNode& node = bvh.nodes[index];
+		uint32_t nearChild = index + 1, farChild = node.offset;
+		float nearT = IntersectBox(bvh.nodes[nearChild], rayOrigin, inverseDirection, tMin, tMax);
+		float farT = IntersectBox(bvh.nodes[farChild], rayOrigin, inverseDirection, tMin, tMax);
+		if (farT < nearT) {
+			std::swap(nearChild, farChild);
+			std::swap(nearT, farT);
+		}
+
+		const uint32_t children[2] = { nearChild, farChild };
+		const float distances[2] = { nearT, farT };
+		bool descend = false;
+		for (int i = 0; i < 2; i++) {
+			if (distances[i] == FLT_MAX) continue;
+			const uint32_t child = children[i];
+			const BvhNode& childNode = bvh.nodes[child];
+			if (childNode.IsLeaf()) {
+				if (AnyTriangle(bvh.triangles, childNode.offset, childNode.count, rayOrigin, rayDirection, tMin, tMax)) return true;
+			}
+			else if (!descend) {
+				index = child;
+				descend = true;
+			}
+			else stack[stackSize++] = child;
+		}
+		if (descend) continue;
+		if (stackSize == 0) return false;
+		index = stack[--stackSize];
+	}
+}
+
+uint32_t BvhTraversal::IntersectPacket(const Bvh& bvh, BvhRayPacket& packet)
+{
+	std::fill(packet.hit, packet.hit + packet.rayCount, false);
+	if (bvh.Empty() || packet.rayCount == 0) return 0;
+
+	PacketTraversal traversal(bvh, packet);
+	if (traversal.Coherent()) {
+		traversal.Trace();
+		return 0;
+	}
+
+	for (uint32_t i = 0; i < packet.rayCount; i++) {
+		const DirectX::XMFLOAT3 direction(packet.direction[0][i], packet.direction[1][i], packet.direction[2][i]);
+		BvhHit hit;
+		if (!IntersectClosest(bvh, packet.origin, direction, packet.tMin, packet.t[i], hit)) continue;
+		packet.t[i] = hit.t;
+		packet.u[i] = hit.barycentrics.x;
+		packet.v[i] = hit.barycentrics.y;
+		packet.geometry[i] = hit.geometry;
+		packet.primitive[i] = hit.primitive;
+		packet.hit[i] = true;
+	}
+	return packet.rayCount;
+}
+
+template<uint32_t Width>
+WideBvh<Width> BvhBuilder::Collapse(const Bvh& bvh)
+{
+	WideBvh<Width> wide;
+	if (bvh.Empty()) return wide;
+	wide.primitives = bvh.primitives;
+	wide.triangles = bvh.triangles;
+	wide.nodes.reserve(bvh.nodes.size() / 2 + 1);
+	CollapseNode(bvh, 0, wide);
+	wide.nodes.shrink_to_fit();
+	return wide;
+}
+
+template<uint32_t Width>
+double BvhBuilder::LaneOccupancy(const WideBvh<Width>& bvh)
+{
+	if (bvh.Empty()) return 0.0;
+	uint64_t used = 0;
+	for (const WideBvhNode<Width>& node : bvh.nodes) {
+		for (uint32_t lane = 0; lane < Width; lane++) used += node.bounds[0][0][lane] <= node.bounds[1][0][lane] ? 1 : 0;
+	}
+	return (double)used / (double)bvh.nodes.size();
+}
+
+template<uint32_t Width>
+bool BvhTraversal::IntersectClosest(const WideBvh<Width>& bvh, const DirectX::XMFLOAT3& origin, const DirectX::XMFLOAT3& direction, float tMin, float tMax, BvhHit& hit)
+{
+	if (bvh.Empty()) return false;
+
+	const SlabRay ray(origin, direction, tMin);
+
+	struct Entry {
+		uint32_t offset;
+		uint32_t count;
+		float t;
+	};
+	// Every level pushes at most Width - 1 entries and the collapsed tree is no deeper than the binary one
+	Entry stack[Bvh::MAX_DEPTH * (Width - 1)];
+	uint32_t stackSize = 0;
+	Entry current = { 0, 0, tMin };
+	float closest = tMax;
+	bool found = false;
+	for (;;) {
+		if (current.count != 0) {
+			for (uint32_t i = current.offset; i < current.offset + current.count; i++) {
+				float t, u, v;
+				if (!IntersectTriangle(bvh.triangles[i], ray.origin, ray.direction, tMin, closest, t, u, v)) continue;
+				closest = t;
+				found = true;
+				hit.t = t;
+				hit.barycentrics = DirectX::XMFLOAT2(u, v);
+				hit.geometry = bvh.primitives[i].geometry;
+				hit.primitive = bvh.primitives[i].primitive;
+			}
+		}
+		else {
+			const WideBvhNode<Width>& node = bvh.nodes[current.offset];
+			alignas(16) float distances[Width];
+			WideNodeDistances(node, ray, closest, distances);
+
+			// At most Width children were hit, an insertion sort orders them nearest first
+			Entry hits[Width];
+			uint32_t hitCount = 0;
+			for (uint32_t lane = 0; lane < Width; lane++) {
+				if (distances[lane] == FLT_MAX) continue;
+				uint32_t slot = hitCount++;
+				for (; slot > 0 && hits[slot - 1].t > distances[lane]; slot--) hits[slot] = hits[slot - 1];
+				hits[slot] = { node.offset[lane], node.count[lane], distances[lane] };
+			}
+			if (hitCount > 0) {
+				for (uint32_t i = hitCount - 1; i > 0; i--) stack[stackSize++] = hits[i];
+				current = hits[0];
+				continue;
+			}
+		}
+
+		// Entries pushed before a closer hit was found may now lie entirely behind it
+		do {
+			if (stackSize == 0) return found;
+			current = stack[--stackSize];
+		} while (current.t > closest);
+	}
+}
+
+template<uint32_t Width>
+bool BvhTraversal::IntersectAny(const WideBvh<Width>& bvh, const DirectX::XMFLOAT3& origin, const DirectX::XMFLOAT3& direction, float tMin, float tMax)
+{
+	if (bvh.Empty()) return false;
+
+	const SlabRay ray(origin, direction, tMin);
+	// The ray never shortens, so pushed children need no distance and are never culled on pop
+	uint32_t stack[Bvh::MAX_DEPTH * (Width - 1)];
+	uint32_t stackSize = 0;
+	uint32_t current = 0;
+	for (;;) {
+		const WideBvhNode<Width>& node = bvh.nodes[current];
+		alignas(16) float distances[Width];
+		WideNodeDistances(node, ray, tMax, distances);
+
+		bool descend = false;
+		for (uint32_t lane = 0; lane < Width; lane++) {
+			if (distances[lane] == FLT_MAX) continue;
+			if (node.count[lane] != 0) {
+				if (AnyTriangle(bvh.triangles, node.offset[lane], node.count[lane], ray.origin, ray.direction, tMin, tMax)) return true;
+			}
+			else if (!descend) {
+				current = node.offset[lane];
+				descend = true;
+			}
+			else stack[stackSize++] = node.offset[lane];
+		}
+		if (descend) continue;
+		if (stackSize == 0) return false;
+		current = stack[--stackSize];
+	}
+}
+
+QuantizedBvh BvhBuilder::Quantize(const Bvh4& bvh)
+{
+	QuantizedBvh quantized;
+	if (bvh.Empty()) return quantized;
+	quantized.primitives = bvh.primitives;
+	quantized.triangles = bvh.triangles;
+	quantized.nodes.resize(bvh.nodes.size());
+	for (size_t i = 0; i < bvh.nodes.size(); i++) {
+		const WideBvhNode<4>& wide = bvh.nodes[i];
+		BvhBox boxes[4];
+		uint32_t offsets[4], counts[4];
+		uint32_t laneCount = 0;
+		// Collapse fills lanes from the first, the empty ones hold inverted boxes
+		for (; laneCount < 4 && wide.bounds[0][0][laneCount] <= wide.bounds[1][0][laneCount]; laneCount++) {
+			const uint32_t lane = laneCount;
+			boxes[lane].boundsMin = DirectX::XMFLOAT3(wide.bounds[0][0][lane], wide.bounds[0][1][lane], wide.bounds[0][2][lane]);
+			boxes[lane].boundsMax = DirectX::XMFLOAT3(wide.bounds[1][0][lane], wide.bounds[1][1][lane], wide.bounds[1][2][lane]);
+			offsets[lane] = wide.offset[lane];
+			counts[lane] = wide.count[lane];
+			if (counts[lane] > QuantizedBvhNode::MAX_LEAF_SIZE) {
+				offsets[lane] = SplitQuantizedLeaf(quantized, offsets[lane], counts[lane]);
+				counts[lane] = 0;
+			}
+		}
+		quantized.nodes[i] = QuantizeNode(boxes, offsets, counts, laneCount);
+	}
+	return quantized;
+}
+
+bool BvhTraversal::IntersectClosest(const QuantizedBvh& bvh, const DirectX::XMFLOAT3& origin, const DirectX::XMFLOAT3& direction, float tMin, float tMax, BvhHit& hit)
+{
+	if (bvh.Empty()) return false;
+
+	const SlabRay ray(origin, direction, tMin);
+
+	struct Entry {
+		uint32_t offset;
+		uint32_t count;
+		float t;
+	};
+	Entry stack[(Bvh::MAX_DEPTH + QUANTIZED_LEAF_SPLIT_DEPTH) * 3];
+	uint32_t stackSize = 0;
+	Entry current = { 0, 0, tMin };
+	float closest = tMax;
+	bool found = false;
+	for (;;) {
+		if (current.count != 0) {
+			for (uint32_t i = current.offset; i < current.offset + current.count; i++) {
+				float t, u, v;
+				if (!IntersectTriangle(bvh.triangles[i], ray.origin, ray.direction, tMin, closest, t, u, v)) continue;
+				closest = t;
+				found = true;
+				hit.t = t;
+				hit.barycentrics = DirectX::XMFLOAT2(u, v);
+				hit.geometry = bvh.primitives[i].geometry;
+				hit.primitive = bvh.primitives[i].primitive;
+			}
+		}
+		else {
+			const QuantizedBvhNode& node = bvh.nodes[current.offset];
+			alignas(16) float distances[4];
+			QuantizedNodeDistances(node, ray, closest, distances);
+
+			Entry hits[4];
+			uint32_t hitCount = 0;
+			for (uint32_t lane = 0; lane < node.laneCount; lane++) {
+				if (distances[lane] == FLT_MAX) continue;
+				uint32_t slot = hitCount++;
+				for (; slot > 0 && hits[slot - 1].t > distances[lane]; slot--) hits[slot] = hits[slot - 1];
+				hits[slot] = { node.offset[lane], node.count[lane], distances[lane] };
+			}
+			if (hitCount > 0) {
+				for (uint32_t i = hitCount - 1; i > 0; i--) stack[stackSize++] = hits[i];
+				current = hits[0];
+				continue;
+			}
+		}
+
+		do {
+			if (stackSize == 0) return found;
+			current = stack[--stackSize];
+		} while (current.t > closest);
+	}
+}
+
+bool BvhTraversal::IntersectAny(const QuantizedBvh& bvh, const DirectX::XMFLOAT3& origin, const DirectX::XMFLOAT3& direction, float tMin, float tMax)
+{
+	if (bvh.Empty()) return false;
+
+	const SlabRay ray(origin, direction, tMin);
+	uint32_t stack[(Bvh::MAX_DEPTH + QUANTIZED_LEAF_SPLIT_DEPTH) * 3];
+	uint32_t stackSize = 0;
+	uint32_t current = 0;
+	for (;;) {
+		const QuantizedBvhNode& node = bvh.nodes[current];
+		alignas(16) float distances[4];
+		QuantizedNodeDistances(node, ray, tMax, distances);
+
+		bool descend = false;
+		for (uint32_t lane = 0; lane < node.laneCount; lane++) {
+			if (distances[lane] == FLT_MAX) continue;
+			if (node.count[lane] != 0) {
+				if (AnyTriangle(bvh.triangles, node.offset[lane], node.count[lane], ray.origin, ray.direction, tMin, tMax)) return true;
+			}
+			else if (!descend) {
+				current = node.offset[lane];
+				descend = true;
+			}
+			else stack[stackSize++] = node.offset[lane];
+		}
+		if (descend) continue;
+		if (stackSize == 0) return false;
+		current = stack[--stackSize];
+	}
+}
+
+template WideBvh<4> BvhBuilder::Collapse<4>(const Bvh& bvh);
+template WideBvh<8> BvhBuilder::Collapse<8>(const Bvh& bvh);
+template double BvhBuilder::LaneOccupancy<4>(const WideBvh<4>& bvh);
+template double BvhBuilder::LaneOccupancy<8>(const WideBvh<8>& bvh);
+template bool BvhTraversal::IntersectClosest<4>(const WideBvh<4>& bvh, const DirectX::XMFLOAT3& origin, const DirectX::XMFLOAT3& direction, float tMin, float tMax, BvhHit& hit);
+template bool BvhTraversal::IntersectClosest<8>(const WideBvh<8>& bvh, const DirectX::XMFLOAT3& origin, const DirectX::XMFLOAT3& direction, float tMin, float tMax, BvhHit& hit);
+template bool BvhTraversal::IntersectAny<4>(const WideBvh<4>& bvh, const DirectX::XMFLOAT3& origin, const DirectX::XMFLOAT3& direction, float tMin, float tMax);
+template bool BvhTraversal::IntersectAny<8>(const WideBvh<8>& bvh, const DirectX::XMFLOAT3& origin, const DirectX::XMFLOAT3& direction, float tMin, float tMax);
@@ -0,0 +1,292 @@
+#pragma once
+#include "RaytracingScene.h"
+#include "ThreadPool.h"
+#include <cfloat>
+#include <span>
+
+namespace Dx12MasterProject {
+
+	//One geometry of a bottom level build, the CPU side of a D3D12_RAYTRACING_GEOMETRY_DESC. Positions are the first
+	//float3 of each vertex, indices are 32 bit.
+	struct BvhGeometryDesc {
+		const void* vertices = nullptr;
+		uint32_t vertexCount = 0;
+		uint32_t vertexStride = sizeof(RTVertexBufferLayout);
+		const uint32_t* indices = nullptr;
+		uint32_t indexCount = 0;
+
+		static BvhGeometryDesc Of(const RtGeometry& geometry) {
+			return { geometry.vertices.data(), (uint32_t)geometry.vertices.size(), sizeof(RTVertexBufferLayout), geometry.indices.data(), (uint32_t)geometry.indices.size() };
+		}
+	};
+
+	//Axis aligned box of a build input that is not a triangle, such as an instance of a bottom level.
+	struct BvhBox {
+		DirectX::XMFLOAT3 boundsMin;
+		DirectX::XMFLOAT3 boundsMax;
+	};
+
+	struct BvhBuildSettings {
+		uint32_t binCount = 16; // per axis, at most 64
+		uint32_t maxLeafSize = 4; // triangles
+		float traversalCost = 1.0f; // SAH cost of visiting a node, relative to intersectionCost
+		float intersectionCost = 1.0f;
+		uint32_t parallelThreshold = 8192; // nodes with at least this many triangles bin in parallel and build their children as separate tasks
+		float spatialSplitBudget = 0.0f; // extra triangle references spatial splits may add, as a fraction of the triangle count, 0 disables them
+		float spatialSplitOverlap = 1.0e-5f; // spatial splits are tried where the object split children overlap by this fraction of the root's area
+	};
+
+	struct LinearBvhSettings {
+		uint32_t mortonBits = 30; // 30 or 63, the longer codes keep ordering centroids closer than 1/1024 of the scene apart
+		uint32_t maxLeafSize = 4; // subtrees of up to this many triangles become one leaf where that lowers the SAH cost
+		uint32_t treeletPasses = 0; // optional treelet reorder passes, each one restructures only twice as large subtrees
+		float traversalCost = 1.0f;
+		float intersectionCost = 1.0f;
+		uint32_t parallelThreshold = 8192; // subtrees of at least this many triangles are flattened as separate tasks
+	};
+
+	//32 bytes. An interior node's first child directly follows it, offset is the second child. A leaf holds count
+	//primitives starting at offset.
+	struct BvhNode {
+		DirectX::XMFLOAT3 boundsMin;
+		uint32_t offset;
+		DirectX::XMFLOAT3 boundsMax;
+		uint32_t count; // 0 for interior nodes
+
+		bool IsLeaf() const { return count != 0; }
+	};
+
+	struct BvhPrimitive {
+		uint32_t geometry = 0; // index into the geometries the BVH was built from
+		uint32_t primitive = 0; // triangle within the geometry
+	};
+
+	//Leaf triangle in the form the intersection test consumes, stored in the same order as the primitive references.
+	struct BvhTriangle {
+		DirectX::XMFLOAT3 v0;
+		DirectX::XMFLOAT3 edge1; // v1 - v0
+		DirectX::XMFLOAT3 edge2; // v2 - v0
+	};
+
+	struct BvhHit {
+		float t = 0.0f;
+		DirectX::XMFLOAT2 barycentrics = DirectX::XMFLOAT2(0.0f, 0.0f); // weights of v1 and v2
+		uint32_t geometry = 0;
+		uint32_t primitive = 0;
+	};
+
+	//Rays sharing one origin, the layout of a pinhole camera tile. Directions are stored as structure of arrays and
+	//traced four at a time, t holds each ray's tMax going in and its closest hit coming out.
+	struct BvhRayPacket {
+		static constexpr uint32_t MAX_RAYS = 256; // a 16x16 tile
+
+		uint32_t rayCount = 0;
+		DirectX::XMFLOAT3 origin = DirectX::XMFLOAT3(0.0f, 0.0f, 0.0f);
+		float tMin = 0.0f;
+		alignas(16) float direction[3][MAX_RAYS];
+		alignas(16) float t[MAX_RAYS];
+		alignas(16) float u[MAX_RAYS]; // barycentrics of the hit, as in BvhHit
+		alignas(16) float v[MAX_RAYS];
+		uint32_t geometry[MAX_RAYS];
+		uint32_t primitive[MAX_RAYS];
+		bool hit[MAX_RAYS]; // set for the rays whose t the last traversal shortened
+	};
+
+	//Binary bottom level BVH in depth first order. Triangles with invalid indices or non finite positions are left out,
+	//as DXR treats them as inactive.
+	struct Bvh {
+		static constexpr uint32_t MAX_DEPTH = 64; // the builder never exceeds it, so traversal stacks can be fixed size
+
+		std::vector<BvhNode> nodes;
+		std::vector<BvhPrimitive> primitives;
+		std::vector<BvhTriangle> triangles;
+
+		bool Empty() const { return nodes.empty(); }
+		size_t MemoryBytes() const {
+			return nodes.size() * sizeof(BvhNode) + primitives.size() * sizeof(BvhPrimitive) + triangles.size() * sizeof(BvhTriangle);
+		}
+	};
+
+	//Child bounds of a wide node in structure of arrays form, so one vector slab test covers four children. Empty
+	//lanes hold an inverted box that no ray enters.
+	template<uint32_t Width>
+	struct alignas(64) WideBvhNode {
+		static_assert(Width % 4 == 0, "lanes are tested four at a time");
+
+		float bounds[2][3][Width]; // [min, max][axis][lane]
+		uint32_t offset[Width]; // child node, or first triangle of a leaf child
+		uint32_t count[Width]; // triangles of a leaf child, 0 for interior children and empty lanes
+	};
+
+	//A binary BVH collapsed into Width-ary nodes, the leaves and triangle order of the binary BVH are kept. Nodes are in
+	//depth first order with the root first.
+	template<uint32_t Width>
+	struct WideBvh {
+		std::vector<WideBvhNode<Width>> nodes;
+		std::vector<BvhPrimitive> primitives;
+		std::vector<BvhTriangle> triangles;
+
+		bool Empty() const { return nodes.empty(); }
+		size_t MemoryBytes() const {
+			return nodes.size() * sizeof(WideBvhNode<Width>) + primitives.size() * sizeof(BvhPrimitive) + triangles.size() * sizeof(BvhTriangle);
+		}
+	};
+
+	using Bvh4 = WideBvh<4>;
+	using Bvh8 = WideBvh<8>;
+
+	//64 bytes, a 4 wide node whose child boxes are stored as 8 bit steps on a grid over its own box (Ylitie, Karras and
+	//Laine 2017). Grid spacings are powers of two, so a plane origin + step * spacing rounds only once and the
+	//quantizer can make sure it still encloses the child. Leaf children live in their parent's lane as a triangle
+	//range, there are no leaf nodes.
+	struct alignas(64) QuantizedBvhNode {
+		static constexpr uint32_t MAX_LEAF_SIZE = UINT16_MAX;
+
+		DirectX::XMFLOAT3 origin; // min corner of the node's box
+		int8_t exponent[3]; // the grid spacing of each axis is 2^exponent
+		uint8_t laneCount; // used lanes, always the first ones
+		uint8_t bounds[2][3][4]; // [min, max][axis][lane], min steps rounded down and max steps up
+		uint32_t offset[4]; // child node, or first triangle of a leaf child
+		uint16_t count[4]; // triangles of a leaf child, 0 for interior children
+	};
+	static_assert(sizeof(QuantizedBvhNode) == 64, "one cache line per node");
+
+	//A 4 wide BVH with quantized nodes, in the 4 wide BVH's node order. Leaves of more than MAX_LEAF_SIZE triangles are
+	//spread over extra nodes at the end.
+	struct QuantizedBvh {
+		std::vector<QuantizedBvhNode> nodes;
+		std::vector<BvhPrimitive> primitives;
+		std::vector<BvhTriangle> triangles;
+
+		bool Empty() const { return nodes.empty(); }
+		size_t MemoryBytes() const {
+			return nodes.size() * sizeof(QuantizedBvhNode) + primitives.size() * sizeof(BvhPrimitive) + triangles.size() * sizeof(BvhTriangle);
+		}
+	};
+
+	struct BvhStats {
+		uint64_t nodeCount = 0;
+		uint64_t leafCount = 0;
+		uint64_t primitiveCount = 0;
+		uint32_t maxDepth = 0;
+		uint32_t maxLeafSize = 0;
+		float sahCost = 0.0f; // expected cost of a ray through the root bounds, in intersectionCost units
+
+		double PrimitivesPerLeaf() const { return leafCount > 0 ? (double)primitiveCount / (double)leafCount : 0.0; }
+	};
+
+	namespace BvhBuilder {
+		//Binned SAH (Wald 2007): centroids are binned along every axis and the cheapest plane between bins splits the
+		//node, a node becomes a leaf once splitting costs more than intersecting its triangles. Large nodes bin in
+		//parallel and hand one child to the pool. The result does not depend on the thread count.
+		//With a spatial split budget nodes may also cut triangles in two at a plane, which keeps a few huge triangles
+		//from bloating the boxes of everything around them (SBVH). Such triangles are referenced from more than one
+		//leaf, primitives and triangles then hold the duplicates.
+		Bvh Build(std::span<const BvhGeometryDesc> geometries, const BvhBuildSettings& settings = {}, ThreadPool* pool = nullptr);
+
+		//Linear BVH for per frame rebuilds: triangles are sorted along a Morton curve of their centroids with a parallel
+		//radix sort, the hierarchy then follows from the sorted codes and is emitted in parallel (Karras 2012). Builds
+		//in a fraction of the SAH build's time for a somewhat higher SAH cost, treelet passes recover part of it. The
+		//result does not depend on the thread count.
+		Bvh BuildLinear(std::span<const BvhGeometryDesc> geometries, const LinearBvhSettings& settings = {}, ThreadPool* pool = nullptr);
+
+		//Binned SAH build over boxes, for top levels. Primitive i of the result refers to box i with geometry 0, no
+		//triangles are stored. Empty or non finite boxes are left out, there is nothing to cut for spatial splits.
+		Bvh BuildOverBoxes(std::span<const BvhBox> boxes, const BvhBuildSettings& settings = {}, ThreadPool* pool = nullptr);
+
+		BvhStats Stats(const Bvh& bvh, const BvhBuildSettings& settings = {});
+
+		//Pulls grandchildren up into each node until it has Width children, always opening the interior child with the
+		//largest surface area as it is the one most rays would otherwise descend into. Implemented for 4 and 8.
+		template<uint32_t Width>
+		WideBvh<Width> Collapse(const Bvh& bvh);
+
+		//Average number of used lanes per node.
+		template<uint32_t Width>
+		double LaneOccupancy(const WideBvh<Width>& bvh);
+
+		//Quantizes every node of a 4 wide BVH, keeping its triangles. Child boxes grow by less than 2/255 of their parent's
+		//extent per side, so traversal visits a few more nodes than on the full precision boxes.
+		QuantizedBvh Quantize(const Bvh4& bvh);
+	}
+
+	namespace BvhTraversal {
+		//Closest triangle along origin + t * direction with t in [tMin, tMax], no face culling. Children are visited
+		//nearest first so later subtrees are cut off by the closest hit found so far.
+		bool IntersectClosest(const Bvh& bvh, const DirectX::XMFLOAT3& origin, const DirectX::XMFLOAT3& direction, float tMin, float tMax, BvhHit& hit);
+
+		//Same query over a wide BVH. All children of a node are slab tested with XMVECTOR math, the ones hit are sorted
+		//by entry distance and pushed far to near with that distance, popped entries beyond the closest hit are skipped.
+		template<uint32_t Width>
+		bool IntersectClosest(const WideBvh<Width>& bvh, const DirectX::XMFLOAT3& origin, const DirectX::XMFLOAT3& direction, float tMin, float tMax, BvhHit& hit);
+
+		//Closest hits of every ray of the packet, written to the packet. Nodes are entered with the first ray that hits
+		//them, the rays before it are inactive for the whole subtree. When that ray misses, an interval arithmetic test
+		//of the packet's frustum against the box skips the node for all rays before searching for another active one.
+		//The frustum bounds need every ray to run the same way along each axis, packets that straddle an axis are traced
+		//ray by ray. Hits are identical to IntersectClosest except for the choice between triangles at exactly the same
+		//distance. Returns the number of rays that were traced one by one.
+		uint32_t IntersectPacket(const Bvh& bvh, BvhRayPacket& packet);
+
+		//Same query on quantized nodes. Each node's child planes are dequantized in registers as it is tested. The closest
+		//hit is the full precision BVH's, up to the choice between triangles at exactly the same distance.
+		bool IntersectClosest(const QuantizedBvh& bvh, const DirectX::XMFLOAT3& origin, const DirectX::XMFLOAT3& direction, float tMin, float tMax, BvhHit& hit);
+
+		//Whether any triangle lies along the ray within [tMin, tMax], the query of shadow rays. Returns on the first
+		//intersection found and keeps no hit attributes. Leaf children whose box the ray enters are tested before any
+		//interior child is descended into, as any triangle ends the search, and the wide layouts do not sort their
+		//children by distance.
+		bool IntersectAny(const Bvh& bvh, const DirectX::XMFLOAT3& origin, const DirectX::XMFLOAT3& direction, float tMin, float tMax);
+		template<uint32_t Width>
+		bool IntersectAny(const WideBvh<Width>& bvh, const DirectX::XMFLOAT3& origin, const DirectX::XMFLOAT3& direction, float tMin, float tMax);
+		bool IntersectAny(const QuantizedBvh& bvh, const DirectX::XMFLOAT3& origin, const DirectX::XMFLOAT3& direction, float tMin, float tMax);
+
+		//1 / direction with zero components replaced, a zero would turn the slab distances of a box starting at the origin into NaN.
+		inline void InverseDirection(const float direction[3], float inverseDirection[3])
+		{
+			for (int axis = 0; axis < 3; axis++) {
+				const float component = direction[axis] != 0.0f ? direction[axis] : 1.0e-30f;
+				inverseDirection[axis] = 1.0f / component;
+			}
+		}
+
+		//Entry distance of the ray into the node's box, FLT_MAX when it misses [tMin, tMax].
+		inline float IntersectBox(const BvhNode& node, const float origin[3], const float inverseDirection[3], float tMin, float tMax)
+		{
+			const float* boundsMin = &node.boundsMin.x;
+			const float* boundsMax = &node.boundsMax.x;
+			float enter = tMin, exit = tMax;
+			for (int axis = 0; axis < 3; axis++) {
+				float t0 = (boundsMin[axis] - origin[axis]) * inverseDirection[axis];
+				float t1 = (boundsMax[axis] - origin[axis]) * inverseDirection[axis];
+				if (t0 > t1) std::swap(t0, t1);
+				enter = (std::max)(enter, t0);
+				// Widened by two ulps so rounding cannot lose a hit that grazes the box (Ize 2013)
+				exit = (std::min)(exit, t1 * 1.00000024f);
+			}
+			return enter <= exit ? enter : FLT_MAX;
+		}
+
+		//Moller-Trumbore, u and v are the barycentrics of the second and third vertex.
+		inline bool IntersectTriangle(const BvhTriangle& triangle, const float origin[3], const float direction[3], float tMin, float tMax, float& t, float& u, float& v)
+		{
+			const DirectX::XMFLOAT3& e1 = triangle.edge1;
+			const DirectX::XMFLOAT3& e2 = triangle.edge2;
+			const float pvec[3] = { direction[1] * e2.z - direction[2] * e2.y, direction[2] * e2.x - direction[0] * e2.z, direction[0] * e2.y - direction[1] * e2.x };
+			const float det = e1.x * pvec[0] + e1.y * pvec[1] + e1.z * pvec[2];
+			if (det == 0.0f) return false;
+
+			const float invDet = 1.0f / det;
+			const float tvec[3] = { origin[0] - triangle.v0.x, origin[1] - triangle.v0.y, origin[2] - triangle.v0.z };
+			u = (tvec[0] * pvec[0] + tvec[1] * pvec[1] + tvec[2] * pvec[2]) * invDet;
+			if (u < 0.0f || u > 1.0f) return false;
+
+			const float qvec[3] = { tvec[1] * e1.z - tvec[2] * e1.y, tvec[2] * e1.x - tvec[0] * e1.z, tvec[0] * e1.y - tvec[1] * e1.x };
+			v = (direction[0] * qvec[0] + direction[1] * qvec[1] + direction[2] * qvec[2]) * invDet;
+			if (v < 0.0f || u + v > 1.0f) return false;
+
+			t = (e2.x * qvec[0] + e2.y * qvec[1] + e2.z * qvec[2]) * invDet;
+			return t >= tMin && t <= tMax;
+		}
+	}
+}
@@ -0,0 +1,160 @@
+#include "BvhCache.h"
+#include "MeshCache.h"
+#include <filesystem>
+#include <iomanip>
+
+using namespace Dx12MasterProject;
+
+namespace {
+	uint64_t AlignBlob(uint64_t offset)
+	{
+		return (offset + BvhCache::BLOB_ALIGNMENT - 1) & ~(BvhCache::BLOB_ALIGNMENT - 1);
+	}
+
+	bool BlobInFile(uint64_t offset, uint64_t byteSize, uint64_t fileSize)
+	{
+		return offset % BvhCache::BLOB_ALIGNMENT == 0 && offset <= fileSize && byteSize <= fileSize - offset;
+	}
+
+	//Every link points forward within the arrays and no path is deeper than traversal stacks allow.
+	bool NodesValid(const BvhNode* nodes, uint32_t nodeCount, uint32_t primitiveCount)
+	{
+		std::vector<uint32_t> depths(nodeCount, 0);
+		for (uint32_t i = 0; i < nodeCount; i++) {
+			const BvhNode& node = nodes[i];
+			if (node.IsLeaf()) {
+				if ((uint64_t)node.offset + node.count > primitiveCount) return false;
+				continue;
+			}
+			if (i + 1 >= nodeCount || node.offset <= i || node.offset >= nodeCount || depths[i] >= Bvh::MAX_DEPTH) return false;
+			depths[i + 1] = (std::max)(depths[i + 1], depths[i] + 1);
+			depths[node.offset] = (std::max)(depths[node.offset], depths[i] + 1);
+		}
+		return true;
+	}
+
+	//Every primitive names a geometry and a triangle of the inputs the key was hashed from.
+	bool PrimitivesValid(const BvhPrimitive* primitives, uint32_t primitiveCount, std::span<const uint32_t> triangleCounts)
+	{
+		for (uint32_t i = 0; i < primitiveCount; i++) {
+			if (primitives[i].geometry >= triangleCounts.size() || primitives[i].primitive >= triangleCounts[primitives[i].geometry]) return false;
+		}
+		return true;
+	}
+}
+
+uint64_t BvhCache::KeyFor(std::span<const BvhGeometryDesc> geometries, const BvhBuildSettings& settings)
+{
+	// The split between threads never changes the result, so it does not invalidate caches
+	BvhBuildSettings keyed = settings;
+	keyed.parallelThreshold = 0;
+	uint64_t key = HashBytes(&keyed, sizeof(keyed));
+	for (const BvhGeometryDesc& geometry : geometries) {
+		const uint32_t counts[3] = { geometry.vertexCount, geometry.vertexStride, geometry.indexCount };
+		key = HashBytes(counts, sizeof(counts), key);
+		if (geometry.vertices != nullptr) key = HashBytes(geometry.vertices, (size_t)geometry.vertexCount * geometry.vertexStride, key);
+		if (geometry.indices != nullptr) key = HashBytes(geometry.indices, (size_t)geometry.indexCount * sizeof(uint32_t), key);
+	}
+	return key;
+}
+
+std::string BvhCache::CachePathFor(const std::string& directory, uint64_t key)
+{
+	std::ostringstream stream;
+	stream << std::hex << std::setw(16) << std::setfill('0') << key;
+	return directory + "/" + stream.str() + ".bvhcache";
+}
+
+bool BvhCache::Write(const std::string& cachePath, uint64_t key, const Bvh& bvh)
+{
+	FileHeader fileHeader;
+	fileHeader.key = key;
+	fileHeader.nodeCount = (uint32_t)bvh.nodes.size();
+	fileHeader.primitiveCount = (uint32_t)bvh.primitives.size();
+	fileHeader.nodeOffset = AlignBlob(sizeof(FileHeader));
+	fileHeader.primitiveOffset = AlignBlob(fileHeader.nodeOffset + sizeof(BvhNode) * bvh.nodes.size());
+	fileHeader.triangleOffset = AlignBlob(fileHeader.primitiveOffset + sizeof(BvhPrimitive) * bvh.primitives.size());
+	fileHeader.fileSize = AlignBlob(fileHeader.triangleOffset + sizeof(BvhTriangle) * bvh.triangles.size());
+
+	// Written to a temporary first so a crash mid write never leaves a cache that looks valid
+	const std::string tempPath = cachePath + ".tmp";
+	{
+		std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+		if (!out) return false;
+
+		const char padding[BLOB_ALIGNMENT] = {};
+		auto writePadded = [&](const void* data, uint64_t byteSize) {
+			out.write(static_cast<const char*>(data), byteSize);
+			uint64_t position = (uint64_t)out.tellp();
+			out.write(padding, AlignBlob(position) - position);
+		};
+
+		writePadded(&fileHeader, sizeof(fileHeader));
+		writePadded(bvh.nodes.data(), sizeof(BvhNode) * bvh.nodes.size());
+		writePadded(bvh.primitives.data(), sizeof(BvhPrimitive) * bvh.primitives.size());
+		writePadded(bvh.triangles.data(), sizeof(BvhTriangle) * bvh.triangles.size());
+		if (!out) return false;
+	}
+
+	std::error_code error;
+	std::filesystem::rename(tempPath, cachePath, error);
+	return !error;
+}
+
+bool BvhCache::Read(const std::string& cachePath, uint64_t key, std::span<const uint32_t> triangleCounts, Bvh& bvh)
+{
+	MappedFile file;
+	if (!file.Open(cachePath)) return false;
+
+	const uint64_t fileSize = file.Size();
+	if (fileSize < sizeof(FileHeader)) return false;
+
+	const FileHeader* fileHeader = reinterpret_cast<const FileHeader*>(file.Data());
+	const bool headerValid = fileHeader->magic == MAGIC &&
+		fileHeader->version == VERSION &&
+		fileHeader->key == key &&
+		fileHeader->nodeSize == sizeof(BvhNode) &&
+		fileHeader->primitiveSize == sizeof(BvhPrimitive) &&
+		fileHeader->triangleSize == sizeof(BvhTriangle) &&
+		fileHeader->maxDepth == Bvh::MAX_DEPTH &&
+		fileHeader->fileSize == fileSize &&
+		BlobInFile(fileHeader->nodeOffset, sizeof(BvhNode) * (uint64_t)fileHeader->nodeCount, fileSize) &&
+		BlobInFile(fileHeader->primitiveOffset, sizeof(BvhPrimitive) * (uint64_t)fileHeader->primitiveCount, fileSize) &&
+		BlobInFile(fileHeader->triangleOffset, sizeof(BvhTriangle) * (uint64_t)fileHeader->primitiveCount, fileSize);
+	if (!headerValid) return false;
+
+	const BvhNode* nodes = reinterpret_cast<const BvhNode*>(file.Data() + fileHeader->nodeOffset);
+	if (!NodesValid(nodes, fileHeader->nodeCount, fileHeader->primitiveCount)) return false;
+	const BvhPrimitive* primitives = reinterpret_cast<const BvhPrimitive*>(file.Data() + fileHeader->primitiveOffset);
+	if (!PrimitivesValid(primitives, fileHeader->primitiveCount, triangleCounts)) return false;
+
+	Bvh cached;
+	auto copyBlob = [&](auto& destination, uint64_t offset, size_t count) {
+		destination.resize(count);
+		if (count > 0) memcpy(destination.data(), file.Data() + offset, sizeof(destination[0]) * count);
+	};
+	copyBlob(cached.nodes, fileHeader->nodeOffset, fileHeader->nodeCount);
+	copyBlob(cached.primitives, fileHeader->primitiveOffset, fileHeader->primitiveCount);
+	copyBlob(cached.triangles, fileHeader->triangleOffset, fileHeader->primitiveCount);
+	bvh = std::move(cached);
+	return true;
+}
+
+Bvh BvhCache::BuildCached(const std::string& directory, std::span<const BvhGeometryDesc> geometries, const BvhBuildSettings& settings, ThreadPool* pool, bool* hit)
+{
+	const uint64_t key = KeyFor(geometries, settings);
+	const std::string cachePath = CachePathFor(directory, key);
+	std::vector<uint32_t> triangleCounts;
+	triangleCounts.reserve(geometries.size());
+	for (const BvhGeometryDesc& geometry : geometries) triangleCounts.push_back(geometry.indexCount / 3);
+	Bvh bvh;
+	const bool cached = Read(cachePath, key, triangleCounts, bvh);
+	if (hit != nullptr) *hit = cached;
+	if (cached) return bvh;
+
+	bvh = BvhBuilder::Build(geometries, settings, pool);
+	std::error_code error;
+	std::filesystem::create_directories(directory, error);
+	Write(cachePath, key, bvh);
+	return bvh;
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include "Bvh.h"
+#include <string>
+
+namespace Dx12MasterProject {
+
+	/*
+		BVH cache file layout (all offsets from the start of the file, blobs 16 byte aligned). The arrays of a Bvh are
+		stored as they are in memory: children and leaves refer to each other by index, so the file holds no pointers
+		and reads back at any address.
+		The cache stays outside the AssetDatabase: a bottom level is keyed by the geometry it is built from, which a
+		scene assembles from any number of source models, so there is no one source record to hang it on. The key is
+		already the content hash, a stale file is never read and a new one never overwrites it.
+		-FileHeader
+		-BvhNode[nodeCount], BvhPrimitive[primitiveCount], BvhTriangle[primitiveCount]
+	*/
+	namespace BvhCache {
+		const uint32_t MAGIC = 0x48435642; // "BVCH"
+		const uint32_t VERSION = 1;
+		const uint64_t BLOB_ALIGNMENT = 16;
+
+		struct FileHeader {
+			uint32_t magic = MAGIC;
+			uint32_t version = VERSION;
+			uint64_t key = 0;
+			uint32_t nodeSize = sizeof(BvhNode);
+			uint32_t primitiveSize = sizeof(BvhPrimitive);
+			uint32_t triangleSize = sizeof(BvhTriangle);
+			uint32_t maxDepth = Bvh::MAX_DEPTH;
+			uint64_t fileSize = 0;
+			uint32_t nodeCount = 0;
+			uint32_t primitiveCount = 0;
+			uint64_t nodeOffset = 0;
+			uint64_t primitiveOffset = 0;
+			uint64_t triangleOffset = 0;
+		};
+
+		//Hash of everything a BvhBuilder::Build result depends on: the vertex and index data of every geometry, in order,
+		//and the build settings.
+		uint64_t KeyFor(std::span<const BvhGeometryDesc> geometries, const BvhBuildSettings& settings);
+		std::string CachePathFor(const std::string& directory, uint64_t key);
+
+		bool Write(const std::string& cachePath, uint64_t key, const Bvh& bvh);
+
+		//Maps the cache and copies its arrays out, one memcpy each. Fails on any version, key or size mismatch, on node
+		//links that would take traversal out of the arrays and on primitives outside the geometries, triangleCounts holds
+		//one entry per geometry the key was hashed from.
+		bool Read(const std::string& cachePath, uint64_t key, std::span<const uint32_t> triangleCounts, Bvh& bvh);
+
+		//BvhBuilder::Build through a cache directory: a warm start reads the BVH, a cold one builds and writes it. hit
+		//tells which happened.
+		Bvh BuildCached(const std::string& directory, std::span<const BvhGeometryDesc> geometries, const BvhBuildSettings& settings = {},
+			ThreadPool* pool = nullptr, bool* hit = nullptr);
+	}
+}
@@ -0,0 +1,416 @@
+#include "CpuRaytracer.h"
+#include "BvhCache.h"
+#include <chrono>
+
+using namespace Dx12MasterProject;
+
+namespace {
+	constexpr uint32_t PRIMARY_RAY_INDEX = 0;
+
+	DirectX::XMFLOAT3 LinearToSrgb(const DirectX::XMFLOAT3& c)
+	{
+		// Based on http://chilliant.blogspot.com/2012/08/srgb-approximations-for-hlsl.html
+		auto channel = [](float value) {
+			const float sq1 = std::sqrt(value);
+			const float sq2 = std::sqrt(sq1);
+			const float sq3 = std::sqrt(sq2);
+			return 0.662002687f * sq1 + 0.684122060f * sq2 - 0.323583601f * sq3 - 0.0225411470f * value;
+		};
+		return DirectX::XMFLOAT3(channel(c.x), channel(c.y), channel(c.z));
+	}
+
+	//Float to UNORM conversion of a render target write, alpha is always 1.
+	uint32_t PackUnorm(const DirectX::XMFLOAT3& color)
+	{
+		auto channel = [](float value) { return (uint32_t)((std::min)((std::max)(value, 0.0f), 1.0f) * 255.0f + 0.5f); };
+		return channel(color.x) | (channel(color.y) << 8) | (channel(color.z) << 16) | (255u << 24);
+	}
+
+	//Instances whose box at least one ray of the packet enters, in depth first order. The packet's hits carry over from
+	//one instance to the next, so the order only decides how soon rays get shortened.
+	void PacketInstances(const TopLevelBvh& topLevel, std::span<const CpuRay> rays, uint8_t instanceMask, std::vector<uint32_t>& instances)
+	{
+		const Bvh& tree = topLevel.Tree();
+		if (tree.Empty()) return;
+
+		const float origin[3] = { rays[0].origin.x, rays[0].origin.y, rays[0].origin.z };
+		std::array<std::array<float, 3>, BvhRayPacket::MAX_RAYS> inverseDirections;
+		for (size_t r = 0; r < rays.size(); r++) BvhTraversal::InverseDirection(&rays[r].direction.x, inverseDirections[r].data());
+		auto entered = [&](const BvhNode& node) {
+			for (size_t r = 0; r < rays.size(); r++) {
+				if (BvhTraversal::IntersectBox(node, origin, inverseDirections[r].data(), rays[r].tMin, rays[r].tMax) != FLT_MAX) return true;
+			}
+			return false;
+		};
+
+		uint32_t stack[Bvh::MAX_DEPTH + 1];
+		uint32_t stackSize = 0;
+		if (entered(tree.nodes[0])) stack[stackSize++] = 0;
+		while (stackSize > 0) {
+			const uint32_t index = stack[--stackSize];
+			const BvhNode& node = tree.nodes[index];
+			if (node.IsLeaf()) {
+				for (uint32_t p = node.offset; p < node.offset + node.count; p++) {
+					const uint32_t instance = tree.primitives[p].primitive;
+					if ((topLevel.Instance(instance).mask & instanceMask) != 0) instances.push_back(instance);
+				}
+				continue;
+			}
+			if (entered(tree.nodes[node.offset])) stack[stackSize++] = node.offset;
+			if (entered(tree.nodes[index + 1])) stack[stackSize++] = index + 1;
+		}
+	}
+}
+
+CpuRaytracer::CpuRaytracer(const RtScene& scene, const BvhBuildSettings& settings, ThreadPool* pool, CpuBvhLayout layout, const std::string& bvhCacheDirectory) :
+	mScene(scene), mLayout(layout)
+{
+	for (const std::vector<uint32_t>& bottomLevel : scene.bottomLevels) {
+		std::vector<BvhGeometryDesc> geometries;
+		for (uint32_t geometry : bottomLevel) geometries.push_back(BvhGeometryDesc::Of(scene.geometries[geometry]));
+		const Bvh& bvh = mBottomLevels.emplace_back(bvhCacheDirectory.empty() ? BvhBuilder::Build(geometries, settings, pool) :
+			BvhCache::BuildCached(bvhCacheDirectory, geometries, settings, pool));
+		if (layout == CpuBvhLayout::Wide4) mWideBottomLevels4.push_back(BvhBuilder::Collapse<4>(bvh));
+		else if (layout == CpuBvhLayout::Wide8) mWideBottomLevels8.push_back(BvhBuilder::Collapse<8>(bvh));
+		else if (layout == CpuBvhLayout::Quantized4) mQuantizedBottomLevels.push_back(BvhBuilder::Quantize(BvhBuilder::Collapse<4>(bvh)));
+	}
+
+	mTopLevel = TopLevelBvh(scene.instances, mBottomLevels, {}, pool);
+}
+
+TopLevelUpdate CpuRaytracer::UpdateInstanceTransforms(std::span<const DirectX::XMFLOAT4X4> world, ThreadPool* pool)
+{
+	assert(world.size() == mTopLevel.InstanceCount());
+	for (uint32_t i = 0; i < mTopLevel.InstanceCount(); i++) mTopLevel.SetTransform(i, world[i]);
+	return mTopLevel.Update(pool);
+}
+
+bool CpuRaytracer::TraceClosest(const CpuRay& ray, uint8_t instanceMask, CpuHit& hit) const
+{
+	const DirectX::XMVECTOR worldOrigin = DirectX::XMLoadFloat3(&ray.origin);
+	const DirectX::XMVECTOR worldDirection = DirectX::XMLoadFloat3(&ray.direction);
+	float closest = ray.tMax;
+	bool found = false;
+
+	TopLevelTraversal instances(mTopLevel, ray.origin, ray.direction, ray.tMin, instanceMask);
+	for (uint32_t i = instances.Next(closest); i != TopLevelTraversal::END; i = instances.Next(closest)) {
+		const TopLevelInstance& instance = mTopLevel.Instance(i);
+
+		// The direction is not renormalized, so t measured in object space is the world space t
+		const DirectX::XMMATRIX worldToObject = DirectX::XMLoadFloat3x4(&instance.inverse);
+		DirectX::XMFLOAT3 origin, direction;
+		DirectX::XMStoreFloat3(&origin, DirectX::XMVector3TransformCoord(worldOrigin, worldToObject));
+		DirectX::XMStoreFloat3(&direction, DirectX::XMVector3TransformNormal(worldDirection, worldToObject));
+
+		BvhHit bvhHit;
+		bool intersected = false;
+		switch (mLayout) {
+		case CpuBvhLayout::Binary:
+			intersected = BvhTraversal::IntersectClosest(mBottomLevels[instance.bottomLevel], origin, direction, ray.tMin, closest, bvhHit);
+			break;
+		case CpuBvhLayout::Wide4:
+			intersected = BvhTraversal::IntersectClosest(mWideBottomLevels4[instance.bottomLevel], origin, direction, ray.tMin, closest, bvhHit);
+			break;
+		case CpuBvhLayout::Wide8:
+			intersected = BvhTraversal::IntersectClosest(mWideBottomLevels8[instance.bottomLevel], origin, direction, ray.tMin, closest, bvhHit);
+			break;
+		case CpuBvhLayout::Quantized4:
+			intersected = BvhTraversal::IntersectClosest(mQuantizedBottomLevels[instance.bottomLevel], origin, direction, ray.tMin, closest, bvhHit);
+			break;
+		}
+		if (!intersected) continue;
+		closest = bvhHit.t;
+		found = true;
+		hit.t = bvhHit.t;
+		hit.barycentrics = bvhHit.barycentrics;
+		hit.instance = i;
+		hit.geometry = bvhHit.geometry;
+		hit.primitive = bvhHit.primitive;
+	}
+	return found;
+}
+
+bool CpuRaytracer::TraceAny(const CpuRay& ray, uint8_t instanceMask) const
+{
+	const DirectX::XMVECTOR worldOrigin = DirectX::XMLoadFloat3(&ray.origin);
+	const DirectX::XMVECTOR worldDirection = DirectX::XMLoadFloat3(&ray.direction);
+
+	TopLevelTraversal instances(mTopLevel, ray.origin, ray.direction, ray.tMin, instanceMask);
+	for (uint32_t i = instances.Next(ray.tMax); i != TopLevelTraversal::END; i = instances.Next(ray.tMax)) {
+		const TopLevelInstance& instance = mTopLevel.Instance(i);
+		const DirectX::XMMATRIX worldToObject = DirectX::XMLoadFloat3x4(&instance.inverse);
+		DirectX::XMFLOAT3 origin, direction;
+		DirectX::XMStoreFloat3(&origin, DirectX::XMVector3TransformCoord(worldOrigin, worldToObject));
+		DirectX::XMStoreFloat3(&direction, DirectX::XMVector3TransformNormal(worldDirection, worldToObject));
+
+		bool intersected = false;
+		switch (mLayout) {
+		case CpuBvhLayout::Binary:
+			intersected = BvhTraversal::IntersectAny(mBottomLevels[instance.bottomLevel], origin, direction, ray.tMin, ray.tMax);
+			break;
+		case CpuBvhLayout::Wide4:
+			intersected = BvhTraversal::IntersectAny(mWideBottomLevels4[instance.bottomLevel], origin, direction, ray.tMin, ray.tMax);
+			break;
+		case CpuBvhLayout::Wide8:
+			intersected = BvhTraversal::IntersectAny(mWideBottomLevels8[instance.bottomLevel], origin, direction, ray.tMin, ray.tMax);
+			break;
+		case CpuBvhLayout::Quantized4:
+			intersected = BvhTraversal::IntersectAny(mQuantizedBottomLevels[instance.bottomLevel], origin, direction, ray.tMin, ray.tMax);
+			break;
+		}
+		if (intersected) return true;
+	}
+	return false;
+}
+
+uint32_t CpuRaytracer::TraceClosestPacket(std::span<const CpuRay> rays, uint8_t instanceMask, std::span<CpuHit> hits, std::span<bool> found) const
+{
+	assert(!rays.empty() && rays.size() <= BvhRayPacket::MAX_RAYS && hits.size() >= rays.size() && found.size() >= rays.size());
+	BvhRayPacket packet;
+	packet.rayCount = (uint32_t)rays.size();
+	packet.tMin = rays[0].tMin;
+	for (uint32_t r = 0; r < packet.rayCount; r++) {
+		packet.t[r] = rays[r].tMax;
+		found[r] = false;
+	}
+
+	// Closest hits carry over between instances in packet.t, as closest does in TraceClosest
+	const DirectX::XMVECTOR worldOrigin = DirectX::XMLoadFloat3(&rays[0].origin);
+	uint32_t singleRays = 0;
+	std::vector<uint32_t> instances;
+	PacketInstances(mTopLevel, rays, instanceMask, instances);
+	for (uint32_t i : instances) {
+		const TopLevelInstance& instance = mTopLevel.Instance(i);
+		const DirectX::XMMATRIX worldToObject = DirectX::XMLoadFloat3x4(&instance.inverse);
+		DirectX::XMStoreFloat3(&packet.origin, DirectX::XMVector3TransformCoord(worldOrigin, worldToObject));
+		for (uint32_t r = 0; r < packet.rayCount; r++) {
+			DirectX::XMFLOAT3 direction;
+			DirectX::XMStoreFloat3(&direction, DirectX::XMVector3TransformNormal(DirectX::XMLoadFloat3(&rays[r].direction), worldToObject));
+			packet.direction[0][r] = direction.x;
+			packet.direction[1][r] = direction.y;
+			packet.direction[2][r] = direction.z;
+		}
+
+		singleRays += BvhTraversal::IntersectPacket(mBottomLevels[instance.bottomLevel], packet);
+		for (uint32_t r = 0; r < packet.rayCount; r++) {
+			if (!packet.hit[r]) continue;
+			found[r] = true;
+			hits[r].t = packet.t[r];
+			hits[r].barycentrics = DirectX::XMFLOAT2(packet.u[r], packet.v[r]);
+			hits[r].instance = i;
+			hits[r].geometry = packet.geometry[r];
+			hits[r].primitive = packet.primitive[r];
+		}
+	}
+	return singleRays;
+}
+
+const RtHitRecord& CpuRaytracer::HitGroup(const CpuHit& hit, uint32_t rayIndex) const
+{
+	const uint32_t record = mTopLevel.Instance(hit.instance).hitGroupOffset + hit.geometry * DemoScene::RAY_TYPE_COUNT + rayIndex;
+	return mScene.hitGroups[record];
+}
+
+void CpuRaytracer::TraceRay(const CpuRay& ray, uint8_t instanceMask, RayPayload& payload, RayCounts& counts) const
+{
+	counts.primary++;
+	CpuHit hit;
+	const bool found = TraceClosest(ray, instanceMask, hit);
+	InvokeHitOrMiss(ray, found, hit, payload, counts);
+}
+
+void CpuRaytracer::InvokeHitOrMiss(const CpuRay& ray, bool found, const CpuHit& hit, RayPayload& payload, RayCounts& counts) const
+{
+	if (!found) {
+		Miss(payload);
+		return;
+	}
+
+	const RtHitRecord& record = HitGroup(hit, PRIMARY_RAY_INDEX);
+	if (record.program == RtHitProgram::Plane) PlaneHit(payload, ray, hit, counts);
+	else Hit(payload, hit, mScene.colourSets[record.colourSet]);
+}
+
+void CpuRaytracer::TraceRay(const CpuRay& ray, uint8_t instanceMask, ShadowPayload& payload, RayCounts& counts) const
+{
+	counts.shadow++;
+	// Shadow rays are traced with RAY_FLAG_ACCEPT_FIRST_HIT_AND_END_SEARCH and every hit group runs ShadowHit for
+	// them, so which triangle was hit never matters
+	if (TraceAny(ray, instanceMask)) {
+		ShadowHit(payload);
+	}
+	else {
+		ShadowMiss(payload);
+	}
+}
+
+CpuRay CpuRaytracer::PrimaryRay(uint32_t x, uint32_t y, uint32_t width, uint32_t height) const
+{
+	const float dx = ((float)x / (float)width) * 2.0f - 1.0f;
+	const float dy = ((float)y / (float)height) * 2.0f - 1.0f;
+	const float aspectRatio = (float)width / (float)height;
+
+	CpuRay ray;
+	ray.origin = DirectX::XMFLOAT3(0.0f, 0.0f, -2.0f);
+	DirectX::XMStoreFloat3(&ray.direction, DirectX::XMVector3Normalize(DirectX::XMVectorSet(dx * aspectRatio, -dy, 1.0f, 0.0f)));
+	ray.tMin = 0.0f;
+	ray.tMax = 100000.0f;
+	return ray;
+}
+
+DirectX::XMFLOAT3 CpuRaytracer::RayGen(uint32_t x, uint32_t y, uint32_t width, uint32_t height, RayCounts& counts) const
+{
+	RayPayload payload;
+	TraceRay(PrimaryRay(x, y, width, height), 0xFF, payload, counts);
+	return LinearToSrgb(payload.color);
+}
+
+void CpuRaytracer::RayGenTile(uint32_t x0, uint32_t y0, uint32_t tileWidth, uint32_t tileHeight, uint32_t width, uint32_t height, uint32_t* pixels, RayCounts& counts) const
+{
+	std::array<CpuRay, BvhRayPacket::MAX_RAYS> rays;
+	std::array<CpuHit, BvhRayPacket::MAX_RAYS> hits;
+	std::array<bool, BvhRayPacket::MAX_RAYS> found;
+	const uint32_t rayCount = tileWidth * tileHeight;
+	for (uint32_t y = 0; y < tileHeight; y++) {
+		for (uint32_t x = 0; x < tileWidth; x++) rays[y * tileWidth + x] = PrimaryRay(x0 + x, y0 + y, width, height);
+	}
+	counts.fallback += TraceClosestPacket(std::span(rays.data(), rayCount), 0xFF, hits, found);
+
+	for (uint32_t i = 0; i < rayCount; i++) {
+		counts.primary++;
+		RayPayload payload;
+		InvokeHitOrMiss(rays[i], found[i], hits[i], payload, counts);
+		pixels[(size_t)(y0 + i / tileWidth) * width + x0 + i % tileWidth] = PackUnorm(LinearToSrgb(payload.color));
+	}
+}
+
+void CpuRaytracer::Miss(RayPayload& payload) const
+{
+	payload.color = DirectX::XMFLOAT3(0.4f, 0.6f, 0.2f);
+}
+
+void CpuRaytracer::Hit(RayPayload& payload, const CpuHit& hit, const std::array<DirectX::XMFLOAT3, 3>& colours) const
+{
+	const DirectX::XMFLOAT3 barycentrics(1.0f - hit.barycentrics.x - hit.barycentrics.y, hit.barycentrics.x, hit.barycentrics.y);
+	payload.color = DirectX::XMFLOAT3(
+		colours[0].x * barycentrics.x + colours[1].x * barycentrics.y + colours[2].x * barycentrics.z,
+		colours[0].y * barycentrics.x + colours[1].y * barycentrics.y + colours[2].y * barycentrics.z,
+		colours[0].z * barycentrics.x + colours[1].z * barycentrics.y + colours[2].z * barycentrics.z);
+}
+
+void CpuRaytracer::PlaneHit(RayPayload& payload, const CpuRay& ray, const CpuHit& hit, RayCounts& counts) const
+{
+	CpuRay shadowRay;
+	shadowRay.origin = DirectX::XMFLOAT3(ray.origin.x + hit.t * ray.direction.x, ray.origin.y + hit.t * ray.direction.y, ray.origin.z + hit.t * ray.direction.z);
+	DirectX::XMStoreFloat3(&shadowRay.direction, DirectX::XMVector3Normalize(DirectX::XMVectorSet(0.5f, 0.5f, -0.5f, 0.0f)));
+	shadowRay.tMin = 0.01f;
+	shadowRay.tMax = 100000.0f;
+
+	ShadowPayload shadowPayload;
+	TraceRay(shadowRay, 0xFF, shadowPayload, counts);
+
+	const float factor = shadowPayload.hit ? 0.1f : 1.0f;
+	payload.color = DirectX::XMFLOAT3(0.9f * factor, 0.9f * factor, 0.9f * factor);
+}
+
+void CpuRaytracer::ShadowHit(ShadowPayload& payload) const
+{
+	payload.hit = true;
+}
+
+void CpuRaytracer::ShadowMiss(ShadowPayload& payload) const
+{
+	payload.hit = false;
+}
+
+CpuRenderStats CpuRaytracer::Render(uint32_t width, uint32_t height, std::vector<uint32_t>& pixels, ThreadPool* pool, uint32_t packetSize) const
+{
+	auto start = std::chrono::steady_clock::now();
+	ThreadPool& threadPool = pool != nullptr ? *pool : ThreadPool::Global();
+	pixels.resize((size_t)width * height);
+	// Packets walk the binary BVHs, the other layouts keep their own kernels for every ray
+	packetSize = mLayout == CpuBvhLayout::Binary ? (std::min)((std::max)(packetSize, 1u), MAX_PACKET_SIZE) : 1;
+
+	// One task per row of tiles, or per pixel row when every ray is traced on its own
+	std::atomic<uint64_t> primaryRays = 0;
+	std::atomic<uint64_t> shadowRays = 0;
+	std::atomic<uint64_t> fallbackRays = 0;
+	threadPool.ParallelFor((height + packetSize - 1) / packetSize, [&](uint32_t band) {
+		RayCounts counts;
+		const uint32_t y0 = band * packetSize;
+		if (packetSize == 1) {
+			uint32_t* row = pixels.data() + (size_t)y0 * width;
+			for (uint32_t x = 0; x < width; x++) row[x] = PackUnorm(RayGen(x, y0, width, height, counts));
+		}
+		else {
+			const uint32_t tileHeight = (std::min)(packetSize, height - y0);
+			for (uint32_t x0 = 0; x0 < width; x0 += packetSize) RayGenTile(x0, y0, (std::min)(packetSize, width - x0), tileHeight, width, height, pixels.data(), counts);
+		}
+		primaryRays.fetch_add(counts.primary, std::memory_order_relaxed);
+		shadowRays.fetch_add(counts.shadow, std::memory_order_relaxed);
+		fallbackRays.fetch_add(counts.fallback, std::memory_order_relaxed);
+	});
+
+	CpuRenderStats stats;
+	stats.primaryRays = primaryRays;
+	stats.shadowRays = shadowRays;
+	stats.fallbackRays = fallbackRays;
+	stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return stats;
+}
+
+bool CpuRaytracer::WriteBmp(const std::string& path, uint32_t width, uint32_t height, std::span<const uint32_t> pixels)
+{
+	if (pixels.size() < (size_t)width * height) return false;
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if (!file) return false;
+
+	// 24 bit BGR rows, bottom row first, each padded to 4 bytes
+	const uint32_t rowSize = (width * 3 + 3) & ~3u;
+	const uint32_t imageSize = rowSize * height;
+	auto write16 = [&](uint16_t value) { file.write((const char*)&value, sizeof(value)); };
+	auto write32 = [&](uint32_t value) { file.write((const char*)&value, sizeof(value)); };
+	write16(0x4D42); // "BM"
+	write32(14 + 40 + imageSize);
+	write32(0);
+	write32(14 + 40);
+	write32(40);
+	write32(width);
+	write32(height);
+	write16(1);
+	write16(24);
+	write32(0); // BI_RGB
+	write32(imageSize);
+	write32(2835); // 72 dpi
+	write32(2835);
+	write32(0);
+	write32(0);
+
+	std::vector<uint8_t> row(rowSize, 0);
+	for (uint32_t y = height; y-- > 0;) {
+		for (uint32_t x = 0; x < width; x++) {
+			const uint32_t pixel = pixels[(size_t)y * width + x];
+			row[x * 3 + 0] = (uint8_t)(pixel >> 16);
+			row[x * 3 + 1] = (uint8_t)(pixel >> 8);
+			row[x * 3 + 2] = (uint8_t)pixel;
+		}
+		file.write((const char*)row.data(), row.size());
+	}
+	return (bool)file;
+}
+
+int CpuRaytracer::RunRenderCommand(const std::string& imagePath)
+{
+	const RtScene scene = DemoScene::Build(0.0f);
+	CpuRaytracer tracer(scene);
+	std::vector<uint32_t> pixels;
+	const CpuRenderStats stats = tracer.Render(DEFAULT_WIDTH, DEFAULT_HEIGHT, pixels);
+	const bool written = WriteBmp(imagePath, DEFAULT_WIDTH, DEFAULT_HEIGHT, pixels);
+
+	std::ostringstream log;
+	log << "CPU raytrace " << DEFAULT_WIDTH << "x" << DEFAULT_HEIGHT << ": " << stats.primaryRays << " primary and " << stats.shadowRays
+		<< " shadow rays in " << stats.seconds * 1000.0 << " ms, " << stats.RaysPerSecond() / 1.0e6 << " Mrays/s, "
+		<< (written ? "written to " + imagePath : "IMAGE NOT WRITTEN") << "\n";
+	OutputDebugStringA(log.str().c_str());
+	return written ? 0 : 1;
+}
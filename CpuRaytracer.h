@@ -0,0 +1,135 @@
+#pragma once
+#include "TopLevelBvh.h"
+#include <span>
+
+namespace Dx12MasterProject {
+
+	//RayDesc of a TraceRay call.
+	struct CpuRay {
+		DirectX::XMFLOAT3 origin = DirectX::XMFLOAT3(0.0f, 0.0f, 0.0f);
+		float tMin = 0.0f;
+		DirectX::XMFLOAT3 direction = DirectX::XMFLOAT3(0.0f, 0.0f, 1.0f);
+		float tMax = 100000.0f;
+	};
+
+	//What a closest hit program can query about its intersection.
+	struct CpuHit {
+		float t = 0.0f; // RayTCurrent()
+		DirectX::XMFLOAT2 barycentrics = DirectX::XMFLOAT2(0.0f, 0.0f); // weights of the second and third vertex, as in BuiltInTriangleIntersectionAttributes
+		uint32_t instance = 0;
+		uint32_t geometry = 0; // GeometryIndex() within the instance's bottom level
+		uint32_t primitive = 0; // PrimitiveIndex()
+	};
+
+	//Bottom level layout TraceClosest walks, all of them find the same hits.
+	enum class CpuBvhLayout : uint8_t {
+		Binary,
+		Wide4,
+		Wide8,
+		Quantized4,
+	};
+
+	struct CpuRenderStats {
+		uint64_t primaryRays = 0;
+		uint64_t shadowRays = 0;
+		uint64_t fallbackRays = 0; // primary ray traversals of an instance's bottom level that a packet did one ray at a time
+		double seconds = 0.0;
+
+		double RaysPerSecond() const { return seconds > 0.0 ? (double)(primaryRays + shadowRays) / seconds : 0.0; }
+	};
+
+	/*
+		CPU reference of the DXR path, runs the programs of RayGenShaders.hlsl against an RtScene:
+		-RayGen shoots one pinhole ray per pixel, Miss, Hit or PlaneHit colour it and linearToSrgb encodes it
+		-PlaneHit traces the shadow ray through the second record of each hit group and the second miss program
+		-A top level BVH over the instances hands out the instances a ray passes through nearest first, rays are moved
+		 into each one's object space as DXR does and traverse its bottom level BVH in the tracer's layout, collapsed to
+		 4 children per node by default, triangles are intersected without culling
+		-With the binary layout primary rays are traced as packets of packetSize x packetSize pixel tiles, the rest of
+		 each pixel's shading runs per ray. The image is the same as with single rays. The packet kernel only walks
+		 binary BVHs, the wide and quantized layouts trace every ray on its own.
+		-Rows of pixels or tiles are spread across the thread pool, pixels are independent so the image does not depend
+		 on the thread count
+	*/
+	class CpuRaytracer
+	{
+	public:
+		static constexpr uint32_t DEFAULT_WIDTH = 1980;
+		static constexpr uint32_t DEFAULT_HEIGHT = 1080;
+		static constexpr uint32_t DEFAULT_PACKET_SIZE = 8; // tile edge in pixels for the binary layout, 1 traces every primary ray on its own
+		static constexpr uint32_t MAX_PACKET_SIZE = 16;
+
+		//The scene must outlive the tracer. Builds a BVH over every bottom level of the scene and collapses it when a wide
+		//layout is asked for. With a cache directory the bottom levels are read from and written to a BvhCache there.
+		explicit CpuRaytracer(const RtScene& scene, const BvhBuildSettings& settings = {}, ThreadPool* pool = nullptr, CpuBvhLayout layout = CpuBvhLayout::Wide4,
+			const std::string& bvhCacheDirectory = {});
+
+		const Bvh& BottomLevel(uint32_t index) const { return mBottomLevels[index]; }
+		CpuBvhLayout Layout() const { return mLayout; }
+		const TopLevelBvh& TopLevel() const { return mTopLevel; }
+
+		//Moves the instances as BuildTopLevelAS with bUpdate = true does, one world matrix per instance of the scene. The
+		//top level is refitted, or rebuilt when refits have degraded it too far. The scene's own matrices are only read
+		//on construction.
+		TopLevelUpdate UpdateInstanceTransforms(std::span<const DirectX::XMFLOAT4X4> world, ThreadPool* pool = nullptr);
+
+		//Nearest intersection within [tMin, tMax] over the instances whose mask shares a bit with instanceMask.
+		bool TraceClosest(const CpuRay& ray, uint8_t instanceMask, CpuHit& hit) const;
+		//TraceClosest of rays sharing their origin, tMin and tMax, traced together through each instance's binary bottom
+		//level whatever the layout. found tells which hits were written. Returns how many ray and instance pairs had to
+		//be traced one ray at a time.
+		uint32_t TraceClosestPacket(std::span<const CpuRay> rays, uint8_t instanceMask, std::span<CpuHit> hits, std::span<bool> found) const;
+		//Whether anything lies along the ray within [tMin, tMax] over the instances whose mask shares a bit with
+		//instanceMask, what TraceRay with RAY_FLAG_ACCEPT_FIRST_HIT_AND_END_SEARCH finds out. Ends on the first hit.
+		bool TraceAny(const CpuRay& ray, uint8_t instanceMask) const;
+
+		//Dispatches RayGen over width x height, pixels come out as R8G8B8A8_UNORM like the raytracing output UAV.
+		//packetSize only applies to the binary layout, the others always trace single rays.
+		CpuRenderStats Render(uint32_t width, uint32_t height, std::vector<uint32_t>& pixels, ThreadPool* pool = nullptr,
+			uint32_t packetSize = DEFAULT_PACKET_SIZE) const;
+
+		static bool WriteBmp(const std::string& path, uint32_t width, uint32_t height, std::span<const uint32_t> pixels);
+
+		//Headless -raytrace-cpu entry point, renders the demo scene at its starting rotation into a bitmap. Non zero on failure.
+		static int RunRenderCommand(const std::string& imagePath);
+
+	private:
+		struct RayPayload {
+			DirectX::XMFLOAT3 color;
+		};
+		struct ShadowPayload {
+			bool hit;
+		};
+		struct RayCounts {
+			uint64_t primary = 0;
+			uint64_t shadow = 0;
+			uint64_t fallback = 0;
+		};
+
+		//The shader programs, same names and arguments as in RayGenShaders.hlsl.
+		DirectX::XMFLOAT3 RayGen(uint32_t x, uint32_t y, uint32_t width, uint32_t height, RayCounts& counts) const;
+		//RayGen over a tile with the primary rays traced as one packet, writes the tile's pixels.
+		void RayGenTile(uint32_t x0, uint32_t y0, uint32_t tileWidth, uint32_t tileHeight, uint32_t width, uint32_t height, uint32_t* pixels, RayCounts& counts) const;
+		CpuRay PrimaryRay(uint32_t x, uint32_t y, uint32_t width, uint32_t height) const;
+		void Miss(RayPayload& payload) const;
+		void Hit(RayPayload& payload, const CpuHit& hit, const std::array<DirectX::XMFLOAT3, 3>& colours) const;
+		void PlaneHit(RayPayload& payload, const CpuRay& ray, const CpuHit& hit, RayCounts& counts) const;
+		void ShadowHit(ShadowPayload& payload) const;
+		void ShadowMiss(ShadowPayload& payload) const;
+
+		//TraceRay, the payload type decides which ray index and miss program apply.
+		void TraceRay(const CpuRay& ray, uint8_t instanceMask, RayPayload& payload, RayCounts& counts) const;
+		void TraceRay(const CpuRay& ray, uint8_t instanceMask, ShadowPayload& payload, RayCounts& counts) const;
+		//The closest hit or miss program a primary ray's TraceRay ends in.
+		void InvokeHitOrMiss(const CpuRay& ray, bool found, const CpuHit& hit, RayPayload& payload, RayCounts& counts) const;
+		const RtHitRecord& HitGroup(const CpuHit& hit, uint32_t rayIndex) const;
+
+		const RtScene& mScene;
+		CpuBvhLayout mLayout;
+		std::vector<Bvh> mBottomLevels;
+		std::vector<Bvh4> mWideBottomLevels4; // filled for CpuBvhLayout::Wide4 only
+		std::vector<Bvh8> mWideBottomLevels8; // filled for CpuBvhLayout::Wide8 only
+		std::vector<QuantizedBvh> mQuantizedBottomLevels; // filled for CpuBvhLayout::Quantized4 only
+		TopLevelBvh mTopLevel;
+	};
+}
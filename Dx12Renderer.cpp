@@ -1,5 +1,8 @@
 #include "Dx12Renderer.h"
 #include "Input.h"
+#include "Benchmark.h"
+#include "AssetDatabase.h"
+#include "CpuRaytracer.h"
 
 using namespace Dx12MasterProject;
 
@@ -16,7 +19,28 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PSTR pCmdLine,
     _CrtSetDbgFlag(_CRTDBG_ALLOC_MEM_DF | _CRTDBG_LEAK_CHECK_DF);
 #endif
 
+    if (pCmdLine != nullptr && strstr(pCmdLine, "-benchmark") != nullptr) {
+        return Benchmark::RunAll("BenchmarkResults.txt");
+    }
+    // -test runs the correctness checks alone, the exit code tells whether they passed
+    if (pCmdLine != nullptr && strstr(pCmdLine, "-test") != nullptr) {
+        return Benchmark::RunTests("TestResults.txt");
+    }
+    // -cook [directory] brings the directory's asset database up to date without opening the renderer
+    if (pCmdLine != nullptr && strstr(pCmdLine, "-cook") != nullptr) {
+        std::istringstream arguments(strstr(pCmdLine, "-cook") + strlen("-cook"));
+        std::string directory = "Models";
+        arguments >> directory;
+        return AssetDatabase::RunCookCommand(directory, "CookResults.txt");
+    }
+    // -raytrace-cpu renders the raytraced demo scene on the CPU, for machines without DXR
+    if (pCmdLine != nullptr && strstr(pCmdLine, "-raytrace-cpu") != nullptr) {
+        return CpuRaytracer::RunRenderCommand("CpuRaytrace.bmp");
+    }
+
     renderer = new Dx12Renderer(hInstance);
+    // -compact-vertices draws the raster path from the lossy 16 byte CompactVertex buffers
+    renderer->SetCompactVertices(pCmdLine != nullptr && strstr(pCmdLine, "-compact-vertices") != nullptr);
 
     try {
         if (!renderer->Initialise(hInstance, nShowCmd)) return 0;
@@ -71,6 +95,12 @@ bool Dx12Renderer::Get4xMsaaState() const
     return m4xMSAAState;
 }
 
+void Dx12Renderer::SetCompactVertices(bool value)
+{
+    assert(mD3DDevice == nullptr);
+    mCompactVertices = value;
+}
+
 void Dx12Renderer::Set4xMsaaState(bool value)
 {
     if (m4xMSAAState != value) {
@@ -100,9 +130,12 @@ bool Dx12Renderer::Initialise(HINSTANCE hInstance, int nShowCmd)
     else {
         BuildRootSignature();
         BuildShadersAndInputLayout();
-        tempModel = std::make_unique<Model>(std::string("Models/Shiba.fbx"));
-        BuildBoxGeometry();
-        BuildRenderItems();
+        // Loads in the background, its render items appear once the upload has completed on the GPU. A cooked
+        // artefact is used while the asset database has one for the current source.
+        AssetDatabase assets("Models");
+        assets.Load();
+        const std::string modelPath = "Models/Shiba.fbx";
+        mModelLoader.Request(modelPath, assets.ImportSettingsFor(modelPath), [this](ModelHandle handle, ModelLoadState state) { OnModelLoaded(handle, state); });
         BuildFrameResources();
         BuildDescriptorHeaps();
         BuildConstantBuffers();
@@ -246,6 +279,7 @@ bool Dx12Renderer::InitialiseDirect3D()
 
 void Dx12Renderer::Draw(const Timer gameTimer)
 {
+    std::vector<ModelHandle> modelUploads;
     if (!mRaytracing) {
         auto cmdListAllocation = mCurrFrameResource->cmdListAllocator;
         ThrowIfFailed(cmdListAllocation->Reset());
@@ -255,6 +289,7 @@ void Dx12Renderer::Draw(const Timer gameTimer)
         else {
             ThrowIfFailed(mCommandList->Reset(cmdListAllocation.Get(), mPsos["opaque"].Get()));
         }
+        modelUploads = RecordModelUploads();
     }
     else {
         auto cmdListAllocation = mCurrFrameResourceRT->cmdListAllocator;
@@ -371,6 +406,7 @@ void Dx12Renderer::Draw(const Timer gameTimer)
     if (mRaytracing) mCurrFrameResourceRT->fence = ++mCurrFence;
     else mCurrFrameResource->fence = ++mCurrFence;
     mCommandQueue->Signal(mFence.Get(), mCurrFence);
+    for (ModelHandle handle : modelUploads) mModelLoader.UploadSubmitted(handle, mCurrFence);
 }
 
 void Dx12Renderer::UpdateCamera(const Timer gameTimer)
@@ -388,6 +424,8 @@ void Dx12Renderer::UpdateObjectsCB(const Timer gameTimer)
 
             ObjectsConsts objConsts;
             DirectX::XMStoreFloat4x4(&objConsts.world, DirectX::XMMatrixTranspose(world));
+            objConsts.positionScale = e->positionQuantization.scale;
+            objConsts.positionOffset = e->positionQuantization.offset;
             currObjCB->CopyData(e->objCBIndex, objConsts);
             e->numFramesDirty--;
         }
@@ -468,15 +506,21 @@ void Dx12Renderer::Update(const Timer gameTimer)
             CloseHandle(eventHandle);
         }
 
+        // Models whose upload has completed get their render items before the object constants are written
+        mModelLoader.Retire(mFence->GetCompletedValue());
+
         //Very Bad!!! Just rotates Monkey but only works if only model.
-        DirectX::XMMATRIX world = DirectX::XMLoadFloat4x4(&mOpaqueRendItems[0]->world);
+        if (!mOpaqueRendItems.empty()) {
+            DirectX::XMMATRIX world = DirectX::XMLoadFloat4x4(&mOpaqueRendItems[0]->world);
 
-        DirectX::XMMATRIX newWorld = DirectX::XMMatrixIdentity()
-            * DirectX::XMMatrixRotationY(1.0f * ft)
-            * world;
+            DirectX::XMMATRIX newWorld = DirectX::XMMatrixIdentity()
+                * DirectX::XMMatrixRotationY(1.0f * ft)
+                * world;
 
-        DirectX::XMStoreFloat4x4(&mOpaqueRendItems[0]->world, newWorld);
-        mOpaqueRendItems[0]->numFramesDirty++;
+            DirectX::XMFLOAT4X4 rotated;
+            DirectX::XMStoreFloat4x4(&rotated, newWorld);
+            mOpaqueRendItems[0]->SetWorld(rotated);
+        }
 
         UpdateObjectsCB(gameTimer);
         UpdateMainPassCB(gameTimer);
@@ -639,7 +683,7 @@ void Dx12Renderer::FlushCommandQueue()
 
 void Dx12Renderer::BuildDescriptorHeaps()
 {
-    UINT objCount = (UINT)mOpaqueRendItems.size();
+    UINT objCount = MAX_RENDER_ITEMS;
     UINT numDescriptors = (objCount + 1) * gNumFrameResources;
     mPassCBVOffset = objCount * gNumFrameResources;
 
@@ -654,7 +698,7 @@ void Dx12Renderer::BuildDescriptorHeaps()
 void Dx12Renderer::BuildConstantBuffers()
 {
     UINT objCBByteSize = Utility::CalcConstantBufferByteSize(sizeof(ObjectsConsts));
-    UINT objCount = (UINT)mOpaqueRendItems.size();
+    UINT objCount = MAX_RENDER_ITEMS;
 
     for (int frameIndex = 0; frameIndex < gNumFrameResources; ++frameIndex) {
         auto objectCB = mFrameResources[frameIndex]->objectCB->Resource();
@@ -717,9 +761,22 @@ void Dx12Renderer::BuildShadersAndInputLayout()
 {
     HRESULT hr = S_OK;
 
-    mShaders["standardVS"] = Utility::CompileShader(L"cube_vs.hlsl", nullptr, "VS", "vs_5_1");
+    const D3D_SHADER_MACRO compactDefines[] = { { "COMPACT_VERTEX", "1" }, { nullptr, nullptr } };
+    mShaders["standardVS"] = Utility::CompileShader(L"cube_vs.hlsl", mCompactVertices ? compactDefines : nullptr, "VS", "vs_5_1");
     mShaders["opaquePS"] = Utility::CompileShader(L"cube_ps.hlsl", nullptr, "PS", "ps_5_1");
 
+    if (mCompactVertices) {
+        mInputLayout = {
+            { "POSITION", 0, DXGI_FORMAT_R16G16B16A16_UNORM, 0, offsetof(CompactVertex, pos),
+            D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0},
+            { "NORMAL", 0, DXGI_FORMAT_R16G16_SNORM, 0, offsetof(CompactVertex, norm),
+            D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0},
+            { "COLOUR", 0, DXGI_FORMAT_R8G8B8A8_UNORM, 0, offsetof(CompactVertex, colour),
+            D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0}
+        };
+        return;
+    }
+
     mInputLayout = {
         { "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0,
         D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0},
@@ -730,40 +787,74 @@ void Dx12Renderer::BuildShadersAndInputLayout()
     };
 }
 
-void Dx12Renderer::BuildBoxGeometry()
+MeshGeometry* Dx12Renderer::BuildModelGeometry(const Model& model, const std::string& name)
 {
-    std::vector<vertexConsts> vertices;
-    vertices = tempModel->meshes[0].vertices;
-    std::vector<std::uint16_t> indices;
-    indices = tempModel->meshes[0].indices;
-
-    const UINT vbByteSize = (UINT)vertices.size() * sizeof(vertexConsts);
-    const UINT ibByteSize = (UINT)indices.size() * sizeof(std::uint16_t);
+    // Every mesh of the model shares one vertex and one index buffer, each mesh is a submesh addressed through its
+    // base vertex so its indices stay local and keep the narrowest format any single mesh needs
+    std::vector<uint8_t> allVertices;
+    std::vector<uint32_t> allIndices;
+    size_t largestMeshVertexCount = 0;
+    const UINT vertexStride = mCompactVertices ? sizeof(CompactVertex) : sizeof(vertexConsts);
+
+    auto modelGeo = std::make_unique<MeshGeometry>();
+    modelGeo->name = name;
+
+    for (size_t meshIndex = 0; meshIndex < model.meshes.size(); meshIndex++) {
+        const Mesh& mesh = model.meshes[meshIndex];
+        std::span<const vertexConsts> vertices = mesh.Vertices();
+        const INT baseVertex = (INT)(allVertices.size() / vertexStride);
+        largestMeshVertexCount = (std::max)(largestMeshVertexCount, vertices.size());
+
+        // Compact vertices are quantized against the mesh bounds, the render item gets the matching dequantization
+        if (mCompactVertices) {
+            std::vector<CompactVertex> compactVertices = VertexCompression::EncodeVertices(vertices, VertexCompression::QuantizationFor(mesh.bounds));
+            const uint8_t* bytes = reinterpret_cast<const uint8_t*>(compactVertices.data());
+            allVertices.insert(allVertices.end(), bytes, bytes + compactVertices.size() * sizeof(CompactVertex));
+        }
+        else {
+            const uint8_t* bytes = reinterpret_cast<const uint8_t*>(vertices.data());
+            allVertices.insert(allVertices.end(), bytes, bytes + vertices.size_bytes());
+        }
 
-    mBoxGeometry = std::make_unique<MeshGeometry>();
-    mBoxGeometry->name = "shapeGeo";
+        // LOD levels only hold indices, they follow the full detail indices and share the mesh's vertices
+        for (size_t level = 0; level <= mesh.lods.size(); level++) {
+            IndexView levelIndices = level == 0 ? mesh.Indices() : mesh.lods[level - 1].Indices();
+            SubmeshGeometry subMesh;
+            subMesh.IndexCount = (UINT)levelIndices.size();
+            subMesh.StartIndexLocation = (UINT)allIndices.size();
+            subMesh.BaseVertexLocation = baseVertex;
+            subMesh.Bounds = mesh.bounds;
+            subMesh.Sphere = mesh.sphere;
+            subMesh.LodLevel = (UINT)level;
+            subMesh.GeometricError = level == 0 ? 0.0f : mesh.lods[level - 1].geometricError;
+            for (size_t i = 0; i < levelIndices.size(); i++) allIndices.push_back(levelIndices[i]);
+
+            const std::string submeshName = "mesh" + std::to_string(meshIndex);
+            modelGeo->drawArgs[level == 0 ? submeshName : submeshName + "_lod" + std::to_string(level)] = subMesh;
+        }
+    }
+    IndexBufferData indices = IndexBufferData::Pack(IndexView(std::span<const uint32_t>(allIndices)), largestMeshVertexCount);
 
-    ThrowIfFailed(D3DCreateBlob(vbByteSize, &mBoxGeometry->vertexBufferCPU));
-    CopyMemory(mBoxGeometry->vertexBufferCPU->GetBufferPointer(), vertices.data(), vbByteSize);
+    const UINT vbByteSize = (UINT)allVertices.size();
+    const UINT ibByteSize = indices.ByteSize();
 
-    ThrowIfFailed(D3DCreateBlob(ibByteSize, &mBoxGeometry->indexBufferCPU));
-    CopyMemory(mBoxGeometry->indexBufferCPU->GetBufferPointer(), indices.data(), ibByteSize);
+    ThrowIfFailed(D3DCreateBlob(vbByteSize, &modelGeo->vertexBufferCPU));
+    CopyMemory(modelGeo->vertexBufferCPU->GetBufferPointer(), allVertices.data(), vbByteSize);
 
-    mBoxGeometry->vertexBufferGPU = CreateDefaultBuffer(mD3DDevice.Get(), mCommandList.Get(), vertices.data(), vbByteSize, mBoxGeometry->vertexBufferUploader);
-    mBoxGeometry->indexBufferGPU  = CreateDefaultBuffer(mD3DDevice.Get(), mCommandList.Get(), indices.data(),  ibByteSize, mBoxGeometry->indexBufferUploader);
+    ThrowIfFailed(D3DCreateBlob(ibByteSize, &modelGeo->indexBufferCPU));
+    CopyMemory(modelGeo->indexBufferCPU->GetBufferPointer(), indices.bytes.data(), ibByteSize);
 
-    mBoxGeometry->vertexByteStride = sizeof(vertexConsts);
-    mBoxGeometry->vertexBufferByteSize = vbByteSize;
-    mBoxGeometry->indexFormat = DXGI_FORMAT_R16_UINT;
-    mBoxGeometry->indexBufferByteSize = ibByteSize;
+    modelGeo->vertexBufferGPU = CreateDefaultBuffer(mD3DDevice.Get(), mCommandList.Get(), allVertices.data(), vbByteSize, modelGeo->vertexBufferUploader);
+    modelGeo->indexBufferGPU  = CreateDefaultBuffer(mD3DDevice.Get(), mCommandList.Get(), indices.bytes.data(),  ibByteSize, modelGeo->indexBufferUploader);
 
-    SubmeshGeometry subMesh;
-    subMesh.IndexCount = (UINT)indices.size();
-    subMesh.StartIndexLocation = 0;
-    subMesh.BaseVertexLocation = 0;
+    modelGeo->vertexByteStride = vertexStride;
+    modelGeo->vertexBufferByteSize = vbByteSize;
+    modelGeo->indexFormat = indices.format;
+    modelGeo->indexBufferByteSize = ibByteSize;
 
-    mBoxGeometry->drawArgs["box"] = subMesh;
-    mGeos[mBoxGeometry->name] = std::move(mBoxGeometry);
+    MeshGeometry* geo = modelGeo.get();
+    mGeos[name] = std::move(modelGeo);
+    return geo;
 }
 
 void Dx12Renderer::BuildPSO()
@@ -806,7 +897,7 @@ void Dx12Renderer::BuildPSO()
 void Dx12Renderer::BuildFrameResources()
 {
     for (int i = 0; i < gNumFrameResources; ++i) {
-        mFrameResources.push_back(std::make_unique<FrameResource>(mD3DDevice.Get(), 1, (UINT)mAllRendItems.size()));
+        mFrameResources.push_back(std::make_unique<FrameResource>(mD3DDevice.Get(), 1, MAX_RENDER_ITEMS));
     }
 }
 
@@ -817,19 +908,51 @@ void Dx12Renderer::BuildFrameResourcesRT()
     }
 }
 
-void Dx12Renderer::BuildRenderItems()
+void Dx12Renderer::BuildRenderItems(const Model& model, MeshGeometry* modelGeo)
+{
+    // One render item per placed submesh, positioned by its node's world matrix
+    for (const SceneInstance& instance : model.sceneGraph.Instances()) {
+        if (mAllRendItems.size() == MAX_RENDER_ITEMS) {
+            std::cout << "Render item limit reached, " << modelGeo->name << " is only partly drawn" << std::endl;
+            break;
+        }
+        auto rendItem = std::make_unique<RenderItem>();
+        rendItem->objCBIndex = (UINT)mAllRendItems.size();
+        rendItem->meshGeo = modelGeo;
+        rendItem->primitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+        const SubmeshGeometry& subMesh = modelGeo->drawArgs["mesh" + std::to_string(instance.mesh)];
+        rendItem->indexCount = subMesh.IndexCount;
+        rendItem->startIndexLocation = subMesh.StartIndexLocation;
+        rendItem->baseVertexLocation = subMesh.BaseVertexLocation;
+        if (mCompactVertices) rendItem->positionQuantization = VertexCompression::QuantizationFor(subMesh.Bounds);
+        rendItem->localBounds = subMesh.Bounds;
+        rendItem->SetWorld(instance.world);
+        mOpaqueRendItems.push_back(rendItem.get());
+        mAllRendItems.push_back(std::move(rendItem));
+    }
+}
+
+std::vector<ModelHandle> Dx12Renderer::RecordModelUploads()
 {
-    auto boxRendItem = std::make_unique<RenderItem>();
-    DirectX::XMStoreFloat4x4(&boxRendItem->world, DirectX::XMMatrixScaling(1.0f, 1.0f, 1.0f) * DirectX::XMMatrixTranslation(0.0f, 0.0f, 0.0f));
-    boxRendItem->objCBIndex = 0;
-    boxRendItem->meshGeo = mGeos["shapeGeo"].get();
-    boxRendItem->primitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-    boxRendItem->indexCount = boxRendItem->meshGeo->drawArgs["box"].IndexCount;
-    boxRendItem->startIndexLocation = boxRendItem->meshGeo->drawArgs["box"].StartIndexLocation;
-    boxRendItem->baseVertexLocation = boxRendItem->meshGeo->drawArgs["box"].BaseVertexLocation;
-    mAllRendItems.push_back(std::move(boxRendItem));
-
-    for (auto& e : mAllRendItems) mOpaqueRendItems.push_back(e.get());
+    // Copies go on this frame's command list, the loader learns the fence value once the list is submitted
+    std::vector<ModelHandle> uploads = mModelLoader.TakeLoaded(MAX_MODEL_UPLOADS_PER_FRAME);
+    for (ModelHandle handle : uploads) {
+        BuildModelGeometry(*mModelLoader.GetModel(handle), "model" + std::to_string(handle));
+    }
+    return uploads;
+}
+
+void Dx12Renderer::OnModelLoaded(ModelHandle handle, ModelLoadState state)
+{
+    if (state != ModelLoadState::Resident) {
+        std::cout << "Model Load Error: unable to load " << mModelLoader.Path(handle) << std::endl;
+        return;
+    }
+
+    // The copy has executed, the upload heaps can go
+    MeshGeometry* modelGeo = mGeos["model" + std::to_string(handle)].get();
+    modelGeo->DisposeUploaders();
+    BuildRenderItems(*mModelLoader.GetModel(handle), modelGeo);
 }
 
 void Dx12Renderer::DrawRenderItems(ID3D12GraphicsCommandList* cmdList, const std::vector<RenderItem*>& rendItems)
@@ -837,15 +960,24 @@ void Dx12Renderer::DrawRenderItems(ID3D12GraphicsCommandList* cmdList, const std
     UINT objCBByteSize = Utility::CalcConstantBufferByteSize(sizeof(ObjectsConsts));
     auto objectCB = mCurrFrameResource->objectCB->Resource();
 
+    // Submeshes of one model share their buffers, the input assembler only needs rebinding when the geometry changes
+    const MeshGeometry* boundGeo = nullptr;
+    D3D12_PRIMITIVE_TOPOLOGY boundTopology = D3D_PRIMITIVE_TOPOLOGY_UNDEFINED;
     for (size_t i = 0; i < rendItems.size(); ++i) {
         auto ri = rendItems[i];
-        auto meshGeoVertexBufferView = ri->meshGeo->VertexBufferView();
-        cmdList->IASetVertexBuffers(0, 1, &meshGeoVertexBufferView);
-        auto meshGeoIndexBufferView = ri->meshGeo->IndexBufferView();
-        cmdList->IASetIndexBuffer(&meshGeoIndexBufferView);
-        cmdList->IASetPrimitiveTopology(ri->primitiveType);
+        if (ri->meshGeo != boundGeo) {
+            auto meshGeoVertexBufferView = ri->meshGeo->VertexBufferView();
+            cmdList->IASetVertexBuffers(0, 1, &meshGeoVertexBufferView);
+            auto meshGeoIndexBufferView = ri->meshGeo->IndexBufferView();
+            cmdList->IASetIndexBuffer(&meshGeoIndexBufferView);
+            boundGeo = ri->meshGeo;
+        }
+        if (ri->primitiveType != boundTopology) {
+            cmdList->IASetPrimitiveTopology(ri->primitiveType);
+            boundTopology = ri->primitiveType;
+        }
 
-        UINT cbvIndex = mCurrFrameResourceIndex * (UINT)mOpaqueRendItems.size() + ri->objCBIndex;
+        UINT cbvIndex = mCurrFrameResourceIndex * MAX_RENDER_ITEMS + ri->objCBIndex;
         auto cbvHandle = CD3DX12_GPU_DESCRIPTOR_HANDLE(mCBVHeap->GetGPUDescriptorHandleForHeapStart());
         cbvHandle.Offset(cbvIndex, mCBVSRVUAVDescriptorSize);
 
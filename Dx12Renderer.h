@@ -1,6 +1,8 @@
 #pragma once
 #include "Utility.h"
-#include "Model.h"
+#include "AsyncModelLoader.h"
+#include "VertexCompression.h"
+#include "RaytracingScene.h"
 //#include "Win32Wnd.h"
 #include "UploadBuffer.h"
 #include "FrameResource.h"
@@ -23,6 +25,18 @@ namespace Dx12MasterProject {
 		UINT indexCount = 0;
 		UINT startIndexLocation = 0;
 		int baseVertexLocation = 0;
+
+		PositionQuantization positionQuantization;
+
+		DirectX::BoundingBox localBounds; // of the submesh
+		DirectX::BoundingBox worldBounds; // localBounds under world, kept current by SetWorld
+
+		//Moving an item goes through here so only items that actually move pay for the bounds transform.
+		void SetWorld(const DirectX::XMFLOAT4X4& newWorld) {
+			world = newWorld;
+			worldBounds = Bounds::TransformBox(localBounds, world);
+			numFramesDirty = gNumFrameResources;
+		}
 	};
 
 	struct AccelerationStructBuffers {
@@ -117,11 +131,6 @@ namespace Dx12MasterProject {
 		D3D12_STATE_SUBOBJECT subObj = {};
 	};
 
-	struct RTVertexBufferLayout {
-		DirectX::XMFLOAT3 vertexPos;
-		DirectX::XMFLOAT3 vertexNorm;
-	};
-
 	class Dx12Renderer
 	{
 	public:
@@ -136,6 +145,8 @@ namespace Dx12MasterProject {
 
 		bool Get4xMsaaState() const;
 		void Set4xMsaaState(bool value);
+		//Raster vertex format, CompactVertex when set. Only before Initialise, the buffers and shaders are built for one format.
+		void SetCompactVertices(bool value);
 		void ToggleRaytracingState();
 
 		bool Initialise(HINSTANCE hInstance, int nShowCmd);
@@ -164,9 +175,11 @@ namespace Dx12MasterProject {
 
 		ComPtr<ID3D12Resource> mVertexBuffer[3];
 		ComPtr<ID3D12Resource> mIndexBuffer[3];
+		DXGI_FORMAT mIndexFormat[3] = { DXGI_FORMAT_R32_UINT, DXGI_FORMAT_R32_UINT, DXGI_FORMAT_R32_UINT };
 		AccelerationStructBuffers mTopLvlBuffers;
 		ComPtr<ID3D12Resource> mBotLvlAS[2];
 		std::uint64_t mTlasSize = 0;
+		SceneGraph mRtSceneGraph; // TLAS instances, each mesh reference is an index into mBotLvlAS
 
 		ComPtr<ID3D12StateObject> mPipelineState;
 		ComPtr<ID3D12RootSignature> mEmptyRootSig;
@@ -187,7 +200,8 @@ namespace Dx12MasterProject {
 		void CreateTriangleVB(ID3D12Device5* device, ID3D12Resource* vertexBuff[], ID3D12Resource* indexBuff[], int index);
 		void CreateCubeVB(ID3D12Device5* device, ID3D12Resource* vertexBuff[], ID3D12Resource* indexBuff[], int index, float width, float height, float length);
 		void CreatePlaneVB(ID3D12Device5* device, ID3D12Resource* vertexBuff[], ID3D12Resource* indexBuff[], int index, float width, float length, float heightOffset);
-		AccelerationStructBuffers CreateBottomLevelAS(ID3D12Device5* device, ID3D12GraphicsCommandList4* cmdList, ID3D12Resource* vertBuff[], const uint32_t vertexCount[], ID3D12Resource* indexBuff[], const uint32_t indexCount[], uint32_t geomCount);
+		void UploadGeometry(ID3D12Device5* device, ID3D12Resource* vertexBuff[], ID3D12Resource* indexBuff[], int index, const RtGeometry& geometry);
+		AccelerationStructBuffers CreateBottomLevelAS(ID3D12Device5* device, ID3D12GraphicsCommandList4* cmdList, ID3D12Resource* vertBuff[], const uint32_t vertexCount[], ID3D12Resource* indexBuff[], const uint32_t indexCount[], const DXGI_FORMAT indexFormat[], uint32_t geomCount);
 		void BuildTopLevelAS(ID3D12Device5* device, ID3D12GraphicsCommandList4* cmdList, ID3D12Resource* botLvlAS[], std::uint64_t& tlasSize, float rotation, bool bUpdate, AccelerationStructBuffers& buffers);
 
 		ID3DBlob* CompileLibrary(const WCHAR* filename, const WCHAR* targetString);
@@ -222,10 +236,12 @@ namespace Dx12MasterProject {
 		void BuildConstantBuffers();
 		void BuildRootSignature();
 		void BuildShadersAndInputLayout();
-		void BuildBoxGeometry();
+		MeshGeometry* BuildModelGeometry(const Model& model, const std::string& name);
 		void BuildPSO();
 		void BuildFrameResources();
-		void BuildRenderItems();
+		void BuildRenderItems(const Model& model, MeshGeometry* modelGeo);
+		std::vector<ModelHandle> RecordModelUploads();
+		void OnModelLoaded(ModelHandle handle, ModelLoadState state);
 		void DrawRenderItems(ID3D12GraphicsCommandList* cmdList, const std::vector<RenderItem*>& rendItems);
 
 
@@ -251,8 +267,7 @@ namespace Dx12MasterProject {
 
 		bool mVSync = false;
 		bool mRaytracing = true;
-
-		const int mRTInstanceCount = 3;
+		bool mCompactVertices = false; // CompactVertex buffers and the COMPACT_VERTEX shader variant
 
 		DXGI_FORMAT mBackBufferFormat = DXGI_FORMAT_R8G8B8A8_UNORM;
 		DXGI_FORMAT mDepthStencilFormat = DXGI_FORMAT_D24_UNORM_S8_UINT;
@@ -282,6 +297,10 @@ namespace Dx12MasterProject {
 		std::vector<D3D12_INPUT_ELEMENT_DESC> mInputLayout;
 		std::vector<std::unique_ptr<RenderItem>> mAllRendItems;
 		std::vector<RenderItem*> mOpaqueRendItems;
+		//Object constants and their descriptors are sized once, render items of models that finish loading later fill them in
+		static const UINT MAX_RENDER_ITEMS = 1024;
+		//Uploads recorded per frame, spreads the copy cost of several models finishing together
+		static const size_t MAX_MODEL_UPLOADS_PER_FRAME = 1;
 
 		PassConsts mMainPassCB;
 		UINT mPassCBVOffset = 0;
@@ -289,8 +308,7 @@ namespace Dx12MasterProject {
 
 		bool lightColourIncrease = false;
 
-		std::unique_ptr<MeshGeometry> mBoxGeometry;
-		std::unique_ptr<Model> tempModel;
+		AsyncModelLoader mModelLoader;
 		ComPtr<ID3DBlob> mvsByteCode;
 		ComPtr<ID3DBlob> mpsByteCode;
 
@@ -5,6 +5,11 @@
 namespace Dx12MasterProject {
 	struct ObjectsConsts {
 		DirectX::XMFLOAT4X4 world = IDENTITY_MATRIX;
+		//Dequantization for compact vertices, identity for full float vertices
+		DirectX::XMFLOAT3 positionScale = { 1.0f, 1.0f, 1.0f };
+		float padding1 = 0.0f;
+		DirectX::XMFLOAT3 positionOffset = { 0.0f, 0.0f, 0.0f };
+		float padding2 = 0.0f;
 	};
 
 	struct PassConsts {
@@ -0,0 +1,74 @@
+#pragma once
+#include "Utility.h"
+#include <cstring>
+#include <span>
+#include <vector>
+
+namespace Dx12MasterProject {
+
+	//Indices stay 32 bit while a mesh is being processed and are narrowed to 16 bit for upload and caching whenever
+	//every vertex is still addressable, so small meshes don't pay for the wide format.
+
+	inline UINT IndexFormatSize(DXGI_FORMAT format)
+	{
+		return format == DXGI_FORMAT_R16_UINT ? sizeof(uint16_t) : sizeof(uint32_t);
+	}
+
+	inline DXGI_FORMAT SelectIndexFormat(size_t vertexCount)
+	{
+		return vertexCount <= 0xFFFF ? DXGI_FORMAT_R16_UINT : DXGI_FORMAT_R32_UINT;
+	}
+
+	//Non owning view over 16 or 32 bit indices.
+	struct IndexView {
+		const void* data = nullptr;
+		size_t count = 0;
+		DXGI_FORMAT format = DXGI_FORMAT_R32_UINT;
+
+		IndexView() = default;
+		IndexView(const void* Data, size_t Count, DXGI_FORMAT Format) : data(Data), count(Count), format(Format) {}
+		IndexView(std::span<const uint32_t> indices) : data(indices.data()), count(indices.size()), format(DXGI_FORMAT_R32_UINT) {}
+		IndexView(std::span<const uint16_t> indices) : data(indices.data()), count(indices.size()), format(DXGI_FORMAT_R16_UINT) {}
+
+		uint32_t operator[](size_t i) const {
+			return format == DXGI_FORMAT_R16_UINT ? static_cast<const uint16_t*>(data)[i] : static_cast<const uint32_t*>(data)[i];
+		}
+
+		size_t size() const { return count; }
+		bool empty() const { return count == 0; }
+		size_t size_bytes() const { return count * IndexFormatSize(format); }
+	};
+
+	//Owned index data in its upload format.
+	struct IndexBufferData {
+		DXGI_FORMAT format = DXGI_FORMAT_R16_UINT;
+		size_t count = 0;
+		std::vector<uint8_t> bytes;
+
+		static IndexBufferData Pack(IndexView indices, DXGI_FORMAT format) {
+			IndexBufferData packed;
+			packed.format = format;
+			packed.count = indices.size();
+			packed.bytes.resize(indices.size() * IndexFormatSize(format));
+			if (format == indices.format) {
+				if (!indices.empty()) memcpy(packed.bytes.data(), indices.data, packed.bytes.size());
+			}
+			else if (format == DXGI_FORMAT_R16_UINT) {
+				uint16_t* out = reinterpret_cast<uint16_t*>(packed.bytes.data());
+				for (size_t i = 0; i < indices.size(); i++) out[i] = (uint16_t)indices[i];
+			}
+			else {
+				uint32_t* out = reinterpret_cast<uint32_t*>(packed.bytes.data());
+				for (size_t i = 0; i < indices.size(); i++) out[i] = indices[i];
+			}
+			return packed;
+		}
+
+		static IndexBufferData Pack(IndexView indices, size_t vertexCount) {
+			return Pack(indices, SelectIndexFormat(vertexCount));
+		}
+
+		IndexView View() const { return IndexView(bytes.data(), count, format); }
+		UINT ByteSize() const { return (UINT)bytes.size(); }
+	};
+}
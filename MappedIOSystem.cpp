@@ -0,0 +1,68 @@
+#include "MappedIOSystem.h"
+#include <cstring>
+
+using namespace Dx12MasterProject;
+
+size_t MappedIOStream::Read(void* buffer, size_t size, size_t count)
+{
+	if (size == 0 || count == 0) return 0;
+
+	// Like fread only whole elements are returned
+	const uint64_t available = mFile.Size() - mPosition;
+	const size_t elements = (size_t)(std::min)((uint64_t)count, available / size);
+	if (elements == 0) return 0;
+
+	const size_t bytes = elements * size;
+	memcpy(buffer, mFile.Data() + mPosition, bytes);
+	mPosition += bytes;
+	ReadAhead();
+	return elements;
+}
+
+aiReturn MappedIOStream::Seek(size_t offset, aiOrigin origin)
+{
+	// Offsets wrap like fseek's signed ones, so a backward relative seek arrives as a huge size_t
+	uint64_t position;
+	switch (origin) {
+	case aiOrigin_SET: position = offset; break;
+	case aiOrigin_CUR: position = mPosition + offset; break;
+	case aiOrigin_END: position = mFile.Size() + offset; break;
+	default: return aiReturn_FAILURE;
+	}
+	if (position > mFile.Size()) return aiReturn_FAILURE;
+
+	mPosition = position;
+	// A forward jump restarts the read-ahead window from the new position, pages behind it were prefetched already
+	if (mPosition > mPrefetchedEnd) mPrefetchedEnd = mPosition;
+	ReadAhead();
+	return aiReturn_SUCCESS;
+}
+
+void MappedIOStream::ReadAhead()
+{
+	// Issue the next window once the reader is halfway through the current one, so the prefetch overlaps parsing
+	if (mPrefetchedEnd >= mFile.Size() || mPosition + READ_AHEAD / 2 < mPrefetchedEnd) return;
+	const uint64_t start = (std::max)(mPosition, mPrefetchedEnd);
+	const uint64_t end = (std::min)(mPosition + READ_AHEAD, mFile.Size());
+	mFile.Prefetch(start, end - start);
+	mPrefetchedEnd = end;
+}
+
+bool MappedIOSystem::Exists(const char* path) const
+{
+	const DWORD attributes = GetFileAttributesA(path);
+	return attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY) == 0;
+}
+
+Assimp::IOStream* MappedIOSystem::Open(const char* path, const char* mode)
+{
+	if (strchr(mode, 'w') != nullptr || strchr(mode, 'a') != nullptr || strchr(mode, '+') != nullptr) return nullptr;
+
+	MappedIOStream* stream = new MappedIOStream();
+	if (!stream->mFile.Open(path)) {
+		delete stream;
+		return nullptr;
+	}
+	stream->ReadAhead();
+	return stream;
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include "MeshCache.h"
+
+#include <assimp/IOSystem.hpp>
+#include <assimp/IOStream.hpp>
+
+namespace Dx12MasterProject {
+
+	//Read only Assimp stream over a memory mapped file. Reads are copies out of the mapping, and the pages ahead of the
+	//read position are prefetched a window at a time so a sequential parse does not stall on every page fault.
+	class MappedIOStream : public Assimp::IOStream
+	{
+	public:
+		static constexpr uint64_t READ_AHEAD = 4ull << 20;
+
+		MappedIOStream(const MappedIOStream& temp) = delete;
+		MappedIOStream& operator= (const MappedIOStream& temp) = delete;
+
+		size_t Read(void* buffer, size_t size, size_t count) override;
+		size_t Write(const void* buffer, size_t size, size_t count) override { return 0; }
+		aiReturn Seek(size_t offset, aiOrigin origin) override;
+		size_t Tell() const override { return (size_t)mPosition; }
+		size_t FileSize() const override { return (size_t)mFile.Size(); }
+		void Flush() override {}
+
+	private:
+		friend class MappedIOSystem;
+		MappedIOStream() = default;
+
+		void ReadAhead();
+
+		MappedFile mFile;
+		uint64_t mPosition = 0;
+		uint64_t mPrefetchedEnd = 0;
+	};
+
+	//Hands Assimp mapped streams instead of its default stdio ones, import reads then skip the stdio buffer and
+	//most importers' own copy of the whole file goes straight from the page cache. Write modes are refused.
+	class MappedIOSystem : public Assimp::IOSystem
+	{
+	public:
+		bool Exists(const char* path) const override;
+		char getOsSeparator() const override { return '\\'; }
+		Assimp::IOStream* Open(const char* path, const char* mode = "rb") override;
+		void Close(Assimp::IOStream* stream) override { delete stream; }
+	};
+}
@@ -0,0 +1,335 @@
+#include "MeshCache.h"
+#include "Model.h"
+#include <filesystem>
+
+using namespace Dx12MasterProject;
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+bool MappedFile::Open(const std::string& path)
+{
+	Close();
+
+	mFile = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (mFile == INVALID_HANDLE_VALUE) return false;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(mFile, &fileSize) || fileSize.QuadPart == 0) {
+		Close();
+		return false;
+	}
+
+	mMapping = CreateFileMappingA(mFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mMapping == nullptr) {
+		Close();
+		return false;
+	}
+
+	mData = static_cast<const uint8_t*>(MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0));
+	if (mData == nullptr) {
+		Close();
+		return false;
+	}
+	mSize = static_cast<uint64_t>(fileSize.QuadPart);
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (mData != nullptr) UnmapViewOfFile(mData);
+	if (mMapping != nullptr) CloseHandle(mMapping);
+	if (mFile != INVALID_HANDLE_VALUE) CloseHandle(mFile);
+	mData = nullptr;
+	mMapping = nullptr;
+	mFile = INVALID_HANDLE_VALUE;
+	mSize = 0;
+}
+
+void MappedFile::Prefetch(uint64_t offset, uint64_t size) const
+{
+	if (mData == nullptr || offset >= mSize) return;
+	WIN32_MEMORY_RANGE_ENTRY range;
+	range.VirtualAddress = const_cast<uint8_t*>(mData + offset);
+	range.NumberOfBytes = static_cast<SIZE_T>((std::min)(size, mSize - offset));
+	PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+}
+
+uint64_t Dx12MasterProject::HashBytes(const void* data, size_t size, uint64_t seed)
+{
+	const uint64_t prime = 0x100000001b3ull;
+	const uint8_t* bytes = static_cast<const uint8_t*>(data);
+	uint64_t hash = seed;
+
+	size_t i = 0;
+	for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+		uint64_t word;
+		memcpy(&word, bytes + i, sizeof(word));
+		hash = (hash ^ word) * prime;
+	}
+	for (; i < size; i++) {
+		hash = (hash ^ bytes[i]) * prime;
+	}
+	return hash;
+}
+
+bool Dx12MasterProject::HashFile(const std::string& path, uint64_t& hash)
+{
+	MappedFile file;
+	if (!file.Open(path)) return false;
+	hash = HashBytes(file.Data(), static_cast<size_t>(file.Size()));
+	return true;
+}
+
+namespace {
+	uint64_t AlignBlob(uint64_t offset)
+	{
+		return (offset + MeshCache::BLOB_ALIGNMENT - 1) & ~(MeshCache::BLOB_ALIGNMENT - 1);
+	}
+
+	bool BlobInFile(uint64_t offset, uint64_t byteSize, uint64_t fileSize)
+	{
+		return offset % MeshCache::BLOB_ALIGNMENT == 0 && offset <= fileSize && byteSize <= fileSize - offset;
+	}
+
+	//Every index addresses a vertex of the mesh, the blob checks alone would let a corrupt index read past the vertices.
+	bool IndicesValid(IndexView indices, uint32_t vertexCount)
+	{
+		uint32_t maxIndex = 0;
+		for (size_t i = 0; i < indices.size(); i++) maxIndex = (std::max)(maxIndex, indices[i]);
+		return indices.empty() || maxIndex < vertexCount;
+	}
+
+	//Every meshlet's ranges lie within the meshlet vertex and triangle arrays, its local indices within its own
+	//vertices and its vertices within the mesh.
+	bool MeshletsValid(const MeshletData& meshlets, uint32_t vertexCount)
+	{
+		const std::span<const uint32_t> meshletVertices = meshlets.Vertices();
+		const std::span<const uint8_t> meshletTriangles = meshlets.Triangles();
+		for (const Meshlet& meshlet : meshlets.Meshlets()) {
+			if ((uint64_t)meshlet.vertexOffset + meshlet.vertexCount > meshletVertices.size() ||
+				((uint64_t)meshlet.triangleOffset + meshlet.triangleCount) * 3 > meshletTriangles.size()) return false;
+			for (uint32_t i = 0; i < meshlet.vertexCount; i++) {
+				if (meshletVertices[meshlet.vertexOffset + i] >= vertexCount) return false;
+			}
+			for (uint32_t i = 0; i < meshlet.triangleCount * 3; i++) {
+				if (meshletTriangles[meshlet.triangleOffset * 3 + i] >= meshlet.vertexCount) return false;
+			}
+		}
+		return true;
+	}
+}
+
+std::string MeshCache::CachePathFor(const std::string& sourcePath)
+{
+	return sourcePath + ".meshcache";
+}
+
+bool MeshCache::Write(const std::string& cachePath, uint64_t sourceHash, const std::vector<Mesh>& meshes, const SceneGraph& scene)
+{
+	FileHeader fileHeader;
+	fileHeader.sourceHash = sourceHash;
+	fileHeader.meshCount = (uint32_t)meshes.size();
+	fileHeader.nodeCount = (uint32_t)scene.NodeCount();
+	fileHeader.meshRefCount = (uint32_t)scene.InstanceCount();
+
+	std::vector<MeshHeader> meshHeaders(meshes.size());
+	std::vector<IndexBufferData> packedIndices(meshes.size());
+	std::vector<std::vector<LodHeader>> lodHeaders(meshes.size());
+	std::vector<std::vector<IndexBufferData>> packedLodIndices(meshes.size());
+	uint64_t offset = AlignBlob(sizeof(FileHeader) + sizeof(MeshHeader) * meshHeaders.size());
+	fileHeader.parentOffset = offset;
+	offset = AlignBlob(offset + sizeof(uint32_t) * scene.parents.size());
+	fileHeader.localTransformOffset = offset;
+	offset = AlignBlob(offset + sizeof(DirectX::XMFLOAT4X4) * scene.localTransforms.size());
+	fileHeader.meshOffsetOffset = offset;
+	offset = AlignBlob(offset + sizeof(uint32_t) * scene.meshOffsets.size());
+	fileHeader.meshRefOffset = offset;
+	offset = AlignBlob(offset + sizeof(uint32_t) * scene.meshRefs.size());
+	for (size_t i = 0; i < meshes.size(); i++) {
+		MeshHeader& header = meshHeaders[i];
+		packedIndices[i] = IndexBufferData::Pack(meshes[i].Indices(), meshes[i].Vertices().size());
+		header.vertexCount = (uint32_t)meshes[i].Vertices().size();
+		header.indexCount = (uint32_t)packedIndices[i].count;
+		header.indexFormat = packedIndices[i].format;
+		header.boundsCenter = meshes[i].bounds.Center;
+		header.boundsExtents = meshes[i].bounds.Extents;
+		header.sphereCenter = meshes[i].sphere.Center;
+		header.sphereRadius = meshes[i].sphere.Radius;
+
+		header.vertexOffset = offset;
+		offset = AlignBlob(offset + meshes[i].Vertices().size_bytes());
+		header.indexOffset = offset;
+		offset = AlignBlob(offset + packedIndices[i].ByteSize());
+
+		const MeshletData& meshlets = meshes[i].meshlets;
+		header.meshletCount = (uint32_t)meshlets.Meshlets().size();
+		header.meshletVertexCount = (uint32_t)meshlets.Vertices().size();
+		header.meshletTriangleCount = (uint32_t)(meshlets.Triangles().size() / 3);
+		header.meshletOffset = offset;
+		offset = AlignBlob(offset + meshlets.Meshlets().size_bytes());
+		header.meshletBoundsOffset = offset;
+		offset = AlignBlob(offset + meshlets.Bounds().size_bytes());
+		header.meshletVertexOffset = offset;
+		offset = AlignBlob(offset + meshlets.Vertices().size_bytes());
+		header.meshletTriangleOffset = offset;
+		offset = AlignBlob(offset + meshlets.Triangles().size_bytes());
+
+		// LODs share the mesh's vertices, so the mesh's index format addresses them too
+		const std::vector<MeshLod>& lods = meshes[i].lods;
+		header.lodCount = (uint32_t)lods.size();
+		header.lodOffset = offset;
+		offset = AlignBlob(offset + sizeof(LodHeader) * lods.size());
+		lodHeaders[i].resize(lods.size());
+		packedLodIndices[i].resize(lods.size());
+		for (size_t level = 0; level < lods.size(); level++) {
+			packedLodIndices[i][level] = IndexBufferData::Pack(lods[level].Indices(), packedIndices[i].format);
+			lodHeaders[i][level].indexCount = (uint32_t)packedLodIndices[i][level].count;
+			lodHeaders[i][level].geometricError = lods[level].geometricError;
+			lodHeaders[i][level].indexOffset = offset;
+			offset = AlignBlob(offset + packedLodIndices[i][level].ByteSize());
+		}
+	}
+	fileHeader.fileSize = offset;
+
+	// Written to a temporary first so a crash mid write never leaves a cache that looks valid
+	const std::string tempPath = cachePath + ".tmp";
+	{
+		std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+		if (!out) return false;
+
+		const char padding[BLOB_ALIGNMENT] = {};
+		auto writePadded = [&](const void* data, uint64_t byteSize) {
+			out.write(static_cast<const char*>(data), byteSize);
+			uint64_t position = (uint64_t)out.tellp();
+			out.write(padding, AlignBlob(position) - position);
+		};
+
+		out.write(reinterpret_cast<const char*>(&fileHeader), sizeof(fileHeader));
+		writePadded(meshHeaders.data(), sizeof(MeshHeader) * meshHeaders.size());
+		writePadded(scene.parents.data(), sizeof(uint32_t) * scene.parents.size());
+		writePadded(scene.localTransforms.data(), sizeof(DirectX::XMFLOAT4X4) * scene.localTransforms.size());
+		writePadded(scene.meshOffsets.data(), sizeof(uint32_t) * scene.meshOffsets.size());
+		writePadded(scene.meshRefs.data(), sizeof(uint32_t) * scene.meshRefs.size());
+		for (size_t i = 0; i < meshes.size(); i++) {
+			writePadded(meshes[i].Vertices().data(), meshes[i].Vertices().size_bytes());
+			writePadded(packedIndices[i].bytes.data(), packedIndices[i].ByteSize());
+			writePadded(meshes[i].meshlets.Meshlets().data(), meshes[i].meshlets.Meshlets().size_bytes());
+			writePadded(meshes[i].meshlets.Bounds().data(), meshes[i].meshlets.Bounds().size_bytes());
+			writePadded(meshes[i].meshlets.Vertices().data(), meshes[i].meshlets.Vertices().size_bytes());
+			writePadded(meshes[i].meshlets.Triangles().data(), meshes[i].meshlets.Triangles().size_bytes());
+			writePadded(lodHeaders[i].data(), sizeof(LodHeader) * lodHeaders[i].size());
+			for (const IndexBufferData& lodIndices : packedLodIndices[i]) writePadded(lodIndices.bytes.data(), lodIndices.ByteSize());
+		}
+		if (!out) return false;
+	}
+
+	std::error_code error;
+	std::filesystem::rename(tempPath, cachePath, error);
+	return !error;
+}
+
+bool MeshCache::Read(const std::string& cachePath, uint64_t sourceHash, MappedFile& file, std::vector<Mesh>& meshes, SceneGraph& scene)
+{
+	if (!file.Open(cachePath)) return false;
+
+	const uint64_t fileSize = file.Size();
+	if (fileSize < sizeof(FileHeader)) {
+		file.Close();
+		return false;
+	}
+
+	const FileHeader* fileHeader = reinterpret_cast<const FileHeader*>(file.Data());
+	const bool headerValid = fileHeader->magic == MAGIC &&
+		fileHeader->version == VERSION &&
+		fileHeader->sourceHash == sourceHash &&
+		fileHeader->vertexStride == sizeof(vertexConsts) &&
+		fileHeader->fileSize == fileSize &&
+		sizeof(FileHeader) + sizeof(MeshHeader) * (uint64_t)fileHeader->meshCount <= fileSize &&
+		BlobInFile(fileHeader->parentOffset, sizeof(uint32_t) * (uint64_t)fileHeader->nodeCount, fileSize) &&
+		BlobInFile(fileHeader->localTransformOffset, sizeof(DirectX::XMFLOAT4X4) * (uint64_t)fileHeader->nodeCount, fileSize) &&
+		BlobInFile(fileHeader->meshOffsetOffset, sizeof(uint32_t) * ((uint64_t)fileHeader->nodeCount + 1), fileSize) &&
+		BlobInFile(fileHeader->meshRefOffset, sizeof(uint32_t) * (uint64_t)fileHeader->meshRefCount, fileSize);
+	if (!headerValid) {
+		file.Close();
+		return false;
+	}
+
+	SceneGraph cachedScene;
+	auto copyBlob = [&](auto& destination, uint64_t offset, size_t count) {
+		destination.resize(count);
+		if (count > 0) memcpy(destination.data(), file.Data() + offset, sizeof(destination[0]) * count);
+	};
+	copyBlob(cachedScene.parents, fileHeader->parentOffset, fileHeader->nodeCount);
+	copyBlob(cachedScene.localTransforms, fileHeader->localTransformOffset, fileHeader->nodeCount);
+	copyBlob(cachedScene.meshOffsets, fileHeader->meshOffsetOffset, (size_t)fileHeader->nodeCount + 1);
+	copyBlob(cachedScene.meshRefs, fileHeader->meshRefOffset, fileHeader->meshRefCount);
+	if (!cachedScene.IsValid(fileHeader->meshCount)) {
+		file.Close();
+		return false;
+	}
+	cachedScene.UpdateWorldTransforms();
+
+	const MeshHeader* meshHeaders = reinterpret_cast<const MeshHeader*>(file.Data() + sizeof(FileHeader));
+	std::vector<Mesh> mappedMeshes;
+	mappedMeshes.reserve(fileHeader->meshCount);
+	for (uint32_t i = 0; i < fileHeader->meshCount; i++) {
+		const MeshHeader& header = meshHeaders[i];
+		const uint64_t vertexBytes = (uint64_t)header.vertexCount * sizeof(vertexConsts);
+		const DXGI_FORMAT indexFormat = (DXGI_FORMAT)header.indexFormat;
+		const uint64_t indexBytes = (uint64_t)header.indexCount * IndexFormatSize(indexFormat);
+		const bool formatValid = indexFormat == DXGI_FORMAT_R16_UINT || indexFormat == DXGI_FORMAT_R32_UINT;
+		const bool blobsValid = BlobInFile(header.vertexOffset, vertexBytes, fileSize) &&
+			BlobInFile(header.indexOffset, indexBytes, fileSize) &&
+			BlobInFile(header.meshletOffset, (uint64_t)header.meshletCount * sizeof(Meshlet), fileSize) &&
+			BlobInFile(header.meshletBoundsOffset, (uint64_t)header.meshletCount * sizeof(MeshletBounds), fileSize) &&
+			BlobInFile(header.meshletVertexOffset, (uint64_t)header.meshletVertexCount * sizeof(uint32_t), fileSize) &&
+			BlobInFile(header.meshletTriangleOffset, (uint64_t)header.meshletTriangleCount * 3, fileSize) &&
+			BlobInFile(header.lodOffset, (uint64_t)header.lodCount * sizeof(LodHeader), fileSize);
+		if (!formatValid || !blobsValid) {
+			file.Close();
+			return false;
+		}
+
+		const LodHeader* lodHeaders = reinterpret_cast<const LodHeader*>(file.Data() + header.lodOffset);
+		for (uint32_t level = 0; level < header.lodCount; level++) {
+			if (!BlobInFile(lodHeaders[level].indexOffset, (uint64_t)lodHeaders[level].indexCount * IndexFormatSize(indexFormat), fileSize)) {
+				file.Close();
+				return false;
+			}
+		}
+
+		std::span<const vertexConsts> vertices(reinterpret_cast<const vertexConsts*>(file.Data() + header.vertexOffset), header.vertexCount);
+		IndexView indices(file.Data() + header.indexOffset, header.indexCount, indexFormat);
+		if (!IndicesValid(indices, header.vertexCount)) {
+			file.Close();
+			return false;
+		}
+		Mesh& mesh = mappedMeshes.emplace_back(vertices, indices, DirectX::BoundingBox(header.boundsCenter, header.boundsExtents),
+			DirectX::BoundingSphere(header.sphereCenter, header.sphereRadius));
+		mesh.meshlets = MeshletData(
+			std::span<const Meshlet>(reinterpret_cast<const Meshlet*>(file.Data() + header.meshletOffset), header.meshletCount),
+			std::span<const MeshletBounds>(reinterpret_cast<const MeshletBounds*>(file.Data() + header.meshletBoundsOffset), header.meshletCount),
+			std::span<const uint32_t>(reinterpret_cast<const uint32_t*>(file.Data() + header.meshletVertexOffset), header.meshletVertexCount),
+			std::span<const uint8_t>(file.Data() + header.meshletTriangleOffset, (size_t)header.meshletTriangleCount * 3));
+		if (!MeshletsValid(mesh.meshlets, header.vertexCount)) {
+			file.Close();
+			return false;
+		}
+		mesh.lods.reserve(header.lodCount);
+		for (uint32_t level = 0; level < header.lodCount; level++) {
+			const IndexView lodIndices(file.Data() + lodHeaders[level].indexOffset, lodHeaders[level].indexCount, indexFormat);
+			if (!IndicesValid(lodIndices, header.vertexCount)) {
+				file.Close();
+				return false;
+			}
+			mesh.lods.emplace_back(lodIndices, lodHeaders[level].geometricError);
+		}
+	}
+
+	meshes = std::move(mappedMeshes);
+	scene = std::move(cachedScene);
+	return true;
+}
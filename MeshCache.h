@@ -0,0 +1,109 @@
+#pragma once
+#include "Utility.h"
+#include "FrameResource.h"
+#include <string>
+#include <vector>
+
+namespace Dx12MasterProject {
+
+	struct Mesh;
+	class SceneGraph;
+
+	//Read only view of a whole file through a memory mapping. The view stays valid until Close or destruction.
+	class MappedFile
+	{
+	public:
+		MappedFile() = default;
+		MappedFile(const MappedFile& temp) = delete;
+		MappedFile& operator= (const MappedFile& temp) = delete;
+		~MappedFile();
+
+		bool Open(const std::string& path);
+		void Close();
+
+		bool IsOpen() const { return mData != nullptr; }
+		const uint8_t* Data() const { return mData; }
+		uint64_t Size() const { return mSize; }
+
+		//Asks the memory manager to page in a range ahead of use, clamped to the file. Only a hint, failures are ignored.
+		void Prefetch(uint64_t offset, uint64_t size) const;
+
+	private:
+		HANDLE mFile = INVALID_HANDLE_VALUE;
+		HANDLE mMapping = nullptr;
+		const uint8_t* mData = nullptr;
+		uint64_t mSize = 0;
+	};
+
+	//64 bit FNV-1a, consumed a word at a time so hashing a large source file stays cheap compared to importing it.
+	uint64_t HashBytes(const void* data, size_t size, uint64_t seed = 0xcbf29ce484222325ull);
+	bool HashFile(const std::string& path, uint64_t& hash);
+
+	/*
+		Mesh cache file layout (all offsets from the start of the file, blobs 16 byte aligned):
+		-FileHeader
+		-MeshHeader[meshCount]
+		-Scene graph: uint32 parent[nodeCount], XMFLOAT4X4 local[nodeCount], uint32 meshOffset[nodeCount + 1], uint32 meshRef[meshRefCount]
+		-Per mesh: vertexConsts[vertexCount], index[indexCount] at the narrowest width that addresses every vertex,
+		 Meshlet[meshletCount], MeshletBounds[meshletCount], uint32[meshletVertexCount], uint8[meshletTriangleCount * 3],
+		 LodHeader[lodCount], then per LOD index[indexCount] in the mesh's index format
+	*/
+	namespace MeshCache {
+		const uint32_t MAGIC = 0x4843534D; // "MSCH"
+		const uint32_t VERSION = 6;
+		const uint64_t BLOB_ALIGNMENT = 16;
+
+		struct FileHeader {
+			uint32_t magic = MAGIC;
+			uint32_t version = VERSION;
+			uint64_t sourceHash = 0;
+			uint32_t meshCount = 0;
+			uint32_t vertexStride = sizeof(vertexConsts);
+			uint64_t fileSize = 0;
+			uint32_t nodeCount = 0;
+			uint32_t meshRefCount = 0;
+			uint64_t parentOffset = 0;
+			uint64_t localTransformOffset = 0;
+			uint64_t meshOffsetOffset = 0;
+			uint64_t meshRefOffset = 0;
+		};
+
+		struct MeshHeader {
+			uint32_t vertexCount = 0;
+			uint32_t indexCount = 0;
+			uint32_t indexFormat = DXGI_FORMAT_R16_UINT;
+			uint32_t padding = 0;
+			uint64_t vertexOffset = 0;
+			uint64_t indexOffset = 0;
+			DirectX::XMFLOAT3 boundsCenter = { 0.0f, 0.0f, 0.0f };
+			DirectX::XMFLOAT3 boundsExtents = { 0.0f, 0.0f, 0.0f };
+			uint32_t meshletCount = 0;
+			uint32_t meshletVertexCount = 0;
+			uint32_t meshletTriangleCount = 0;
+			uint32_t padding2 = 0;
+			uint64_t meshletOffset = 0;
+			uint64_t meshletBoundsOffset = 0;
+			uint64_t meshletVertexOffset = 0;
+			uint64_t meshletTriangleOffset = 0;
+			uint32_t lodCount = 0;
+			uint32_t padding3 = 0;
+			uint64_t lodOffset = 0;
+			DirectX::XMFLOAT3 sphereCenter = { 0.0f, 0.0f, 0.0f };
+			float sphereRadius = 0.0f;
+		};
+
+		struct LodHeader {
+			uint32_t indexCount = 0;
+			float geometricError = 0.0f;
+			uint64_t indexOffset = 0;
+		};
+
+		std::string CachePathFor(const std::string& sourcePath);
+		bool Write(const std::string& cachePath, uint64_t sourceHash, const std::vector<Mesh>& meshes, const SceneGraph& scene);
+
+		//Maps the cache and builds meshes that point straight into the mapping, the small scene graph is copied out and
+		//its world matrices recomputed. Fails on any version, hash or size mismatch and on indices that would address
+		//past the arrays they index.
+		bool Read(const std::string& cachePath, uint64_t sourceHash, MappedFile& file, std::vector<Mesh>& meshes, SceneGraph& scene);
+	}
+}
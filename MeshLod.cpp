@@ -0,0 +1,303 @@
+#include "MeshLod.h"
+#include "Model.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <numeric>
+#include <unordered_map>
+
+using namespace Dx12MasterProject;
+
+namespace {
+	//Area weighted sum of squared distances to a set of planes. Kept in double, a vertex late in the chain carries the
+	//planes of hundreds of collapsed neighbours.
+	struct Quadric {
+		double a2 = 0.0, b2 = 0.0, c2 = 0.0, ab = 0.0, ac = 0.0, bc = 0.0, ad = 0.0, bd = 0.0, cd = 0.0, d2 = 0.0;
+		double weight = 0.0;
+
+		void AddPlane(double a, double b, double c, double d, double w)
+		{
+			a2 += w * a * a; b2 += w * b * b; c2 += w * c * c;
+			ab += w * a * b; ac += w * a * c; bc += w * b * c;
+			ad += w * a * d; bd += w * b * d; cd += w * c * d;
+			d2 += w * d * d;
+			weight += w;
+		}
+
+		Quadric& operator+= (const Quadric& other)
+		{
+			a2 += other.a2; b2 += other.b2; c2 += other.c2;
+			ab += other.ab; ac += other.ac; bc += other.bc;
+			ad += other.ad; bd += other.bd; cd += other.cd;
+			d2 += other.d2;
+			weight += other.weight;
+			return *this;
+		}
+
+		//Area weighted sum of squared distances from the point to the planes, the collapse cost.
+		double Error(const DirectX::XMFLOAT3& point) const
+		{
+			const double x = point.x, y = point.y, z = point.z;
+			const double error = a2 * x * x + b2 * y * y + c2 * z * z + 2.0 * (ab * x * y + ac * x * z + bc * y * z) +
+				2.0 * (ad * x + bd * y + cd * z) + d2;
+			return (std::max)(error, 0.0);
+		}
+
+		//Area weighted mean of the squared distances, its root is the RMS distance in model units.
+		double MeanSquaredError(const DirectX::XMFLOAT3& point) const
+		{
+			return weight > 0.0 ? Error(point) / weight : 0.0;
+		}
+	};
+
+	struct Collapse {
+		uint32_t source;
+		uint32_t target;
+		double error;
+	};
+
+	class Simplifier
+	{
+	public:
+		Simplifier(std::span<const vertexConsts> vertices, IndexView indices) : mVertices(vertices)
+		{
+			GroupPositions();
+
+			const size_t triangleIndexCount = indices.size() - indices.size() % 3;
+			mIndices.reserve(triangleIndexCount);
+			for (size_t i = 0; i < triangleIndexCount; i += 3) {
+				const uint32_t triangle[3] = { indices[i], indices[i + 1], indices[i + 2] };
+				if (IsDegenerate(triangle[0], triangle[1], triangle[2])) continue;
+				mIndices.insert(mIndices.end(), triangle, triangle + 3);
+			}
+
+			LockVertices();
+			BuildQuadrics();
+		}
+
+		size_t TriangleCount() const { return mIndices.size() / 3; }
+		const std::vector<uint32_t>& Indices() const { return mIndices; }
+		//Largest RMS distance of a collapsed vertex from the planes it gathered, over every collapse so far.
+		float GeometricError() const { return (float)std::sqrt(mMaxError); }
+
+		//Collapses the cheapest edges first until the target is met. Each vertex takes part in at most one collapse per
+		//pass so the adjacency gathered up front stays valid. Returns the number of triangles removed.
+		size_t CollapsePass(size_t targetTriangles)
+		{
+			const size_t vertexCount = mVertices.size();
+			const size_t triangleCount = TriangleCount();
+			if (triangleCount <= targetTriangles) return 0;
+
+			// Vertex to triangle adjacency, CSR layout
+			std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+			for (uint32_t index : mIndices) adjacencyOffsets[index + 1]++;
+			for (size_t v = 0; v < vertexCount; v++) adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+			std::vector<uint32_t> adjacency(mIndices.size());
+			std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+			for (size_t i = 0; i < mIndices.size(); i++) adjacency[fill[mIndices[i]]++] = (uint32_t)(i / 3);
+
+			std::vector<Collapse> collapses;
+			collapses.reserve(mIndices.size());
+			for (size_t t = 0; t < triangleCount; t++) {
+				for (uint32_t e = 0; e < 3; e++) {
+					const uint32_t a = mIndices[t * 3 + e];
+					const uint32_t b = mIndices[t * 3 + (e + 1) % 3];
+					if (!mLocked[mPositionId[a]]) collapses.push_back({ a, b, CollapseCost(a, b) });
+					if (!mLocked[mPositionId[b]]) collapses.push_back({ b, a, CollapseCost(b, a) });
+				}
+			}
+			if (collapses.empty()) return 0;
+			std::sort(collapses.begin(), collapses.end(), [](const Collapse& x, const Collapse& y) {
+				if (x.error != y.error) return x.error < y.error;
+				return x.source != y.source ? x.source < y.source : x.target < y.target;
+			});
+
+			// Most collapses remove two triangles. Locks stop many of the cheapest candidates, so the pass may go past
+			// the ideal error by a margin, beyond that it is better to rebuild the candidates from the reduced mesh.
+			const size_t triangleGoal = triangleCount - targetTriangles;
+			const size_t edgeGoal = (std::min)(triangleGoal / 2, collapses.size() - 1);
+			const double errorGoal = collapses[edgeGoal].error * 1.5;
+
+			std::vector<uint32_t> remap(vertexCount);
+			std::iota(remap.begin(), remap.end(), 0u);
+			std::vector<uint8_t> passLocked(vertexCount, 0);
+			size_t removed = 0;
+			for (const Collapse& collapse : collapses) {
+				if (removed >= triangleGoal) break;
+				if (collapse.error > errorGoal && removed > triangleGoal / 10) break;
+				if (passLocked[collapse.source] || passLocked[collapse.target]) continue;
+
+				const std::span<const uint32_t> triangles(adjacency.data() + adjacencyOffsets[collapse.source], adjacencyOffsets[collapse.source + 1] - adjacencyOffsets[collapse.source]);
+				size_t collapsed = 0;
+				if (!CanCollapse(collapse, triangles, remap, collapsed)) continue;
+
+				remap[collapse.source] = collapse.target;
+				Quadric& merged = mQuadrics[mPositionId[collapse.target]];
+				merged += mQuadrics[mPositionId[collapse.source]];
+				passLocked[collapse.source] = 1;
+				passLocked[collapse.target] = 1;
+				mMaxError = (std::max)(mMaxError, merged.MeanSquaredError(mVertices[collapse.target].pos));
+				removed += collapsed;
+			}
+
+			// Sources are never targets within a pass, so one remap step resolves every index
+			size_t written = 0;
+			for (size_t t = 0; t < triangleCount; t++) {
+				const uint32_t a = remap[mIndices[t * 3]], b = remap[mIndices[t * 3 + 1]], c = remap[mIndices[t * 3 + 2]];
+				if (IsDegenerate(a, b, c)) continue;
+				mIndices[written++] = a;
+				mIndices[written++] = b;
+				mIndices[written++] = c;
+			}
+			const size_t removedTriangles = triangleCount - written / 3;
+			mIndices.resize(written);
+			return removedTriangles;
+		}
+
+	private:
+		//Groups vertices with bit identical positions, after welding these only differ in their normals (a hard edge).
+		//Every vertex maps to the lowest index of its group.
+		void GroupPositions()
+		{
+			const size_t vertexCount = mVertices.size();
+			auto positionKey = [&](uint32_t v) {
+				std::array<uint32_t, 3> key;
+				memcpy(key.data(), &mVertices[v].pos, sizeof(key));
+				return key;
+			};
+
+			std::vector<uint32_t> order(vertexCount);
+			std::iota(order.begin(), order.end(), 0u);
+			std::sort(order.begin(), order.end(), [&](uint32_t x, uint32_t y) {
+				const std::array<uint32_t, 3> keyX = positionKey(x), keyY = positionKey(y);
+				return keyX != keyY ? keyX < keyY : x < y;
+			});
+
+			mPositionId.resize(vertexCount);
+			mWedgeCount.assign(vertexCount, 0);
+			for (size_t i = 0; i < vertexCount; i++) {
+				const bool newGroup = i == 0 || positionKey(order[i]) != positionKey(order[i - 1]);
+				mPositionId[order[i]] = newGroup ? order[i] : mPositionId[order[i - 1]];
+				mWedgeCount[mPositionId[order[i]]]++;
+			}
+		}
+
+		//Error of the merged quadric at the target, the target's own planes count as much as the source's.
+		double CollapseCost(uint32_t source, uint32_t target) const
+		{
+			Quadric merged = mQuadrics[mPositionId[source]];
+			merged += mQuadrics[mPositionId[target]];
+			return merged.Error(mVertices[target].pos);
+		}
+
+		bool IsDegenerate(uint32_t a, uint32_t b, uint32_t c) const
+		{
+			return mPositionId[a] == mPositionId[b] || mPositionId[b] == mPositionId[c] || mPositionId[a] == mPositionId[c];
+		}
+
+		//Borders (an edge without a twin), seams (a position shared by several vertices) and non manifold edges stay put,
+		//moving them would open holes or tear attributes. They can still be collapse targets.
+		void LockVertices()
+		{
+			std::unordered_map<uint64_t, uint32_t> edges;
+			edges.reserve(mIndices.size());
+			auto edgeKey = [](uint32_t from, uint32_t to) { return ((uint64_t)from << 32) | to; };
+			for (size_t i = 0; i < mIndices.size(); i += 3) {
+				for (uint32_t e = 0; e < 3; e++) {
+					edges[edgeKey(mPositionId[mIndices[i + e]], mPositionId[mIndices[i + (e + 1) % 3]])]++;
+				}
+			}
+
+			mLocked.assign(mVertices.size(), 0);
+			for (size_t v = 0; v < mVertices.size(); v++) {
+				if (mWedgeCount[v] > 1) mLocked[v] = 1;
+			}
+			for (const auto& [key, count] : edges) {
+				const uint32_t from = (uint32_t)(key >> 32), to = (uint32_t)key;
+				if (count > 1 || edges.find(edgeKey(to, from)) == edges.end()) {
+					mLocked[from] = 1;
+					mLocked[to] = 1;
+				}
+			}
+		}
+
+		void BuildQuadrics()
+		{
+			mQuadrics.assign(mVertices.size(), Quadric());
+			for (size_t i = 0; i < mIndices.size(); i += 3) {
+				const DirectX::XMFLOAT3& p0 = mVertices[mIndices[i]].pos;
+				const DirectX::XMFLOAT3& p1 = mVertices[mIndices[i + 1]].pos;
+				const DirectX::XMFLOAT3& p2 = mVertices[mIndices[i + 2]].pos;
+				const double e1[3] = { (double)p1.x - p0.x, (double)p1.y - p0.y, (double)p1.z - p0.z };
+				const double e2[3] = { (double)p2.x - p0.x, (double)p2.y - p0.y, (double)p2.z - p0.z };
+				double normal[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+				const double length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+				if (length <= 0.0) continue;
+				for (double& component : normal) component /= length;
+				const double distance = -(normal[0] * p0.x + normal[1] * p0.y + normal[2] * p0.z);
+
+				for (uint32_t c = 0; c < 3; c++) {
+					mQuadrics[mPositionId[mIndices[i + c]]].AddPlane(normal[0], normal[1], normal[2], distance, length * 0.5);
+				}
+			}
+		}
+
+		//Rejects the collapse when a surviving triangle around the source would flip or become degenerate, otherwise
+		//counts the triangles it removes.
+		bool CanCollapse(const Collapse& collapse, std::span<const uint32_t> triangles, const std::vector<uint32_t>& remap, size_t& collapsed) const
+		{
+			const uint32_t targetId = mPositionId[collapse.target];
+			const DirectX::XMVECTOR targetPosition = DirectX::XMLoadFloat3(&mVertices[collapse.target].pos);
+			collapsed = 0;
+			for (uint32_t t : triangles) {
+				const uint32_t corners[3] = { remap[mIndices[t * 3]], remap[mIndices[t * 3 + 1]], remap[mIndices[t * 3 + 2]] };
+				if (IsDegenerate(corners[0], corners[1], corners[2])) continue; // already removed by an earlier collapse
+				if (mPositionId[corners[0]] == targetId || mPositionId[corners[1]] == targetId || mPositionId[corners[2]] == targetId) {
+					collapsed++;
+					continue;
+				}
+
+				DirectX::XMVECTOR before[3], after[3];
+				for (uint32_t c = 0; c < 3; c++) {
+					before[c] = DirectX::XMLoadFloat3(&mVertices[corners[c]].pos);
+					after[c] = corners[c] == collapse.source ? targetPosition : before[c];
+				}
+				const DirectX::XMVECTOR normalBefore = DirectX::XMVector3Cross(DirectX::XMVectorSubtract(before[1], before[0]), DirectX::XMVectorSubtract(before[2], before[0]));
+				const DirectX::XMVECTOR normalAfter = DirectX::XMVector3Cross(DirectX::XMVectorSubtract(after[1], after[0]), DirectX::XMVectorSubtract(after[2], after[0]));
+				// Turning a face by more than ~75 degrees counts as a flip, a plain sign test lets slivers fold over in steps
+				const float lengths = DirectX::XMVectorGetX(DirectX::XMVector3Length(normalBefore)) * DirectX::XMVectorGetX(DirectX::XMVector3Length(normalAfter));
+				if (DirectX::XMVectorGetX(DirectX::XMVector3Dot(normalBefore, normalAfter)) <= 0.25f * lengths) return false;
+			}
+			return true;
+		}
+
+		std::span<const vertexConsts> mVertices;
+		std::vector<uint32_t> mIndices;
+		std::vector<uint32_t> mPositionId;
+		std::vector<uint32_t> mWedgeCount; // per position id
+		std::vector<uint8_t> mLocked; // per position id
+		std::vector<Quadric> mQuadrics; // per position id
+		double mMaxError = 0.0; // squared
+	};
+}
+
+std::vector<MeshLod> LodBuilder::Build(const Mesh& mesh, const LodSettings& settings)
+{
+	std::vector<MeshLod> lods;
+	Simplifier simplifier(mesh.Vertices(), mesh.Indices());
+	const size_t fullTriangleCount = simplifier.TriangleCount();
+
+	size_t previousTriangleCount = fullTriangleCount;
+	const uint32_t levelCount = (std::min)(settings.levelCount, LodSettings::MAX_LEVELS);
+	for (uint32_t level = 0; level < levelCount; level++) {
+		const size_t target = (size_t)((double)fullTriangleCount * (std::max)(settings.triangleRatios[level], 0.0f));
+		while (simplifier.TriangleCount() > target && simplifier.CollapsePass(target) > 0) {}
+
+		// A level that is no smaller than the last one adds nothing, one that missed its target is as far as it goes
+		if (simplifier.TriangleCount() >= previousTriangleCount) break;
+		previousTriangleCount = simplifier.TriangleCount();
+		lods.emplace_back(simplifier.Indices(), simplifier.GeometricError());
+		if (simplifier.TriangleCount() > target) break;
+	}
+	return lods;
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include "Utility.h"
+#include "IndexBuffer.h"
+#include <span>
+
+namespace Dx12MasterProject {
+
+	struct Mesh;
+
+	struct LodSettings {
+		static constexpr uint32_t MAX_LEVELS = 4;
+		uint32_t levelCount = 3;
+		float triangleRatios[MAX_LEVELS] = { 0.5f, 0.25f, 0.125f, 0.0625f }; // of the full detail triangle count
+	};
+
+	//One simplified level of a mesh. Levels only carry indices, they draw from the full detail mesh's vertices so a
+	//whole chain shares one vertex buffer. Either owned or viewed from a mesh cache mapping like the mesh data itself.
+	struct MeshLod {
+		std::vector<uint32_t> indices;
+		float geometricError = 0.0f; // model units, largest RMS distance of a collapsed vertex from its original planes
+
+		MeshLod() = default;
+		MeshLod(std::vector<uint32_t> Indices, float GeometricError) : indices(std::move(Indices)), geometricError(GeometricError) {}
+		MeshLod(IndexView MappedIndices, float GeometricError) : geometricError(GeometricError), mappedIndices(MappedIndices), mapped(true) {}
+
+		IndexView Indices() const { return mapped ? mappedIndices : IndexView(std::span<const uint32_t>(indices)); }
+
+	private:
+		IndexView mappedIndices;
+		bool mapped = false;
+	};
+
+	namespace LodBuilder {
+		//Quadric error metric simplification (Garland and Heckbert 1997) by half edge collapses, so every level reuses
+		//the existing vertices. Border, seam and non manifold vertices are locked in place, collapses that would flip a
+		//triangle are rejected. The levels are snapshots of one progressive run, each at or below its triangle ratio,
+		//the chain ends early when the mesh cannot be reduced any further.
+		std::vector<MeshLod> Build(const Mesh& mesh, const LodSettings& settings = {});
+	}
+}
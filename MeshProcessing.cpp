@@ -0,0 +1,514 @@
+#include "MeshProcessing.h"
+#include "Model.h"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+using namespace Dx12MasterProject;
+
+namespace {
+	const uint32_t INVALID_VERTEX = 0xFFFFFFFF;
+
+	int64_t CellCoord(float value, float inverseCellSize)
+	{
+		// Clamped so huge coordinates or NaNs still land in a valid (if shared) cell
+		const double limit = 4.0e18;
+		double cell = std::floor((double)value * inverseCellSize);
+		if (!(cell >= -limit)) cell = -limit;
+		if (cell > limit) cell = limit;
+		return (int64_t)cell;
+	}
+
+	uint32_t HashCell(int64_t x, int64_t y, int64_t z)
+	{
+		return (uint32_t)x * 73856093u ^ (uint32_t)y * 19349663u ^ (uint32_t)z * 83492791u;
+	}
+
+	bool WithinEpsilon(const DirectX::XMFLOAT3& a, const DirectX::XMFLOAT3& b, float epsilon)
+	{
+		return std::fabs(a.x - b.x) <= epsilon && std::fabs(a.y - b.y) <= epsilon && std::fabs(a.z - b.z) <= epsilon;
+	}
+
+	//Spatial hash over the welded vertices. Cells are twice the position epsilon wide so any vertex within epsilon of
+	//a query lies in one of at most 2x2x2 neighbouring cells. Buckets chain through next[], collisions between cells
+	//are harmless because candidates are always compared by value.
+	class WeldGrid
+	{
+	public:
+		WeldGrid(size_t vertexCount, const WeldSettings& settings) : mSettings(settings)
+		{
+			mInverseCellSize = settings.positionEpsilon > 0.0f ? 0.5f / settings.positionEpsilon : 1.0f;
+			mBuckets.assign(std::bit_ceil((std::max)(vertexCount * 2, (size_t)1)), INVALID_VERTEX);
+			mMask = (uint32_t)(mBuckets.size() - 1);
+			mNext.reserve(vertexCount);
+		}
+
+		uint32_t Find(const vertexConsts& vertex, const std::vector<vertexConsts>& welded) const
+		{
+			const float epsilon = mSettings.positionEpsilon;
+			const int64_t minX = CellCoord(vertex.pos.x - epsilon, mInverseCellSize), maxX = CellCoord(vertex.pos.x + epsilon, mInverseCellSize);
+			const int64_t minY = CellCoord(vertex.pos.y - epsilon, mInverseCellSize), maxY = CellCoord(vertex.pos.y + epsilon, mInverseCellSize);
+			const int64_t minZ = CellCoord(vertex.pos.z - epsilon, mInverseCellSize), maxZ = CellCoord(vertex.pos.z + epsilon, mInverseCellSize);
+
+			for (int64_t x = minX; x <= maxX; x++) {
+				for (int64_t y = minY; y <= maxY; y++) {
+					for (int64_t z = minZ; z <= maxZ; z++) {
+						for (uint32_t candidate = mBuckets[HashCell(x, y, z) & mMask]; candidate != INVALID_VERTEX; candidate = mNext[candidate]) {
+							if (WithinEpsilon(welded[candidate].pos, vertex.pos, mSettings.positionEpsilon) &&
+								WithinEpsilon(welded[candidate].norm, vertex.norm, mSettings.normalEpsilon)) {
+								return candidate;
+							}
+						}
+					}
+				}
+			}
+			return INVALID_VERTEX;
+		}
+
+		//Vertices must be inserted in welded order, index i is the i'th insert.
+		void Insert(const vertexConsts& vertex)
+		{
+			uint32_t& bucket = mBuckets[HashCell(CellCoord(vertex.pos.x, mInverseCellSize), CellCoord(vertex.pos.y, mInverseCellSize), CellCoord(vertex.pos.z, mInverseCellSize)) & mMask];
+			mNext.push_back(bucket);
+			bucket = (uint32_t)(mNext.size() - 1);
+		}
+
+	private:
+		WeldSettings mSettings;
+		float mInverseCellSize = 1.0f;
+		uint32_t mMask = 0;
+		std::vector<uint32_t> mBuckets;
+		std::vector<uint32_t> mNext;
+	};
+
+	//Optimisation passes rewrite the arrays in place, meshes mapped from the cache are copied out first.
+	void MakeOwned(Mesh& mesh)
+	{
+		if (!mesh.IsMapped()) return;
+		std::span<const vertexConsts> vertices = mesh.Vertices();
+		IndexView indices = mesh.Indices();
+		std::vector<uint32_t> ownedIndices(indices.size());
+		for (size_t i = 0; i < indices.size(); i++) ownedIndices[i] = indices[i];
+		mesh = Mesh(std::vector<vertexConsts>(vertices.begin(), vertices.end()), std::move(ownedIndices));
+	}
+
+	//FIFO post transform cache. A vertex stays resident until cacheSize newer vertices have been transformed, flushing
+	//just moves the clock far enough that every entry reads as evicted.
+	class FifoCache
+	{
+	public:
+		FifoCache(size_t vertexCount, uint32_t cacheSize) : mCacheSize(cacheSize), mTime(cacheSize + 1), mTimestamps(vertexCount, 0) {}
+
+		//Returns true on a miss.
+		bool Access(uint32_t vertex)
+		{
+			if (mTime - mTimestamps[vertex] <= mCacheSize) return false;
+			mTimestamps[vertex] = mTime++;
+			return true;
+		}
+
+		//Vertices transformed since this one entered the cache, anything above the cache size has been evicted.
+		uint64_t Age(uint32_t vertex) const { return mTime - mTimestamps[vertex]; }
+		void Flush() { mTime += mCacheSize + 1; }
+
+	private:
+		uint64_t mCacheSize;
+		uint64_t mTime;
+		std::vector<uint64_t> mTimestamps;
+	};
+
+	//Tipsify (Sander et al. 2007): fans around one vertex at a time, moving to the neighbour that will still be in the
+	//cache when its remaining triangles are emitted, and falling back to recently used vertices on a dead end.
+	std::vector<uint32_t> TipsifyOrder(const std::vector<uint32_t>& indices, size_t vertexCount, uint32_t cacheSize)
+	{
+		const size_t triangleCount = indices.size() / 3;
+
+		// Vertex to triangle adjacency, CSR layout
+		std::vector<uint32_t> liveTriangles(vertexCount, 0);
+		for (uint32_t index : indices) liveTriangles[index]++;
+		std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+		for (size_t v = 0; v < vertexCount; v++) adjacencyOffsets[v + 1] = adjacencyOffsets[v] + liveTriangles[v];
+		std::vector<uint32_t> adjacency(indices.size());
+		{
+			std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+			for (size_t i = 0; i < triangleCount * 3; i++) adjacency[fill[indices[i]]++] = (uint32_t)(i / 3);
+		}
+
+		std::vector<bool> emitted(triangleCount, false);
+		std::vector<uint32_t> deadEnds;
+		deadEnds.reserve(indices.size());
+		std::vector<uint32_t> candidates;
+		FifoCache cache(vertexCount, cacheSize);
+		std::vector<uint32_t> output;
+		output.reserve(indices.size());
+
+		uint32_t cursor = 0;
+		uint32_t fanVertex = vertexCount > 0 ? 0 : INVALID_VERTEX;
+		while (fanVertex != INVALID_VERTEX) {
+			candidates.clear();
+			for (uint32_t a = adjacencyOffsets[fanVertex]; a < adjacencyOffsets[fanVertex + 1]; a++) {
+				const uint32_t triangle = adjacency[a];
+				if (emitted[triangle]) continue;
+				emitted[triangle] = true;
+				for (uint32_t c = 0; c < 3; c++) {
+					const uint32_t vertex = indices[triangle * 3 + c];
+					output.push_back(vertex);
+					deadEnds.push_back(vertex);
+					candidates.push_back(vertex);
+					liveTriangles[vertex]--;
+					cache.Access(vertex);
+				}
+			}
+
+			// Oldest candidate that survives its own remaining triangles, so it is used before it gets evicted
+			uint32_t next = INVALID_VERTEX;
+			int64_t bestPriority = -1;
+			for (uint32_t vertex : candidates) {
+				if (liveTriangles[vertex] == 0) continue;
+				int64_t priority = 0;
+				if (cache.Age(vertex) + 2 * liveTriangles[vertex] <= cacheSize) priority = (int64_t)cache.Age(vertex);
+				if (priority > bestPriority) {
+					bestPriority = priority;
+					next = vertex;
+				}
+			}
+
+			// Dead end, try the recently emitted vertices before scanning for any vertex with triangles left
+			while (next == INVALID_VERTEX && !deadEnds.empty()) {
+				const uint32_t vertex = deadEnds.back();
+				deadEnds.pop_back();
+				if (liveTriangles[vertex] > 0) next = vertex;
+			}
+			for (; next == INVALID_VERTEX && cursor < vertexCount; cursor++) {
+				if (liveTriangles[cursor] > 0) next = cursor;
+			}
+			fanVertex = next;
+		}
+		return output;
+	}
+
+	//Splits a cache optimised triangle order into clusters that can be reordered without hurting the cache much.
+	//Hard boundaries are where the order already restarts (all three vertices miss), each hard cluster is then split
+	//again wherever the running ACMR is within threshold of the cluster's own ACMR (as in meshoptimizer).
+	std::vector<uint32_t> ClusterBoundaries(const std::vector<uint32_t>& indices, size_t vertexCount, uint32_t cacheSize, float threshold)
+	{
+		const uint32_t triangleCount = (uint32_t)(indices.size() / 3);
+		auto triangleMisses = [&](FifoCache& cache, uint32_t triangle) {
+			return (uint32_t)cache.Access(indices[triangle * 3]) + (uint32_t)cache.Access(indices[triangle * 3 + 1]) + (uint32_t)cache.Access(indices[triangle * 3 + 2]);
+		};
+
+		std::vector<uint32_t> hardBoundaries;
+		{
+			FifoCache cache(vertexCount, cacheSize);
+			for (uint32_t t = 0; t < triangleCount; t++) {
+				if (triangleMisses(cache, t) == 3 || t == 0) hardBoundaries.push_back(t);
+			}
+		}
+
+		std::vector<uint32_t> boundaries;
+		FifoCache cache(vertexCount, cacheSize);
+		for (size_t c = 0; c < hardBoundaries.size(); c++) {
+			const uint32_t start = hardBoundaries[c];
+			const uint32_t end = c + 1 < hardBoundaries.size() ? hardBoundaries[c + 1] : triangleCount;
+
+			cache.Flush();
+			uint32_t clusterMisses = 0;
+			for (uint32_t t = start; t < end; t++) clusterMisses += triangleMisses(cache, t);
+			const float targetAcmr = threshold * (float)clusterMisses / (float)(end - start);
+
+			boundaries.push_back(start);
+			cache.Flush();
+			uint32_t runningMisses = 0;
+			uint32_t runningTriangles = 0;
+			for (uint32_t t = start; t < end; t++) {
+				runningMisses += triangleMisses(cache, t);
+				runningTriangles++;
+				if ((float)runningMisses / (float)runningTriangles <= targetAcmr && t + 1 < end) {
+					boundaries.push_back(t + 1);
+					cache.Flush();
+					runningMisses = 0;
+					runningTriangles = 0;
+				}
+			}
+		}
+		return boundaries;
+	}
+
+	//Projects positions for one of the six axis aligned views, u right, v up and depth away from the viewer, using the
+	//same left handed look-to basis as the camera so front faces are clockwise.
+	struct OverdrawView {
+		int uAxis;
+		float uSign;
+		int vAxis;
+		int depthAxis;
+		float depthSign;
+	};
+
+	const OverdrawView OVERDRAW_VIEWS[] = {
+		{ 0,  1.0f, 1, 2,  1.0f }, { 0, -1.0f, 1, 2, -1.0f },
+		{ 2, -1.0f, 1, 0,  1.0f }, { 2,  1.0f, 1, 0, -1.0f },
+		{ 0, -1.0f, 2, 1,  1.0f }, { 0,  1.0f, 2, 1, -1.0f },
+	};
+
+	float Component(const DirectX::XMFLOAT3& value, int axis)
+	{
+		return axis == 0 ? value.x : (axis == 1 ? value.y : value.z);
+	}
+}
+
+WeldStats& WeldStats::operator+= (const WeldStats& other)
+{
+	inputVertexCount += other.inputVertexCount;
+	outputVertexCount += other.outputVertexCount;
+	removedTriangleCount += other.removedTriangleCount;
+	return *this;
+}
+
+WeldStats MeshProcessing::WeldVertices(Mesh& mesh, const WeldSettings& settings)
+{
+	std::span<const vertexConsts> vertices = mesh.Vertices();
+	IndexView indices = mesh.Indices();
+
+	WeldStats stats;
+	stats.inputVertexCount = vertices.size();
+
+	// Greedy, first come first served: each vertex joins the first welded vertex it matches
+	WeldGrid grid(vertices.size(), settings);
+	std::vector<vertexConsts> welded;
+	welded.reserve(vertices.size());
+	std::vector<uint32_t> remap(vertices.size());
+	for (size_t i = 0; i < vertices.size(); i++) {
+		uint32_t match = grid.Find(vertices[i], welded);
+		if (match == INVALID_VERTEX) {
+			match = (uint32_t)welded.size();
+			welded.push_back(vertices[i]);
+			grid.Insert(vertices[i]);
+		}
+		remap[i] = match;
+	}
+
+	std::vector<uint32_t> weldedIndices;
+	weldedIndices.reserve(indices.size());
+	const size_t triangleIndexCount = indices.size() - indices.size() % 3;
+	for (size_t i = 0; i < triangleIndexCount; i += 3) {
+		const uint32_t a = remap[indices[i]];
+		const uint32_t b = remap[indices[i + 1]];
+		const uint32_t c = remap[indices[i + 2]];
+		if (a == b || b == c || a == c) {
+			stats.removedTriangleCount++;
+			continue;
+		}
+		weldedIndices.push_back(a);
+		weldedIndices.push_back(b);
+		weldedIndices.push_back(c);
+	}
+	for (size_t i = triangleIndexCount; i < indices.size(); i++) weldedIndices.push_back(remap[indices[i]]);
+
+	// Collapsed triangles can leave vertices nothing refers to any more
+	if (stats.removedTriangleCount > 0) {
+		std::vector<uint32_t> compact(welded.size(), INVALID_VERTEX);
+		std::vector<vertexConsts> referenced;
+		referenced.reserve(welded.size());
+		for (uint32_t& index : weldedIndices) {
+			if (compact[index] == INVALID_VERTEX) {
+				compact[index] = (uint32_t)referenced.size();
+				referenced.push_back(welded[index]);
+			}
+			index = compact[index];
+		}
+		welded = std::move(referenced);
+	}
+
+	stats.outputVertexCount = welded.size();
+	mesh = Mesh(std::move(welded), std::move(weldedIndices));
+	return stats;
+}
+
+void MeshProcessing::OptimizeMesh(Mesh& mesh, const MeshOptimizeSettings& settings)
+{
+	OptimizeVertexCache(mesh, settings.cacheSize);
+	OptimizeOverdraw(mesh, settings.cacheSize, settings.overdrawThreshold);
+	OptimizeVertexFetch(mesh);
+}
+
+void MeshProcessing::OptimizeVertexCache(Mesh& mesh, uint32_t cacheSize)
+{
+	if (mesh.Indices().size() % 3 != 0) return;
+	MakeOwned(mesh);
+	mesh.indices = TipsifyOrder(mesh.indices, mesh.vertices.size(), cacheSize);
+}
+
+void MeshProcessing::OptimizeVertexCache(std::vector<uint32_t>& indices, size_t vertexCount, uint32_t cacheSize)
+{
+	if (indices.size() % 3 != 0) return;
+	indices = TipsifyOrder(indices, vertexCount, cacheSize);
+}
+
+void MeshProcessing::OptimizeOverdraw(Mesh& mesh, uint32_t cacheSize, float threshold)
+{
+	if (mesh.Indices().size() % 3 != 0 || mesh.Indices().size() < 6) return;
+	MakeOwned(mesh);
+	const std::vector<uint32_t>& indices = mesh.indices;
+	const uint32_t triangleCount = (uint32_t)(indices.size() / 3);
+
+	// Area weighted centroid and unnormalised face normal (pointing towards the front face) per triangle
+	std::vector<DirectX::XMFLOAT3> centroids(triangleCount);
+	std::vector<DirectX::XMFLOAT3> normals(triangleCount);
+	std::vector<float> weights(triangleCount);
+	DirectX::XMVECTOR meshCentroid = DirectX::XMVectorZero();
+	float meshWeight = 0.0f;
+	for (uint32_t t = 0; t < triangleCount; t++) {
+		DirectX::XMVECTOR a = DirectX::XMLoadFloat3(&mesh.vertices[indices[t * 3]].pos);
+		DirectX::XMVECTOR b = DirectX::XMLoadFloat3(&mesh.vertices[indices[t * 3 + 1]].pos);
+		DirectX::XMVECTOR c = DirectX::XMLoadFloat3(&mesh.vertices[indices[t * 3 + 2]].pos);
+		DirectX::XMVECTOR normal = DirectX::XMVector3Cross(DirectX::XMVectorSubtract(b, a), DirectX::XMVectorSubtract(c, a));
+		DirectX::XMVECTOR centroid = DirectX::XMVectorScale(DirectX::XMVectorAdd(DirectX::XMVectorAdd(a, b), c), 1.0f / 3.0f);
+		weights[t] = DirectX::XMVectorGetX(DirectX::XMVector3Length(normal));
+		DirectX::XMStoreFloat3(&centroids[t], centroid);
+		DirectX::XMStoreFloat3(&normals[t], normal);
+		meshCentroid = DirectX::XMVectorMultiplyAdd(centroid, DirectX::XMVectorReplicate(weights[t]), meshCentroid);
+		meshWeight += weights[t];
+	}
+	if (meshWeight > 0.0f) meshCentroid = DirectX::XMVectorScale(meshCentroid, 1.0f / meshWeight);
+
+	// Clusters facing away from the centre are drawn first, they are the ones most likely to occlude the rest
+	struct Cluster {
+		uint32_t firstTriangle;
+		uint32_t triangleCount;
+		float sortKey;
+	};
+	std::vector<uint32_t> boundaries = ClusterBoundaries(indices, mesh.vertices.size(), cacheSize, threshold);
+	std::vector<Cluster> clusters(boundaries.size());
+	for (size_t i = 0; i < boundaries.size(); i++) {
+		Cluster& cluster = clusters[i];
+		cluster.firstTriangle = boundaries[i];
+		cluster.triangleCount = (i + 1 < boundaries.size() ? boundaries[i + 1] : triangleCount) - cluster.firstTriangle;
+
+		DirectX::XMVECTOR centroid = DirectX::XMVectorZero();
+		DirectX::XMVECTOR normal = DirectX::XMVectorZero();
+		float weight = 0.0f;
+		for (uint32_t t = cluster.firstTriangle; t < cluster.firstTriangle + cluster.triangleCount; t++) {
+			centroid = DirectX::XMVectorMultiplyAdd(DirectX::XMLoadFloat3(&centroids[t]), DirectX::XMVectorReplicate(weights[t]), centroid);
+			normal = DirectX::XMVectorAdd(normal, DirectX::XMLoadFloat3(&normals[t]));
+			weight += weights[t];
+		}
+
+		const float normalLength = DirectX::XMVectorGetX(DirectX::XMVector3Length(normal));
+		if (weight > 0.0f && normalLength > 0.0f) {
+			centroid = DirectX::XMVectorScale(centroid, 1.0f / weight);
+			normal = DirectX::XMVectorScale(normal, 1.0f / normalLength);
+			cluster.sortKey = DirectX::XMVectorGetX(DirectX::XMVector3Dot(DirectX::XMVectorSubtract(centroid, meshCentroid), normal));
+		}
+		else {
+			cluster.sortKey = 0.0f;
+		}
+	}
+	std::stable_sort(clusters.begin(), clusters.end(), [](const Cluster& a, const Cluster& b) { return a.sortKey > b.sortKey; });
+
+	std::vector<uint32_t> sorted;
+	sorted.reserve(indices.size());
+	for (const Cluster& cluster : clusters) {
+		sorted.insert(sorted.end(), indices.begin() + cluster.firstTriangle * 3, indices.begin() + (cluster.firstTriangle + cluster.triangleCount) * 3);
+	}
+	mesh.indices = std::move(sorted);
+}
+
+void MeshProcessing::OptimizeVertexFetch(Mesh& mesh)
+{
+	MakeOwned(mesh);
+
+	// Vertices are renumbered in first use order, any that are never referenced are dropped
+	std::vector<uint32_t> remap(mesh.vertices.size(), INVALID_VERTEX);
+	std::vector<vertexConsts> ordered;
+	ordered.reserve(mesh.vertices.size());
+	for (uint32_t& index : mesh.indices) {
+		if (remap[index] == INVALID_VERTEX) {
+			remap[index] = (uint32_t)ordered.size();
+			ordered.push_back(mesh.vertices[index]);
+		}
+		index = remap[index];
+	}
+	mesh = Mesh(std::move(ordered), std::move(mesh.indices));
+}
+
+VertexCacheStats MeshProcessing::AnalyzeVertexCache(const Mesh& mesh, uint32_t cacheSize)
+{
+	const size_t vertexCount = mesh.Vertices().size();
+	IndexView indices = mesh.Indices();
+
+	VertexCacheStats stats;
+	stats.triangleCount = indices.size() / 3;
+	FifoCache cache(vertexCount, cacheSize);
+	std::vector<bool> referenced(vertexCount, false);
+	for (size_t i = 0; i < indices.size(); i++) {
+		const uint32_t vertex = indices[i];
+		stats.cacheMisses += cache.Access(vertex) ? 1 : 0;
+		if (!referenced[vertex]) {
+			referenced[vertex] = true;
+			stats.vertexCount++;
+		}
+	}
+	return stats;
+}
+
+OverdrawStats MeshProcessing::AnalyzeOverdraw(const Mesh& mesh, uint32_t resolution)
+{
+	OverdrawStats stats;
+	std::span<const vertexConsts> vertices = mesh.Vertices();
+	IndexView indices = mesh.Indices();
+	if (vertices.empty() || resolution == 0) return stats;
+
+	// Every view fits the bounds' largest extent to the viewport so the mesh keeps its proportions
+	const DirectX::XMFLOAT3 center = mesh.bounds.Center;
+	const float extent = (std::max)({ mesh.bounds.Extents.x, mesh.bounds.Extents.y, mesh.bounds.Extents.z });
+	const float scale = extent > 0.0f ? (float)resolution / (2.0f * extent) : 0.0f;
+
+	std::vector<float> depth((size_t)resolution * resolution);
+	std::vector<DirectX::XMFLOAT3> projected(vertices.size());
+	for (const OverdrawView& view : OVERDRAW_VIEWS) {
+		for (size_t i = 0; i < vertices.size(); i++) {
+			const DirectX::XMFLOAT3& pos = vertices[i].pos;
+			projected[i].x = view.uSign * (Component(pos, view.uAxis) - Component(center, view.uAxis)) * scale + resolution * 0.5f;
+			projected[i].y = (Component(pos, view.vAxis) - Component(center, view.vAxis)) * scale + resolution * 0.5f;
+			projected[i].z = view.depthSign * Component(pos, view.depthAxis);
+		}
+		std::fill(depth.begin(), depth.end(), FLT_MAX);
+
+		for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+			const DirectX::XMFLOAT3& p0 = projected[indices[i]];
+			DirectX::XMFLOAT3 p1 = projected[indices[i + 1]];
+			DirectX::XMFLOAT3 p2 = projected[indices[i + 2]];
+
+			// Front faces are clockwise with v up, so a negative signed area; swapping two vertices makes the edge tests positive
+			const float area = (p1.x - p0.x) * (p2.y - p0.y) - (p1.y - p0.y) * (p2.x - p0.x);
+			if (!(area < 0.0f)) continue;
+			std::swap(p1, p2);
+			const float inverseArea = -1.0f / area;
+
+			const int minX = (std::max)(0, (int)std::floor((std::min)({ p0.x, p1.x, p2.x })));
+			const int maxX = (std::min)((int)resolution - 1, (int)std::ceil((std::max)({ p0.x, p1.x, p2.x })));
+			const int minY = (std::max)(0, (int)std::floor((std::min)({ p0.y, p1.y, p2.y })));
+			const int maxY = (std::min)((int)resolution - 1, (int)std::ceil((std::max)({ p0.y, p1.y, p2.y })));
+			for (int y = minY; y <= maxY; y++) {
+				for (int x = minX; x <= maxX; x++) {
+					const float px = x + 0.5f;
+					const float py = y + 0.5f;
+					const float w0 = (p2.x - p1.x) * (py - p1.y) - (p2.y - p1.y) * (px - p1.x);
+					const float w1 = (p0.x - p2.x) * (py - p2.y) - (p0.y - p2.y) * (px - p2.x);
+					const float w2 = (p1.x - p0.x) * (py - p0.y) - (p1.y - p0.y) * (px - p0.x);
+					if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f) continue;
+
+					const float z = (w0 * p0.z + w1 * p1.z + w2 * p2.z) * inverseArea;
+					float& stored = depth[(size_t)y * resolution + x];
+					if (z < stored) {
+						stored = z;
+						stats.pixelsShaded++;
+					}
+				}
+			}
+		}
+
+		for (float stored : depth) stats.pixelsCovered += stored != FLT_MAX ? 1 : 0;
+	}
+	return stats;
+}
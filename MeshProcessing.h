@@ -0,0 +1,67 @@
+#pragma once
+#include "Utility.h"
+
+namespace Dx12MasterProject {
+
+	struct Mesh;
+
+	struct WeldSettings {
+		float positionEpsilon = 1.0e-5f; // per component, in model units
+		float normalEpsilon = 1.0e-3f; // per component, 0 only merges identical normals
+	};
+
+	struct WeldStats {
+		uint64_t inputVertexCount = 0;
+		uint64_t outputVertexCount = 0;
+		uint64_t removedTriangleCount = 0;
+
+		//Fraction of the input vertices that survived, lower is better.
+		double Ratio() const { return inputVertexCount > 0 ? (double)outputVertexCount / (double)inputVertexCount : 1.0; }
+		WeldStats& operator+= (const WeldStats& other);
+	};
+
+	struct MeshOptimizeSettings {
+		uint32_t cacheSize = 16; // post transform cache entries the triangle order is tuned for
+		float overdrawThreshold = 1.05f; // ACMR a cluster may lose so it can be split further for overdraw sorting
+	};
+
+	//FIFO post transform cache simulation of an index buffer.
+	struct VertexCacheStats {
+		uint64_t triangleCount = 0;
+		uint64_t vertexCount = 0; // referenced vertices
+		uint64_t cacheMisses = 0;
+
+		double Acmr() const { return triangleCount > 0 ? (double)cacheMisses / (double)triangleCount : 0.0; } // average cache miss ratio, misses per triangle
+		double Atvr() const { return vertexCount > 0 ? (double)cacheMisses / (double)vertexCount : 0.0; } // average transformed vertex ratio, 1 is optimal
+	};
+
+	struct OverdrawStats {
+		uint64_t pixelsCovered = 0;
+		uint64_t pixelsShaded = 0;
+
+		double Overdraw() const { return pixelsCovered > 0 ? (double)pixelsShaded / (double)pixelsCovered : 0.0; }
+	};
+
+	//Native mesh clean up passes, independent of Assimp so they can be run on meshes mapped from the mesh cache.
+	namespace MeshProcessing {
+
+		//Merges vertices whose position and normal match within the epsilons, remaps the indices and drops the triangles
+		//that collapse as a result. Colour is not compared, it is a per vertex placeholder until textures are supported,
+		//the first vertex of each welded group keeps its colour. Mapped meshes are copied into owned storage first.
+		WeldStats WeldVertices(Mesh& mesh, const WeldSettings& settings = {});
+
+		//Reorders triangles for the post transform cache (Tipsify), then sorts cache friendly clusters of them so outward
+		//facing clusters draw first to cut overdraw, then renumbers the vertices in first use order for fetch locality.
+		void OptimizeMesh(Mesh& mesh, const MeshOptimizeSettings& settings = {});
+		void OptimizeVertexCache(Mesh& mesh, uint32_t cacheSize);
+		void OptimizeVertexCache(std::vector<uint32_t>& indices, size_t vertexCount, uint32_t cacheSize); // LOD indices sharing a mesh's vertices
+		void OptimizeOverdraw(Mesh& mesh, uint32_t cacheSize, float threshold);
+		void OptimizeVertexFetch(Mesh& mesh);
+
+		VertexCacheStats AnalyzeVertexCache(const Mesh& mesh, uint32_t cacheSize);
+
+		//Rasterizes the mesh in index order from the six axis directions with back face culling and a depth test,
+		//counting every fragment that passes the depth test against the pixels it covers.
+		OverdrawStats AnalyzeOverdraw(const Mesh& mesh, uint32_t resolution = 256);
+	}
+}
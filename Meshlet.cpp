@@ -0,0 +1,172 @@
+#include "Meshlet.h"
+#include "Model.h"
+#include <cmath>
+
+using namespace Dx12MasterProject;
+
+namespace {
+	const uint32_t INVALID_LOCAL = 0xFFFFFFFF;
+
+	//Ritter's sphere: start from the two points furthest apart along a greedy search, then grow to cover the rest.
+	void BoundingSphereFor(const std::vector<DirectX::XMVECTOR>& points, DirectX::XMFLOAT3& center, float& radius)
+	{
+		auto furthestFrom = [&](DirectX::XMVECTOR from) {
+			size_t furthest = 0;
+			float furthestDistance = -1.0f;
+			for (size_t i = 0; i < points.size(); i++) {
+				float distance = DirectX::XMVectorGetX(DirectX::XMVector3LengthSq(DirectX::XMVectorSubtract(points[i], from)));
+				if (distance > furthestDistance) {
+					furthestDistance = distance;
+					furthest = i;
+				}
+			}
+			return points[furthest];
+		};
+
+		DirectX::XMVECTOR a = furthestFrom(points[0]);
+		DirectX::XMVECTOR b = furthestFrom(a);
+		DirectX::XMVECTOR sphereCenter = DirectX::XMVectorScale(DirectX::XMVectorAdd(a, b), 0.5f);
+		float sphereRadius = DirectX::XMVectorGetX(DirectX::XMVector3Length(DirectX::XMVectorSubtract(b, a))) * 0.5f;
+
+		for (const DirectX::XMVECTOR& point : points) {
+			const DirectX::XMVECTOR offset = DirectX::XMVectorSubtract(point, sphereCenter);
+			const float distance = DirectX::XMVectorGetX(DirectX::XMVector3Length(offset));
+			if (distance > sphereRadius) {
+				const float grownRadius = (sphereRadius + distance) * 0.5f;
+				sphereCenter = DirectX::XMVectorAdd(sphereCenter, DirectX::XMVectorScale(offset, (grownRadius - sphereRadius) / distance));
+				sphereRadius = grownRadius;
+			}
+		}
+
+		DirectX::XMStoreFloat3(&center, sphereCenter);
+		radius = sphereRadius;
+	}
+
+	MeshletBounds ComputeBounds(const Meshlet& meshlet, const MeshletData& data, std::span<const vertexConsts> vertices)
+	{
+		MeshletBounds bounds;
+
+		std::vector<DirectX::XMVECTOR> points(meshlet.vertexCount);
+		for (uint32_t i = 0; i < meshlet.vertexCount; i++) {
+			points[i] = DirectX::XMLoadFloat3(&vertices[data.vertices[meshlet.vertexOffset + i]].pos);
+		}
+		BoundingSphereFor(points, bounds.center, bounds.radius);
+
+		// Cone axis is the mean facing direction, the cutoff comes from the triangle furthest from it
+		std::vector<DirectX::XMVECTOR> normals;
+		normals.reserve(meshlet.triangleCount);
+		DirectX::XMVECTOR axis = DirectX::XMVectorZero();
+		for (uint32_t t = 0; t < meshlet.triangleCount; t++) {
+			const uint8_t* triangle = &data.triangles[(meshlet.triangleOffset + t) * 3];
+			DirectX::XMVECTOR a = points[triangle[0]];
+			DirectX::XMVECTOR b = points[triangle[1]];
+			DirectX::XMVECTOR c = points[triangle[2]];
+			DirectX::XMVECTOR normal = DirectX::XMVector3Cross(DirectX::XMVectorSubtract(b, a), DirectX::XMVectorSubtract(c, a));
+			const float length = DirectX::XMVectorGetX(DirectX::XMVector3Length(normal));
+			if (length <= 0.0f) continue; // degenerate, faces nowhere
+			normal = DirectX::XMVectorScale(normal, 1.0f / length);
+			normals.push_back(normal);
+			axis = DirectX::XMVectorAdd(axis, normal);
+		}
+
+		const float axisLength = DirectX::XMVectorGetX(DirectX::XMVector3Length(axis));
+		if (normals.empty() || axisLength <= 0.0f) return bounds;
+		axis = DirectX::XMVectorScale(axis, 1.0f / axisLength);
+
+		float minDot = 1.0f;
+		for (const DirectX::XMVECTOR& normal : normals) {
+			minDot = (std::min)(minDot, DirectX::XMVectorGetX(DirectX::XMVector3Dot(normal, axis)));
+		}
+
+		DirectX::XMStoreFloat3(&bounds.coneAxis, axis);
+		// A cone of 90 degrees or wider contains a front face from every viewpoint, keep the cutoff at 1 so it never culls
+		bounds.coneCutoff = minDot > 0.0f ? std::sqrt(1.0f - minDot * minDot) : 1.0f;
+		return bounds;
+	}
+}
+
+MeshletStats& MeshletStats::operator+= (const MeshletStats& other)
+{
+	meshCount += other.meshCount;
+	meshletCount += other.meshletCount;
+	triangleCount += other.triangleCount;
+	vertexCount += other.vertexCount;
+	triangleCapacity += other.triangleCapacity;
+	vertexCapacity += other.vertexCapacity;
+	return *this;
+}
+
+MeshletData MeshletBuilder::Build(const Mesh& mesh, const MeshletSettings& settings)
+{
+	// Local indices are stored in a byte, so a meshlet can never address more than 256 vertices
+	const uint32_t maxVertices = (std::min)((std::max)(settings.maxVertices, 3u), 256u);
+	const uint32_t maxTriangles = (std::max)(settings.maxTriangles, 1u);
+
+	std::span<const vertexConsts> vertices = mesh.Vertices();
+	IndexView indices = mesh.Indices();
+	const size_t triangleCount = indices.size() / 3;
+
+	MeshletData data;
+	data.triangles.reserve(triangleCount * 3);
+	std::vector<uint32_t> localIndex(vertices.size(), INVALID_LOCAL);
+
+	Meshlet current;
+	auto finishMeshlet = [&]() {
+		if (current.triangleCount == 0) return;
+		for (uint32_t i = 0; i < current.vertexCount; i++) localIndex[data.vertices[current.vertexOffset + i]] = INVALID_LOCAL;
+		data.meshlets.push_back(current);
+		current = Meshlet();
+		current.vertexOffset = (uint32_t)data.vertices.size();
+		current.triangleOffset = (uint32_t)(data.triangles.size() / 3);
+	};
+
+	for (size_t t = 0; t < triangleCount; t++) {
+		const uint32_t triangle[3] = { indices[t * 3], indices[t * 3 + 1], indices[t * 3 + 2] };
+
+		uint32_t newVertices = 0;
+		for (uint32_t c = 0; c < 3; c++) {
+			// Repeated corners of a degenerate triangle only need one slot
+			const bool repeated = (c > 0 && triangle[c] == triangle[0]) || (c > 1 && triangle[c] == triangle[1]);
+			if (localIndex[triangle[c]] == INVALID_LOCAL && !repeated) newVertices++;
+		}
+		if (current.vertexCount + newVertices > maxVertices || current.triangleCount + 1 > maxTriangles) finishMeshlet();
+
+		for (uint32_t c = 0; c < 3; c++) {
+			uint32_t& local = localIndex[triangle[c]];
+			if (local == INVALID_LOCAL) {
+				local = current.vertexCount++;
+				data.vertices.push_back(triangle[c]);
+			}
+			data.triangles.push_back((uint8_t)local);
+		}
+		current.triangleCount++;
+	}
+	finishMeshlet();
+
+	data.bounds.reserve(data.meshlets.size());
+	for (const Meshlet& meshlet : data.meshlets) data.bounds.push_back(ComputeBounds(meshlet, data, vertices));
+	return data;
+}
+
+MeshletStats MeshletBuilder::Stats(const MeshletData& data, const MeshletSettings& settings)
+{
+	MeshletStats stats;
+	stats.meshCount = 1;
+	stats.meshletCount = data.Meshlets().size();
+	for (const Meshlet& meshlet : data.Meshlets()) {
+		stats.triangleCount += meshlet.triangleCount;
+		stats.vertexCount += meshlet.vertexCount;
+	}
+	stats.triangleCapacity = stats.meshletCount * settings.maxTriangles;
+	stats.vertexCapacity = stats.meshletCount * settings.maxVertices;
+	return stats;
+}
+
+bool MeshletBuilder::IsBackfacing(const MeshletBounds& bounds, const DirectX::XMFLOAT3& cameraPosition)
+{
+	// The sphere lies entirely outside the cone of directions from which any of its triangles can be front facing
+	const DirectX::XMVECTOR toCenter = DirectX::XMVectorSubtract(DirectX::XMLoadFloat3(&bounds.center), DirectX::XMLoadFloat3(&cameraPosition));
+	const float distance = DirectX::XMVectorGetX(DirectX::XMVector3Length(toCenter));
+	const float alongAxis = DirectX::XMVectorGetX(DirectX::XMVector3Dot(toCenter, DirectX::XMLoadFloat3(&bounds.coneAxis)));
+	return alongAxis >= bounds.coneCutoff * distance + bounds.radius;
+}
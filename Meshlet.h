@@ -0,0 +1,81 @@
+#pragma once
+#include "Utility.h"
+#include <span>
+
+namespace Dx12MasterProject {
+
+	struct Mesh;
+
+	struct MeshletSettings {
+		uint32_t maxVertices = 64;
+		uint32_t maxTriangles = 124;
+	};
+
+	//Triangles are stored as three uint8 indices into the meshlet's slice of the vertex list, the vertex list indexes
+	//the mesh vertices.
+	struct Meshlet {
+		uint32_t vertexOffset = 0;
+		uint32_t triangleOffset = 0; // in triangles, the byte offset is three times this
+		uint32_t vertexCount = 0;
+		uint32_t triangleCount = 0;
+	};
+
+	//Bounding sphere plus a normal cone for cluster backface culling. Every triangle faces within the cone around axis,
+	//cutoff is the sine of the cone's half angle (1 when the meshlet can never be rejected).
+	struct MeshletBounds {
+		DirectX::XMFLOAT3 center = { 0.0f, 0.0f, 0.0f };
+		float radius = 0.0f;
+		DirectX::XMFLOAT3 coneAxis = { 0.0f, 0.0f, 1.0f };
+		float coneCutoff = 1.0f;
+	};
+
+	//Meshlets of one mesh, either owned or viewed from a mesh cache mapping like the mesh data itself.
+	struct MeshletData {
+		std::vector<Meshlet> meshlets;
+		std::vector<MeshletBounds> bounds;
+		std::vector<uint32_t> vertices;
+		std::vector<uint8_t> triangles;
+
+		MeshletData() = default;
+		MeshletData(std::span<const Meshlet> MappedMeshlets, std::span<const MeshletBounds> MappedBounds, std::span<const uint32_t> MappedVertices, std::span<const uint8_t> MappedTriangles) :
+			mappedMeshlets(MappedMeshlets), mappedBounds(MappedBounds), mappedVertices(MappedVertices), mappedTriangles(MappedTriangles), mapped(true) {}
+
+		std::span<const Meshlet> Meshlets() const { return mapped ? mappedMeshlets : std::span<const Meshlet>(meshlets); }
+		std::span<const MeshletBounds> Bounds() const { return mapped ? mappedBounds : std::span<const MeshletBounds>(bounds); }
+		std::span<const uint32_t> Vertices() const { return mapped ? mappedVertices : std::span<const uint32_t>(vertices); }
+		std::span<const uint8_t> Triangles() const { return mapped ? mappedTriangles : std::span<const uint8_t>(triangles); }
+		bool Empty() const { return Meshlets().empty(); }
+
+	private:
+		std::span<const Meshlet> mappedMeshlets;
+		std::span<const MeshletBounds> mappedBounds;
+		std::span<const uint32_t> mappedVertices;
+		std::span<const uint8_t> mappedTriangles;
+		bool mapped = false;
+	};
+
+	struct MeshletStats {
+		uint64_t meshCount = 0;
+		uint64_t meshletCount = 0;
+		uint64_t triangleCount = 0;
+		uint64_t vertexCount = 0; // meshlet vertex list entries, shared vertices count once per meshlet
+		uint64_t triangleCapacity = 0;
+		uint64_t vertexCapacity = 0;
+
+		double TriangleFill() const { return triangleCapacity > 0 ? (double)triangleCount / (double)triangleCapacity : 0.0; }
+		double VertexFill() const { return vertexCapacity > 0 ? (double)vertexCount / (double)vertexCapacity : 0.0; }
+		double MeshletsPerMesh() const { return meshCount > 0 ? (double)meshletCount / (double)meshCount : 0.0; }
+		MeshletStats& operator+= (const MeshletStats& other);
+	};
+
+	namespace MeshletBuilder {
+		//Greedy scan over the index buffer, a meshlet is closed as soon as the next triangle would overflow either limit.
+		//Run it on a cache optimised index order, the locality of that order is what keeps the meshlets compact.
+		MeshletData Build(const Mesh& mesh, const MeshletSettings& settings = {});
+
+		MeshletStats Stats(const MeshletData& data, const MeshletSettings& settings);
+
+		//True when every triangle of the meshlet faces away from the camera, positions in the mesh's own space.
+		bool IsBackfacing(const MeshletBounds& bounds, const DirectX::XMFLOAT3& cameraPosition);
+	}
+}
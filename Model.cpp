@@ -1,91 +1,193 @@
 #include "Model.h"
+#include "MappedIOSystem.h"
 #include <chrono>
+#include <algorithm>
 using namespace Dx12MasterProject;
 
-Model::Model(std::string path)
+namespace {
+	static_assert(sizeof(aiVector3D) == sizeof(DirectX::XMFLOAT3), "aiVector3D must be three packed floats");
+
+	//Writes a packed float3 stream into one field of the interleaved vertices. Each vertex is moved with a single
+	//16 byte load/store, the spilled 4th lane lands in the following vertex member and is overwritten when that
+	//member is written, so pos must be converted before norm and norm before colour. The last source element
+	//is loaded as a float3 to avoid reading past the end of the stream.
+	void ConvertFloat3Stream(const aiVector3D* src, uint32_t count, DirectX::XMFLOAT3 vertexConsts::* field, vertexConsts* dst)
+	{
+		if (count == 0) return;
+		const DirectX::XMFLOAT3* srcFloat3 = reinterpret_cast<const DirectX::XMFLOAT3*>(src);
+		for (uint32_t i = 0; i + 1 < count; i++) {
+			DirectX::XMVECTOR value = DirectX::XMLoadFloat4(reinterpret_cast<const DirectX::XMFLOAT4*>(&srcFloat3[i]));
+			DirectX::XMStoreFloat4(reinterpret_cast<DirectX::XMFLOAT4*>(&(dst[i].*field)), value);
+		}
+		DirectX::XMStoreFloat3(&(dst[count - 1].*field), DirectX::XMLoadFloat3(&srcFloat3[count - 1]));
+	}
+
+	//Deterministic per mesh vertex colours (PCG32), independent of which thread converts the mesh.
+	struct ColourGenerator {
+		explicit ColourGenerator(uint32_t seed) : state(0x853c49e6748fea9bull + seed * 0xda3e39cb94b95bdbull) { NextUint(); }
+
+		uint32_t NextUint() {
+			uint64_t old = state;
+			state = old * 6364136223846793005ull + 1442695040888963407ull;
+			uint32_t xorShifted = (uint32_t)(((old >> 18u) ^ old) >> 27u);
+			uint32_t rot = (uint32_t)(old >> 59u);
+			return (xorShifted >> rot) | (xorShifted << ((0u - rot) & 31u));
+		}
+
+		float NextUnorm() { return (NextUint() >> 8) * (1.0f / 16777216.0f); }
+
+		DirectX::XMFLOAT4 Next() {
+			float r = NextUnorm();
+			float g = NextUnorm();
+			float b = NextUnorm();
+			return DirectX::XMFLOAT4(r, g, b, 1.0f);
+		}
+
+		uint64_t state;
+	};
+}
+
+uint64_t Dx12MasterProject::ImportKey(uint64_t sourceHash, const ModelImportSettings& settings)
+{
+	// Processing changes what gets cached, so its settings are part of the key
+	uint64_t key = sourceHash;
+	if (settings.weldVertices) key = HashBytes(&settings.weld, sizeof(WeldSettings), key);
+	if (settings.optimizeMeshes) key = HashBytes(&settings.optimize, sizeof(MeshOptimizeSettings), key);
+	if (settings.buildMeshlets) key = HashBytes(&settings.meshlet, sizeof(MeshletSettings), key);
+	if (settings.buildLods) key = HashBytes(&settings.lod, sizeof(LodSettings), key);
+	return key;
+}
+
+Model::Model(std::string path, const ModelImportSettings& settings) : importSettings(settings)
 {
 	LoadModel(path);
 }
 
 void Model::LoadModel(std::string path)
 {
+	directory = path.substr(0, path.find_last_of('/'));
+
+	// Warm start, the mesh cache is only trusted while it matches the source file contents
+	uint64_t sourceHash = importSettings.sourceHash;
+	const bool hashed = importSettings.sourceHashKnown || HashFile(path, sourceHash);
+	sourceHash = ImportKey(sourceHash, importSettings);
+	const std::string cachePath = importSettings.cachePath.empty() ? MeshCache::CachePathFor(path) : importSettings.cachePath;
+	if (importSettings.useMeshCache && hashed && MeshCache::Read(cachePath, sourceHash, cacheFile, meshes, sceneGraph)) return;
+
 	// Read file via ASSIMP
+	auto importStart = std::chrono::steady_clock::now();
 	Assimp::Importer importer;
+	if (importSettings.mappedImport) importer.SetIOHandler(new MappedIOSystem()); // the importer owns and deletes it
 	const aiScene* scene = importer.ReadFile(path,
 		aiProcess_ConvertToLeftHanded | aiProcess_Triangulate | aiProcess_FlipUVs);
+	auto importEnd = std::chrono::steady_clock::now();
+	loadStats.importSeconds = std::chrono::duration<double>(importEnd - importStart).count();
 
-	if (scene->mRootNode == nullptr) {
+	if (scene == nullptr || scene->mRootNode == nullptr) {
 		std::cout << "Assimp Error: " << importer.GetErrorString() << std::endl;
 		return;
 	}
 
-	directory = path.substr(0, path.find_last_of('/'));
-	ProcessNode(scene->mRootNode, scene);
+	auto processStart = std::chrono::steady_clock::now();
+	ProcessMeshes(scene);
+	FlattenNodes(scene);
+	auto processEnd = std::chrono::steady_clock::now();
+	loadStats.processSeconds = std::chrono::duration<double>(processEnd - processStart).count();
+
+	if (importSettings.useMeshCache && hashed && !MeshCache::Write(cachePath, sourceHash, meshes, sceneGraph)) {
+		std::cout << "Mesh Cache Error: unable to write " << cachePath << std::endl;
+	}
 }
 
-void Model::ProcessNode(aiNode* node, const aiScene* scene)
+void Model::ProcessMeshes(const aiScene* scene)
 {
-	for (uint32_t i = 0; i < node->mNumMeshes; i++) {
-		aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-		meshes.push_back(ProcessMesh(mesh, scene));
+	// Every source mesh is converted once, nodes that place it again only add a reference in the scene graph.
+	// Meshes are indexed like aiScene::mMeshes so node mesh indices carry over unchanged.
+	meshes.clear();
+	meshes.resize(scene->mNumMeshes);
+
+	ThreadPool& pool = importSettings.threadPool != nullptr ? *importSettings.threadPool : ThreadPool::Global();
+	std::vector<WeldStats> weldStats(scene->mNumMeshes);
+	pool.ParallelFor(scene->mNumMeshes, [&](uint32_t i) {
+		Mesh& mesh = meshes[i];
+		mesh = ProcessMesh(scene->mMeshes[i], scene, i);
+		if (importSettings.weldVertices) weldStats[i] = MeshProcessing::WeldVertices(mesh, importSettings.weld);
+		if (importSettings.optimizeMeshes) MeshProcessing::OptimizeMesh(mesh, importSettings.optimize);
+		if (importSettings.buildMeshlets) mesh.meshlets = MeshletBuilder::Build(mesh, importSettings.meshlet);
+		if (importSettings.buildLods) {
+			mesh.lods = LodBuilder::Build(mesh, importSettings.lod);
+			if (importSettings.optimizeMeshes) {
+				for (MeshLod& lod : mesh.lods) MeshProcessing::OptimizeVertexCache(lod.indices, mesh.Vertices().size(), importSettings.optimize.cacheSize);
+			}
+		}
+	});
+
+	for (const WeldStats& stats : weldStats) loadStats.weld += stats;
+	if (importSettings.buildMeshlets) {
+		for (const Mesh& mesh : meshes) loadStats.meshlets += MeshletBuilder::Stats(mesh.meshlets, importSettings.meshlet);
 	}
 
-	for (uint32_t i = 0; i < node->mNumChildren; i++)
-	{
-		ProcessNode(node->mChildren[i], scene);
+	for (const Mesh& mesh : meshes) loadStats.vertexCount += mesh.vertices.size();
+}
+
+void Model::FlattenNodes(const aiScene* scene)
+{
+	// Depth first with an explicit stack, children pushed in reverse so they come out in their source order
+	sceneGraph.Clear();
+	std::vector<std::pair<const aiNode*, uint32_t>> stack = { { scene->mRootNode, SceneGraph::NO_PARENT } };
+	while (!stack.empty()) {
+		const auto [node, parent] = stack.back();
+		stack.pop_back();
+
+		// Assimp matrices are row major for column vectors, the transpose is the row vector form DirectXMath uses
+		const aiMatrix4x4& m = node->mTransformation;
+		const DirectX::XMFLOAT4X4 local(
+			m.a1, m.b1, m.c1, m.d1,
+			m.a2, m.b2, m.c2, m.d2,
+			m.a3, m.b3, m.c3, m.d3,
+			m.a4, m.b4, m.c4, m.d4);
+		const uint32_t index = sceneGraph.AddNode(parent, local, std::span<const uint32_t>(node->mMeshes, node->mNumMeshes));
+
+		for (uint32_t i = node->mNumChildren; i > 0; i--) stack.push_back({ node->mChildren[i - 1], index });
 	}
+	sceneGraph.UpdateWorldTransforms();
 }
 
-Mesh Model::ProcessMesh(aiMesh* mesh, const aiScene* scene)
+Mesh Model::ProcessMesh(aiMesh* mesh, const aiScene* scene, uint32_t meshIndex)
 {
-	std::vector<vertexConsts> vertices;
-	std::vector<uint16_t> indices;
-
-	for (uint32_t i = 0; i < mesh->mNumVertices; i++) {
-		vertexConsts vertex;
-		DirectX::XMFLOAT3 tempVector;
-
-		// Positions
-		tempVector.x = mesh->mVertices[i].x;
-		tempVector.y = mesh->mVertices[i].y;
-		tempVector.z = mesh->mVertices[i].z;
-		vertex.pos = tempVector;
-
-		//Add normals here when supported !!!!
-		tempVector.x = mesh->mNormals[i].x;
-		tempVector.y = mesh->mNormals[i].y;
-		tempVector.z = mesh->mNormals[i].z;
-		vertex.norm = tempVector;
-		//Add texture coords here when supported !!!!
-
-		//Remove this when textures are add !!!!
-		
-		//vertex.colour = DirectX::XMFLOAT4{
-		//	mesh->mColors[0]->r,
-		//	mesh->mColors[0]->g,
-		//	mesh->mColors[0]->b,
-		//	mesh->mColors[0]->a
-		//};
-
-		auto start = std::chrono::system_clock::now();
-		auto end = std::chrono::system_clock::now();
-
-		std::chrono::duration<double> elapsed_seconds = end - start;
-		//std::srand(elapsed_seconds.count());
-		vertex.colour = DirectX::XMFLOAT4{ ((float)std::rand() / RAND_MAX), ((float)std::rand() / RAND_MAX),  ((float)std::rand() / RAND_MAX),  1.0f };
-		
-
-		vertices.push_back(vertex);
+	std::vector<vertexConsts> vertices(mesh->mNumVertices);
+	ConvertFloat3Stream(mesh->mVertices, mesh->mNumVertices, &vertexConsts::pos, vertices.data());
+	if (mesh->HasNormals()) {
+		ConvertFloat3Stream(mesh->mNormals, mesh->mNumVertices, &vertexConsts::norm, vertices.data());
 	}
+	else {
+		for (vertexConsts& vertex : vertices) vertex.norm = DirectX::XMFLOAT3(0.0f, 0.0f, 0.0f);
+	}
+
+	//Add texture coords here when supported !!!!
+	//Remove this when textures are add !!!!
+	ColourGenerator colours(meshIndex);
+	for (vertexConsts& vertex : vertices) vertex.colour = colours.Next();
 
+	size_t indexCount = 0;
+	for (uint32_t i = 0; i < mesh->mNumFaces; i++) indexCount += mesh->mFaces[i].mNumIndices;
+
+	std::vector<uint32_t> indices(indexCount);
+	uint32_t* indexOut = indices.data();
 	for (uint32_t i = 0; i < mesh->mNumFaces; i++) {
-		aiFace face = mesh->mFaces[i];
+		const aiFace& face = mesh->mFaces[i];
 		for (uint32_t j = 0; j < face.mNumIndices; j++) {
-			indices.push_back(face.mIndices[j]);
+			*indexOut++ = face.mIndices[j];
 		}
-		
+
 		//Add texture processing here
-		
 	}
-	return Mesh(vertices, indices);
+	return Mesh(std::move(vertices), std::move(indices));
 }
+
+void Mesh::CalculateBounds()
+{
+	std::span<const vertexConsts> verts = Vertices();
+	bounds = Bounds::ComputeBox(verts);
+	sphere = Bounds::ComputeSphere(verts, bounds);
+}
\ No newline at end of file
@@ -4,12 +4,21 @@
 
 #include "Utility.h"
 #include "FrameResource.h"
+#include "Bounds.h"
+#include "IndexBuffer.h"
+#include "MeshCache.h"
+#include "MeshLod.h"
+#include "MeshProcessing.h"
+#include "Meshlet.h"
+#include "SceneGraph.h"
+#include "ThreadPool.h"
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 #include <map>
 #include <vector>
+#include <span>
 
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
@@ -20,23 +29,77 @@ namespace Dx12MasterProject {
 	struct Mesh {
 	public:
 		std::vector<vertexConsts> vertices;
-		std::vector<uint16_t> indices;
-		Mesh(std::vector<vertexConsts> Vertices, std::vector<uint16_t> Indices) {
-			vertices = Vertices;
-			indices = Indices;
+		std::vector<uint32_t> indices;
+		DirectX::BoundingBox bounds;
+		DirectX::BoundingSphere sphere; // centered on the bounds
+		MeshletData meshlets;
+		std::vector<MeshLod> lods; // coarser levels, finest first, drawn with the vertices above
+
+		Mesh() = default;
+		Mesh(std::vector<vertexConsts> Vertices, std::vector<uint32_t> Indices) : vertices(std::move(Vertices)), indices(std::move(Indices)) {
+			CalculateBounds();
 		}
+
+		//Views into a mesh cache mapping, the owning Model keeps the mapping alive.
+		Mesh(std::span<const vertexConsts> MappedVertices, IndexView MappedIndices, const DirectX::BoundingBox& Bounds, const DirectX::BoundingSphere& Sphere) :
+			bounds(Bounds), sphere(Sphere), mappedVertices(MappedVertices), mappedIndices(MappedIndices), mapped(true) {}
+
+		std::span<const vertexConsts> Vertices() const { return mapped ? mappedVertices : std::span<const vertexConsts>(vertices); }
+		IndexView Indices() const { return mapped ? mappedIndices : IndexView(std::span<const uint32_t>(indices)); }
+		bool IsMapped() const { return mapped; }
+
+		void CalculateBounds();
+
+	private:
+		std::span<const vertexConsts> mappedVertices;
+		IndexView mappedIndices;
+		bool mapped = false;
+	};
+
+	struct ModelImportSettings {
+		ThreadPool* threadPool = nullptr; // nullptr uses ThreadPool::Global()
+		bool useMeshCache = true;
+		std::string cachePath; // empty keeps the mesh cache beside the source, see MeshCache::CachePathFor
+		bool sourceHashKnown = false; // the caller already hashed the source, LoadModel uses sourceHash instead of rereading it
+		uint64_t sourceHash = 0; // HashFile of the source, only read with sourceHashKnown
+		bool mappedImport = true; // Assimp reads through MappedIOSystem instead of its stdio default
+		bool weldVertices = true;
+		WeldSettings weld;
+		bool optimizeMeshes = true;
+		MeshOptimizeSettings optimize;
+		bool buildMeshlets = true;
+		MeshletSettings meshlet;
+		bool buildLods = true;
+		LodSettings lod;
+	};
+
+	//Mesh cache key, the source contents hash combined with every setting that changes what gets cached.
+	uint64_t ImportKey(uint64_t sourceHash, const ModelImportSettings& settings);
+
+	struct ModelLoadStats {
+		double importSeconds = 0.0;
+		double processSeconds = 0.0;
+		uint64_t vertexCount = 0;
+		WeldStats weld; // empty when loaded from the cache or welding is off
+		MeshletStats meshlets; // empty when loaded from the cache or meshlets are off
 	};
 
 	class Model
 	{
 	public:
-		std::vector<Mesh> meshes;
-		Model(std::string path);
+		std::vector<Mesh> meshes; // one per source mesh, however many nodes place it
+		SceneGraph sceneGraph;
+		ModelLoadStats loadStats;
+		Model(std::string path, const ModelImportSettings& settings = {});
 		void LoadModel(std::string path);
+		bool IsFromCache() const { return cacheFile.IsOpen(); }
 	private:
-		void ProcessNode(aiNode* node, const aiScene* scene);
-		Mesh ProcessMesh(aiMesh* mesh, const aiScene* scene);
+		void ProcessMeshes(const aiScene* scene);
+		void FlattenNodes(const aiScene* scene);
+		Mesh ProcessMesh(aiMesh* mesh, const aiScene* scene, uint32_t meshIndex);
+		ModelImportSettings importSettings;
 		std::string directory;
+		MappedFile cacheFile;
 	};
 }
 
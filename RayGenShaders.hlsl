@@ -120,7 +120,8 @@ void PlaneHit(inout RayPayload payload, in BuiltInTriangleIntersectionAttributes
     ray.TMin = 0.01f;
     ray.TMax = 100000.0f;
     ShadowPayload shadowPayload;
-    TraceRay(gRtScene, 0 /*rayFlags*/, 0xFF, 1 /* ray index*/, 0, 1, ray, shadowPayload);
+    // Any occluder will do, the first hit found ends the search and runs ShadowHit
+    TraceRay(gRtScene, RAY_FLAG_ACCEPT_FIRST_HIT_AND_END_SEARCH, 0xFF, 1 /* ray index*/, 0, 1, ray, shadowPayload);
     
     float factor = shadowPayload.hit ? 0.1f : 1.0f;
     payload.color = float4(0.9f, 0.9f, 0.9f, 1.0f) * factor;
@@ -32,7 +32,7 @@ static const WCHAR* PLANE_HIT_GROUP = L"PlaneHitGroup";
 static const WCHAR* SHADOW_HIT_GROUP = L"ShadowHitGroup";
 
 
-AccelerationStructBuffers Dx12Renderer::CreateBottomLevelAS(ID3D12Device5* device, ID3D12GraphicsCommandList4* cmdList, ID3D12Resource* vertBuff[], const uint32_t vertexCount[], ID3D12Resource* indexBuff[], const uint32_t indexCount[], uint32_t geomCount)
+AccelerationStructBuffers Dx12Renderer::CreateBottomLevelAS(ID3D12Device5* device, ID3D12GraphicsCommandList4* cmdList, ID3D12Resource* vertBuff[], const uint32_t vertexCount[], ID3D12Resource* indexBuff[], const uint32_t indexCount[], const DXGI_FORMAT indexFormat[], uint32_t geomCount)
 {
     std::vector<D3D12_RAYTRACING_GEOMETRY_DESC> geomDesc;
     geomDesc.resize(geomCount);
@@ -45,7 +45,7 @@ AccelerationStructBuffers Dx12Renderer::CreateBottomLevelAS(ID3D12Device5* devic
         geomDesc[i].Triangles.VertexCount = vertexCount[i];
         geomDesc[i].Triangles.IndexBuffer = indexBuff[i]->GetGPUVirtualAddress();
         geomDesc[i].Triangles.IndexCount = indexCount[i];
-        geomDesc[i].Triangles.IndexFormat = DXGI_FORMAT_R32_UINT;
+        geomDesc[i].Triangles.IndexFormat = indexFormat[i];
 
         geomDesc[i].Flags = D3D12_RAYTRACING_GEOMETRY_FLAG_OPAQUE;
     }
@@ -85,11 +85,17 @@ AccelerationStructBuffers Dx12Renderer::CreateBottomLevelAS(ID3D12Device5* devic
 
 void Dx12Renderer::BuildTopLevelAS(ID3D12Device5* device, ID3D12GraphicsCommandList4* cmdList, ID3D12Resource* botLvlAS[], std::uint64_t& tlasSize, float rotation, bool bUpdate, AccelerationStructBuffers& buffers)
 {
+    // The instances are the scene graph's mesh references, an update only moves them so the count stays
+    if (bUpdate) DemoScene::UpdateSceneGraph(rotation, mRtSceneGraph);
+    else DemoScene::BuildSceneGraph(rotation, mRtSceneGraph);
+    const std::vector<SceneInstance> instances = mRtSceneGraph.Instances();
+    const uint32_t instanceCount = (uint32_t)instances.size();
+
     // Create TLas
     D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS inputs = {};
     inputs.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
     inputs.Flags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_UPDATE;
-    inputs.NumDescs = mRTInstanceCount; 
+    inputs.NumDescs = instanceCount;
     inputs.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL;
 
     D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO info;
@@ -106,36 +112,22 @@ void Dx12Renderer::BuildTopLevelAS(ID3D12Device5* device, ID3D12GraphicsCommandL
         // Create the buffers
         buffers.pScratch = CreateBuffer(device, info.ScratchDataSizeInBytes, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, kDefaultHeapProps);
         buffers.pResult = CreateBuffer(device, info.ResultDataMaxSizeInBytes, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_RAYTRACING_ACCELERATION_STRUCTURE, kDefaultHeapProps);
-        buffers.pInstanceDesc = CreateBuffer(device, sizeof(D3D12_RAYTRACING_INSTANCE_DESC) * mRTInstanceCount, D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_GENERIC_READ, kUploadHeapProps);
+        buffers.pInstanceDesc = CreateBuffer(device, sizeof(D3D12_RAYTRACING_INSTANCE_DESC) * instanceCount, D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_GENERIC_READ, kUploadHeapProps);
         tlasSize = info.ResultDataMaxSizeInBytes;
     }
 
     D3D12_RAYTRACING_INSTANCE_DESC* pInstanceDesc;
     buffers.pInstanceDesc->Map(0, nullptr, (void**)&pInstanceDesc);
-    ZeroMemory(pInstanceDesc, sizeof(D3D12_RAYTRACING_INSTANCE_DESC) * mRTInstanceCount);
-
-    DirectX::XMMATRIX trans[3];
-    DirectX::XMMATRIX rotationMat = DirectX::XMMatrixRotationY(rotation);
-    trans[0] = trans[1] = trans[2] = DirectX::XMMatrixIdentity();
-    trans[1] = rotationMat * DirectX::XMMatrixTranslation(-2.0f, 0.0f, 0.0f);
-    trans[2] = rotationMat * DirectX::XMMatrixTranslation(2.0f, 0.0f, 0.0f);
-
-    pInstanceDesc[0].InstanceID = 0;
-    pInstanceDesc[0].InstanceContributionToHitGroupIndex = 0;
-    pInstanceDesc[0].Flags = D3D12_RAYTRACING_INSTANCE_FLAG_NONE;
-    memcpy(pInstanceDesc[0].Transform, &trans[0], sizeof(pInstanceDesc[0].Transform));
-    pInstanceDesc[0].AccelerationStructure = botLvlAS[0]->GetGPUVirtualAddress();
-    pInstanceDesc[0].InstanceMask = 0xFF;
-    
+    ZeroMemory(pInstanceDesc, sizeof(D3D12_RAYTRACING_INSTANCE_DESC) * instanceCount);
 
-    for (uint32_t i = 1; i < mRTInstanceCount; i++) {
+    // The CPU reference tracer places its instances through the same DemoScene scene graph
+    for (uint32_t i = 0; i < instanceCount; i++) {
         // Initialize instance desc.
-        pInstanceDesc[i].InstanceID = i;                           
-        pInstanceDesc[i].InstanceContributionToHitGroupIndex = (i* 2) + 2; //shader table offset
+        pInstanceDesc[i].InstanceID = i;
+        pInstanceDesc[i].InstanceContributionToHitGroupIndex = DemoScene::HitGroupOffset(i); //shader table offset
         pInstanceDesc[i].Flags = D3D12_RAYTRACING_INSTANCE_FLAG_NONE;
-        DirectX::XMMATRIX m = DirectX::XMMatrixTranspose(trans[i]); 
-        memcpy(pInstanceDesc[i].Transform, &m, sizeof(pInstanceDesc[i].Transform));
-        pInstanceDesc[i].AccelerationStructure = botLvlAS[1]->GetGPUVirtualAddress();
+        StoreInstanceTransform(instances[i].world, pInstanceDesc[i].Transform);
+        pInstanceDesc[i].AccelerationStructure = botLvlAS[instances[i].mesh]->GetGPUVirtualAddress();
         pInstanceDesc[i].InstanceMask = 0xFF;
     }
     // Unmap
@@ -166,15 +158,15 @@ void Dx12Renderer::CreateAccelerationStructures()
 {
     int index = 0;
     CreateTriangleVB(mD3DDevice.Get(), mVertexBuffer->GetAddressOf(), mIndexBuffer->GetAddressOf(), 0);
-    CreatePlaneVB(mD3DDevice.Get(), mVertexBuffer->GetAddressOf(), mIndexBuffer->GetAddressOf(), 1, 100.0f, 100.0f, -1.0f);
+    CreatePlaneVB(mD3DDevice.Get(), mVertexBuffer->GetAddressOf(), mIndexBuffer->GetAddressOf(), 1, DemoScene::PLANE_WIDTH, DemoScene::PLANE_LENGTH, DemoScene::PLANE_HEIGHT);
     //CreateCubeVB(mD3DDevice.Get(), mVertexBuffer->GetAddressOf(), mIndexBuffer->GetAddressOf(), 2, 0.5f, 0.5f, 0.5f);
     AccelerationStructBuffers botLevelBuffers[2];
 
     const uint32_t vertexCount[] = { 3, 4 };// , 8};
     const uint32_t indexCount[] = { 3, 6 };// , 36 };
-    botLevelBuffers[0] = CreateBottomLevelAS(mD3DDevice.Get(), mCommandList.Get(), mVertexBuffer->GetAddressOf(), vertexCount, mIndexBuffer->GetAddressOf(), indexCount, 2);
+    botLevelBuffers[0] = CreateBottomLevelAS(mD3DDevice.Get(), mCommandList.Get(), mVertexBuffer->GetAddressOf(), vertexCount, mIndexBuffer->GetAddressOf(), indexCount, mIndexFormat, 2);
     mBotLvlAS[0] = botLevelBuffers[0].pResult;
-    botLevelBuffers[1] = CreateBottomLevelAS(mD3DDevice.Get(), mCommandList.Get(), mVertexBuffer->GetAddressOf(), vertexCount, mIndexBuffer->GetAddressOf(), indexCount, 1);
+    botLevelBuffers[1] = CreateBottomLevelAS(mD3DDevice.Get(), mCommandList.Get(), mVertexBuffer->GetAddressOf(), vertexCount, mIndexBuffer->GetAddressOf(), indexCount, mIndexFormat, 1);
     mBotLvlAS[1] = botLevelBuffers[1].pResult;
 
     BuildTopLevelAS(mD3DDevice.Get(), mCommandList.Get(), mBotLvlAS->GetAddressOf(), mTlasSize, 0, false, mTopLvlBuffers);
@@ -375,29 +367,14 @@ void Dx12Renderer::CreateShaderTable()
 
 void Dx12Renderer::CreateConstantBufferRT()
 {
-    DirectX::XMFLOAT4 bufferData[] = {
-        //A
-        DirectX::XMFLOAT4(1.0f, 0.0f, 0.0f, 1.0f),
-        DirectX::XMFLOAT4(1.0f, 1.0f, 0.0f, 1.0f),
-        DirectX::XMFLOAT4(1.0f, 0.0f, 1.0f, 1.0f),
-
-        //B
-        DirectX::XMFLOAT4(0.0f, 1.0f, 0.0f, 1.0f),
-        DirectX::XMFLOAT4(0.0f, 1.0f, 1.0f, 1.0f),
-        DirectX::XMFLOAT4(1.0f, 1.0f, 0.0f, 1.0f),
-
-        //C
-        DirectX::XMFLOAT4(0.0f, 0.0f, 1.0f, 1.0f),
-        DirectX::XMFLOAT4(1.0f, 0.0f, 1.0f, 1.0f),
-        DirectX::XMFLOAT4(0.0f, 1.0f, 1.0f, 1.0f),
-    };
+    const auto& bufferData = DemoScene::TriangleColours();
 
     for (uint32_t i = 0; i < 3; i++) {
         const uint32_t buffSize = sizeof(DirectX::XMFLOAT4) *  3;
-        mConstantBufferRT[i] = CreateBuffer(mD3DDevice.Get(), sizeof(buffSize), D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_GENERIC_READ, kUploadHeapProps);
+        mConstantBufferRT[i] = CreateBuffer(mD3DDevice.Get(), buffSize, D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_GENERIC_READ, kUploadHeapProps);
         uint8_t* pData;
         ThrowIfFailed(mConstantBufferRT[i]->Map(0, nullptr, (void**)&pData));
-        memcpy(pData, &bufferData[i * 3], sizeof(bufferData));
+        memcpy(pData, &bufferData[i * 3], buffSize);
         mConstantBufferRT[i]->Unmap(0, nullptr);
     }
 }
@@ -455,101 +432,35 @@ ID3D12Resource* Dx12Renderer::CreateBuffer(ID3D12Device5* device, uint64_t size,
 
 void Dx12Renderer::CreateTriangleVB(ID3D12Device5* device, ID3D12Resource* vertexBuff[], ID3D12Resource* indexBuff[], int index)
 {
-    const RTVertexBufferLayout vertices[] =
-    {
-        RTVertexBufferLayout{ DirectX::XMFLOAT3(0,          1,  0), DirectX::XMFLOAT3(0.0f, 1.0f, 0.0f)},
-        RTVertexBufferLayout{ DirectX::XMFLOAT3(0.866f,  -0.5f, 0), DirectX::XMFLOAT3(0.0f, 1.0f, 0.0f)},
-        RTVertexBufferLayout{ DirectX::XMFLOAT3(-0.866f, -0.5f, 0), DirectX::XMFLOAT3(0.0f, 1.0f, 0.0f)},
-    };  
-
-    const int indices[] = {
-        0, 1, 2
-    };
-
-    vertexBuff[index] = CreateBuffer(device, sizeof(vertices), D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_GENERIC_READ, kUploadHeapProps);
-    uint8_t* data;
-    vertexBuff[index]->Map(0, nullptr, (void**)&data);
-    memcpy(data, vertices, sizeof(vertices));
-    vertexBuff[index]->Unmap(0, nullptr);
-
-    indexBuff[index] = CreateBuffer(device, sizeof(indices), D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_GENERIC_READ, kUploadHeapProps);
-    uint8_t* data1;
-    indexBuff[index]->Map(0, nullptr, (void**)&data1);
-    memcpy(data1, indices, sizeof(indices));
-    indexBuff[index]->Unmap(0, nullptr);
+    UploadGeometry(device, vertexBuff, indexBuff, index, DemoScene::Triangle());
 }
 
 void Dx12Renderer::CreateCubeVB(ID3D12Device5* device, ID3D12Resource* vertexBuff[], ID3D12Resource* indexBuff[], int index, float width, float height, float length)
 {
-    const RTVertexBufferLayout vertices[] =
-    {
-      RTVertexBufferLayout{DirectX::XMFLOAT3(-width, -height, -length), DirectX::XMFLOAT3(-0.577350f, -0.577350f, -0.577350f)},
-      RTVertexBufferLayout{DirectX::XMFLOAT3(-width, +height, -length), DirectX::XMFLOAT3(-0.408248f,  0.816497f, -0.408248f)},
-      RTVertexBufferLayout{DirectX::XMFLOAT3(+width, +height, -length), DirectX::XMFLOAT3( 0.408248f,  0.408248f, -0.816497f)},
-      RTVertexBufferLayout{DirectX::XMFLOAT3(+width, -height, -length), DirectX::XMFLOAT3( 0.816497f, -0.408248f, -0.408248f)},
-      RTVertexBufferLayout{DirectX::XMFLOAT3(-width, -height, +length), DirectX::XMFLOAT3(-0.408248f, -0.408248f,  0.816497f)},
-      RTVertexBufferLayout{DirectX::XMFLOAT3(-width, +height, +length), DirectX::XMFLOAT3(-0.816497f,  0.408248f,  0.408248f)},
-      RTVertexBufferLayout{DirectX::XMFLOAT3(+width, +height, +length), DirectX::XMFLOAT3( 0.577350f,  0.577350f,  0.577350f)},
-      RTVertexBufferLayout{DirectX::XMFLOAT3(+width, -height, +length), DirectX::XMFLOAT3( 0.408248f, -0.816497f,  0.408248f)},
-    };
-
-    const int indices[] = {
-        0, 1, 2,
-        0, 2, 3,
-
-        4, 6, 5,
-        4, 7, 6,
-
-        4, 5, 1,
-        4, 1, 0,
-
-        3, 2, 6,
-        3, 6, 7,
-
-        1, 5, 6,
-        1, 6, 2,
-
-        4, 0, 3,
-        4, 3, 7
-    };
-
-    vertexBuff[index] = CreateBuffer(device, sizeof(vertices), D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_GENERIC_READ, kUploadHeapProps);
-    uint8_t* data;
-    vertexBuff[index]->Map(0, nullptr, (void**)&data);
-    memcpy(data, vertices, sizeof(vertices));
-    vertexBuff[index]->Unmap(0, nullptr);
-
-    indexBuff[index] = CreateBuffer(device, sizeof(indices), D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_GENERIC_READ, kUploadHeapProps);
-    uint8_t* data1;
-    indexBuff[index]->Map(0, nullptr, (void**)&data1);
-    memcpy(data1, indices, sizeof(indices));
-    indexBuff[index]->Unmap(0, nullptr);
+    UploadGeometry(device, vertexBuff, indexBuff, index, DemoScene::Cube(width, height, length));
 }
 
 void Dx12Renderer::CreatePlaneVB(ID3D12Device5* device, ID3D12Resource* vertexBuff[], ID3D12Resource* indexBuff[], int index, float width, float length, float heightOffset)
 {
-    const RTVertexBufferLayout vertices[] =
-    {
-        RTVertexBufferLayout{DirectX::XMFLOAT3(-width, heightOffset, -length), DirectX::XMFLOAT3(0.0f, 0.0f, 1.0f)},
-        RTVertexBufferLayout{DirectX::XMFLOAT3( width, heightOffset, -length), DirectX::XMFLOAT3(0.0f, 0.0f, 1.0f)},
-        RTVertexBufferLayout{DirectX::XMFLOAT3( width, heightOffset,  length), DirectX::XMFLOAT3(0.0f, 0.0f, 1.0f)},
-        RTVertexBufferLayout{DirectX::XMFLOAT3(-width, heightOffset,  length), DirectX::XMFLOAT3(0.0f, 0.0f, 1.0f)},
-    };
-
-    const int indices[] = {
-        1, 0, 2, 2, 0, 3
-    };
+    UploadGeometry(device, vertexBuff, indexBuff, index, DemoScene::Plane(width, length, heightOffset));
+}
 
-    vertexBuff[index] = CreateBuffer(device, sizeof(vertices), D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_GENERIC_READ, kUploadHeapProps);
+void Dx12Renderer::UploadGeometry(ID3D12Device5* device, ID3D12Resource* vertexBuff[], ID3D12Resource* indexBuff[], int index, const RtGeometry& geometry)
+{
+    const size_t vertexBytes = geometry.vertices.size() * sizeof(RTVertexBufferLayout);
+    vertexBuff[index] = CreateBuffer(device, vertexBytes, D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_GENERIC_READ, kUploadHeapProps);
     uint8_t* data;
     vertexBuff[index]->Map(0, nullptr, (void**)&data);
-    memcpy(data, vertices, sizeof(vertices));
+    memcpy(data, geometry.vertices.data(), vertexBytes);
     vertexBuff[index]->Unmap(0, nullptr);
 
-    indexBuff[index] = CreateBuffer(device, sizeof(indices), D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_GENERIC_READ, kUploadHeapProps);
+    IndexBufferData packedIndices = IndexBufferData::Pack(IndexView(std::span<const uint32_t>(geometry.indices)), geometry.vertices.size());
+    mIndexFormat[index] = packedIndices.format;
+
+    indexBuff[index] = CreateBuffer(device, packedIndices.ByteSize(), D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_GENERIC_READ, kUploadHeapProps);
     uint8_t* data1;
     indexBuff[index]->Map(0, nullptr, (void**)&data1);
-    memcpy(data1, indices, sizeof(indices));
+    memcpy(data1, packedIndices.bytes.data(), packedIndices.ByteSize());
     indexBuff[index]->Unmap(0, nullptr);
 }
 
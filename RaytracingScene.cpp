@@ -0,0 +1,164 @@
+#include "RaytracingScene.h"
+#include "Model.h"
+
+using namespace Dx12MasterProject;
+
+RtGeometry Dx12MasterProject::MakeRtGeometry(const Mesh& mesh)
+{
+	RtGeometry geometry;
+	std::span<const vertexConsts> vertices = mesh.Vertices();
+	geometry.vertices.reserve(vertices.size());
+	for (const vertexConsts& vertex : vertices) geometry.vertices.push_back(RTVertexBufferLayout{ vertex.pos, vertex.norm });
+
+	IndexView indices = mesh.Indices();
+	geometry.indices.resize(indices.size());
+	for (size_t i = 0; i < indices.size(); i++) geometry.indices[i] = indices[i];
+	return geometry;
+}
+
+RtGeometry DemoScene::Triangle()
+{
+	RtGeometry geometry;
+	geometry.vertices = {
+		RTVertexBufferLayout{ DirectX::XMFLOAT3(0,          1,  0), DirectX::XMFLOAT3(0.0f, 1.0f, 0.0f)},
+		RTVertexBufferLayout{ DirectX::XMFLOAT3(0.866f,  -0.5f, 0), DirectX::XMFLOAT3(0.0f, 1.0f, 0.0f)},
+		RTVertexBufferLayout{ DirectX::XMFLOAT3(-0.866f, -0.5f, 0), DirectX::XMFLOAT3(0.0f, 1.0f, 0.0f)},
+	};
+	geometry.indices = { 0, 1, 2 };
+	return geometry;
+}
+
+RtGeometry DemoScene::Plane(float width, float length, float heightOffset)
+{
+	RtGeometry geometry;
+	geometry.vertices = {
+		RTVertexBufferLayout{DirectX::XMFLOAT3(-width, heightOffset, -length), DirectX::XMFLOAT3(0.0f, 0.0f, 1.0f)},
+		RTVertexBufferLayout{DirectX::XMFLOAT3( width, heightOffset, -length), DirectX::XMFLOAT3(0.0f, 0.0f, 1.0f)},
+		RTVertexBufferLayout{DirectX::XMFLOAT3( width, heightOffset,  length), DirectX::XMFLOAT3(0.0f, 0.0f, 1.0f)},
+		RTVertexBufferLayout{DirectX::XMFLOAT3(-width, heightOffset,  length), DirectX::XMFLOAT3(0.0f, 0.0f, 1.0f)},
+	};
+	geometry.indices = { 1, 0, 2, 2, 0, 3 };
+	return geometry;
+}
+
+RtGeometry DemoScene::Cube(float width, float height, float length)
+{
+	RtGeometry geometry;
+	geometry.vertices = {
+		RTVertexBufferLayout{DirectX::XMFLOAT3(-width, -height, -length), DirectX::XMFLOAT3(-0.577350f, -0.577350f, -0.577350f)},
+		RTVertexBufferLayout{DirectX::XMFLOAT3(-width, +height, -length), DirectX::XMFLOAT3(-0.408248f,  0.816497f, -0.408248f)},
+		RTVertexBufferLayout{DirectX::XMFLOAT3(+width, +height, -length), DirectX::XMFLOAT3( 0.408248f,  0.408248f, -0.816497f)},
+		RTVertexBufferLayout{DirectX::XMFLOAT3(+width, -height, -length), DirectX::XMFLOAT3( 0.816497f, -0.408248f, -0.408248f)},
+		RTVertexBufferLayout{DirectX::XMFLOAT3(-width, -height, +length), DirectX::XMFLOAT3(-0.408248f, -0.408248f,  0.816497f)},
+		RTVertexBufferLayout{DirectX::XMFLOAT3(-width, +height, +length), DirectX::XMFLOAT3(-0.816497f,  0.408248f,  0.408248f)},
+		RTVertexBufferLayout{DirectX::XMFLOAT3(+width, +height, +length), DirectX::XMFLOAT3( 0.577350f,  0.577350f,  0.577350f)},
+		RTVertexBufferLayout{DirectX::XMFLOAT3(+width, -height, +length), DirectX::XMFLOAT3( 0.408248f, -0.816497f,  0.408248f)},
+	};
+	geometry.indices = {
+		0, 1, 2,
+		0, 2, 3,
+
+		4, 6, 5,
+		4, 7, 6,
+
+		4, 5, 1,
+		4, 1, 0,
+
+		3, 2, 6,
+		3, 6, 7,
+
+		1, 5, 6,
+		1, 6, 2,
+
+		4, 0, 3,
+		4, 3, 7
+	};
+	return geometry;
+}
+
+void DemoScene::InstanceTransforms(float rotation, DirectX::XMFLOAT4X4 world[INSTANCE_COUNT])
+{
+	const DirectX::XMMATRIX rotationMat = DirectX::XMMatrixRotationY(rotation);
+	DirectX::XMStoreFloat4x4(&world[0], DirectX::XMMatrixIdentity());
+	DirectX::XMStoreFloat4x4(&world[1], rotationMat * DirectX::XMMatrixTranslation(-2.0f, 0.0f, 0.0f));
+	DirectX::XMStoreFloat4x4(&world[2], rotationMat * DirectX::XMMatrixTranslation(2.0f, 0.0f, 0.0f));
+}
+
+void DemoScene::BuildSceneGraph(float rotation, SceneGraph& sceneGraph)
+{
+	sceneGraph.Clear();
+	const uint32_t planeAndTriangle = 0, triangle = 1;
+	const uint32_t root = sceneGraph.AddNode(SceneGraph::NO_PARENT, IDENTITY_MATRIX, std::span(&planeAndTriangle, 1));
+	for (uint32_t i = 1; i < INSTANCE_COUNT; i++) sceneGraph.AddNode(root, IDENTITY_MATRIX, std::span(&triangle, 1));
+	UpdateSceneGraph(rotation, sceneGraph);
+}
+
+void DemoScene::UpdateSceneGraph(float rotation, SceneGraph& sceneGraph)
+{
+	// The root stays at the origin, so the children's local matrices are their world matrices
+	InstanceTransforms(rotation, sceneGraph.localTransforms.data());
+	sceneGraph.UpdateWorldTransforms();
+}
+
+uint32_t DemoScene::HitGroupOffset(uint32_t instance)
+{
+	// Instance 0 owns records 0-3 for its triangle and plane, every other instance two records after that
+	return instance == 0 ? 0 : (instance * 2) + 2;
+}
+
+const std::array<DirectX::XMFLOAT4, 3 * DemoScene::INSTANCE_COUNT>& DemoScene::TriangleColours()
+{
+	static const std::array<DirectX::XMFLOAT4, 3 * INSTANCE_COUNT> colours = {
+		//A
+		DirectX::XMFLOAT4(1.0f, 0.0f, 0.0f, 1.0f),
+		DirectX::XMFLOAT4(1.0f, 1.0f, 0.0f, 1.0f),
+		DirectX::XMFLOAT4(1.0f, 0.0f, 1.0f, 1.0f),
+
+		//B
+		DirectX::XMFLOAT4(0.0f, 1.0f, 0.0f, 1.0f),
+		DirectX::XMFLOAT4(0.0f, 1.0f, 1.0f, 1.0f),
+		DirectX::XMFLOAT4(1.0f, 1.0f, 0.0f, 1.0f),
+
+		//C
+		DirectX::XMFLOAT4(0.0f, 0.0f, 1.0f, 1.0f),
+		DirectX::XMFLOAT4(1.0f, 0.0f, 1.0f, 1.0f),
+		DirectX::XMFLOAT4(0.0f, 1.0f, 1.0f, 1.0f),
+	};
+	return colours;
+}
+
+RtScene DemoScene::Build(float rotation)
+{
+	RtScene scene;
+	scene.geometries.push_back(Triangle());
+	scene.geometries.push_back(Plane(PLANE_WIDTH, PLANE_LENGTH, PLANE_HEIGHT));
+	scene.bottomLevels = { { 0, 1 }, { 0 } };
+
+	// Placed through the same scene graph BuildTopLevelAS walks
+	SceneGraph sceneGraph;
+	BuildSceneGraph(rotation, sceneGraph);
+	for (const SceneInstance& node : sceneGraph.Instances()) {
+		RtInstance& instance = scene.instances.emplace_back();
+		instance.world = node.world;
+		instance.instanceId = (uint32_t)scene.instances.size() - 1;
+		instance.hitGroupOffset = HitGroupOffset(instance.instanceId);
+		instance.bottomLevel = node.mesh;
+	}
+
+	// Same record order as CreateShaderTable, primary ray record followed by the shadow ray record
+	const RtHitRecord shadow = { RtHitProgram::Shadow, 0 };
+	scene.hitGroups = {
+		{ RtHitProgram::Triangle, 0 }, shadow,
+		{ RtHitProgram::Plane, 0 }, shadow,
+		{ RtHitProgram::Triangle, 1 }, shadow,
+		{ RtHitProgram::Triangle, 2 }, shadow,
+		{ RtHitProgram::Triangle, 0 }, shadow,
+	};
+
+	const auto& colours = TriangleColours();
+	for (uint32_t set = 0; set < INSTANCE_COUNT; set++) {
+		auto& colourSet = scene.colourSets.emplace_back();
+		for (uint32_t i = 0; i < 3; i++) colourSet[i] = DirectX::XMFLOAT3(colours[set * 3 + i].x, colours[set * 3 + i].y, colours[set * 3 + i].z);
+	}
+	return scene;
+}
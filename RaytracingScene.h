@@ -0,0 +1,86 @@
+#pragma once
+#include "Utility.h"
+#include "SceneGraph.h"
+#include <array>
+
+namespace Dx12MasterProject {
+
+	struct RTVertexBufferLayout {
+		DirectX::XMFLOAT3 vertexPos;
+		DirectX::XMFLOAT3 vertexNorm;
+	};
+
+	struct Mesh;
+
+	//One triangle geometry of a bottom level structure, laid out as CreateBottomLevelAS consumes it.
+	struct RtGeometry {
+		std::vector<RTVertexBufferLayout> vertices;
+		std::vector<uint32_t> indices;
+	};
+
+	//Positions and normals of an imported mesh with its indices widened to 32 bit.
+	RtGeometry MakeRtGeometry(const Mesh& mesh);
+
+	//What a D3D12_RAYTRACING_INSTANCE_DESC holds, the world matrix in the renderer's row vector convention.
+	struct RtInstance {
+		DirectX::XMFLOAT4X4 world = IDENTITY_MATRIX;
+		uint32_t instanceId = 0;
+		uint32_t hitGroupOffset = 0; // InstanceContributionToHitGroupIndex
+		uint32_t bottomLevel = 0;
+		uint8_t mask = 0xFF;
+	};
+
+	//Closest hit programs of RayGenShaders.hlsl.
+	enum class RtHitProgram : uint8_t {
+		Triangle, // Hit
+		Plane, // PlaneHit
+		Shadow, // ShadowHit
+	};
+
+	//One hit group record of the shader table, colourSet picks the cbRtPerFrame buffer bound to it.
+	struct RtHitRecord {
+		RtHitProgram program = RtHitProgram::Triangle;
+		uint32_t colourSet = 0;
+	};
+
+	/*
+		Everything a TraceRay call resolves against:
+		-Bottom levels list their geometries in GeometryIndex() order
+		-Hit group records are indexed like DXR does, hitGroupOffset + geometry * RAY_TYPE_COUNT + ray index
+		-Colour sets are the cbRtPerFrame contents, three per set
+	*/
+	struct RtScene {
+		std::vector<RtGeometry> geometries;
+		std::vector<std::vector<uint32_t>> bottomLevels;
+		std::vector<RtInstance> instances;
+		std::vector<RtHitRecord> hitGroups;
+		std::vector<std::array<DirectX::XMFLOAT3, 3>> colourSets;
+	};
+
+	//The scene the DXR path draws, shared with the CPU reference tracer so both trace the same thing.
+	namespace DemoScene {
+		constexpr uint32_t INSTANCE_COUNT = 3;
+		constexpr uint32_t RAY_TYPE_COUNT = 2; // primary and shadow, the geometry multiplier passed to TraceRay
+		constexpr float PLANE_WIDTH = 100.0f;
+		constexpr float PLANE_LENGTH = 100.0f;
+		constexpr float PLANE_HEIGHT = -1.0f;
+
+		RtGeometry Triangle();
+		RtGeometry Plane(float width, float length, float heightOffset);
+		RtGeometry Cube(float width, float height, float length);
+
+		//Instance 0 is the triangle and plane at the origin, 1 and 2 are triangles spinning in place either side of it.
+		void InstanceTransforms(float rotation, DirectX::XMFLOAT4X4 world[INSTANCE_COUNT]);
+		//One node per instance, 1 and 2 children of 0, each referencing its bottom level as its mesh. Instances() lists
+		//them in instance order.
+		void BuildSceneGraph(float rotation, SceneGraph& sceneGraph);
+		//Moves the nodes of BuildSceneGraph to another rotation and recomputes their world matrices.
+		void UpdateSceneGraph(float rotation, SceneGraph& sceneGraph);
+		//InstanceContributionToHitGroupIndex, matches the record layout of CreateShaderTable.
+		uint32_t HitGroupOffset(uint32_t instance);
+		//cbRtPerFrame contents, three colours per triangle instance.
+		const std::array<DirectX::XMFLOAT4, 3 * INSTANCE_COUNT>& TriangleColours();
+
+		RtScene Build(float rotation);
+	}
+}
@@ -0,0 +1,74 @@
+#include "SceneGraph.h"
+
+using namespace Dx12MasterProject;
+
+uint32_t SceneGraph::AddNode(uint32_t parent, const DirectX::XMFLOAT4X4& localTransform, std::span<const uint32_t> meshes)
+{
+	const uint32_t node = (uint32_t)parents.size();
+	parents.push_back(parent);
+	localTransforms.push_back(localTransform);
+	worldTransforms.push_back(localTransform);
+	meshRefs.insert(meshRefs.end(), meshes.begin(), meshes.end());
+	meshOffsets.push_back((uint32_t)meshRefs.size());
+	return node;
+}
+
+void SceneGraph::Clear()
+{
+	parents.clear();
+	localTransforms.clear();
+	worldTransforms.clear();
+	meshOffsets.assign(1, 0);
+	meshRefs.clear();
+}
+
+void SceneGraph::UpdateWorldTransforms()
+{
+	worldTransforms.resize(parents.size());
+	for (size_t i = 0; i < parents.size(); i++) {
+		const DirectX::XMMATRIX local = DirectX::XMLoadFloat4x4(&localTransforms[i]);
+		if (parents[i] == NO_PARENT) {
+			DirectX::XMStoreFloat4x4(&worldTransforms[i], local);
+		}
+		else {
+			DirectX::XMStoreFloat4x4(&worldTransforms[i], DirectX::XMMatrixMultiply(local, DirectX::XMLoadFloat4x4(&worldTransforms[parents[i]])));
+		}
+	}
+}
+
+std::vector<SceneInstance> SceneGraph::Instances() const
+{
+	std::vector<SceneInstance> instances;
+	instances.reserve(meshRefs.size());
+	for (uint32_t node = 0; node < (uint32_t)parents.size(); node++) {
+		for (uint32_t mesh : NodeMeshes(node)) {
+			SceneInstance& instance = instances.emplace_back();
+			instance.node = node;
+			instance.mesh = mesh;
+			instance.world = worldTransforms[node];
+		}
+	}
+	return instances;
+}
+
+bool SceneGraph::IsValid(size_t meshCount) const
+{
+	const size_t nodeCount = parents.size();
+	if (localTransforms.size() != nodeCount || meshOffsets.size() != nodeCount + 1 || meshOffsets[0] != 0) return false;
+	for (size_t i = 0; i < nodeCount; i++) {
+		if (parents[i] != NO_PARENT && parents[i] >= i) return false;
+		if (meshOffsets[i + 1] < meshOffsets[i]) return false;
+	}
+	if (meshOffsets[nodeCount] != meshRefs.size()) return false;
+	for (uint32_t mesh : meshRefs) {
+		if (mesh >= meshCount) return false;
+	}
+	return true;
+}
+
+void Dx12MasterProject::StoreInstanceTransform(const DirectX::XMFLOAT4X4& world, float transform[3][4])
+{
+	for (int row = 0; row < 3; row++) {
+		for (int column = 0; column < 4; column++) transform[row][column] = world.m[column][row];
+	}
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include "Utility.h"
+#include <span>
+
+namespace Dx12MasterProject {
+
+	//One drawable placement of a mesh, what a render item or a TLAS instance is built from.
+	struct SceneInstance {
+		uint32_t node = 0;
+		uint32_t mesh = 0; // index into Model::meshes
+		DirectX::XMFLOAT4X4 world = IDENTITY_MATRIX;
+	};
+
+	//Node hierarchy flattened into structure of arrays. Nodes are stored in topological order, every parent before its
+	//children, so world matrices come out of one linear pass with the parent's result already computed. Meshes are
+	//referenced by index, a mesh placed by several nodes is stored once. Matrices use the row vector convention of the
+	//rest of the renderer (world = local * parentWorld).
+	class SceneGraph
+	{
+	public:
+		static constexpr uint32_t NO_PARENT = 0xFFFFFFFF;
+
+		std::vector<uint32_t> parents;
+		std::vector<DirectX::XMFLOAT4X4> localTransforms;
+		std::vector<DirectX::XMFLOAT4X4> worldTransforms;
+		std::vector<uint32_t> meshOffsets = { 0 }; // CSR, node i references meshRefs[meshOffsets[i], meshOffsets[i + 1])
+		std::vector<uint32_t> meshRefs;
+
+		//The parent must already be in the graph.
+		uint32_t AddNode(uint32_t parent, const DirectX::XMFLOAT4X4& localTransform, std::span<const uint32_t> meshes);
+		void Clear();
+
+		size_t NodeCount() const { return parents.size(); }
+		size_t InstanceCount() const { return meshRefs.size(); }
+		std::span<const uint32_t> NodeMeshes(uint32_t node) const {
+			return std::span<const uint32_t>(meshRefs.data() + meshOffsets[node], meshOffsets[node + 1] - meshOffsets[node]);
+		}
+
+		void UpdateWorldTransforms();
+
+		//Every (node, mesh) pair in node order with the node's world matrix.
+		std::vector<SceneInstance> Instances() const;
+
+		//Parents precede children, offsets are consistent and every mesh reference is below meshCount.
+		bool IsValid(size_t meshCount) const;
+	};
+
+	//Writes a row vector world matrix as the 3x4 column vector transform of a D3D12_RAYTRACING_INSTANCE_DESC.
+	void StoreInstanceTransform(const DirectX::XMFLOAT4X4& world, float transform[3][4]);
+}
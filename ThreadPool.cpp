@@ -0,0 +1,100 @@
+#include "ThreadPool.h"
+
+using namespace Dx12MasterProject;
+
+ThreadPool::ThreadPool(uint32_t workerCount)
+{
+	mWorkers.reserve(workerCount);
+	for (uint32_t i = 0; i < workerCount; i++) {
+		mWorkers.emplace_back([this]() { WorkerLoop(); });
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mStopping = true;
+	}
+	mWake.notify_all();
+	for (std::thread& worker : mWorkers) worker.join();
+}
+
+ThreadPool& ThreadPool::Global()
+{
+	static ThreadPool pool;
+	return pool;
+}
+
+uint32_t ThreadPool::DefaultWorkerCount()
+{
+	uint32_t hardwareThreads = std::thread::hardware_concurrency();
+	return hardwareThreads > 1 ? hardwareThreads - 1 : 1;
+}
+
+void ThreadPool::Enqueue(std::function<void()> task)
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mTasks.push_back(std::move(task));
+	}
+	mWake.notify_one();
+}
+
+bool ThreadPool::RunPendingTask()
+{
+	std::function<void()> task;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		if (mTasks.empty()) return false;
+		task = std::move(mTasks.front());
+		mTasks.pop_front();
+	}
+	task();
+	return true;
+}
+
+void ThreadPool::WaitFor(const std::atomic<uint32_t>& pending)
+{
+	while (pending.load(std::memory_order_acquire) != 0) {
+		if (!RunPendingTask()) std::this_thread::yield();
+	}
+}
+
+void ThreadPool::ParallelFor(uint32_t count, const std::function<void(uint32_t)>& func)
+{
+	if (count == 0) return;
+
+	std::atomic<uint32_t> nextIndex = 0;
+	auto drain = [&]() {
+		for (uint32_t i = nextIndex.fetch_add(1); i < count; i = nextIndex.fetch_add(1)) func(i);
+	};
+
+	// One helper per worker at most, the calling thread takes a share as well
+	uint32_t helperCount = (std::min)(WorkerCount(), count - 1);
+	std::atomic<uint32_t> pendingHelpers = helperCount;
+	for (uint32_t i = 0; i < helperCount; i++) {
+		Enqueue([&]() {
+			drain();
+			pendingHelpers.fetch_sub(1, std::memory_order_release);
+		});
+	}
+
+	drain();
+	WaitFor(pendingHelpers);
+}
+
+void ThreadPool::WorkerLoop()
+{
+	for (;;) {
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			mWake.wait(lock, [this]() { return mStopping || !mTasks.empty(); });
+			if (mStopping && mTasks.empty()) return;
+			task = std::move(mTasks.front());
+			mTasks.pop_front();
+		}
+		task();
+	}
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Dx12MasterProject {
+
+	//Fixed set of worker threads pulling from one shared queue. Threads that wait on pool work (ParallelFor, WaitFor)
+	//run queued tasks themselves while waiting, so pool work can safely be issued from inside other pool tasks.
+	class ThreadPool
+	{
+	public:
+		//The default leaves one hardware thread for the caller. With no workers the calling thread does all of the work.
+		ThreadPool() : ThreadPool(DefaultWorkerCount()) {}
+		explicit ThreadPool(uint32_t workerCount);
+		ThreadPool(const ThreadPool& temp) = delete;
+		ThreadPool& operator= (const ThreadPool& temp) = delete;
+		~ThreadPool();
+
+		static ThreadPool& Global();
+		static uint32_t DefaultWorkerCount();
+
+		uint32_t WorkerCount() const { return (uint32_t)mWorkers.size(); }
+
+		void Enqueue(std::function<void()> task);
+		bool RunPendingTask();
+
+		//Blocks until pending reaches zero, helping with queued work in the meantime.
+		void WaitFor(const std::atomic<uint32_t>& pending);
+
+		//Calls func(i) for every i in [0, count), spread across the workers and the calling thread.
+		void ParallelFor(uint32_t count, const std::function<void(uint32_t)>& func);
+
+	private:
+		void WorkerLoop();
+
+		std::vector<std::thread> mWorkers;
+		std::deque<std::function<void()>> mTasks;
+		std::mutex mMutex;
+		std::condition_variable mWake;
+		bool mStopping = false;
+	};
+}
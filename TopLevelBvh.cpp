@@ -0,0 +1,177 @@
+#include "TopLevelBvh.h"
+#include "SceneGraph.h"
+
+using namespace Dx12MasterProject;
+
+namespace {
+	constexpr uint32_t PARALLEL_CHUNK = 4096; // instances per task when instance boxes are recomputed
+
+	float HalfArea(const DirectX::XMFLOAT3& boundsMin, const DirectX::XMFLOAT3& boundsMax)
+	{
+		const float dx = boundsMax.x - boundsMin.x, dy = boundsMax.y - boundsMin.y, dz = boundsMax.z - boundsMin.z;
+		return dx * dy + dy * dz + dz * dx;
+	}
+
+	void Grow(BvhNode& node, const DirectX::XMFLOAT3& boundsMin, const DirectX::XMFLOAT3& boundsMax)
+	{
+		node.boundsMin = DirectX::XMFLOAT3((std::min)(node.boundsMin.x, boundsMin.x), (std::min)(node.boundsMin.y, boundsMin.y), (std::min)(node.boundsMin.z, boundsMin.z));
+		node.boundsMax = DirectX::XMFLOAT3((std::max)(node.boundsMax.x, boundsMax.x), (std::max)(node.boundsMax.y, boundsMax.y), (std::max)(node.boundsMax.z, boundsMax.z));
+	}
+
+	//Box of an object space box after the 3x4 transform, per output axis the smaller and larger product of every input
+	//axis are summed (Arvo 1990). Widened by a few ulps of its coordinates, the bottom level is entered with a ray
+	//transformed the other way and a hit on its boundary must still be inside the world box.
+	BvhBox TransformBox(const BvhBox& box, const DirectX::XMFLOAT3X4& transform)
+	{
+		if (box.boundsMin.x > box.boundsMax.x) return box;
+		const float* boxMin = &box.boundsMin.x;
+		const float* boxMax = &box.boundsMax.x;
+		BvhBox result;
+		float* resultMin = &result.boundsMin.x;
+		float* resultMax = &result.boundsMax.x;
+		for (int row = 0; row < 3; row++) {
+			float low = transform.m[row][3], high = transform.m[row][3];
+			for (int column = 0; column < 3; column++) {
+				const float a = transform.m[row][column] * boxMin[column];
+				const float b = transform.m[row][column] * boxMax[column];
+				low += (std::min)(a, b);
+				high += (std::max)(a, b);
+			}
+			const float padding = ((std::max)(std::abs(low), std::abs(high)) + (high - low)) * 1.0e-6f;
+			resultMin[row] = low - padding;
+			resultMax[row] = high + padding;
+		}
+		return result;
+	}
+}
+
+TopLevelBvh::TopLevelBvh(std::span<const RtInstance> instances, std::span<const Bvh> bottomLevels, const TopLevelBvhSettings& settings, ThreadPool* pool) :
+	mSettings(settings)
+{
+	mBottomLevelBoxes.reserve(bottomLevels.size());
+	for (const Bvh& bottomLevel : bottomLevels) {
+		if (bottomLevel.Empty()) mBottomLevelBoxes.push_back({ DirectX::XMFLOAT3(FLT_MAX, FLT_MAX, FLT_MAX), DirectX::XMFLOAT3(-FLT_MAX, -FLT_MAX, -FLT_MAX) });
+		else mBottomLevelBoxes.push_back({ bottomLevel.nodes[0].boundsMin, bottomLevel.nodes[0].boundsMax });
+	}
+
+	mInstances.resize(instances.size());
+	for (uint32_t i = 0; i < (uint32_t)instances.size(); i++) {
+		TopLevelInstance& instance = mInstances[i];
+		instance.instanceId = instances[i].instanceId;
+		instance.hitGroupOffset = instances[i].hitGroupOffset;
+		instance.bottomLevel = instances[i].bottomLevel;
+		instance.mask = instances[i].mask;
+		SetTransform(i, instances[i].world);
+	}
+	Rebuild(pool);
+}
+
+void TopLevelBvh::SetTransform(uint32_t index, const DirectX::XMFLOAT4X4& world)
+{
+	TopLevelInstance& instance = mInstances[index];
+	StoreInstanceTransform(world, instance.transform.m);
+	DirectX::XMStoreFloat3x4(&instance.inverse, DirectX::XMMatrixInverse(nullptr, DirectX::XMLoadFloat4x4(&world)));
+}
+
+void TopLevelBvh::UpdateInstanceBoxes(ThreadPool& pool)
+{
+	mInstanceBoxes.resize(mInstances.size());
+	const uint32_t count = (uint32_t)mInstances.size();
+	pool.ParallelFor((count + PARALLEL_CHUNK - 1) / PARALLEL_CHUNK, [&](uint32_t chunk) {
+		const uint32_t end = (std::min)((chunk + 1) * PARALLEL_CHUNK, count);
+		for (uint32_t i = chunk * PARALLEL_CHUNK; i < end; i++) {
+			mInstanceBoxes[i] = TransformBox(mBottomLevelBoxes[mInstances[i].bottomLevel], mInstances[i].transform);
+		}
+	});
+}
+
+void TopLevelBvh::Refit(ThreadPool* pool)
+{
+	UpdateInstanceBoxes(pool != nullptr ? *pool : ThreadPool::Global());
+	if (mTree.Empty()) return;
+
+	// Children always follow their parent in depth first order, so a reverse sweep sees them refitted first
+	double cost = 0.0;
+	for (size_t i = mTree.nodes.size(); i-- > 0;) {
+		BvhNode& node = mTree.nodes[i];
+		node.boundsMin = DirectX::XMFLOAT3(FLT_MAX, FLT_MAX, FLT_MAX);
+		node.boundsMax = DirectX::XMFLOAT3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+		if (node.IsLeaf()) {
+			for (uint32_t p = node.offset; p < node.offset + node.count; p++) {
+				const BvhBox& box = mInstanceBoxes[mTree.primitives[p].primitive];
+				Grow(node, box.boundsMin, box.boundsMax);
+			}
+			cost += (double)HalfArea(node.boundsMin, node.boundsMax) * mSettings.build.intersectionCost * node.count;
+		}
+		else {
+			Grow(node, mTree.nodes[i + 1].boundsMin, mTree.nodes[i + 1].boundsMax);
+			Grow(node, mTree.nodes[node.offset].boundsMin, mTree.nodes[node.offset].boundsMax);
+			cost += (double)HalfArea(node.boundsMin, node.boundsMax) * mSettings.build.traversalCost;
+		}
+	}
+	const BvhNode& root = mTree.nodes[0];
+	mSahCost = (float)(cost / (std::max)(HalfArea(root.boundsMin, root.boundsMax), FLT_MIN));
+}
+
+void TopLevelBvh::Rebuild(ThreadPool* pool)
+{
+	UpdateInstanceBoxes(pool != nullptr ? *pool : ThreadPool::Global());
+	mTree = BvhBuilder::BuildOverBoxes(mInstanceBoxes, mSettings.build, pool);
+	mSahCost = mBuildSahCost = BvhBuilder::Stats(mTree, mSettings.build).sahCost;
+}
+
+TopLevelUpdate TopLevelBvh::Update(ThreadPool* pool)
+{
+	Refit(pool);
+	if (mSahCost <= mBuildSahCost * mSettings.rebuildThreshold) return TopLevelUpdate::Refit;
+	Rebuild(pool);
+	return TopLevelUpdate::Rebuild;
+}
+
+TopLevelTraversal::TopLevelTraversal(const TopLevelBvh& topLevel, const DirectX::XMFLOAT3& origin, const DirectX::XMFLOAT3& direction, float tMin, uint8_t instanceMask) :
+	mTopLevel(topLevel), mOrigin{ origin.x, origin.y, origin.z }, mTMin(tMin), mInstanceMask(instanceMask)
+{
+	const float rayDirection[3] = { direction.x, direction.y, direction.z };
+	BvhTraversal::InverseDirection(rayDirection, mInverseDirection);
+	const Bvh& tree = topLevel.Tree();
+	if (tree.Empty()) return;
+
+	const float t = BvhTraversal::IntersectBox(tree.nodes[0], mOrigin, mInverseDirection, tMin, FLT_MAX);
+	if (t != FLT_MAX) mStack[mStackSize++] = { 0, t };
+}
+
+uint32_t TopLevelTraversal::Next(float tMax)
+{
+	const Bvh& tree = mTopLevel.Tree();
+	for (;;) {
+		while (mLeafNext < mLeafEnd) {
+			const uint32_t instance = tree.primitives[mLeafNext++].primitive;
+			if ((mTopLevel.Instance(instance).mask & mInstanceMask) != 0) return instance;
+		}
+		if (mStackSize == 0) return END;
+
+		const Entry entry = mStack[--mStackSize];
+		if (entry.t > tMax) continue;
+
+		// Descend nearest first to the next leaf, farther children wait on the stack with their entry distance
+		uint32_t index = entry.node;
+		for (;;) {
+			const BvhNode& node = tree.nodes[index];
+			if (node.IsLeaf()) {
+				mLeafNext = node.offset;
+				mLeafEnd = node.offset + node.count;
+				break;
+			}
+			uint32_t nearChild = index + 1, farChild = node.offset;
+			float nearT = BvhTraversal::IntersectBox(tree.nodes[nearChild], mOrigin, mInverseDirection, mTMin, tMax);
+			float farT = BvhTraversal::IntersectBox(tree.nodes[farChild], mOrigin, mInverseDirection, mTMin, tMax);
+			if (farT < nearT) {
+				std::swap(nearChild, farChild);
+				std::swap(nearT, farT);
+			}
+			if (nearT == FLT_MAX) break;
+			if (farT != FLT_MAX) mStack[mStackSize++] = { farChild, farT };
+			index = nearChild;
+		}
+	}
+}
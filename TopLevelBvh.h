@@ -0,0 +1,97 @@
+#pragma once
+#include "Bvh.h"
+
+namespace Dx12MasterProject {
+
+	//One instance of a top level structure, what a D3D12_RAYTRACING_INSTANCE_DESC holds plus the inverse transform.
+	struct TopLevelInstance {
+		DirectX::XMFLOAT3X4 transform; // object to world, the column vector layout of the instance desc
+		DirectX::XMFLOAT3X4 inverse; // world to object
+		uint32_t instanceId = 0;
+		uint32_t hitGroupOffset = 0; // InstanceContributionToHitGroupIndex
+		uint32_t bottomLevel = 0;
+		uint8_t mask = 0xFF;
+	};
+
+	struct TopLevelBvhSettings {
+		BvhBuildSettings build = { 16, 1 }; // entering an instance costs a transform and a bottom level root test, so leaves hold one
+		float rebuildThreshold = 1.3f; // Update rebuilds once refits have raised the SAH cost by this factor over the last build
+	};
+
+	enum class TopLevelUpdate : uint8_t {
+		Refit,
+		Rebuild,
+	};
+
+	/*
+		Two level acceleration structure on the CPU, the top level over instances of shared bottom level BVHs:
+		-Instance boxes are the bottom level root boxes carried through each instance's transform
+		-Transform only changes, the bUpdate = true path of BuildTopLevelAS, refit the boxes bottom up and keep the tree
+		-Refitted boxes of moving instances grow and overlap more, so refits track the SAH cost and Update rebuilds once
+		 it passes rebuildThreshold times the cost of the last build
+		-Only the bottom level root boxes are kept, the bottom levels themselves may change layout or move
+	*/
+	class TopLevelBvh
+	{
+	public:
+		TopLevelBvh() = default;
+		//World matrices are in the renderer's row vector convention. Instances of empty bottom levels are never hit.
+		TopLevelBvh(std::span<const RtInstance> instances, std::span<const Bvh> bottomLevels, const TopLevelBvhSettings& settings = {}, ThreadPool* pool = nullptr);
+
+		uint32_t InstanceCount() const { return (uint32_t)mInstances.size(); }
+		const TopLevelInstance& Instance(uint32_t index) const { return mInstances[index]; }
+		const Bvh& Tree() const { return mTree; }
+		//Expected cost of a ray through the root, in intersectionCost units, as it stands and as the last build left it.
+		float SahCost() const { return mSahCost; }
+		float BuildSahCost() const { return mBuildSahCost; }
+
+		//Takes effect on the next Refit, Rebuild or Update.
+		void SetTransform(uint32_t index, const DirectX::XMFLOAT4X4& world);
+
+		void Refit(ThreadPool* pool = nullptr);
+		void Rebuild(ThreadPool* pool = nullptr);
+		//Refit, followed by a rebuild when the refit degraded the tree past the settings' threshold.
+		TopLevelUpdate Update(ThreadPool* pool = nullptr);
+
+	private:
+		void UpdateInstanceBoxes(ThreadPool& pool);
+
+		TopLevelBvhSettings mSettings;
+		std::vector<TopLevelInstance> mInstances;
+		std::vector<BvhBox> mInstanceBoxes; // world space
+		std::vector<BvhBox> mBottomLevelBoxes; // object space root boxes, inverted for empty bottom levels
+		Bvh mTree; // primitive i of a leaf is the instance index
+		float mSahCost = 0.0f;
+		float mBuildSahCost = 0.0f;
+	};
+
+	//Walks the instances a ray passes through, boxes nearest first, handing them out one by one so the caller can trace
+	//each bottom level and shorten the ray before the next. Instances whose mask shares no bit with instanceMask are
+	//skipped without a transform.
+	class TopLevelTraversal
+	{
+	public:
+		static constexpr uint32_t END = UINT32_MAX;
+
+		TopLevelTraversal(const TopLevelBvh& topLevel, const DirectX::XMFLOAT3& origin, const DirectX::XMFLOAT3& direction, float tMin, uint8_t instanceMask);
+
+		//Next instance whose box the ray enters before tMax, END once there are none.
+		uint32_t Next(float tMax);
+
+	private:
+		struct Entry {
+			uint32_t node;
+			float t;
+		};
+
+		const TopLevelBvh& mTopLevel;
+		float mOrigin[3];
+		float mInverseDirection[3];
+		float mTMin;
+		uint8_t mInstanceMask;
+		uint32_t mLeafNext = 0;
+		uint32_t mLeafEnd = 0;
+		Entry mStack[Bvh::MAX_DEPTH + 1];
+		uint32_t mStackSize = 0;
+	};
+}
@@ -113,6 +113,9 @@ struct SubmeshGeometry {
 	UINT StartIndexLocation = 0;
 	INT BaseVertexLocation = 0;
 	DirectX::BoundingBox Bounds;
+	DirectX::BoundingSphere Sphere;
+	UINT LodLevel = 0;
+	float GeometricError = 0.0f; // model units, an RMS distance (MeshLod::geometricError), project to screen space to pick a level
 };
 
 struct MeshGeometry {
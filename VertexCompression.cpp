@@ -0,0 +1,172 @@
+#include "VertexCompression.h"
+#include "Model.h"
+#include <cmath>
+
+using namespace Dx12MasterProject;
+
+namespace {
+	float SignNotZero(float value)
+	{
+		return value >= 0.0f ? 1.0f : -1.0f;
+	}
+
+	//Folds the lower hemisphere of an L1 normalised vector over the diagonals of the octahedron.
+	void OctWrap(float& u, float& v)
+	{
+		const float foldedU = (1.0f - std::fabs(v)) * SignNotZero(u);
+		const float foldedV = (1.0f - std::fabs(u)) * SignNotZero(v);
+		u = foldedU;
+		v = foldedV;
+	}
+
+	float SnormToFloat(int16_t value)
+	{
+		return (std::max)((float)value / 32767.0f, -1.0f);
+	}
+
+	uint16_t FloatToUnorm16(float value)
+	{
+		return (uint16_t)std::lround((std::min)((std::max)(value, 0.0f), 1.0f) * 65535.0f);
+	}
+
+	uint8_t FloatToUnorm8(float value)
+	{
+		return (uint8_t)std::lround((std::min)((std::max)(value, 0.0f), 1.0f) * 255.0f);
+	}
+
+	float AngleBetween(const DirectX::XMFLOAT3& a, const DirectX::XMFLOAT3& b)
+	{
+		DirectX::XMVECTOR unitA = DirectX::XMVector3Normalize(DirectX::XMLoadFloat3(&a));
+		DirectX::XMVECTOR unitB = DirectX::XMVector3Normalize(DirectX::XMLoadFloat3(&b));
+		// atan2 of |cross| and dot stays accurate for the tiny angles being measured, acos does not
+		const float sine = DirectX::XMVectorGetX(DirectX::XMVector3Length(DirectX::XMVector3Cross(unitA, unitB)));
+		const float cosine = DirectX::XMVectorGetX(DirectX::XMVector3Dot(unitA, unitB));
+		return std::atan2(sine, cosine);
+	}
+}
+
+PositionQuantization VertexCompression::QuantizationFor(const DirectX::BoundingBox& bounds)
+{
+	PositionQuantization quantization;
+	quantization.scale = DirectX::XMFLOAT3(bounds.Extents.x * 2.0f, bounds.Extents.y * 2.0f, bounds.Extents.z * 2.0f);
+	quantization.offset = DirectX::XMFLOAT3(bounds.Center.x - bounds.Extents.x, bounds.Center.y - bounds.Extents.y, bounds.Center.z - bounds.Extents.z);
+	return quantization;
+}
+
+float VertexCompression::PositionErrorBound(const PositionQuantization& quantization)
+{
+	// Half a unorm step per axis, plus the float rounding of unorm * scale + offset on the way back
+	const DirectX::XMVECTOR scale = DirectX::XMLoadFloat3(&quantization.scale);
+	const DirectX::XMVECTOR offset = DirectX::XMLoadFloat3(&quantization.offset);
+	const float halfStep = DirectX::XMVectorGetX(DirectX::XMVector3Length(scale)) * (0.5f / 65535.0f);
+	const float rounding = 4.0f * FLT_EPSILON * DirectX::XMVectorGetX(DirectX::XMVector3Length(DirectX::XMVectorAdd(DirectX::XMVectorAbs(scale), DirectX::XMVectorAbs(offset))));
+	return halfStep + rounding;
+}
+
+void VertexCompression::OctEncode(const DirectX::XMFLOAT3& normal, int16_t encoded[2])
+{
+	const float l1 = std::fabs(normal.x) + std::fabs(normal.y) + std::fabs(normal.z);
+	if (l1 == 0.0f) {
+		encoded[0] = 0;
+		encoded[1] = 0;
+		return;
+	}
+
+	float u = normal.x / l1;
+	float v = normal.y / l1;
+	if (normal.z < 0.0f) OctWrap(u, v);
+
+	// Of the four snorm values around (u, v) keep the one that decodes closest to the input normal
+	// Compared by chord length, the dot product of nearly parallel unit vectors is too close to 1 to rank them in float
+	const DirectX::XMVECTOR unitNormal = DirectX::XMVector3Normalize(DirectX::XMLoadFloat3(&normal));
+	const float floorU = std::floor(u * 32767.0f), floorV = std::floor(v * 32767.0f);
+	float bestDistance = FLT_MAX;
+	for (int i = 0; i < 4; i++) {
+		int16_t candidate[2] = {
+			(int16_t)(std::min)((std::max)(floorU + (i & 1), -32767.0f), 32767.0f),
+			(int16_t)(std::min)((std::max)(floorV + (i >> 1), -32767.0f), 32767.0f)
+		};
+		const DirectX::XMFLOAT3 decoded = OctDecode(candidate);
+		const float distance = DirectX::XMVectorGetX(DirectX::XMVector3LengthSq(DirectX::XMVectorSubtract(DirectX::XMLoadFloat3(&decoded), unitNormal)));
+		if (distance < bestDistance) {
+			bestDistance = distance;
+			encoded[0] = candidate[0];
+			encoded[1] = candidate[1];
+		}
+	}
+}
+
+DirectX::XMFLOAT3 VertexCompression::OctDecode(const int16_t encoded[2])
+{
+	float u = SnormToFloat(encoded[0]);
+	float v = SnormToFloat(encoded[1]);
+	const float z = 1.0f - std::fabs(u) - std::fabs(v);
+	if (z < 0.0f) OctWrap(u, v);
+
+	DirectX::XMFLOAT3 normal;
+	DirectX::XMStoreFloat3(&normal, DirectX::XMVector3Normalize(DirectX::XMVectorSet(u, v, z, 0.0f)));
+	return normal;
+}
+
+CompactVertex VertexCompression::Encode(const vertexConsts& vertex, const PositionQuantization& quantization)
+{
+	// Flat axes have no extent to quantize, everything lands on the offset
+	auto toUnorm = [](float value, float offset, float scale) {
+		return FloatToUnorm16(scale > 0.0f ? (value - offset) / scale : 0.0f);
+	};
+
+	CompactVertex compact;
+	compact.pos[0] = toUnorm(vertex.pos.x, quantization.offset.x, quantization.scale.x);
+	compact.pos[1] = toUnorm(vertex.pos.y, quantization.offset.y, quantization.scale.y);
+	compact.pos[2] = toUnorm(vertex.pos.z, quantization.offset.z, quantization.scale.z);
+	compact.pos[3] = 0;
+	OctEncode(vertex.norm, compact.norm);
+	compact.colour[0] = FloatToUnorm8(vertex.colour.x);
+	compact.colour[1] = FloatToUnorm8(vertex.colour.y);
+	compact.colour[2] = FloatToUnorm8(vertex.colour.z);
+	compact.colour[3] = FloatToUnorm8(vertex.colour.w);
+	return compact;
+}
+
+vertexConsts VertexCompression::Decode(const CompactVertex& vertex, const PositionQuantization& quantization)
+{
+	vertexConsts decoded;
+	decoded.pos.x = vertex.pos[0] / 65535.0f * quantization.scale.x + quantization.offset.x;
+	decoded.pos.y = vertex.pos[1] / 65535.0f * quantization.scale.y + quantization.offset.y;
+	decoded.pos.z = vertex.pos[2] / 65535.0f * quantization.scale.z + quantization.offset.z;
+	decoded.norm = OctDecode(vertex.norm);
+	decoded.colour = DirectX::XMFLOAT4(vertex.colour[0] / 255.0f, vertex.colour[1] / 255.0f, vertex.colour[2] / 255.0f, vertex.colour[3] / 255.0f);
+	return decoded;
+}
+
+std::vector<CompactVertex> VertexCompression::EncodeVertices(std::span<const vertexConsts> vertices, const PositionQuantization& quantization)
+{
+	std::vector<CompactVertex> compact(vertices.size());
+	for (size_t i = 0; i < vertices.size(); i++) compact[i] = Encode(vertices[i], quantization);
+	return compact;
+}
+
+CompressionError VertexCompression::MeasureError(const Mesh& mesh)
+{
+	const PositionQuantization quantization = QuantizationFor(mesh.bounds);
+
+	CompressionError error;
+	error.positionErrorBound = PositionErrorBound(quantization);
+	error.normalErrorBound = NORMAL_ERROR_BOUND;
+	error.colourErrorBound = COLOUR_ERROR_BOUND;
+	for (const vertexConsts& vertex : mesh.Vertices()) {
+		const vertexConsts decoded = Decode(Encode(vertex, quantization), quantization);
+
+		DirectX::XMVECTOR positionDelta = DirectX::XMVectorSubtract(DirectX::XMLoadFloat3(&decoded.pos), DirectX::XMLoadFloat3(&vertex.pos));
+		error.maxPositionError = (std::max)(error.maxPositionError, DirectX::XMVectorGetX(DirectX::XMVector3Length(positionDelta)));
+
+		if (vertex.norm.x != 0.0f || vertex.norm.y != 0.0f || vertex.norm.z != 0.0f) {
+			error.maxNormalError = (std::max)(error.maxNormalError, AngleBetween(decoded.norm, vertex.norm));
+		}
+
+		const float colourError = (std::max)({ std::fabs(decoded.colour.x - vertex.colour.x), std::fabs(decoded.colour.y - vertex.colour.y),
+			std::fabs(decoded.colour.z - vertex.colour.z), std::fabs(decoded.colour.w - vertex.colour.w) });
+		error.maxColourError = (std::max)(error.maxColourError, colourError);
+	}
+	return error;
+}
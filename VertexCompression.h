@@ -0,0 +1,63 @@
+#pragma once
+#include "Utility.h"
+#include "FrameResource.h"
+#include <span>
+
+namespace Dx12MasterProject {
+
+	struct Mesh;
+
+	//16 byte vertex for the COMPACT_VERTEX shader path:
+	//-pos, R16G16B16A16_UNORM relative to the mesh bounds (w unused)
+	//-norm, R16G16_SNORM octahedral encoded unit normal
+	//-colour, R8G8B8A8_UNORM
+	struct CompactVertex {
+		uint16_t pos[4];
+		int16_t norm[2];
+		uint8_t colour[4];
+	};
+	static_assert(sizeof(CompactVertex) == 16, "CompactVertex must stay 16 bytes");
+
+	//Maps a unorm position back to model space, pos = unorm * scale + offset.
+	struct PositionQuantization {
+		DirectX::XMFLOAT3 scale = { 1.0f, 1.0f, 1.0f };
+		DirectX::XMFLOAT3 offset = { 0.0f, 0.0f, 0.0f };
+	};
+
+	//Largest round trip errors next to the bounds the encoding guarantees. Normal errors are angles in radians,
+	//position errors are distances in model units.
+	struct CompressionError {
+		float maxPositionError = 0.0f;
+		float positionErrorBound = 0.0f;
+		float maxNormalError = 0.0f;
+		float normalErrorBound = 0.0f;
+		float maxColourError = 0.0f;
+		float colourErrorBound = 0.0f;
+
+		bool WithinBounds() const {
+			return maxPositionError <= positionErrorBound && maxNormalError <= normalErrorBound && maxColourError <= colourErrorBound;
+		}
+	};
+
+	namespace VertexCompression {
+		//Snorm rounding moves each octahedral coordinate by at most half a step (1/65534). Decoding before normalisation
+		//has a length of at least 1/sqrt(3) and moves by at most sqrt(6) times that, so the angle moves by at most
+		//sqrt(18) half steps.
+		const float NORMAL_ERROR_BOUND = 4.2426407f / 65534.0f;
+		const float COLOUR_ERROR_BOUND = 0.5f / 255.0f + FLT_EPSILON;
+
+		PositionQuantization QuantizationFor(const DirectX::BoundingBox& bounds);
+		float PositionErrorBound(const PositionQuantization& quantization);
+
+		void OctEncode(const DirectX::XMFLOAT3& normal, int16_t encoded[2]);
+		DirectX::XMFLOAT3 OctDecode(const int16_t encoded[2]);
+
+		CompactVertex Encode(const vertexConsts& vertex, const PositionQuantization& quantization);
+		vertexConsts Decode(const CompactVertex& vertex, const PositionQuantization& quantization);
+		std::vector<CompactVertex> EncodeVertices(std::span<const vertexConsts> vertices, const PositionQuantization& quantization);
+
+		//Round trips every vertex of the mesh through the compact format. Zero normals (meshes imported without
+		//normals) are skipped as they have no direction to preserve.
+		CompressionError MeasureError(const Mesh& mesh);
+	}
+}
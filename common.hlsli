@@ -1,6 +1,10 @@
 cbuffer cbPerObject : register(b0)
 {
     float4x4 gWorld; //used
+    float3 gPositionScale;
+    float gObjectPadding1;
+    float3 gPositionOffset;
+    float gObjectPadding2;
 };
 
 cbuffer cbPass : register(b1)
@@ -37,12 +41,32 @@ cbuffer cbPass : register(b1)
 //    float3 gTriangleColour3[3];
 //}
 
+#ifdef COMPACT_VERTEX
+// Matches CompactVertex, position is unorm within the mesh bounds and the normal is octahedral encoded
+struct vertexIn
+{
+    float4 posQ : POSITION;
+    float2 normOct : NORMAL;
+    float4 colour : COLOUR;
+};
+
+float3 OctDecode(float2 oct)
+{
+    float3 n = float3(oct, 1.0f - abs(oct.x) - abs(oct.y));
+    if (n.z < 0.0f)
+    {
+        n.xy = (1.0f - abs(n.yx)) * (n.xy >= 0.0f ? 1.0f : -1.0f);
+    }
+    return normalize(n);
+}
+#else
 struct vertexIn
 {
     float3 posL : POSITION;
     float3 posN : NORMAL;
     float4 colour : COLOUR;
 };
+#endif
 
 struct vertexOut
 {
@@ -2,11 +2,19 @@
 
 blinnPhongLightingPixelShaderInput VS(vertexIn vIn)
 {
+#ifdef COMPACT_VERTEX
+    float3 posL = vIn.posQ.xyz * gPositionScale + gPositionOffset;
+    float3 normalL = OctDecode(vIn.normOct);
+#else
+    float3 posL = vIn.posL;
+    float3 normalL = vIn.posN;
+#endif
+
     blinnPhongLightingPixelShaderInput vOut;
-    float4 posW = mul(float4(vIn.posL, 1.0f), gWorld);
+    float4 posW = mul(float4(posL, 1.0f), gWorld);
     vOut.worldPos = posW;
     vOut.clipPos = mul(posW, gViewProj);
-    float4 posN = mul(float4(vIn.posN, 1.0f), gWorld);
+    float4 posN = mul(float4(normalL, 1.0f), gWorld);
     vOut.worldNormal = posN;
     vOut.colour = vIn.colour;
     return vOut;